@@ -20,6 +20,7 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 // A CanopyContext holds the internal state used by the libcanopy library.
@@ -49,6 +50,11 @@ typedef struct STCloudVarReader_t * CanopyVarReader;
 // A CanopyInitObject represents structure fields being initialized.
 typedef struct STCloudVarInitObject_t * CanopyVarInitObject;
 
+// A CanopyVarHandle is a pre-resolved reference to a Cloud Variable.  Obtain
+// one with canopy_var_handle and pass it to the *_h routines to skip the
+// by-name lookup on each access.
+typedef struct STCloudVar_t * CanopyVarHandle;
+
 typedef int (*CanopyOnChangeCallback)(CanopyContext, const char *, void *);
 
 // A CanopyPromise is a synchronization primitive.  When the libcanopy library
@@ -146,6 +152,7 @@ typedef enum
     CANOPY_ERROR_VARIABLE_NOT_SET,
    
     // A single-use Cloud Variable value has already been used as an argument.
+    // No longer returned: canopy_var_set frees values once used.
     CANOPY_ERROR_SINGLE_USE_VALUE_ALREADY_USED,
 
     // The provided datatype does not match the dataype expected.
@@ -167,9 +174,21 @@ typedef enum
     CANOPY_ERROR_ARRAY_INDEX_OUT_OF_BOUNDS,
 
     // Operation timed out
-    CANOPY_ERROR_TIMED_OUT
+    CANOPY_ERROR_TIMED_OUT,
+
+    // A blocking call (such as canopy_sync_blocking) was made on the sync
+    // thread, for example from a callback, where it could never complete.
+    CANOPY_ERROR_WRONG_THREAD,
+
+    // Cloud Variables cannot be initialized while the sync thread
+    // (CANOPY_SYNC_THREAD) is running.
+    CANOPY_ERROR_SYNC_THREAD_RUNNING
 } CanopyResultEnum;
 
+// Callback triggered when a CanopyPromise completes.  <result> is the
+// outcome of the asynchronous operation.
+typedef void (*CanopyPromiseCallback)(CanopyPromise promise, CanopyResultEnum result, void *userdata);
+
 // CanopyGlobalOptEnum
 //
 // Identifiers for the options that can be provided to canopy_set_global_opt
@@ -280,16 +299,142 @@ typedef enum
     // must be a boolean.  If true, the calling thread will block until the
     // sync operation completes (either successfully, or with an error, or
     // times out).  If false, the call to canopy_sync will begin synchronizing
-    // in another thread and them immediately return.
+    // and then immediately return.  The sync makes progress whenever
+    // canopy_service or canopy_promise_wait is called.
+    //
+    // Defaults to false.
     CANOPY_SYNC_BLOCKING,
 
     // Configures the amount of time to allow canopy_sync synchronization to
-    // take, in milliseconds.  Must be a nonnegative integer.  If
+    // take, in milliseconds.  Must be a nonnegative integer.  A sync that
+    // hasn't completed this long after it started (for example, because the
+    // server stalls the handshake) fails with CANOPY_ERROR_TIMED_OUT.  If
     // CANOPY_SYNC_BLOCKING is enabled, then this specifies the maximum amount
-    // of time the canopy_sync command will block for.  If CANOPY_SYNC_BLOCKING
-    // is disabled, then this specifies the maximum amount of time the spawned
-    // synchronization thread will exist for.
-    CANOPY_SYNC_TIMEOUT_MS
+    // of time the canopy_sync command will block for.  It is also used by
+    // canopy_sync_blocking when no timeout is given.  0 means no limit.
+    //
+    // Defaults to 10000.
+    CANOPY_SYNC_TIMEOUT_MS,
+
+    // Caps the scratch memory used by each canopy_sync cycle, in bytes.
+    // Must be a nonnegative integer.  Outbound payloads and send buffers are
+    // allocated from a per-context arena that is reused between cycles; a
+    // sync whose payload doesn't fit fails with CANOPY_ERROR_OUT_OF_MEMORY
+    // and its changes are retried on the next sync.  0 means no cap.
+    //
+    // Defaults to 0.
+    CANOPY_SYNC_ARENA_MAX_BYTES,
+
+    // Configures the encoding of sync payloads sent to the Canopy Cloud
+    // Service.  The value must be a CanopyPayloadFormatEnum value.
+    // Inbound payloads are accepted in either format, regardless of this
+    // setting.
+    //
+    // Defaults to CANOPY_PAYLOAD_FORMAT_JSON
+    CANOPY_PAYLOAD_FORMAT,
+
+    // Configures whether a background thread drives sync for this context.
+    // The value must be a boolean.  If true, the thread connects, sends and
+    // receives on its own, canopy_service does nothing, and the typed setters
+    // (canopy_var_set_float32, etc) queue their update for the thread
+    // without taking the context lock, so they never wait for a sync in
+    // progress.  Other libcanopy calls may be made from any thread.
+    // Variables must all be initialized (with canopy_var_init) before the
+    // thread is started: while it runs, canopy_var_init returns
+    // CANOPY_ERROR_SYNC_THREAD_RUNNING.  Promise and on-change callbacks run
+    // on the background thread, and must not wait on promises themselves.
+    //
+    // Defaults to false.
+    CANOPY_SYNC_THREAD,
+
+    // Configures automatic reconnection, in milliseconds.  Must be a
+    // nonnegative integer.  When the WebSocket connection drops (or an
+    // attempt to connect fails), libcanopy reconnects on its own while
+    // canopy_service is called (or the CANOPY_SYNC_THREAD runs).  The delay
+    // before each attempt doubles after every consecutive failure, starting
+    // from this value and capped at CANOPY_RECONNECT_MAX_MS, and is
+    // randomized to between half and all of that so that many devices don't
+    // reconnect in lockstep.  0 disables automatic reconnection, so the
+    // next canopy_sync reconnects instead.
+    //
+    // Defaults to 500.
+    CANOPY_RECONNECT_MIN_MS,
+
+    // Configures the longest delay between reconnection attempts, in
+    // milliseconds.  Must be a nonnegative integer.  See
+    // CANOPY_RECONNECT_MIN_MS.
+    //
+    // Defaults to 30000.
+    CANOPY_RECONNECT_MAX_MS,
+
+    // Configures the size, in bytes, of the pieces in which libwebsockets
+    // hands over received data.  Must be a positive integer.  Takes effect
+    // from the next WebSocket connection.  An inbound message that doesn't
+    // fit in one piece is reassembled (see CANOPY_WS_MAX_MESSAGE_BYTES);
+    // a larger value saves that copy for large control payloads, at the cost
+    // of memory for each connection.
+    //
+    // Defaults to 4096.
+    CANOPY_WS_RX_BUFFER_BYTES,
+
+    // Configures the largest inbound WebSocket message accepted, in bytes.
+    // Must be a positive integer.  Larger messages are discarded, and an
+    // error is logged.
+    //
+    // Defaults to 1048576.
+    CANOPY_WS_MAX_MESSAGE_BYTES,
+
+    // Configures how many bytes are written to the WebSocket back to back,
+    // without waiting for the connection to report that it is writable
+    // again.  Must be a positive integer.  Queued payloads are pipelined
+    // up to this limit; a payload larger than it still goes out on its own.
+    //
+    // Defaults to 65536.
+    CANOPY_WS_MAX_BYTES_IN_FLIGHT,
+
+    // Configures how long, in milliseconds, a sync may hold back its
+    // outbound payload while earlier payloads are still waiting to be
+    // written.  Must be a nonnegative integer.  Changes made and synced
+    // meanwhile are coalesced into the held payload, so a fast publisher
+    // sends fewer, larger payloads.  When the connection is idle, payloads
+    // are sent at once regardless.  0 disables holding.
+    //
+    // Defaults to 50.
+    CANOPY_SEND_LATENCY_BUDGET_MS,
+
+    // Configures store-and-forward buffering of Cloud Variable changes made
+    // while the device is offline (WebSocket protocols only).  The value
+    // must be a string naming a file, which is created if needed and
+    // memory-mapped.  While there is no connection to the server, each
+    // change to a numeric or bool Cloud Variable is recorded in the file
+    // with a timestamp.  Once the connection is back, the recorded samples
+    // are sent as "history" in batches of CANOPY_OFFLINE_BATCH_SIZE, and
+    // removed from the file.  Samples left in the file when the process
+    // exits are sent by the next context that opens it.  NULL disables
+    // buffering.
+    //
+    // Defaults to NULL.
+    CANOPY_OFFLINE_FILE,
+
+    // Configures how many samples the CANOPY_OFFLINE_FILE holds.  Must be a
+    // positive integer.  Only used when the file is created; an existing
+    // file keeps its capacity.  Each sample takes 64 bytes.
+    //
+    // Defaults to 16384.
+    CANOPY_OFFLINE_CAPACITY,
+
+    // Configures what happens to a sample recorded when the
+    // CANOPY_OFFLINE_FILE is full.  The value must be a
+    // CanopyOfflineOverflowEnum value.
+    //
+    // Defaults to CANOPY_OFFLINE_DROP_OLDEST.
+    CANOPY_OFFLINE_OVERFLOW,
+
+    // Configures the largest number of recorded samples sent in one
+    // message when the connection comes back.  Must be a positive integer.
+    //
+    // Defaults to 512.
+    CANOPY_OFFLINE_BATCH_SIZE
 } CanopyOptEnum;
 
 typedef enum
@@ -301,7 +446,10 @@ typedef enum
     CANOPY_VAR_MIN_VALUE,
     CANOPY_VAR_MAX_VALUE,
     CANOPY_VAR_DESCRIPTION,
-    CANOPY_VAR_FIELD
+    CANOPY_VAR_FIELD,
+    CANOPY_VAR_CHANGE_FILTER,
+    CANOPY_VAR_DEADBAND,
+    CANOPY_VAR_HISTORY_CAPACITY
 } CanopyVarConfigEnum;
 
 // CanopyProtocolEnum
@@ -326,6 +474,79 @@ typedef enum {
     CANOPY_PROTOCOL_WSS,
 } CanopyProtocolEnum;
 
+// CanopyPayloadFormatEnum
+//
+// List of wire encodings for sync payloads.
+typedef enum {
+    // JSON text, with Cloud Variables referenced by name.
+    CANOPY_PAYLOAD_FORMAT_JSON,
+
+    // CBOR (RFC 7049), sent as binary WebSocket frames.  Cloud Variables are
+    // referenced by a numeric ID, which is announced alongside the
+    // variable's SDDL the first time it is synced.  See docs/di_protocol.md.
+    CANOPY_PAYLOAD_FORMAT_CBOR,
+} CanopyPayloadFormatEnum;
+
+// CanopyVarChangeFilterEnum
+//
+// List of policies deciding whether setting a Cloud Variable marks it as
+// changed, so that it gets sent on the next sync.
+typedef enum {
+    // Every set marks the variable as changed.
+    CANOPY_VAR_FILTER_NONE,
+
+    // Setting a variable to the value it already holds is ignored.
+    CANOPY_VAR_FILTER_EXACT,
+
+    // A new value only counts as a change if it differs from the last
+    // reported value by more than the CANOPY_VAR_DEADBAND amount.
+    CANOPY_VAR_FILTER_ABSOLUTE_DEADBAND,
+
+    // A new value only counts as a change if it differs from the last
+    // reported value by more than CANOPY_VAR_DEADBAND percent of it.
+    CANOPY_VAR_FILTER_PERCENT_DEADBAND,
+} CanopyVarChangeFilterEnum;
+
+// CanopyOfflineOverflowEnum
+//
+// List of policies for recording a change while the CANOPY_OFFLINE_FILE is
+// full.
+typedef enum {
+    // Discard the oldest recorded sample to make room.
+    CANOPY_OFFLINE_DROP_OLDEST,
+
+    // Discard the new sample, keeping the oldest history.
+    CANOPY_OFFLINE_DROP_NEWEST,
+
+    // Halve the recorded history by discarding every other sample of each
+    // variable, so that the whole offline period stays covered at a lower
+    // resolution.
+    CANOPY_OFFLINE_DOWNSAMPLE,
+} CanopyOfflineOverflowEnum;
+
+// CanopyConnectionStateEnum
+//
+// States of a context's connection to the Canopy Cloud Service (WebSocket
+// protocols only).
+typedef enum {
+    // Not connected, and not trying to connect.  The next canopy_sync
+    // connects.
+    CANOPY_CONNECTION_STATE_DISCONNECTED,
+
+    // Connection attempt underway.
+    CANOPY_CONNECTION_STATE_CONNECTING,
+
+    // Connected.
+    CANOPY_CONNECTION_STATE_CONNECTED,
+
+    // The connection was lost (or an attempt failed).  libcanopy will try
+    // again after a backoff delay; see CANOPY_RECONNECT_MIN_MS.
+    CANOPY_CONNECTION_STATE_WAITING_TO_RECONNECT,
+} CanopyConnectionStateEnum;
+
+// Callback triggered when a context's connection changes state.
+typedef void (*CanopyConnectionStateCallback)(CanopyContext ctx, CanopyConnectionStateEnum state, void *userdata);
+
 // Initialize libcanopy and create a context.  
 //
 // This may be called multiple times to create multiple contexts, which may be
@@ -446,6 +667,33 @@ CanopyResultEnum canopy_set_opt_impl(CanopyContext ctx, ...);
 //          CANOPY_VAR_MAX_VALUE, 0.0,
 //      );
 //
+// By default every set of a variable causes it to be sent on the next sync.
+// A basic variable can instead be given a change filter, so that unchanged
+// or insignificant values are not resent:
+//
+//      canopy_var_init(ctx, "out float32 temperature",
+//          CANOPY_VAR_CHANGE_FILTER, CANOPY_VAR_FILTER_ABSOLUTE_DEADBAND,
+//          CANOPY_VAR_DEADBAND, 0.5
+//      );
+//
+// CANOPY_VAR_CHANGE_FILTER takes a CanopyVarChangeFilterEnum value and
+// CANOPY_VAR_DEADBAND takes a double.  Deadbands are measured against the
+// last value that passed the filter, so slow drift is still reported once
+// it adds up.  Deadband filters treat bool and string variables as
+// CANOPY_VAR_FILTER_EXACT.
+//
+// Normally only a variable's latest value is sent on sync.  A bool or
+// numeric variable can instead keep every value it is set to (that passes
+// its change filter) between syncs, each with a timestamp, and send them
+// all:
+//
+//      canopy_var_init(ctx, "out float32 vibration",
+//          CANOPY_VAR_HISTORY_CAPACITY, 2000
+//      );
+//
+// CANOPY_VAR_HISTORY_CAPACITY takes an int: the most samples kept between
+// syncs.  Once it is reached, the oldest samples are discarded.
+//
 // A fixed-length array can be initialized using:
 //
 //      canopy_var_init(ctx, "out float32 cpu_level[8]");
@@ -465,6 +713,9 @@ CanopyResultEnum canopy_set_opt_impl(CanopyContext ctx, ...);
 //          CANOPY_INIT_FIELD("out int16 status_code"),
 //          CANOPY_INIT_FIELD("in void update_trigger"),
 //      );
+//
+// Returns CANOPY_ERROR_SYNC_THREAD_RUNNING if CANOPY_SYNC_THREAD is enabled;
+// initialize variables before enabling it.
 #define canopy_var_init(ctx, ...) \
     canopy_var_init_impl(ctx, __VA_ARGS__, NULL)
 CanopyResultEnum canopy_var_init_impl(CanopyContext ctx, const char *decl, ...);
@@ -553,27 +804,132 @@ CanopyVarValue CANOPY_VALUE_ARRAY_IMPL(void * dummy, ...);
 //      // Don't forget to sync!
 //      canopy_sync(ctx, CANOPY_SYNC_BLOCKING, true);
 //
+// canopy_var_set takes ownership of <value> and frees it before returning,
+// whether or not it succeeds.  A CanopyVarValue must not be passed to it (or
+// to canopy_var_set_h) more than once.
+//
 CanopyResultEnum canopy_var_set(CanopyContext ctx, const char *varname, CanopyVarValue value);
-#define canopy_var_set_bool(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_BOOL(value))
-#define canopy_var_set_float32(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_FLOAT32(value))
-#define canopy_var_set_float64(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_FLOAT64(value))
-#define canopy_var_set_int8(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_INT8(value))
-#define canopy_var_set_int16(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_INT16(value))
-#define canopy_var_set_int32(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_INT32(value))
-#define canopy_var_set_string(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_STRING(value))
-#define canopy_var_set_uint8(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_UINT8(value))
-#define canopy_var_set_uint16(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_UINT16(value))
-#define canopy_var_set_uint32(ctx, varname, value) \
-    canopy_var_set((ctx), (varname), CANOPY_VALUE_UINT32(value))
+
+// Set the local value of a basic Cloud Variable directly from a C value.
+//
+// These behave like canopy_var_set(...) but do not create a CanopyVarValue
+// object.  The value is written straight into the Cloud Variable's storage,
+// so no memory is allocated on each call (except that a string variable's
+// storage may need to grow).  The Cloud Variable must already be initialized
+// with a matching datatype, otherwise CANOPY_ERROR_INCORRECT_DATATYPE is
+// returned.  canopy_var_set_string returns CANOPY_ERROR_INVALID_VALUE if
+// <value> is NULL.
+//
+//      canopy_var_set_float32(ctx, "temperature", 43.0f);
+//
+CanopyResultEnum canopy_var_set_bool(CanopyContext ctx, const char *varname, bool value);
+CanopyResultEnum canopy_var_set_int8(CanopyContext ctx, const char *varname, int8_t value);
+CanopyResultEnum canopy_var_set_uint8(CanopyContext ctx, const char *varname, uint8_t value);
+CanopyResultEnum canopy_var_set_int16(CanopyContext ctx, const char *varname, int16_t value);
+CanopyResultEnum canopy_var_set_uint16(CanopyContext ctx, const char *varname, uint16_t value);
+CanopyResultEnum canopy_var_set_int32(CanopyContext ctx, const char *varname, int32_t value);
+CanopyResultEnum canopy_var_set_uint32(CanopyContext ctx, const char *varname, uint32_t value);
+CanopyResultEnum canopy_var_set_float32(CanopyContext ctx, const char *varname, float value);
+CanopyResultEnum canopy_var_set_float64(CanopyContext ctx, const char *varname, double value);
+CanopyResultEnum canopy_var_set_string(CanopyContext ctx, const char *varname, const char *value);
+
+// Copy a range of elements between a numeric array Cloud Variable and a C
+// array.
+//
+// canopy_var_set_array_<type> copies <n> values from <buf> into elements
+// <offset> through <offset> + <n> - 1 of the Cloud Variable <varname>.
+// canopy_var_get_array_<type> copies the same elements out into <buf>.
+// Neither creates CanopyVarValue or CanopyVarReader objects, and neither
+// allocates memory:
+//
+//      float spectrum[4096];
+//      canopy_var_init(ctx, "out float32[4096] spectrum");
+//      ...
+//      canopy_var_set_array_float32(ctx, "spectrum", spectrum, 0, 4096);
+//
+// The array's element type must match the routine, otherwise
+// CANOPY_ERROR_INCORRECT_DATATYPE is returned.  If the range extends past
+// the end of the array, CANOPY_ERROR_ARRAY_INDEX_OUT_OF_BOUNDS is returned
+// and nothing is copied.  The getters return CANOPY_ERROR_VARIABLE_NOT_SET
+// if an element in the range has never been set; the contents of <buf> are
+// then unspecified.
+CanopyResultEnum canopy_var_set_array_int8(CanopyContext ctx, const char *varname, const int8_t *buf, size_t offset, size_t n);
+CanopyResultEnum canopy_var_set_array_uint8(CanopyContext ctx, const char *varname, const uint8_t *buf, size_t offset, size_t n);
+CanopyResultEnum canopy_var_set_array_int16(CanopyContext ctx, const char *varname, const int16_t *buf, size_t offset, size_t n);
+CanopyResultEnum canopy_var_set_array_uint16(CanopyContext ctx, const char *varname, const uint16_t *buf, size_t offset, size_t n);
+CanopyResultEnum canopy_var_set_array_int32(CanopyContext ctx, const char *varname, const int32_t *buf, size_t offset, size_t n);
+CanopyResultEnum canopy_var_set_array_uint32(CanopyContext ctx, const char *varname, const uint32_t *buf, size_t offset, size_t n);
+CanopyResultEnum canopy_var_set_array_float32(CanopyContext ctx, const char *varname, const float *buf, size_t offset, size_t n);
+CanopyResultEnum canopy_var_set_array_float64(CanopyContext ctx, const char *varname, const double *buf, size_t offset, size_t n);
+CanopyResultEnum canopy_var_get_array_int8(CanopyContext ctx, const char *varname, int8_t *buf, size_t offset, size_t n);
+CanopyResultEnum canopy_var_get_array_uint8(CanopyContext ctx, const char *varname, uint8_t *buf, size_t offset, size_t n);
+CanopyResultEnum canopy_var_get_array_int16(CanopyContext ctx, const char *varname, int16_t *buf, size_t offset, size_t n);
+CanopyResultEnum canopy_var_get_array_uint16(CanopyContext ctx, const char *varname, uint16_t *buf, size_t offset, size_t n);
+CanopyResultEnum canopy_var_get_array_int32(CanopyContext ctx, const char *varname, int32_t *buf, size_t offset, size_t n);
+CanopyResultEnum canopy_var_get_array_uint32(CanopyContext ctx, const char *varname, uint32_t *buf, size_t offset, size_t n);
+CanopyResultEnum canopy_var_get_array_float32(CanopyContext ctx, const char *varname, float *buf, size_t offset, size_t n);
+CanopyResultEnum canopy_var_get_array_float64(CanopyContext ctx, const char *varname, double *buf, size_t offset, size_t n);
+
+// One field of a C struct bound to a struct Cloud Variable with
+// canopy_var_bind_struct.  <name> is the member's path within the Cloud
+// Variable (such as "fix.quality"), and <offset> is where the field lives
+// within the C struct.  Use CANOPY_STRUCT_FIELD to fill one in.
+typedef struct CanopyStructField
+{
+    const char *name;
+    CanopyDatatypeEnum datatype;
+    size_t offset;
+} CanopyStructField;
+
+// Describe field <member> of C struct type <ctype>, for a Cloud Variable
+// member of the same name and <datatype>.  <member> may name a field of a
+// nested struct, as in CANOPY_STRUCT_FIELD(struct gps, fix.quality, ...).
+#define CANOPY_STRUCT_FIELD(ctype, member, datatype) \
+    { #member, (datatype), offsetof(ctype, member) }
+
+// Bind a C struct layout to the struct Cloud Variable <varname>, so that the
+// whole struct can be set or read with one call:
+//
+//      struct telemetry { float temperature; uint16_t rpm; const char *mode; };
+//
+//      static const CanopyStructField telemetryFields[] = {
+//          CANOPY_STRUCT_FIELD(struct telemetry, temperature, CANOPY_DATATYPE_FLOAT32),
+//          CANOPY_STRUCT_FIELD(struct telemetry, rpm, CANOPY_DATATYPE_UINT16),
+//          CANOPY_STRUCT_FIELD(struct telemetry, mode, CANOPY_DATATYPE_STRING),
+//      };
+//
+//      canopy_var_init(ctx, "out struct telemetry",
+//          CANOPY_INIT_FIELD("float32 temperature"),
+//          CANOPY_INIT_FIELD("uint16 rpm"),
+//          CANOPY_INIT_FIELD("string mode")
+//      );
+//      canopy_var_bind_struct(ctx, "telemetry", telemetryFields, 3);
+//      ...
+//      canopy_var_set_struct(ctx, "telemetry", &telemetry);
+//
+// Each field must name a basic member of the Cloud Variable
+// (CANOPY_ERROR_VARIABLE_NOT_INITIALIZED otherwise) with the same datatype
+// (CANOPY_ERROR_INCORRECT_DATATYPE otherwise).  String fields are "const
+// char *" or "char *".  Members without a field are left alone.  Binding
+// again replaces the previous layout.
+CanopyResultEnum canopy_var_bind_struct(
+        CanopyContext ctx,
+        const char *varname,
+        const CanopyStructField *fields,
+        size_t numFields);
+
+// Set every bound member of the struct Cloud Variable <varname> from the C
+// struct at <src>, as one update: the sync thread never sees some fields
+// set and not others.  No CanopyVarValue objects are created, and nothing
+// is allocated except to grow string storage.  Returns
+// CANOPY_ERROR_INCORRECT_DATATYPE if no layout has been bound.
+CanopyResultEnum canopy_var_set_struct(CanopyContext ctx, const char *varname, const void *src);
+
+// Copy every bound member of the struct Cloud Variable <varname> into the C
+// struct at <dest>.  String fields receive a newly-allocated copy, which
+// the caller must free.  Members that have never been set are skipped, and
+// CANOPY_ERROR_VARIABLE_NOT_SET is returned after the others are copied.
+CanopyResultEnum canopy_var_get_struct(CanopyContext ctx, const char *varname, void *dest);
 
 CanopyVarReader CANOPY_READ_BOOL(bool *dest);
 
@@ -642,6 +998,81 @@ CanopyResultEnum canopy_var_get(CanopyContext ctx, const char *varname, CanopyVa
 #define canopy_var_get_uint32(ctx, varname, outValue) \
     canopy_var_get((ctx), (varname), CANOPY_READ_UINT32(outValue))
 
+// Lookup a Cloud Variable once and get a handle to it.
+//
+// Returns NULL if no Cloud Variable named <varname> has been initialized with
+// canopy_var_init(...).  The handle stays valid until <ctx> is shut down, and
+// must only be used with the context it was obtained from.
+//
+// Handles are meant for hot loops where the same variables are accessed over
+// and over:
+//
+//      CanopyVarHandle temperature = canopy_var_handle(ctx, "temperature");
+//      while (1)
+//      {
+//          canopy_var_set_h(ctx, temperature, CANOPY_VALUE_FLOAT32(read_temp()));
+//          ...
+//      }
+//
+CanopyVarHandle canopy_var_handle(CanopyContext ctx, const char *varname);
+
+// Same as canopy_var_set, but takes a handle from canopy_var_handle instead of
+// a variable name.  Likewise takes ownership of <value> and frees it.
+CanopyResultEnum canopy_var_set_h(CanopyContext ctx, CanopyVarHandle var, CanopyVarValue value);
+
+// Same as canopy_var_get, but takes a handle from canopy_var_handle instead of
+// a variable name.
+CanopyResultEnum canopy_var_get_h(CanopyContext ctx, CanopyVarHandle var, CanopyVarReader dest);
+
+// One update for canopy_var_set_batch.  <datatype> must match the variable's
+// datatype, and selects which member of <val> is used.
+typedef struct CanopyVarUpdate
+{
+    CanopyVarHandle var;
+    CanopyDatatypeEnum datatype;
+    union
+    {
+        bool val_bool;
+        int8_t val_int8;
+        uint8_t val_uint8;
+        int16_t val_int16;
+        uint16_t val_uint16;
+        int32_t val_int32;
+        uint32_t val_uint32;
+        float val_float32;
+        double val_float64;
+        const char *val_string;
+    } val;
+} CanopyVarUpdate;
+
+// Set several Cloud Variables at once.
+//
+// Applies <updates>[0] through <updates>[n-1], in order, as a single unit:
+//
+//  - All updates are checked before any is applied.  If one refers to an
+//    uninitialized variable, has the wrong datatype, or targets an "in"
+//    variable, nothing is changed and the error is returned.
+//
+//  - The context lock is taken once for the whole batch, rather than once
+//    per variable.  When CANOPY_SYNC_THREAD is enabled, the sync thread
+//    sees either none of the batch or all of it, never a partial update.
+//
+//  - Every sample in the batch gets the same timestamp in sample histories
+//    and in the offline buffer.
+//
+// No memory is allocated, except for copies of string values.
+//
+//      CanopyVarUpdate updates[2];
+//      updates[0].var = canopy_var_handle(ctx, "temperature");
+//      updates[0].datatype = CANOPY_DATATYPE_FLOAT32;
+//      updates[0].val.val_float32 = 43.0f;
+//      updates[1].var = canopy_var_handle(ctx, "humidity");
+//      updates[1].datatype = CANOPY_DATATYPE_FLOAT32;
+//      updates[1].val.val_float32 = 0.61f;
+//      canopy_var_set_batch(ctx, updates, 2);
+//
+CanopyResultEnum canopy_var_set_batch(CanopyContext ctx, const CanopyVarUpdate *updates, size_t n);
+
 
 // Register a callback that triggers when a Cloud Variable changes.
 //
@@ -662,14 +1093,121 @@ CanopyResultEnum canopy_var_on_change(CanopyContext ctx, const char *varname, Ca
 //
 // Updates the local and remote copies of each Cloud Variable with the latest
 // values.
-CanopyResultEnum canopy_sync(CanopyContext ctx, CanopyPromise promise);
+//
+// Unless CANOPY_SYNC_BLOCKING is enabled, this starts a sync and returns
+// without waiting for network I/O.  If <outPromise> is non-NULL, it gets set
+// to a new promise that completes when the sync does:
+//
+//      CanopyPromise promise;
+//      canopy_sync(ctx, &promise);
+//      while (!canopy_promise_is_done(promise))
+//      {
+//          do_control_loop_work();
+//          canopy_service(ctx, 1000);
+//      }
+//      result = canopy_promise_result(promise);
+//      canopy_promise_free(promise);
+//
+// If a sync is already in progress, another one is started after it
+// finishes, so that changes made since the first one began are included.
+//
+// Returns an error if the sync fails before needing to wait (for example,
+// because of a missing option).  Otherwise returns CANOPY_SUCCESS, and the
+// final result is reported through the promise.
+CanopyResultEnum canopy_sync(CanopyContext ctx, CanopyPromise *outPromise);
 
 // Synchronize with the cloud server (blocking the current thread).
 //
 // Updates the local and remote copies of each Cloud Variable with the latest
-// values.
+// values.  Waits at most <timeout_us> microseconds, or CANOPY_SYNC_TIMEOUT_MS
+// if <timeout_us> is 0, and returns CANOPY_ERROR_TIMED_OUT if the sync hasn't
+// completed by then.  A sync that times out is abandoned (a connection that
+// was still being set up is dropped), and its changes are sent by the next
+// sync.
+//
+// Must not be called from a callback run by the sync thread (see
+// CANOPY_SYNC_THREAD), which would wait for itself; that returns
+// CANOPY_ERROR_WRONG_THREAD, and the sync goes ahead in the background.
 CanopyResultEnum canopy_sync_blocking(CanopyContext ctx, int timeout_us);
 
+// Make progress on any asynchronous operations (such as canopy_sync) and
+// process payloads received from the cloud server.
+//
+// Waits at most <timeout_us> microseconds for network activity.  Pass 0 to
+// only handle whatever is ready right now, which is suitable for calling
+// from a tight control loop.
+CanopyResultEnum canopy_service(CanopyContext ctx, int timeout_us);
+
+// Has <promise> completed?
+bool canopy_promise_is_done(CanopyPromise promise);
+
+// Get the result of a completed promise.
+//
+// Returns CANOPY_ERROR_PROMISE_NOT_COMPLETE if <promise> hasn't completed
+// yet, otherwise the result of the operation it tracks.
+CanopyResultEnum canopy_promise_result(CanopyPromise promise);
+
+// Wait for <promise> to complete, calling canopy_service as needed.
+//
+// Waits at most <timeout_us> microseconds, or indefinitely if <timeout_us>
+// is negative.  Returns the result of the operation, or
+// CANOPY_ERROR_TIMED_OUT if it hasn't completed in time (in which case the
+// operation carries on, and the promise may still complete later).  Like
+// canopy_sync_blocking, returns CANOPY_ERROR_WRONG_THREAD instead of waiting
+// if called from the sync thread.
+CanopyResultEnum canopy_promise_wait(CanopyPromise promise, int timeout_us);
+
+// Register a callback to be triggered when <promise> completes.
+//
+// The callback runs from within canopy_service (or whichever call completes
+// the operation).  If <promise> has already completed, <cb> is triggered
+// immediately.  Only one callback may be registered per promise.
+CanopyResultEnum canopy_promise_on_done(CanopyPromise promise, CanopyPromiseCallback cb, void *userdata);
+
+// Free a promise obtained from an asynchronous routine.  The operation it
+// tracks carries on if it hasn't completed yet.  All promises must be freed
+// before their context is shut down.
+void canopy_promise_free(CanopyPromise promise);
+
+// Get the current state of the connection to the Canopy Cloud Service.
+CanopyConnectionStateEnum canopy_connection_state(CanopyContext ctx);
+
+// Register a callback to be triggered whenever the connection to the Canopy
+// Cloud Service changes state, for example to show connectivity in a UI.
+// Replaces any callback registered before; pass NULL to remove it.
+//
+// The callback runs from within canopy_service or canopy_sync (or on the
+// background thread, if CANOPY_SYNC_THREAD is enabled).
+CanopyResultEnum canopy_on_connection_state(CanopyContext ctx, CanopyConnectionStateCallback cb, void *userdata);
+
+// Running totals of what a context has sent.
+typedef struct CanopySendStats
+{
+    // canopy_sync calls made with changes to send, and outbound payloads
+    // sent for them.  Syncs made while the connection is busy are
+    // coalesced, so syncs/payloads is the coalescing ratio.
+    uint64_t syncs;
+    uint64_t payloads;
+
+    // WebSocket messages written (including the handshake and offline
+    // history), and their total size in bytes.
+    uint64_t frames;
+    uint64_t bytes;
+
+    // Number of times one or more messages were written back to back.
+    // frames/write_rounds is the pipelining ratio.
+    uint64_t write_rounds;
+} CanopySendStats;
+
+// Get running totals of what <ctx> has sent since it was created.  Returns
+// CANOPY_ERROR_INVALID_VALUE if <stats> is NULL.
+CanopyResultEnum canopy_get_send_stats(CanopyContext ctx, CanopySendStats *stats);
+
+// Get the number of Cloud Variable changes recorded in the
+// CANOPY_OFFLINE_FILE that haven't been sent to the server yet.  Returns 0
+// if CANOPY_OFFLINE_FILE isn't set.
+uint32_t canopy_offline_backlog(CanopyContext ctx);
+
 // Helper routine for performing an operation once in a while.
 // <timer> is a pointer to a long that holds internal state for the time.
 // *timer should be initialized to 0 by your application.
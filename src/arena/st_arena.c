@@ -0,0 +1,198 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "arena/st_arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Size of the first chunk.  Later chunks double.
+#define _MIN_CHUNK_SIZE 1024
+
+#define _ALIGNMENT 16
+#define _ALIGN_UP(n) (((n) + (_ALIGNMENT - 1)) & ~((size_t)_ALIGNMENT - 1))
+
+typedef struct _Chunk_t
+{
+    struct _Chunk_t *prev;
+    size_t size;
+    size_t used;
+    // Followed by <size> bytes of storage, aligned to _ALIGNMENT.
+} _Chunk_t;
+
+#define _CHUNK_HEADER_SIZE _ALIGN_UP(sizeof(_Chunk_t))
+#define _CHUNK_DATA(chunk) ((char *)(chunk) + _CHUNK_HEADER_SIZE)
+
+struct STArena_t
+{
+    // Most recent chunk.  Allocations are only made from this one.
+    _Chunk_t *current;
+
+    // Sum of chunk sizes (excluding headers).
+    size_t capacity;
+
+    // 0 means unlimited.
+    size_t max_bytes;
+
+    // Most recent allocation, for growing in place.
+    void *last_alloc;
+};
+
+static _Chunk_t * _new_chunk(STArena arena, size_t size)
+{
+    _Chunk_t *chunk;
+    if (arena->max_bytes && arena->capacity + size > arena->max_bytes)
+    {
+        return NULL;
+    }
+    chunk = malloc(_CHUNK_HEADER_SIZE + size);
+    if (!chunk)
+    {
+        return NULL;
+    }
+    chunk->prev = arena->current;
+    chunk->size = size;
+    chunk->used = 0;
+    arena->current = chunk;
+    arena->capacity += size;
+    return chunk;
+}
+
+static void _free_chunks(STArena arena)
+{
+    _Chunk_t *chunk, *prev;
+    for (chunk = arena->current; chunk; chunk = prev)
+    {
+        prev = chunk->prev;
+        free(chunk);
+    }
+    arena->current = NULL;
+    arena->capacity = 0;
+    arena->last_alloc = NULL;
+}
+
+STArena st_arena_new()
+{
+    return calloc(1, sizeof(struct STArena_t));
+}
+
+void st_arena_free(STArena arena)
+{
+    if (!arena)
+    {
+        return;
+    }
+    _free_chunks(arena);
+    free(arena);
+}
+
+void st_arena_set_max_bytes(STArena arena, size_t maxBytes)
+{
+    arena->max_bytes = maxBytes;
+    if (maxBytes && arena->capacity > maxBytes)
+    {
+        // Give back memory retained from earlier, larger cycles.
+        _free_chunks(arena);
+    }
+}
+
+void * st_arena_alloc(STArena arena, size_t size)
+{
+    _Chunk_t *chunk = arena->current;
+    void *out;
+
+    size = _ALIGN_UP(size ? size : 1);
+    if (!chunk || chunk->size - chunk->used < size)
+    {
+        size_t chunkSize = chunk ? chunk->size * 2 : _MIN_CHUNK_SIZE;
+        while (chunkSize < size)
+        {
+            chunkSize *= 2;
+        }
+        if (arena->max_bytes && arena->capacity + chunkSize > arena->max_bytes)
+        {
+            // Fall back to the smallest chunk that fits under the cap.
+            chunkSize = size;
+        }
+        chunk = _new_chunk(arena, chunkSize);
+        if (!chunk)
+        {
+            return NULL;
+        }
+    }
+
+    out = _CHUNK_DATA(chunk) + chunk->used;
+    chunk->used += size;
+    arena->last_alloc = out;
+    return out;
+}
+
+void * st_arena_realloc(STArena arena, void *ptr, size_t oldSize, size_t newSize)
+{
+    _Chunk_t *chunk = arena->current;
+    void *out;
+
+    if (ptr && ptr == arena->last_alloc)
+    {
+        // Grow (or shrink) the most recent allocation in place if it fits.
+        size_t offset = (char *)ptr - _CHUNK_DATA(chunk);
+        size_t alignedSize = _ALIGN_UP(newSize ? newSize : 1);
+        if (alignedSize <= chunk->size - offset)
+        {
+            chunk->used = offset + alignedSize;
+            return ptr;
+        }
+    }
+    else if (ptr && newSize <= oldSize)
+    {
+        return ptr;
+    }
+
+    out = st_arena_alloc(arena, newSize);
+    if (out && ptr)
+    {
+        memcpy(out, ptr, oldSize < newSize ? oldSize : newSize);
+    }
+    return out;
+}
+
+void st_arena_reset(STArena arena)
+{
+    _Chunk_t *chunk = arena->current;
+    arena->last_alloc = NULL;
+    if (!chunk)
+    {
+        return;
+    }
+
+    if (chunk->prev)
+    {
+        // Coalesce: replace all chunks with one that covers everything this
+        // cycle used.
+        size_t total = 0;
+        for (; chunk; chunk = chunk->prev)
+        {
+            total += chunk->used;
+        }
+        _free_chunks(arena);
+        // If this fails, the next cycle simply starts from scratch.
+        _new_chunk(arena, total > _MIN_CHUNK_SIZE ? total : _MIN_CHUNK_SIZE);
+        return;
+    }
+    chunk->used = 0;
+}
+
+size_t st_arena_capacity(STArena arena)
+{
+    return arena->capacity;
+}
@@ -0,0 +1,66 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_ARENA_INCLUDED
+#define ST_ARENA_INCLUDED
+
+// Bump allocator for short-lived, per-cycle allocations.
+//
+// Allocations are carved out of large chunks and are never freed
+// individually.  Instead, st_arena_reset releases everything at once.  When
+// a cycle needed more than one chunk, the reset replaces them with a single
+// chunk big enough for the whole cycle, so after a few cycles of similar
+// size the arena stops calling malloc entirely.
+//
+//      STArena arena = st_arena_new();
+//      while (1)
+//      {
+//          char *buf = st_arena_alloc(arena, 1024);
+//          ...
+//          st_arena_reset(arena);
+//      }
+
+#include <canopy.h>
+#include <stddef.h>
+
+typedef struct STArena_t * STArena;
+
+// Create a new, empty arena.  Returns NULL on allocation failure.
+STArena st_arena_new();
+
+// Free an arena and all of its chunks.
+void st_arena_free(STArena arena);
+
+// Cap the total number of bytes the arena may hold in chunks.  Allocations
+// that would exceed the cap fail.  0 (the default) means no cap.
+// Call only while nothing is allocated (e.g. right after st_arena_reset),
+// since lowering the cap may release the arena's chunks.
+void st_arena_set_max_bytes(STArena arena, size_t maxBytes);
+
+// Allocate <size> bytes, aligned for any type.  Returns NULL on failure.
+void * st_arena_alloc(STArena arena, size_t size);
+
+// Resize the allocation <ptr> (of <oldSize> bytes) to <newSize> bytes.
+// Grows in place when <ptr> is the most recent allocation and there is
+// room, otherwise copies.  <ptr> may be NULL.  Returns NULL on failure, in
+// which case <ptr> is left untouched.
+void * st_arena_realloc(STArena arena, void *ptr, size_t oldSize, size_t newSize);
+
+// Release all allocations made since the last reset.
+void st_arena_reset(STArena arena);
+
+// Total bytes held in chunks (i.e. obtained from malloc).
+size_t st_arena_capacity(STArena arena);
+
+#endif // ST_ARENA_INCLUDED
@@ -17,11 +17,15 @@
 
 #include <canopy.h>
 #include <assert.h>
+#include "arena/st_arena.h"
 #include "cloudvar/st_cloudvar.h"
 #include "http/st_http.h"
 #include "log/st_log.h"
 #include "options/st_options.h"
+#include "promise/st_promise.h"
 #include "sync/st_sync.h"
+#include "sync/st_sync_thread.h"
+#include "time/st_time.h"
 #include "websocket/st_websocket.h"
 #include "red_json.h"
 #include "red_string.h"
@@ -50,8 +54,86 @@ typedef struct CanopyContext_t
 
     STWebSocket ws;
 
+    // Scratch memory for sync cycles.  Reset at the end of each cycle.
+    STArena sync_arena;
+
+    // Drives sync cycles without blocking.
+    STSync sync;
+
+    // Recycled CanopyPromise objects.
+    STPromisePool promises;
+
+    // Optional background thread that drives <sync> (CANOPY_SYNC_THREAD).
+    STSyncThread thread;
+
+    // Last connection state reported by <ws>, and who to tell about changes.
+    CanopyConnectionStateEnum connection_state;
+    CanopyConnectionStateCallback cb_connection_state;
+    void *cb_connection_state_userdata;
+
 } CanopyContext_t;
 
+// While the sync thread is running, every entrypoint that touches Cloud
+// Variables or promises holds the context lock.  Otherwise these do nothing.
+// _lock returns whether it took the lock, and that is what _unlock goes by,
+// so the thread starting or stopping in between can't unbalance the lock.
+static bool _lock(CanopyContext ctx)
+{
+    if (ctx->thread && st_sync_thread_is_running(ctx->thread))
+    {
+        st_sync_thread_lock(ctx->thread);
+        return true;
+    }
+    return false;
+}
+
+static void _unlock(CanopyContext ctx, bool locked)
+{
+    if (locked)
+    {
+        st_sync_thread_unlock(ctx->thread);
+    }
+}
+
+// Look up a Cloud Variable by name.  No lock is needed: canopy_var_init is
+// refused while the sync thread runs, so the table doesn't change meanwhile.
+static STCloudVar _lookup_var(CanopyContext ctx, const char *varname)
+{
+    return st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+}
+
+// Forwards connection state changes from the WebSocket to the application.
+// May run on the sync thread, so the state is copied under the lock.
+static void _on_ws_state(STWebSocket ws, CanopyConnectionStateEnum state, void *userdata)
+{
+    CanopyContext ctx = (CanopyContext)userdata;
+    CanopyConnectionStateCallback cb;
+    void *cbUserdata;
+    bool locked;
+
+    locked = _lock(ctx);
+    ctx->connection_state = state;
+    cb = ctx->cb_connection_state;
+    cbUserdata = ctx->cb_connection_state_userdata;
+    _unlock(ctx, locked);
+
+    if (cb)
+    {
+        cb(ctx, state, cbUserdata);
+    }
+}
+
+// Start or stop the sync thread to match the CANOPY_SYNC_THREAD option.
+static CanopyResultEnum _apply_sync_thread_option(CanopyContext ctx)
+{
+    if (ctx->options->val_CANOPY_SYNC_THREAD)
+    {
+        return st_sync_thread_start(ctx->thread);
+    }
+    st_sync_thread_stop(ctx->thread);
+    return CANOPY_SUCCESS;
+}
+
 static CanopyResultEnum _global_init()
 {
     // TODO: thread safety?
@@ -86,10 +168,7 @@ static CanopyResultEnum _global_init()
 
 bool canopy_once_every(uint64_t *timer, uint64_t us) {
     // Timer holds the start time.
-    struct timespec t;
-    uint64_t curtime;
-    clock_gettime(CLOCK_MONOTONIC, &t);
-    curtime = t.tv_sec*CANOPY_SECONDS + (t.tv_nsec/1000);
+    uint64_t curtime = st_time_now_us();
     if (curtime > (*timer + us))
     {
         *timer = curtime;
@@ -128,7 +207,16 @@ CanopyContext canopy_init_context()
     st_options_load_from_env(ctx->options);
 
     ctx->ws = st_websocket_new();
-    if (!ctx->options)
+    if (!ctx->ws)
+    {
+        RedLog_Error("OOM in canopy_create_ctx");
+        goto fail;
+    }
+    ctx->connection_state = CANOPY_CONNECTION_STATE_DISCONNECTED;
+    st_websocket_state_callback(ctx->ws, _on_ws_state, ctx);
+
+    ctx->sync_arena = st_arena_new();
+    if (!ctx->sync_arena)
     {
         RedLog_Error("OOM in canopy_create_ctx");
         goto fail;
@@ -141,6 +229,34 @@ CanopyContext canopy_init_context()
         goto fail;
     }
 
+    ctx->promises = st_promise_pool_new(ctx);
+    if (!ctx->promises)
+    {
+        RedLog_Error("OOM in canopy_create_ctx");
+        goto fail;
+    }
+
+    ctx->sync = st_sync_new(ctx, ctx->options, ctx->ws, ctx->cloudvars, ctx->sync_arena);
+    if (!ctx->sync)
+    {
+        RedLog_Error("OOM in canopy_create_ctx");
+        goto fail;
+    }
+
+    ctx->thread = st_sync_thread_new(ctx->sync);
+    if (!ctx->thread)
+    {
+        RedLog_Error("OOM in canopy_create_ctx");
+        goto fail;
+    }
+
+    // CANOPY_SYNC_THREAD may have come from the environment.
+    if (_apply_sync_thread_option(ctx) != CANOPY_SUCCESS)
+    {
+        RedLog_Error("Could not start sync thread in canopy_create_ctx");
+        goto fail;
+    }
+
     return ctx;
 fail:
     canopy_shutdown_context(ctx);
@@ -152,8 +268,13 @@ CanopyResultEnum canopy_shutdown_context(CanopyContext ctx)
     st_log_trace("canopy_shutdown_context(0x%p)", ctx);
     if (ctx)
     {
+        // Stop the thread before freeing anything it uses.
+        st_sync_thread_free(ctx->thread);
+        st_sync_free(ctx->sync);
+        st_promise_pool_free(ctx->promises);
         st_options_free(ctx->options);
         st_websocket_free(ctx->ws);
+        st_arena_free(ctx->sync_arena);
         st_cloudvar_system_free(ctx->cloudvars);
         free(ctx);
     }
@@ -204,11 +325,18 @@ CanopyResultEnum canopy_set_opt_impl(CanopyContext ctx, ...)
 {
     va_list ap;
     CanopyResultEnum out;
+    bool locked;
     st_log_trace("canopy_set_opt_impl");
+    locked = _lock(ctx);
     va_start(ap, ctx);
     out = st_options_extend_varargs(ctx->options, ap);
     va_end(ap);
-    return out;
+    _unlock(ctx, locked);
+    if (out != CANOPY_SUCCESS)
+    {
+        return out;
+    }
+    return _apply_sync_thread_option(ctx);
 }
 CanopyVarValue CANOPY_VALUE_BOOL(bool x)
 {
@@ -297,35 +425,309 @@ void canopy_var_value_free(CanopyVarValue value)
     return st_cloudvar_value_free(value);
 }
 
+CanopyVarHandle canopy_var_handle(CanopyContext ctx, const char *varname)
+{
+    st_log_trace("canopy_var_handle(0x%p, %s)", ctx, varname);
+    return _lookup_var(ctx, varname);
+}
+
 CanopyResultEnum canopy_var_set(CanopyContext ctx, const char *varname, CanopyVarValue value)
 {
-    CanopyResultEnum result;
     STCloudVar var;
+    CanopyResultEnum result;
+    bool locked;
     st_log_trace("canopy_var_set(0x%p, %s, ...", ctx, varname);
-    if (st_cloudvar_value_already_used(value))
-    {
-        // CanopyVarValue objects are meant to be used once.  If it has been
-        // used already, throw an error.
-        return CANOPY_ERROR_SINGLE_USE_VALUE_ALREADY_USED;
-    }
 
+    locked = _lock(ctx);
     var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    result = canopy_var_set_h(ctx, var, value);
+    _unlock(ctx, locked);
+    return result;
+}
+
+CanopyResultEnum canopy_var_set_h(CanopyContext ctx, CanopyVarHandle var, CanopyVarValue value)
+{
+    CanopyResultEnum result;
+    bool locked;
+
+    // <value> is freed on every path, so a value passed twice can't be
+    // detected here; canopy.h documents that it must not be.
     if (!var)
     {
+        st_cloudvar_value_free(value);
         return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
     }
 
+    locked = _lock(ctx);
     result = st_cloudvar_set_var(var, value);
+    _unlock(ctx, locked);
 
-    // Mark <value> as used, since it is intended to be single-use.
+    // <value> is single-use, so free it now that it has been consumed.
     // This allows, for example:
     //      canopy_set_var(ctx, "foo", CANOPY_FLOAT32(100.0f)) 
     //  to not leak any memory.
-    //  Although, it does result in an alloc and free for each call.
-    st_cloudvar_value_mark_used(value);
+    //  Although, it does result in an alloc and free for each call.  Use the
+    //  typed setters (canopy_var_set_float32, etc) to avoid that.
+    st_cloudvar_value_free(value);
+    return result;
+}
+
+// Checks that a typed setter may be used on <var>.  Datatype and direction
+// never change once a variable is initialized, so this doesn't need the
+// context lock.
+static CanopyResultEnum _check_typed_set(STCloudVar var, CanopyDatatypeEnum datatype)
+{
+    if (st_cloudvar_datatype(var) != datatype)
+    {
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
+    }
+    if (st_cloudvar_concrete_direction(var) == CANOPY_DIRECTION_IN)
+    {
+        return CANOPY_ERROR_CANNOT_MODIFY_INPUT_VARIABLE;
+    }
+    return CANOPY_SUCCESS;
+}
+
+// Expands to the definition of a typed setter, such as:
+//
+//      CanopyResultEnum canopy_var_set_float32(
+//              CanopyContext ctx, 
+//              const char *varname, 
+//              float value)
+//      {
+//          ...
+//          return st_cloudvar_set_float32(var, value);
+//      }
+//
+// While the sync thread is running, the update is queued for it instead.
+// Neither the lookup nor the queueing takes the context lock, so setters
+// never wait for a sync in progress or for each other.  <isValid> is checked
+// first, so that nothing invalid is queued.
+#define _DEFINE_TYPED_SETTER(suffix, ctype, datatypeEnum, isValid) \
+    CanopyResultEnum canopy_var_set_##suffix( \
+            CanopyContext ctx, \
+            const char *varname, \
+            ctype value) \
+    { \
+        STCloudVar var; \
+        STSyncUpdate_t update; \
+        CanopyResultEnum result; \
+        st_log_trace("canopy_var_set_" #suffix "(0x%p, %s, ...)", ctx, varname); \
+        if (!(isValid)) \
+        { \
+            return CANOPY_ERROR_INVALID_VALUE; \
+        } \
+        var = _lookup_var(ctx, varname); \
+        if (!var) \
+        { \
+            return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED; \
+        } \
+        if (!st_sync_thread_is_running(ctx->thread)) \
+        { \
+            return st_cloudvar_set_##suffix(var, value); \
+        } \
+        result = _check_typed_set(var, datatypeEnum); \
+        if (result != CANOPY_SUCCESS) \
+        { \
+            return result; \
+        } \
+        update.set.var = var; \
+        update.set.datatype = datatypeEnum; \
+        update.set.val.val_##suffix = value; \
+        return st_sync_thread_queue_update(ctx->thread, &update); \
+    }
+
+_DEFINE_TYPED_SETTER(bool, bool, CANOPY_DATATYPE_BOOL, true)
+_DEFINE_TYPED_SETTER(int8, int8_t, CANOPY_DATATYPE_INT8, true)
+_DEFINE_TYPED_SETTER(uint8, uint8_t, CANOPY_DATATYPE_UINT8, true)
+_DEFINE_TYPED_SETTER(int16, int16_t, CANOPY_DATATYPE_INT16, true)
+_DEFINE_TYPED_SETTER(uint16, uint16_t, CANOPY_DATATYPE_UINT16, true)
+_DEFINE_TYPED_SETTER(int32, int32_t, CANOPY_DATATYPE_INT32, true)
+_DEFINE_TYPED_SETTER(uint32, uint32_t, CANOPY_DATATYPE_UINT32, true)
+_DEFINE_TYPED_SETTER(float32, float, CANOPY_DATATYPE_FLOAT32, true)
+_DEFINE_TYPED_SETTER(float64, double, CANOPY_DATATYPE_FLOAT64, true)
+_DEFINE_TYPED_SETTER(string, const char *, CANOPY_DATATYPE_STRING, value != NULL)
+
+// Expands to the definitions of the bulk array accessors, such as:
+//
+//      CanopyResultEnum canopy_var_set_array_float32(
+//              CanopyContext ctx, 
+//              const char *varname, 
+//              const float *buf,
+//              size_t offset,
+//              size_t n)
+//      {
+//          ...
+//          return st_cloudvar_array_set_range(var, CANOPY_DATATYPE_FLOAT32, buf, offset, n);
+//      }
+//
+// These go through the context lock rather than the sync thread's queue,
+// since an update may be far too large to queue.
+#define _DEFINE_ARRAY_ACCESSORS(suffix, ctype, datatypeEnum) \
+    CanopyResultEnum canopy_var_set_array_##suffix( \
+            CanopyContext ctx, \
+            const char *varname, \
+            const ctype *buf, \
+            size_t offset, \
+            size_t n) \
+    { \
+        STCloudVar var; \
+        CanopyResultEnum result; \
+        bool locked; \
+        st_log_trace("canopy_var_set_array_" #suffix "(0x%p, %s, ...)", ctx, varname); \
+        var = _lookup_var(ctx, varname); \
+        if (!var) \
+        { \
+            return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED; \
+        } \
+        locked = _lock(ctx); \
+        result = st_cloudvar_array_set_range(var, datatypeEnum, buf, offset, n); \
+        _unlock(ctx, locked); \
+        return result; \
+    } \
+    CanopyResultEnum canopy_var_get_array_##suffix( \
+            CanopyContext ctx, \
+            const char *varname, \
+            ctype *buf, \
+            size_t offset, \
+            size_t n) \
+    { \
+        STCloudVar var; \
+        CanopyResultEnum result; \
+        bool locked; \
+        st_log_trace("canopy_var_get_array_" #suffix "(0x%p, %s, ...)", ctx, varname); \
+        var = _lookup_var(ctx, varname); \
+        if (!var) \
+        { \
+            return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED; \
+        } \
+        locked = _lock(ctx); \
+        result = st_cloudvar_array_get_range(var, datatypeEnum, buf, offset, n); \
+        _unlock(ctx, locked); \
+        return result; \
+    }
+
+_DEFINE_ARRAY_ACCESSORS(int8, int8_t, CANOPY_DATATYPE_INT8)
+_DEFINE_ARRAY_ACCESSORS(uint8, uint8_t, CANOPY_DATATYPE_UINT8)
+_DEFINE_ARRAY_ACCESSORS(int16, int16_t, CANOPY_DATATYPE_INT16)
+_DEFINE_ARRAY_ACCESSORS(uint16, uint16_t, CANOPY_DATATYPE_UINT16)
+_DEFINE_ARRAY_ACCESSORS(int32, int32_t, CANOPY_DATATYPE_INT32)
+_DEFINE_ARRAY_ACCESSORS(uint32, uint32_t, CANOPY_DATATYPE_UINT32)
+_DEFINE_ARRAY_ACCESSORS(float32, float, CANOPY_DATATYPE_FLOAT32)
+_DEFINE_ARRAY_ACCESSORS(float64, double, CANOPY_DATATYPE_FLOAT64)
+
+CanopyResultEnum canopy_var_bind_struct(
+        CanopyContext ctx,
+        const char *varname,
+        const CanopyStructField *fields,
+        size_t numFields)
+{
+    STCloudVar var;
+    CanopyResultEnum result;
+    bool locked;
+    st_log_trace("canopy_var_bind_struct(0x%p, %s, 0x%p, %zu)", ctx, varname, fields, numFields);
+
+    locked = _lock(ctx);
+    var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    if (!var)
+    {
+        _unlock(ctx, locked);
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+    result = st_cloudvar_struct_bind(var, fields, numFields);
+    _unlock(ctx, locked);
     return result;
 }
 
+CanopyResultEnum canopy_var_set_struct(CanopyContext ctx, const char *varname, const void *src)
+{
+    STCloudVar var;
+    CanopyResultEnum result;
+    bool locked;
+    st_log_trace("canopy_var_set_struct(0x%p, %s, 0x%p)", ctx, varname, src);
+
+    var = _lookup_var(ctx, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+
+    // Like canopy_var_set_batch: one lock, one timestamp, so the sync thread
+    // sees all of the fields or none of them.
+    locked = _lock(ctx);
+    st_cloudvar_system_set_sample_time(ctx->cloudvars, st_time_wall_ms());
+    result = st_cloudvar_struct_set_bound(var, src);
+    st_cloudvar_system_set_sample_time(ctx->cloudvars, 0);
+    _unlock(ctx, locked);
+    return result;
+}
+
+CanopyResultEnum canopy_var_get_struct(CanopyContext ctx, const char *varname, void *dest)
+{
+    STCloudVar var;
+    CanopyResultEnum result;
+    bool locked;
+    st_log_trace("canopy_var_get_struct(0x%p, %s, 0x%p)", ctx, varname, dest);
+
+    var = _lookup_var(ctx, varname);
+    if (!var)
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+    }
+
+    locked = _lock(ctx);
+    result = st_cloudvar_struct_get_bound(var, dest);
+    _unlock(ctx, locked);
+    return result;
+}
+
+CanopyResultEnum canopy_var_set_batch(CanopyContext ctx, const CanopyVarUpdate *updates, size_t n)
+{
+    CanopyResultEnum result;
+    CanopyResultEnum firstError = CANOPY_SUCCESS;
+    size_t i;
+    bool locked;
+    st_log_trace("canopy_var_set_batch(0x%p, 0x%p, %zu)", ctx, updates, n);
+
+    // Reject the whole batch up front, so that a bad entry never leaves it
+    // half-applied.
+    for (i = 0; i < n; i++)
+    {
+        if (!updates[i].var)
+        {
+            return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+        }
+        result = _check_typed_set(updates[i].var, updates[i].datatype);
+        if (result != CANOPY_SUCCESS)
+        {
+            return result;
+        }
+        if (updates[i].datatype == CANOPY_DATATYPE_STRING && !updates[i].val.val_string)
+        {
+            return CANOPY_ERROR_INVALID_VALUE;
+        }
+    }
+
+    // Taking the lock first applies anything the typed setters have queued,
+    // so the batch lands after them.  The sync thread can't run until we
+    // unlock, so it never sees the batch partially applied.
+    locked = _lock(ctx);
+    st_cloudvar_system_set_sample_time(ctx->cloudvars, st_time_wall_ms());
+    for (i = 0; i < n; i++)
+    {
+        // Only a failed string allocation can get here.  Keep going, so that
+        // the other variables still get their new values.
+        result = st_cloudvar_set_update(&updates[i]);
+        if (result != CANOPY_SUCCESS && firstError == CANOPY_SUCCESS)
+        {
+            firstError = result;
+        }
+    }
+    st_cloudvar_system_set_sample_time(ctx->cloudvars, 0);
+    _unlock(ctx, locked);
+    return firstError;
+}
+
 CanopyVarReader CANOPY_READ_BOOL(bool *dest)
 {
     st_log_trace("CANOPY_READ_BOOL(0x%p)", dest);
@@ -401,29 +803,52 @@ CanopyVarReader CANOPY_READ_ARRAY_IMPL(void * dummy, ...)
 CanopyResultEnum canopy_var_get(CanopyContext ctx, const char *varname, CanopyVarReader dest)
 {
     STCloudVar var;
+    CanopyResultEnum result;
+    bool locked;
     st_log_trace("canopy_var_get(...)");
 
+    locked = _lock(ctx);
     var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
+    result = canopy_var_get_h(ctx, var, dest);
+    _unlock(ctx, locked);
+    return result;
+}
+
+CanopyResultEnum canopy_var_get_h(CanopyContext ctx, CanopyVarHandle var, CanopyVarReader dest)
+{
+    CanopyResultEnum result;
+    bool locked;
     if (!var)
     {
         return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
     }
 
-    return st_cloudvar_read_var(var, dest);
+    // Taking the lock also applies queued updates, so this reads back the
+    // latest value set.
+    locked = _lock(ctx);
+    result = st_cloudvar_read_var(var, dest);
+    _unlock(ctx, locked);
+    return result;
 }
 
 CanopyResultEnum canopy_var_on_change(CanopyContext ctx, const char *varname, CanopyOnChangeCallback cb, void *userdata)
 {
     STCloudVar var;
+    CanopyResultEnum result;
+    bool locked;
     st_log_trace("canopy_var_on_change(...)");
 
+    locked = _lock(ctx);
     var = st_cloudvar_system_lookup_var(ctx->cloudvars, varname);
     if (!var)
     {
+        _unlock(ctx, locked);
         return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
     }
 
-    return st_cloudvar_register_on_change_callback(var, cb, userdata);
+    result = st_cloudvar_register_on_change_callback(var, cb, userdata);
+    _unlock(ctx, locked);
+    return result;
 }
 
 CanopyResultEnum canopy_var_init_impl(CanopyContext ctx, const char *decl, ...)
@@ -432,6 +857,13 @@ CanopyResultEnum canopy_var_init_impl(CanopyContext ctx, const char *decl, ...)
     va_list ap;
     CanopyResultEnum result;
 
+    // Setters look variables up without the lock, so the table must not
+    // change while the sync thread runs.
+    if (ctx->thread && st_sync_thread_is_running(ctx->thread))
+    {
+        return CANOPY_ERROR_SYNC_THREAD_RUNNING;
+    }
+
     va_start(ap, decl);
     result = st_cloudvar_init_var(ctx->cloudvars, decl, ap);
     va_end(ap);
@@ -439,18 +871,265 @@ CanopyResultEnum canopy_var_init_impl(CanopyContext ctx, const char *decl, ...)
     return result;
 }
 
+// Wait for <promise> until <deadlineUs> (from st_time_now_us), or
+// indefinitely if <deadlineUs> is 0.  <locked> is what the caller's _lock
+// returned: if true, the caller holds the context lock (once) and the sync
+// thread does the work.
+static CanopyResultEnum _wait_until(CanopyPromise promise, uint64_t deadlineUs, bool locked)
+{
+    CanopyContext ctx = promise->ctx;
+    if (st_sync_thread_is_current(ctx->thread))
+    {
+        // A callback on the sync thread holds the (recursive) lock at least
+        // twice, and waiting would only release it once.  Nor can the
+        // thread make progress while it waits for itself.
+        return promise->done ? promise->result : CANOPY_ERROR_WRONG_THREAD;
+    }
+    if (locked)
+    {
+        // The thread does the work; just wait for it.
+        if (!st_sync_thread_wait(ctx->thread, promise, deadlineUs))
+        {
+            return CANOPY_ERROR_TIMED_OUT;
+        }
+        return promise->result;
+    }
+
+    while (!promise->done)
+    {
+        if (st_time_expired(deadlineUs))
+        {
+            return CANOPY_ERROR_TIMED_OUT;
+        }
+        st_sync_service(promise->ctx->sync, 
+                st_time_remaining_ms(deadlineUs, 1000));
+    }
+    return promise->result;
+}
+
 CanopyResultEnum canopy_sync_blocking(CanopyContext ctx, int timeout_us)
 {
-    // TODO: don't ignore timeout_us!
+    CanopyPromise promise;
+    CanopyResultEnum result;
+    uint64_t timeoutUs = timeout_us;
+    uint64_t deadlineUs;
+    bool locked;
+
     st_log_trace("canopy_sync_blocking(...)");
-    return st_sync(ctx, ctx->options, ctx->ws, ctx->cloudvars);
-}
+    if (timeout_us < 0)
+    {
+        return CANOPY_ERROR_INVALID_VALUE;
+    }
+    if (timeout_us == 0)
+    {
+        timeoutUs = (uint64_t)ctx->options->val_CANOPY_SYNC_TIMEOUT_MS*1000;
+    }
 
+    locked = _lock(ctx);
+    promise = st_promise_new(ctx->promises);
+    if (!promise)
+    {
+        _unlock(ctx, locked);
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    // The cycle itself gives up at the deadline, so it doesn't hold up the
+    // next sync after this call returns.  A deadline of 0 means none.
+    deadlineUs = timeoutUs ? st_time_now_us() + timeoutUs : 0;
+    st_sync_start(ctx->sync, promise, deadlineUs);
+    if (locked)
+    {
+        st_sync_thread_wake(ctx->thread);
+    }
+    result = _wait_until(promise, deadlineUs, locked);
+    st_promise_release(promise);
+    _unlock(ctx, locked);
+    return result;
+}
 
-CanopyResultEnum canopy_sync(CanopyContext ctx, CanopyPromise promise)
+CanopyResultEnum canopy_sync(CanopyContext ctx, CanopyPromise *outPromise)
 {
+    CanopyPromise promise;
+    CanopyResultEnum result;
+    bool locked;
+
     st_log_trace("canopy_sync(...)");
-    return st_sync(ctx, ctx->options, ctx->ws, ctx->cloudvars);
+    if (ctx->options->val_CANOPY_SYNC_BLOCKING)
+    {
+        result = canopy_sync_blocking(ctx, 0);
+        if (outPromise)
+        {
+            locked = _lock(ctx);
+            *outPromise = st_promise_new(ctx->promises);
+            if (*outPromise)
+            {
+                st_promise_complete(*outPromise, result);
+            }
+            _unlock(ctx, locked);
+            if (!*outPromise)
+            {
+                return CANOPY_ERROR_OUT_OF_MEMORY;
+            }
+        }
+        return result;
+    }
+
+    locked = _lock(ctx);
+    promise = st_promise_new(ctx->promises);
+    if (!promise)
+    {
+        _unlock(ctx, locked);
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    st_sync_start(ctx->sync, promise, 0);
+
+    if (locked)
+    {
+        // The thread picks it up from here.
+        st_sync_thread_wake(ctx->thread);
+    }
+    else
+    {
+        // Get as far as possible without waiting.
+        st_sync_service(ctx->sync, 0);
+    }
+
+    // Report errors that happened before any waiting was needed.
+    result = promise->done ? promise->result : CANOPY_SUCCESS;
+    if (outPromise)
+    {
+        *outPromise = promise;
+    }
+    else
+    {
+        st_promise_release(promise);
+    }
+    _unlock(ctx, locked);
+    return result;
+}
+
+CanopyResultEnum canopy_service(CanopyContext ctx, int timeout_us)
+{
+    st_log_trace("canopy_service(...)");
+    if (timeout_us < 0)
+    {
+        return CANOPY_ERROR_INVALID_VALUE;
+    }
+    if (st_sync_thread_is_running(ctx->thread))
+    {
+        // The sync thread services the context itself.
+        return CANOPY_SUCCESS;
+    }
+    st_sync_service(ctx->sync, (uint32_t)(((uint64_t)timeout_us + 999) / 1000));
+    return CANOPY_SUCCESS;
+}
+
+bool canopy_promise_is_done(CanopyPromise promise)
+{
+    bool done;
+    bool locked;
+    locked = _lock(promise->ctx);
+    done = promise->done;
+    _unlock(promise->ctx, locked);
+    return done;
+}
+
+CanopyResultEnum canopy_promise_result(CanopyPromise promise)
+{
+    CanopyResultEnum result;
+    bool locked;
+    locked = _lock(promise->ctx);
+    result = promise->done ? promise->result : CANOPY_ERROR_PROMISE_NOT_COMPLETE;
+    _unlock(promise->ctx, locked);
+    return result;
+}
+
+CanopyResultEnum canopy_promise_wait(CanopyPromise promise, int timeout_us)
+{
+    CanopyContext ctx = promise->ctx;
+    CanopyResultEnum result;
+    bool locked;
+    st_log_trace("canopy_promise_wait(0x%p, %d)", promise, timeout_us);
+    locked = _lock(ctx);
+    result = _wait_until(promise, timeout_us < 0 ? 0 : st_time_now_us() + timeout_us, locked);
+    _unlock(ctx, locked);
+    return result;
+}
+
+CanopyResultEnum canopy_promise_on_done(CanopyPromise promise, CanopyPromiseCallback cb, void *userdata)
+{
+    CanopyContext ctx = promise->ctx;
+    bool locked;
+    locked = _lock(ctx);
+    if (promise->cb)
+    {
+        _unlock(ctx, locked);
+        return CANOPY_ERROR_REDUNDANT_PARAMETER;
+    }
+    promise->cb = cb;
+    promise->cb_userdata = userdata;
+    if (promise->done)
+    {
+        cb(promise, promise->result, userdata);
+    }
+    _unlock(ctx, locked);
+    return CANOPY_SUCCESS;
+}
+
+void canopy_promise_free(CanopyPromise promise)
+{
+    CanopyContext ctx;
+    bool locked;
+    if (promise)
+    {
+        ctx = promise->ctx;
+        locked = _lock(ctx);
+        st_promise_release(promise);
+        _unlock(ctx, locked);
+    }
+}
+
+CanopyConnectionStateEnum canopy_connection_state(CanopyContext ctx)
+{
+    CanopyConnectionStateEnum state;
+    bool locked;
+    locked = _lock(ctx);
+    state = ctx->connection_state;
+    _unlock(ctx, locked);
+    return state;
+}
+
+CanopyResultEnum canopy_on_connection_state(CanopyContext ctx, CanopyConnectionStateCallback cb, void *userdata)
+{
+    bool locked;
+    st_log_trace("canopy_on_connection_state(0x%p)", ctx);
+    locked = _lock(ctx);
+    ctx->cb_connection_state = cb;
+    ctx->cb_connection_state_userdata = userdata;
+    _unlock(ctx, locked);
+    return CANOPY_SUCCESS;
+}
+
+CanopyResultEnum canopy_get_send_stats(CanopyContext ctx, CanopySendStats *stats)
+{
+    bool locked;
+    if (!stats)
+    {
+        return CANOPY_ERROR_INVALID_VALUE;
+    }
+    locked = _lock(ctx);
+    st_sync_get_send_stats(ctx->sync, stats);
+    _unlock(ctx, locked);
+    return CANOPY_SUCCESS;
+}
+
+uint32_t canopy_offline_backlog(CanopyContext ctx)
+{
+    uint32_t backlog;
+    bool locked;
+    locked = _lock(ctx);
+    backlog = st_sync_offline_backlog(ctx->sync);
+    _unlock(ctx, locked);
+    return backlog;
 }
 
 void canopy_debug_dump_opts(CanopyContext ctx)
@@ -516,6 +1195,82 @@ void canopy_debug_dump_opts(CanopyContext ctx)
     else
         RedStringList_AppendPrintf(out, "SYNC_TIMEOUT_MS: <undefined>\n");
 
+    if (ctx->options->has_CANOPY_SYNC_ARENA_MAX_BYTES)
+        RedStringList_AppendPrintf(out, "SYNC_ARENA_MAX_BYTES: %d\n", 
+                ctx->options->val_CANOPY_SYNC_ARENA_MAX_BYTES);
+    else
+        RedStringList_AppendPrintf(out, "SYNC_ARENA_MAX_BYTES: <undefined>\n");
+
+    if (ctx->options->has_CANOPY_PAYLOAD_FORMAT)
+        RedStringList_AppendPrintf(out, "PAYLOAD_FORMAT: %d\n", 
+                ctx->options->val_CANOPY_PAYLOAD_FORMAT);
+    else
+        RedStringList_AppendPrintf(out, "PAYLOAD_FORMAT: <undefined>\n");
+
+    if (ctx->options->has_CANOPY_SYNC_THREAD)
+        RedStringList_AppendPrintf(out, "SYNC_THREAD: %d\n", 
+                ctx->options->val_CANOPY_SYNC_THREAD);
+    else
+        RedStringList_AppendPrintf(out, "SYNC_THREAD: <undefined>\n");
+
+    if (ctx->options->has_CANOPY_RECONNECT_MIN_MS)
+        RedStringList_AppendPrintf(out, "RECONNECT_MIN_MS: %d\n", 
+                ctx->options->val_CANOPY_RECONNECT_MIN_MS);
+    else
+        RedStringList_AppendPrintf(out, "RECONNECT_MIN_MS: <undefined>\n");
+
+    if (ctx->options->has_CANOPY_RECONNECT_MAX_MS)
+        RedStringList_AppendPrintf(out, "RECONNECT_MAX_MS: %d\n", 
+                ctx->options->val_CANOPY_RECONNECT_MAX_MS);
+    else
+        RedStringList_AppendPrintf(out, "RECONNECT_MAX_MS: <undefined>\n");
+
+    if (ctx->options->has_CANOPY_WS_RX_BUFFER_BYTES)
+        RedStringList_AppendPrintf(out, "WS_RX_BUFFER_BYTES: %d\n", 
+                ctx->options->val_CANOPY_WS_RX_BUFFER_BYTES);
+    else
+        RedStringList_AppendPrintf(out, "WS_RX_BUFFER_BYTES: <undefined>\n");
+
+    if (ctx->options->has_CANOPY_WS_MAX_MESSAGE_BYTES)
+        RedStringList_AppendPrintf(out, "WS_MAX_MESSAGE_BYTES: %d\n", 
+                ctx->options->val_CANOPY_WS_MAX_MESSAGE_BYTES);
+    else
+        RedStringList_AppendPrintf(out, "WS_MAX_MESSAGE_BYTES: <undefined>\n");
+
+    if (ctx->options->has_CANOPY_WS_MAX_BYTES_IN_FLIGHT)
+        RedStringList_AppendPrintf(out, "WS_MAX_BYTES_IN_FLIGHT: %d\n", 
+                ctx->options->val_CANOPY_WS_MAX_BYTES_IN_FLIGHT);
+    else
+        RedStringList_AppendPrintf(out, "WS_MAX_BYTES_IN_FLIGHT: <undefined>\n");
+
+    if (ctx->options->has_CANOPY_SEND_LATENCY_BUDGET_MS)
+        RedStringList_AppendPrintf(out, "SEND_LATENCY_BUDGET_MS: %d\n", 
+                ctx->options->val_CANOPY_SEND_LATENCY_BUDGET_MS);
+    else
+        RedStringList_AppendPrintf(out, "SEND_LATENCY_BUDGET_MS: <undefined>\n");
+
+    RedStringList_AppendPrintf(out, "OFFLINE_FILE: %s\n", 
+            ctx->options->has_CANOPY_OFFLINE_FILE ?
+                ctx->options->val_CANOPY_OFFLINE_FILE : "<undefined>");
+
+    if (ctx->options->has_CANOPY_OFFLINE_CAPACITY)
+        RedStringList_AppendPrintf(out, "OFFLINE_CAPACITY: %d\n", 
+                ctx->options->val_CANOPY_OFFLINE_CAPACITY);
+    else
+        RedStringList_AppendPrintf(out, "OFFLINE_CAPACITY: <undefined>\n");
+
+    if (ctx->options->has_CANOPY_OFFLINE_OVERFLOW)
+        RedStringList_AppendPrintf(out, "OFFLINE_OVERFLOW: %d\n", 
+                ctx->options->val_CANOPY_OFFLINE_OVERFLOW);
+    else
+        RedStringList_AppendPrintf(out, "OFFLINE_OVERFLOW: <undefined>\n");
+
+    if (ctx->options->has_CANOPY_OFFLINE_BATCH_SIZE)
+        RedStringList_AppendPrintf(out, "OFFLINE_BATCH_SIZE: %d\n", 
+                ctx->options->val_CANOPY_OFFLINE_BATCH_SIZE);
+    else
+        RedStringList_AppendPrintf(out, "OFFLINE_BATCH_SIZE: <undefined>\n");
+
     RedStringList_AppendPrintf(out, "\n\n");
 
     char *outsz = RedStringList_ToNewChars(out);
@@ -0,0 +1,46 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_CBOR_INCLUDED
+#define ST_CBOR_INCLUDED
+
+// CBOR (RFC 7049) encoding constants shared by the reader and writer.
+
+// Major types (high 3 bits of the initial byte)
+#define ST_CBOR_MAJOR_UINT 0
+#define ST_CBOR_MAJOR_NEGINT 1
+#define ST_CBOR_MAJOR_BYTES 2
+#define ST_CBOR_MAJOR_TEXT 3
+#define ST_CBOR_MAJOR_ARRAY 4
+#define ST_CBOR_MAJOR_MAP 5
+#define ST_CBOR_MAJOR_TAG 6
+#define ST_CBOR_MAJOR_SIMPLE 7
+
+// Additional information (low 5 bits of the initial byte)
+#define ST_CBOR_AI_1BYTE 24
+#define ST_CBOR_AI_2BYTE 25
+#define ST_CBOR_AI_4BYTE 26
+#define ST_CBOR_AI_8BYTE 27
+#define ST_CBOR_AI_INDEFINITE 31
+
+// Complete initial bytes for simple values and floats
+#define ST_CBOR_FALSE 0xf4
+#define ST_CBOR_TRUE 0xf5
+#define ST_CBOR_NULL 0xf6
+#define ST_CBOR_FLOAT16 0xf9
+#define ST_CBOR_FLOAT32 0xfa
+#define ST_CBOR_FLOAT64 0xfb
+#define ST_CBOR_BREAK 0xff
+
+#endif // ST_CBOR_INCLUDED
@@ -0,0 +1,396 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cbor/st_cbor_reader.h"
+#include "cbor/st_cbor.h"
+#include <math.h>
+#include <string.h>
+
+// Deepest nesting st_cbor_skip will descend into.
+#define _MAX_SKIP_DEPTH 32
+
+static bool _fail(STCborReader r)
+{
+    r->failed = true;
+    return false;
+}
+
+// Read the initial byte of a data item and its argument.
+// For indefinite-length items, *indefinite is set and *arg is 0.
+static bool _read_head(
+        STCborReader r, 
+        uint8_t *majorType, 
+        uint8_t *ai,
+        uint64_t *arg, 
+        bool *indefinite)
+{
+    int numBytes, i;
+    if (r->failed || r->pos >= r->end)
+    {
+        return _fail(r);
+    }
+    *majorType = *r->pos >> 5;
+    *ai = *r->pos & 0x1f;
+    *arg = 0;
+    *indefinite = false;
+    r->pos++;
+
+    if (*ai < ST_CBOR_AI_1BYTE)
+    {
+        *arg = *ai;
+        return true;
+    }
+    switch (*ai)
+    {
+        case ST_CBOR_AI_1BYTE: numBytes = 1; break;
+        case ST_CBOR_AI_2BYTE: numBytes = 2; break;
+        case ST_CBOR_AI_4BYTE: numBytes = 4; break;
+        case ST_CBOR_AI_8BYTE: numBytes = 8; break;
+        case ST_CBOR_AI_INDEFINITE:
+        {
+            *indefinite = true;
+            return true;
+        }
+        default:
+            return _fail(r);
+    }
+    if (r->end - r->pos < numBytes)
+    {
+        return _fail(r);
+    }
+    for (i = 0; i < numBytes; i++)
+    {
+        *arg = (*arg << 8) | r->pos[i];
+    }
+    r->pos += numBytes;
+    return true;
+}
+
+// Decode IEEE 754 half precision.
+static double _half_to_double(uint16_t half)
+{
+    int exponent = (half >> 10) & 0x1f;
+    int mantissa = half & 0x3ff;
+    double value;
+    if (exponent == 0)
+        value = ldexp(mantissa, -24);
+    else if (exponent != 31)
+        value = ldexp(mantissa + 1024, exponent - 25);
+    else
+        value = mantissa == 0 ? INFINITY : NAN;
+    return (half & 0x8000) ? -value : value;
+}
+
+void st_cbor_reader_init(STCborReader r, const void *data, size_t len)
+{
+    r->pos = (const uint8_t *)data;
+    r->end = r->pos + len;
+    r->failed = false;
+}
+
+bool st_cbor_reader_failed(STCborReader r)
+{
+    return r->failed;
+}
+
+bool st_cbor_reader_at_end(STCborReader r)
+{
+    return r->pos >= r->end;
+}
+
+STCborTypeEnum st_cbor_peek_type(STCborReader r)
+{
+    uint8_t b;
+    if (r->failed || r->pos >= r->end)
+    {
+        return ST_CBOR_TYPE_INVALID;
+    }
+    b = *r->pos;
+    switch (b >> 5)
+    {
+        case ST_CBOR_MAJOR_UINT: return ST_CBOR_TYPE_UINT;
+        case ST_CBOR_MAJOR_NEGINT: return ST_CBOR_TYPE_NEGINT;
+        case ST_CBOR_MAJOR_BYTES: return ST_CBOR_TYPE_BYTES;
+        case ST_CBOR_MAJOR_TEXT: return ST_CBOR_TYPE_TEXT;
+        case ST_CBOR_MAJOR_ARRAY: return ST_CBOR_TYPE_ARRAY;
+        case ST_CBOR_MAJOR_MAP: return ST_CBOR_TYPE_MAP;
+        case ST_CBOR_MAJOR_TAG: return ST_CBOR_TYPE_TAG;
+        default:
+            break;
+    }
+    switch (b)
+    {
+        case ST_CBOR_FALSE:
+        case ST_CBOR_TRUE:
+            return ST_CBOR_TYPE_BOOL;
+        case ST_CBOR_NULL:
+            return ST_CBOR_TYPE_NULL;
+        case ST_CBOR_FLOAT16:
+        case ST_CBOR_FLOAT32:
+        case ST_CBOR_FLOAT64:
+            return ST_CBOR_TYPE_FLOAT;
+        case ST_CBOR_BREAK:
+            return ST_CBOR_TYPE_BREAK;
+        default:
+            return ST_CBOR_TYPE_INVALID;
+    }
+}
+
+bool st_cbor_read_uint(STCborReader r, uint64_t *out)
+{
+    uint8_t majorType, ai;
+    bool indefinite;
+    if (st_cbor_peek_type(r) != ST_CBOR_TYPE_UINT)
+    {
+        return _fail(r);
+    }
+    return _read_head(r, &majorType, &ai, out, &indefinite);
+}
+
+bool st_cbor_read_int(STCborReader r, int64_t *out)
+{
+    uint8_t majorType, ai;
+    uint64_t arg;
+    bool indefinite;
+    STCborTypeEnum type = st_cbor_peek_type(r);
+    if (type != ST_CBOR_TYPE_UINT && type != ST_CBOR_TYPE_NEGINT)
+    {
+        return _fail(r);
+    }
+    if (!_read_head(r, &majorType, &ai, &arg, &indefinite))
+    {
+        return false;
+    }
+    if (arg > INT64_MAX)
+    {
+        return _fail(r);
+    }
+    *out = (majorType == ST_CBOR_MAJOR_NEGINT) ? -1 - (int64_t)arg : (int64_t)arg;
+    return true;
+}
+
+bool st_cbor_read_number(STCborReader r, double *out)
+{
+    uint8_t majorType, ai;
+    uint64_t arg;
+    bool indefinite;
+    STCborTypeEnum type = st_cbor_peek_type(r);
+    if (type != ST_CBOR_TYPE_UINT && type != ST_CBOR_TYPE_NEGINT &&
+            type != ST_CBOR_TYPE_FLOAT)
+    {
+        return _fail(r);
+    }
+    if (!_read_head(r, &majorType, &ai, &arg, &indefinite))
+    {
+        return false;
+    }
+    if (majorType == ST_CBOR_MAJOR_UINT)
+    {
+        *out = (double)arg;
+    }
+    else if (majorType == ST_CBOR_MAJOR_NEGINT)
+    {
+        *out = -1.0 - (double)arg;
+    }
+    else if (ai == ST_CBOR_AI_2BYTE)
+    {
+        *out = _half_to_double((uint16_t)arg);
+    }
+    else if (ai == ST_CBOR_AI_4BYTE)
+    {
+        uint32_t bits = (uint32_t)arg;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        *out = f;
+    }
+    else
+    {
+        memcpy(out, &arg, sizeof(*out));
+    }
+    return true;
+}
+
+bool st_cbor_read_bool(STCborReader r, bool *out)
+{
+    if (st_cbor_peek_type(r) != ST_CBOR_TYPE_BOOL)
+    {
+        return _fail(r);
+    }
+    *out = (*r->pos == ST_CBOR_TRUE);
+    r->pos++;
+    return true;
+}
+
+bool st_cbor_read_null(STCborReader r)
+{
+    if (st_cbor_peek_type(r) != ST_CBOR_TYPE_NULL)
+    {
+        return _fail(r);
+    }
+    r->pos++;
+    return true;
+}
+
+bool st_cbor_read_text(STCborReader r, const char **out, size_t *len)
+{
+    uint8_t majorType, ai;
+    uint64_t arg;
+    bool indefinite;
+    if (st_cbor_peek_type(r) != ST_CBOR_TYPE_TEXT)
+    {
+        return _fail(r);
+    }
+    if (!_read_head(r, &majorType, &ai, &arg, &indefinite))
+    {
+        return false;
+    }
+    if (indefinite || arg > (uint64_t)(r->end - r->pos))
+    {
+        return _fail(r);
+    }
+    *out = (const char *)r->pos;
+    *len = (size_t)arg;
+    r->pos += arg;
+    return true;
+}
+
+static bool _enter_container(STCborReader r, STCborTypeEnum type, STCborContainer c)
+{
+    uint8_t majorType, ai;
+    if (st_cbor_peek_type(r) != type)
+    {
+        return _fail(r);
+    }
+    return _read_head(r, &majorType, &ai, &c->remaining, &c->indefinite);
+}
+
+bool st_cbor_enter_map(STCborReader r, STCborContainer c)
+{
+    return _enter_container(r, ST_CBOR_TYPE_MAP, c);
+}
+
+bool st_cbor_enter_array(STCborReader r, STCborContainer c)
+{
+    return _enter_container(r, ST_CBOR_TYPE_ARRAY, c);
+}
+
+bool st_cbor_container_next(STCborReader r, STCborContainer c)
+{
+    if (r->failed)
+    {
+        return false;
+    }
+    if (c->indefinite)
+    {
+        if (r->pos >= r->end)
+        {
+            return _fail(r);
+        }
+        if (*r->pos == ST_CBOR_BREAK)
+        {
+            r->pos++;
+            return false;
+        }
+        return true;
+    }
+    if (c->remaining == 0)
+    {
+        return false;
+    }
+    c->remaining--;
+    return true;
+}
+
+static bool _skip(STCborReader r, int depth)
+{
+    uint8_t majorType, ai;
+    uint64_t arg, i;
+    bool indefinite;
+
+    if (depth > _MAX_SKIP_DEPTH)
+    {
+        return _fail(r);
+    }
+    if (st_cbor_peek_type(r) == ST_CBOR_TYPE_BREAK)
+    {
+        // Break outside of an indefinite-length item
+        return _fail(r);
+    }
+    if (!_read_head(r, &majorType, &ai, &arg, &indefinite))
+    {
+        return false;
+    }
+    switch (majorType)
+    {
+        case ST_CBOR_MAJOR_UINT:
+        case ST_CBOR_MAJOR_NEGINT:
+        case ST_CBOR_MAJOR_SIMPLE:
+            return !indefinite || _fail(r);
+        case ST_CBOR_MAJOR_BYTES:
+        case ST_CBOR_MAJOR_TEXT:
+        {
+            if (indefinite)
+            {
+                // Sequence of definite-length chunks, ended by a break.
+                while (r->pos < r->end && *r->pos != ST_CBOR_BREAK)
+                {
+                    if (!_skip(r, depth + 1))
+                        return false;
+                }
+                if (r->pos >= r->end)
+                    return _fail(r);
+                r->pos++;
+                return true;
+            }
+            if (arg > (uint64_t)(r->end - r->pos))
+            {
+                return _fail(r);
+            }
+            r->pos += arg;
+            return true;
+        }
+        case ST_CBOR_MAJOR_ARRAY:
+        case ST_CBOR_MAJOR_MAP:
+        {
+            uint64_t itemsPerEntry = (majorType == ST_CBOR_MAJOR_MAP) ? 2 : 1;
+            if (indefinite)
+            {
+                while (r->pos < r->end && *r->pos != ST_CBOR_BREAK)
+                {
+                    if (!_skip(r, depth + 1))
+                        return false;
+                }
+                if (r->pos >= r->end)
+                    return _fail(r);
+                r->pos++;
+                return true;
+            }
+            for (i = 0; i < arg * itemsPerEntry; i++)
+            {
+                if (!_skip(r, depth + 1))
+                    return false;
+            }
+            return true;
+        }
+        case ST_CBOR_MAJOR_TAG:
+            return _skip(r, depth + 1);
+        default:
+            return _fail(r);
+    }
+}
+
+bool st_cbor_skip(STCborReader r)
+{
+    return _skip(r, 0);
+}
@@ -0,0 +1,114 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_CBOR_READER_INCLUDED
+#define ST_CBOR_READER_INCLUDED
+
+// Pull parser for CBOR (RFC 7049) payloads
+//
+// Reads data items one at a time from a length-bounded buffer, without
+// allocating.  Text strings are returned as (pointer, length) pairs into the
+// buffer.  The reader is a small cursor that lives on the caller's stack:
+//
+//      STCborReader_t r;
+//      STCborContainer_t map;
+//      st_cbor_reader_init(&r, payload, len);
+//      if (st_cbor_enter_map(&r, &map))
+//      {
+//          while (st_cbor_container_next(&r, &map))
+//          {
+//              // read key, then value
+//          }
+//      }
+//      if (st_cbor_reader_failed(&r)) ...
+//
+// Any malformed or truncated input, or a read of the wrong type, marks the
+// reader as failed.  Once failed, all further reads fail.
+
+#include <canopy.h>
+#include <stddef.h>
+
+typedef enum
+{
+    ST_CBOR_TYPE_INVALID,
+    ST_CBOR_TYPE_UINT,
+    ST_CBOR_TYPE_NEGINT,
+    ST_CBOR_TYPE_BYTES,
+    ST_CBOR_TYPE_TEXT,
+    ST_CBOR_TYPE_ARRAY,
+    ST_CBOR_TYPE_MAP,
+    ST_CBOR_TYPE_TAG,
+    ST_CBOR_TYPE_BOOL,
+    ST_CBOR_TYPE_NULL,
+    ST_CBOR_TYPE_FLOAT,
+    ST_CBOR_TYPE_BREAK,
+} STCborTypeEnum;
+
+typedef struct STCborReader_t
+{
+    const uint8_t *pos;
+    const uint8_t *end;
+    bool failed;
+} STCborReader_t;
+typedef struct STCborReader_t * STCborReader;
+
+// Iteration state for a map or array being read.
+typedef struct STCborContainer_t
+{
+    // Items (arrays) or key/value pairs (maps) left, if not indefinite.
+    uint64_t remaining;
+    bool indefinite;
+} STCborContainer_t;
+typedef struct STCborContainer_t * STCborContainer;
+
+// Start reading <len> bytes at <data>.
+void st_cbor_reader_init(STCborReader r, const void *data, size_t len);
+
+// Has the reader encountered malformed input or a type mismatch?
+bool st_cbor_reader_failed(STCborReader r);
+
+// Has all input been consumed?
+bool st_cbor_reader_at_end(STCborReader r);
+
+// Type of the next data item, without consuming it.
+STCborTypeEnum st_cbor_peek_type(STCborReader r);
+
+// Read an unsigned integer.
+bool st_cbor_read_uint(STCborReader r, uint64_t *out);
+
+// Read a signed integer that fits in an int64_t.
+bool st_cbor_read_int(STCborReader r, int64_t *out);
+
+// Read any number (integer or half/single/double precision float).
+bool st_cbor_read_number(STCborReader r, double *out);
+
+bool st_cbor_read_bool(STCborReader r, bool *out);
+bool st_cbor_read_null(STCborReader r);
+
+// Read a definite-length text string.  <*out> points into the input buffer
+// and is NOT NUL-terminated.
+bool st_cbor_read_text(STCborReader r, const char **out, size_t *len);
+
+// Begin reading a map or array.
+bool st_cbor_enter_map(STCborReader r, STCborContainer c);
+bool st_cbor_enter_array(STCborReader r, STCborContainer c);
+
+// Returns true if the container has another item (or key/value pair) to
+// read.  Returns false, consuming the end marker if any, once it's done.
+bool st_cbor_container_next(STCborReader r, STCborContainer c);
+
+// Skip over the next data item, including any nested items.
+bool st_cbor_skip(STCborReader r);
+
+#endif // ST_CBOR_READER_INCLUDED
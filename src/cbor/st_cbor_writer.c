@@ -0,0 +1,302 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cbor/st_cbor_writer.h"
+#include "cbor/st_cbor.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Initial buffer size.  Grows geometrically from here.
+#define _INITIAL_CAPACITY 256
+
+struct STCborWriter_t
+{
+    uint8_t *buf;
+    size_t len;
+    size_t capacity;
+
+    // Has an allocation failed?
+    bool failed;
+
+    // If set, the buffer is allocated from here instead of the heap.
+    STArena arena;
+
+    // For in-place writers, the caller's buffer, which <buf> points
+    // <headroom> bytes into.
+    void **place;
+    size_t *place_capacity;
+    size_t headroom;
+    size_t tailroom;
+};
+
+// Grow an in-place writer's buffer so that <capacity> bytes fit between its
+// headroom and tailroom.  Returns the new output buffer, or NULL.
+static uint8_t * _realloc_in_place(STCborWriter w, size_t capacity)
+{
+    size_t size = w->headroom + capacity + w->tailroom;
+    uint8_t *mem = realloc(*w->place, size);
+    if (!mem)
+    {
+        return NULL;
+    }
+    *w->place = mem;
+    *w->place_capacity = size;
+    return &mem[w->headroom];
+}
+
+// Make room for <extra> more bytes.
+static bool _reserve(STCborWriter w, size_t extra)
+{
+    size_t needed;
+    if (w->failed)
+    {
+        return false;
+    }
+    needed = w->len + extra;
+    if (needed > w->capacity)
+    {
+        size_t newCapacity = w->capacity ? w->capacity : _INITIAL_CAPACITY;
+        uint8_t *newBuf;
+        while (newCapacity < needed)
+        {
+            newCapacity *= 2;
+        }
+        if (w->place)
+            newBuf = _realloc_in_place(w, newCapacity);
+        else if (w->arena)
+            newBuf = st_arena_realloc(w->arena, w->buf, w->capacity, newCapacity);
+        else
+            newBuf = realloc(w->buf, newCapacity);
+        if (!newBuf)
+        {
+            w->failed = true;
+            return false;
+        }
+        w->buf = newBuf;
+        w->capacity = newCapacity;
+    }
+    return true;
+}
+
+static void _append(STCborWriter w, const void *bytes, size_t len)
+{
+    if (!_reserve(w, len))
+    {
+        return;
+    }
+    memcpy(&w->buf[w->len], bytes, len);
+    w->len += len;
+}
+
+static void _append_byte(STCborWriter w, uint8_t b)
+{
+    if (!_reserve(w, 1))
+    {
+        return;
+    }
+    w->buf[w->len++] = b;
+}
+
+// Append <n> big-endian bytes of <value>.
+static void _append_be(STCborWriter w, uint64_t value, int n)
+{
+    int i;
+    if (!_reserve(w, n))
+    {
+        return;
+    }
+    for (i = n - 1; i >= 0; i--)
+    {
+        w->buf[w->len++] = (uint8_t)(value >> (8*i));
+    }
+}
+
+// Write a major type and its argument using the shortest encoding.
+static void _append_head(STCborWriter w, uint8_t majorType, uint64_t arg)
+{
+    uint8_t mt = majorType << 5;
+    if (arg < 24)
+    {
+        _append_byte(w, mt | (uint8_t)arg);
+    }
+    else if (arg <= 0xff)
+    {
+        _append_byte(w, mt | ST_CBOR_AI_1BYTE);
+        _append_be(w, arg, 1);
+    }
+    else if (arg <= 0xffff)
+    {
+        _append_byte(w, mt | ST_CBOR_AI_2BYTE);
+        _append_be(w, arg, 2);
+    }
+    else if (arg <= 0xffffffffULL)
+    {
+        _append_byte(w, mt | ST_CBOR_AI_4BYTE);
+        _append_be(w, arg, 4);
+    }
+    else
+    {
+        _append_byte(w, mt | ST_CBOR_AI_8BYTE);
+        _append_be(w, arg, 8);
+    }
+}
+
+STCborWriter st_cbor_writer_new()
+{
+    return calloc(1, sizeof(struct STCborWriter_t));
+}
+
+STCborWriter st_cbor_writer_new_in_arena(STArena arena)
+{
+    STCborWriter w = st_arena_alloc(arena, sizeof(struct STCborWriter_t));
+    if (w)
+    {
+        memset(w, 0, sizeof(struct STCborWriter_t));
+        w->arena = arena;
+    }
+    return w;
+}
+
+STCborWriter st_cbor_writer_new_in_place(
+        STArena arena, 
+        void **buf, 
+        size_t *capacity, 
+        size_t headroom, 
+        size_t tailroom)
+{
+    STCborWriter w = arena ? st_arena_alloc(arena, sizeof(struct STCborWriter_t)) 
+            : malloc(sizeof(struct STCborWriter_t));
+    if (!w)
+    {
+        return NULL;
+    }
+    memset(w, 0, sizeof(struct STCborWriter_t));
+    w->arena = arena;
+    w->place = buf;
+    w->place_capacity = capacity;
+    w->headroom = headroom;
+    w->tailroom = tailroom;
+    if (*buf && *capacity > headroom + tailroom)
+    {
+        w->buf = &((uint8_t *)*buf)[headroom];
+        w->capacity = *capacity - headroom - tailroom;
+    }
+    return w;
+}
+
+void st_cbor_writer_free(STCborWriter w)
+{
+    if (w && !w->arena)
+    {
+        if (!w->place)
+        {
+            free(w->buf);
+        }
+        free(w);
+    }
+}
+
+bool st_cbor_writer_failed(STCborWriter w)
+{
+    return w->failed;
+}
+
+size_t st_cbor_writer_len(STCborWriter w)
+{
+    return w->len;
+}
+
+const uint8_t * st_cbor_writer_data(STCborWriter w)
+{
+    if (w->failed || !_reserve(w, 0))
+    {
+        return NULL;
+    }
+    return w->buf;
+}
+
+void st_cbor_begin_map(STCborWriter w)
+{
+    _append_byte(w, (ST_CBOR_MAJOR_MAP << 5) | ST_CBOR_AI_INDEFINITE);
+}
+
+void st_cbor_end_map(STCborWriter w)
+{
+    _append_byte(w, ST_CBOR_BREAK);
+}
+
+void st_cbor_begin_array(STCborWriter w)
+{
+    _append_byte(w, (ST_CBOR_MAJOR_ARRAY << 5) | ST_CBOR_AI_INDEFINITE);
+}
+
+void st_cbor_end_array(STCborWriter w)
+{
+    _append_byte(w, ST_CBOR_BREAK);
+}
+
+void st_cbor_null(STCborWriter w)
+{
+    _append_byte(w, ST_CBOR_NULL);
+}
+
+void st_cbor_bool(STCborWriter w, bool value)
+{
+    _append_byte(w, value ? ST_CBOR_TRUE : ST_CBOR_FALSE);
+}
+
+void st_cbor_int(STCborWriter w, int64_t value)
+{
+    if (value >= 0)
+    {
+        _append_head(w, ST_CBOR_MAJOR_UINT, (uint64_t)value);
+    }
+    else
+    {
+        // Negative integers are encoded as -1 - n.
+        _append_head(w, ST_CBOR_MAJOR_NEGINT, (uint64_t)(-1 - value));
+    }
+}
+
+void st_cbor_uint(STCborWriter w, uint64_t value)
+{
+    _append_head(w, ST_CBOR_MAJOR_UINT, value);
+}
+
+void st_cbor_float32(STCborWriter w, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    _append_byte(w, ST_CBOR_FLOAT32);
+    _append_be(w, bits, 4);
+}
+
+void st_cbor_float64(STCborWriter w, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    _append_byte(w, ST_CBOR_FLOAT64);
+    _append_be(w, bits, 8);
+}
+
+void st_cbor_string(STCborWriter w, const char *sz)
+{
+    st_cbor_string_len(w, sz, strlen(sz));
+}
+
+void st_cbor_string_len(STCborWriter w, const char *s, size_t len)
+{
+    _append_head(w, ST_CBOR_MAJOR_TEXT, len);
+    _append(w, s, len);
+}
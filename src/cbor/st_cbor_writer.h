@@ -0,0 +1,86 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_CBOR_WRITER_INCLUDED
+#define ST_CBOR_WRITER_INCLUDED
+
+// Streaming CBOR (RFC 7049) emitter for Canopy
+//
+// The binary counterpart of st_json_writer.  Maps and arrays are written
+// with indefinite length, so items can be streamed without counting them
+// first:
+//
+//      STCborWriter w = st_cbor_writer_new_in_arena(arena);
+//      st_cbor_begin_map(w);
+//      st_cbor_uint(w, 3);             // key
+//      st_cbor_float32(w, 21.5f);      // value
+//      st_cbor_end_map(w);
+//      send(st_cbor_writer_data(w), st_cbor_writer_len(w));
+//
+// Allocation failures are sticky.  Once one occurs, further writes are
+// ignored and st_cbor_writer_data returns NULL.
+
+#include <canopy.h>
+#include <stddef.h>
+#include "arena/st_arena.h"
+
+typedef struct STCborWriter_t * STCborWriter;
+
+// Create a new, empty CBOR writer.  Returns NULL on allocation failure.
+STCborWriter st_cbor_writer_new();
+
+// Create a new, empty CBOR writer whose state and buffer are allocated from
+// <arena>.  The writer and its output live until the arena is reset.
+STCborWriter st_cbor_writer_new_in_arena(STArena arena);
+
+// Create a new, empty CBOR writer that writes into the caller's heap
+// buffer, like st_json_writer_new_in_place.
+STCborWriter st_cbor_writer_new_in_place(
+        STArena arena, 
+        void **buf, 
+        size_t *capacity, 
+        size_t headroom, 
+        size_t tailroom);
+
+// Free a CBOR writer and its buffer.  No-op for arena-backed writers.  The
+// buffer of an in-place writer is left to the caller.
+void st_cbor_writer_free(STCborWriter w);
+
+// Has an allocation failed since the writer was created?
+bool st_cbor_writer_failed(STCborWriter w);
+
+// Number of bytes written so far.
+size_t st_cbor_writer_len(STCborWriter w);
+
+// Borrow the bytes written so far.  Valid until the next write or free.
+// Returns NULL if an allocation failed.
+const uint8_t * st_cbor_writer_data(STCborWriter w);
+
+void st_cbor_begin_map(STCborWriter w);
+void st_cbor_end_map(STCborWriter w);
+void st_cbor_begin_array(STCborWriter w);
+void st_cbor_end_array(STCborWriter w);
+
+void st_cbor_null(STCborWriter w);
+void st_cbor_bool(STCborWriter w, bool value);
+void st_cbor_int(STCborWriter w, int64_t value);
+void st_cbor_uint(STCborWriter w, uint64_t value);
+void st_cbor_float32(STCborWriter w, float value);
+void st_cbor_float64(STCborWriter w, double value);
+
+// Write a UTF-8 text string.
+void st_cbor_string(STCborWriter w, const char *sz);
+void st_cbor_string_len(STCborWriter w, const char *s, size_t len);
+
+#endif // ST_CBOR_WRITER_INCLUDED
@@ -227,20 +227,47 @@ CanopyVarValue st_cloudvar_value_array(va_list ap)
 
 void st_cloudvar_value_free(CanopyVarValue value)
 {
-    /*switch (value->datatype)
+    RedHashIterator_t iter;
+    const void *key;
+    const void *hashValue;
+    size_t keySize;
+
+    if (!value)
+    {
+        return;
+    }
+
+    switch (value->datatype)
     {
-        case CANOPY_DATATYPE_FLOAT32:
-            free(value);
-            break;
         case CANOPY_DATATYPE_STRING:
-            free(value->val.val_string);
-            free(value);
+        {
+            free(value->basic_value.val.val_string);
+            break;
+        }
+        case CANOPY_DATATYPE_STRUCT:
+        {
+            RED_HASH_FOREACH(iter, value->struct_hash, &key, &keySize, &hashValue)
+            {
+                st_cloudvar_value_free((CanopyVarValue)hashValue);
+            }
+            RedHash_Free(value->struct_hash);
+            break;
+        }
+        case CANOPY_DATATYPE_ARRAY:
+        {
+            RED_HASH_FOREACH(iter, value->array_hash, &key, &keySize, &hashValue)
+            {
+                st_cloudvar_value_free((CanopyVarValue)hashValue);
+            }
+            RedHash_Free(value->array_hash);
             break;
+        }
         default:
-            assert(1);
+        {
             break;
-    }*/
-    assert(!"Not implemented");
+        }
+    }
+    free(value);
 }
 
 CanopyVarReader st_cloudvar_reader_bool(bool *dest)
@@ -435,10 +462,25 @@ const char * st_cloudvar_name(STCloudVar var)
     return sddl_var_name(var->decl);
 }
 
+uint32_t st_cloudvar_id(STCloudVar var)
+{
+    return var->id;
+}
+
+STCloudVarSystem st_cloudvar_system(STCloudVar var)
+{
+    return st_cloudvar_top_level(var)->sys;
+}
+
+STCloudVar st_cloudvar_top_level(STCloudVar var)
+{
+    return var->root ? var->root : var;
+}
+
 bool st_cloudvar_has_value(STCloudVar var)
 {
     // TODO: should this be recursive routine?
-    return (var->basic_value != NULL) || !(st_cloudvar_is_basic(var));
+    return var->has_value || !(st_cloudvar_is_basic(var));
 }
 
 typedef struct
@@ -453,6 +495,12 @@ CanopyResultEnum st_cloudvar_register_on_change_callback(STCloudVar var, CanopyO
 {
     _CallbackEntry_t * entry;
 
+    // Callbacks are looked up by top-level name.
+    if (!var->sys)
+    {
+        return CANOPY_ERROR_NOT_IMPLEMENTED;
+    }
+
     entry = calloc(1, sizeof(_CallbackEntry_t));
     if (!entry)
     {
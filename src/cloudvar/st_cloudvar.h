@@ -19,6 +19,10 @@
 #include <stdbool.h>
 #include "options/st_options.h"
 #include <red_json.h>
+#include "cbor/st_cbor_reader.h"
+#include "cbor/st_cbor_writer.h"
+#include "json/st_json_reader.h"
+#include "json/st_json_writer.h"
 
 typedef struct STCloudVar_t * STCloudVar;
 typedef struct STCloudVarSystem_t * STCloudVarSystem;
@@ -34,21 +38,49 @@ void st_cloudvar_system_free(STCloudVarSystem sys);
 // Does a local Cloud Variable exist?
 bool st_cloudvar_system_contains(STCloudVarSystem sys, const char *varname);
 
-// Lookup a local Cloud Variable by name
+// Lookup a local Cloud Variable by name.  <varname> may also be the path of
+// a struct member, such as "gps.latitude".
 STCloudVar st_cloudvar_system_lookup_var(STCloudVarSystem sys, const char *varname);
 
+// Give a new top-level Cloud Variable the next free numeric ID.  IDs are
+// dense, starting at 0, in initialization order.  They are used in place of
+// names by the CBOR payload format.
+CanopyResultEnum st_cloudvar_system_assign_id(STCloudVarSystem sys, STCloudVar var);
+
+// Lookup a local Cloud Variable by numeric ID.  Returns NULL if none.
+STCloudVar st_cloudvar_system_lookup_var_by_id(STCloudVarSystem sys, uint64_t id);
+
 // Have any Cloud Variables been touched since the last call to
-// st_cloudvar_system_clear_dirty?
+// st_cloudvar_system_mark_sent?
 bool st_cloudvar_system_is_dirty(STCloudVarSystem sys);
 
-// Clear system's dirty flag
-void st_cloudvar_system_clear_dirty(STCloudVarSystem sys);
+// Called once the dirty Cloud Variables have been put in an outbound
+// payload.  Clears the system's dirty flag and empties the dirty list, but
+// remembers what the payload carried (variables, SDDL, history samples and
+// packed array elements) until st_cloudvar_system_settle_sent.  Changes
+// made in the meantime make their variables dirty again as usual, and the
+// next payload only carries what is new.
+void st_cloudvar_system_mark_sent(STCloudVarSystem sys);
+
+// Called once the payloads since the last call have either been written
+// (<written> true), in which case what they carried is forgotten, or lost,
+// in which case it is all marked dirty again to be sent with the next sync.
+void st_cloudvar_system_settle_sent(STCloudVarSystem sys, bool written);
 
 // Get number of dirty Cloud Variables
 uint32_t st_cloudvar_system_num_dirty(STCloudVarSystem sys);
 
-// Access a particular dirty Cloud Variable by index.
-STCloudVar st_cloudvar_system_dirty_var(STCloudVarSystem sys, uint32_t idx);
+// Iterate over the dirty Cloud Variables, in the order they were first
+// touched since the last call to st_cloudvar_system_mark_sent:
+//
+//      for (var = st_cloudvar_system_first_dirty(sys); 
+//              var; 
+//              var = st_cloudvar_next_dirty(var))
+//      {
+//          ...
+//      }
+STCloudVar st_cloudvar_system_first_dirty(STCloudVarSystem sys);
+STCloudVar st_cloudvar_next_dirty(STCloudVar var);
 
 // Register a callback that gets triggered when a cloud variable's value
 // changes.
@@ -59,15 +91,40 @@ CanopyResultEnum st_cloudvar_register_on_change_callback(STCloudVar var, CanopyO
 // be used again)
 CanopyResultEnum st_cloudvar_set_var(STCloudVar var, CanopyVarValue value);
 
+// Set a basic Cloud Variable's value directly from a C value.  Does not
+// allocate, except when a string variable's buffer has to grow.  Fails with
+// CANOPY_ERROR_INCORRECT_DATATYPE if <var> has a different datatype.
+CanopyResultEnum st_cloudvar_set_bool(STCloudVar var, bool x);
+CanopyResultEnum st_cloudvar_set_int8(STCloudVar var, int8_t x);
+CanopyResultEnum st_cloudvar_set_uint8(STCloudVar var, uint8_t x);
+CanopyResultEnum st_cloudvar_set_int16(STCloudVar var, int16_t x);
+CanopyResultEnum st_cloudvar_set_uint16(STCloudVar var, uint16_t x);
+CanopyResultEnum st_cloudvar_set_int32(STCloudVar var, int32_t x);
+CanopyResultEnum st_cloudvar_set_uint32(STCloudVar var, uint32_t x);
+CanopyResultEnum st_cloudvar_set_float32(STCloudVar var, float x);
+CanopyResultEnum st_cloudvar_set_float64(STCloudVar var, double x);
+CanopyResultEnum st_cloudvar_set_string(STCloudVar var, const char *sz);
+
+// Same as the typed setters above, with the datatype and value taken from
+// <update>.
+CanopyResultEnum st_cloudvar_set_update(const CanopyVarUpdate *update);
+
 // Get Cloud Variable's value using reader.
 CanopyResultEnum st_cloudvar_read_var(STCloudVar var, CanopyVarReader dest);
 
-// Update Cloud Variable's value from JSON.
-CanopyResultEnum st_cloudvar_update_from_json(STCloudVar var, RedJsonValue json);
+// Update Cloud Variable's value from the next JSON value in <r>.
+CanopyResultEnum st_cloudvar_update_from_json(STCloudVar var, STJsonReader r);
 
 CanopyResultEnum st_cloudvar_set_local_value_from_json(STCloudVarSystem vars, const char *varname, RedJsonValue value);
 
-CanopyResultEnum st_cloudvar_value_to_json(RedJsonValue *out, STCloudVar var);
+// Update Cloud Variable's value from the next CBOR data item in <r>.
+CanopyResultEnum st_cloudvar_update_from_cbor(STCloudVar var, STCborReader r);
+
+// Append Cloud Variable's value to a JSON payload being written.
+CanopyResultEnum st_cloudvar_value_write_json(STJsonWriter w, STCloudVar var);
+
+// Append Cloud Variable's value to a CBOR payload being written.
+CanopyResultEnum st_cloudvar_value_write_cbor(STCborWriter w, STCloudVar var);
 
 CanopyVarValue st_cloudvar_value_bool(bool x);
 CanopyVarValue st_cloudvar_value_int8(int8_t x);
@@ -103,6 +160,16 @@ void st_cloudvar_reader_free(CanopyVarReader value);
 
 float st_cloudvar_local_value_float32(STCloudVar var);
 const char * st_cloudvar_name(STCloudVar var);
+uint32_t st_cloudvar_id(STCloudVar var);
+
+// System a Cloud Variable belongs to.  For a struct member, that's the
+// system of the top-level struct it belongs to.
+STCloudVarSystem st_cloudvar_system(STCloudVar var);
+
+// Top-level Cloud Variable that <var> belongs to: <var> itself, or for a
+// struct member, the top-level struct.  This is what gets marked dirty when
+// <var> changes.
+STCloudVar st_cloudvar_top_level(STCloudVar var);
 bool st_cloudvar_has_value(STCloudVar var);
 
 bool st_cloudvar_value_already_used(CanopyVarValue value);
@@ -126,6 +193,59 @@ CanopyDirectionEnum st_cloudvar_concrete_direction(STCloudVar var);
 
 void st_cloudvar_system_mark_dirty(STCloudVarSystem sys, STCloudVar var);
 
+// Called after a local set changes a top-level basic Cloud Variable (that
+// is, whenever the set passes the variable's change filter).  Changes
+// received from the server don't trigger it.
+typedef void (*STCloudVarChangeHook)(STCloudVar var, void *userdata);
+
+// Install <hook>, replacing any previous one.  Pass NULL to remove it.
+void st_cloudvar_system_set_change_hook(STCloudVarSystem sys, STCloudVarChangeHook hook, void *userdata);
+
+// Trigger the system's change hook for <var>.
+void st_cloudvar_system_notify_change(STCloudVarSystem sys, STCloudVar var);
+
+// Timestamp changes made from now on with <timeMs> (wall-clock
+// milliseconds) instead of the current time, for applying changes that were
+// queued earlier.  Pass 0 to go back to the current time.
+void st_cloudvar_system_set_sample_time(STCloudVarSystem sys, uint64_t timeMs);
+
+// Timestamp for a change made now.
+uint64_t st_cloudvar_system_sample_time(STCloudVarSystem sys);
+
+// Can a basic Cloud Variable of <datatype> keep a history?
+bool st_cloudvar_history_supported(CanopyDatatypeEnum datatype);
+
+// Allocate room for <capacity> samples of history.  Does nothing if
+// <capacity> is 0.
+CanopyResultEnum st_cloudvar_history_init(STCloudVar var, uint32_t capacity);
+
+// Append the basic Cloud Variable's current value to its history,
+// timestamped now.  If the history is full, the oldest sample is dropped.
+void st_cloudvar_history_record(STCloudVar var);
+
+// Number of samples in the history that haven't been put in a payload yet.
+uint32_t st_cloudvar_history_count(STCloudVar var);
+
+// Remove the samples put in a payload from the history, once it has been
+// written (<written> true).  Otherwise keep them, to be sent again.
+void st_cloudvar_history_settle_sent(STCloudVar var, bool written);
+
+// Append the samples that haven't been put in a payload yet to a payload
+// being written, as {"t" : [<ms since epoch>, ...], "v" : [<value>, ...]},
+// oldest first.
+CanopyResultEnum st_cloudvar_history_write_json(STJsonWriter w, STCloudVar var);
+CanopyResultEnum st_cloudvar_history_write_cbor(STCborWriter w, STCloudVar var);
+
+// Size of a value of <datatype> stored packed, at its native C size (the
+// leading bytes of STCloudVarBasicValue_t.val).  0 for datatypes that can't
+// be packed, such as strings.
+size_t st_cloudvar_basic_packed_size(CanopyDatatypeEnum datatype);
+
+// Get a bool, integer or float basic Cloud Variable's current value.  Float
+// variables store it in <*floatOut>, the others in <*intOut> (bools as 0 or
+// 1).  Returns false for other datatypes, or if the variable has no value.
+bool st_cloudvar_basic_number(STCloudVar var, int64_t *intOut, double *floatOut);
+
 CanopyDatatypeEnum st_cloudvar_datatype(STCloudVar var);
 
 CanopyResultEnum st_cloudvar_basic_new(
@@ -146,24 +266,73 @@ void st_cloudvar_clear_sddl_dirty_flag(STCloudVar var);
 bool st_cloudvar_is_sddl_dirty(STCloudVar var);
 
 CanopyResultEnum st_cloudvar_basic_set(STCloudVar var, CanopyVarValue value);
-CanopyResultEnum st_cloudvar_basic_update_from_json(STCloudVar var, RedJsonValue json);
+CanopyResultEnum st_cloudvar_basic_update_from_json(STCloudVar var, STJsonReader r);
 
 CanopyResultEnum st_cloudvar_array_set(STCloudVar var, CanopyVarValue value);
 
+// Copy <n> elements of a numeric array between the array and the C array
+// <buf>, starting at element <offset>.  <datatype> must be the array's
+// element datatype.  Setting marks the array dirty; getting fails with
+// CANOPY_ERROR_VARIABLE_NOT_SET if any of the elements has never been set.
+CanopyResultEnum st_cloudvar_array_set_range(
+        STCloudVar var, 
+        CanopyDatatypeEnum datatype, 
+        const void *buf, 
+        size_t offset, 
+        size_t n);
+CanopyResultEnum st_cloudvar_array_get_range(
+        STCloudVar var, 
+        CanopyDatatypeEnum datatype, 
+        void *buf, 
+        size_t offset, 
+        size_t n);
+
+// The elements of a packed array set since the last sync have been put in a
+// payload.  They are no longer dirty, but are remembered until
+// st_cloudvar_array_settle_sent_items.
+void st_cloudvar_array_mark_sent_items(STCloudVar var);
+
+// Forget the elements put in a payload once it has been written (<written>
+// true).  Otherwise mark them dirty again.
+void st_cloudvar_array_settle_sent_items(STCloudVar var, bool written);
+
 bool st_cloudvar_is_basic(STCloudVar var);
 
-CanopyResultEnum st_cloudvar_array_value_to_json(RedJsonValue *out, STCloudVar var);
-CanopyResultEnum st_cloudvar_basic_value_to_json(RedJsonValue *out, STCloudVar var);
+CanopyResultEnum st_cloudvar_array_write_json(STJsonWriter w, STCloudVar var);
+CanopyResultEnum st_cloudvar_array_write_cbor(STCborWriter w, STCloudVar var);
+CanopyResultEnum st_cloudvar_basic_write_json(STJsonWriter w, STCloudVar var);
+CanopyResultEnum st_cloudvar_basic_write_cbor(STCborWriter w, STCloudVar var);
+CanopyResultEnum st_cloudvar_basic_update_from_cbor(STCloudVar var, STCborReader r);
 
 CanopyResultEnum st_cloudvar_basic_read_var(STCloudVar var, CanopyVarReader reader);
 CanopyResultEnum st_cloudvar_array_read_var(STCloudVar var, CanopyVarReader reader);
 
-CanopyResultEnum st_cloudvar_struct_value_to_json(RedJsonValue *out, STCloudVar var);
+CanopyResultEnum st_cloudvar_struct_write_json(STJsonWriter w, STCloudVar var);
+CanopyResultEnum st_cloudvar_struct_write_cbor(STCborWriter w, STCloudVar var);
 CanopyResultEnum st_cloudvar_struct_new(STCloudVar *out, STCloudVarInitOptions options);
 CanopyResultEnum st_cloudvar_struct_validate_value(STCloudVar var, CanopyVarValue value);
 CanopyResultEnum st_cloudvar_struct_set(STCloudVar var, CanopyVarValue value);
 CanopyResultEnum st_cloudvar_struct_read_var(STCloudVar var, CanopyVarReader reader);
 
+// Point every member of the top-level struct <var>, at any depth, back at
+// <var>, so that setting a member marks <var> dirty.
+void st_cloudvar_struct_set_root(STCloudVar var);
+
+// Member of struct <var> at <path> (such as "fix.quality"), or NULL.
+STCloudVar st_cloudvar_struct_member(STCloudVar var, const char *path);
+
+// Bind a C struct layout to struct <var>.  See canopy_var_bind_struct.
+CanopyResultEnum st_cloudvar_struct_bind(
+        STCloudVar var, 
+        const CanopyStructField *fields, 
+        size_t numFields);
+
+// Set struct <var>'s bound members from the C struct at <src>, or copy them
+// out to the C struct at <dest>.  See canopy_var_set_struct and
+// canopy_var_get_struct.
+CanopyResultEnum st_cloudvar_struct_set_bound(STCloudVar var, const void *src);
+CanopyResultEnum st_cloudvar_struct_get_bound(STCloudVar var, void *dest);
+
 CanopyResultEnum st_cloudvar_tuple_value_to_json(RedJsonValue *out, STCloudVar var);
 CanopyResultEnum st_cloudvar_tuple_new(STCloudVar *out, STCloudVarInitOptions options);
 CanopyResultEnum st_cloudvar_tuple_validate_value(STCloudVar var, CanopyVarValue value);
@@ -16,33 +16,219 @@
 #include "cloudvar/st_cloudvar_internal.h"
 #include "red_string.h"
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
-// Convert array cloud variable's value to JSON, recursively
-CanopyResultEnum st_cloudvar_array_value_to_json(RedJsonValue *out, STCloudVar var)
+// Arrays of fixed-size basic datatypes (numbers and bools) are "packed":
+// rather than a child STCloudVar per element, the array holds one buffer of
+// element values at their native size, plus a bitmap of which elements have
+// been set.  A float32[4096] is then a 16KB buffer and a 512-byte bitmap,
+// and writing it out or copying it in is a linear scan.
+//
+// Arrays of other datatypes (strings, structs) still have a child STCloudVar
+// per element, in <array_items>.
+//
+// Packed arrays also track which elements were set since the last sync, and
+// only those are written to outbound payloads, so changing a few channels
+// of a large array doesn't resend all of it.  Once a payload carries them,
+// st_cloudvar_system_mark_sent moves the dirty bits to the sent bits, which
+// st_cloudvar_system_settle_sent then clears, or moves back if the payload
+// was lost.  Both cover top-level arrays and arrays that are struct members.
+
+#define _BITS_PER_WORD 32
+
+static bool _is_packed(STCloudVar var)
 {
-    RedJsonObject jsonObj = RedJsonObject_New();
-    unsigned i;
-    for (i = 0; i < var->array_num_items; i++)
+    return var->array_data != NULL;
+}
+
+static bool _item_is_set(STCloudVar var, size_t i)
+{
+    return (var->array_set_bits[i / _BITS_PER_WORD] >> (i % _BITS_PER_WORD)) & 1;
+}
+
+// Mark elements <first> through <first> + <n> - 1 as set and dirty.
+static void _mark_items_set(STCloudVar var, size_t first, size_t n)
+{
+    size_t i = first, end = first + n;
+    uint32_t mask;
+
+    // Whole words at a time where possible.
+    while (i < end)
     {
-        CanopyResultEnum result;
-        RedJsonValue childValueJson;
-        if (st_cloudvar_has_value(var->array_items[i]))
+        if (i % _BITS_PER_WORD == 0 && end - i >= _BITS_PER_WORD)
+        {
+            mask = 0xffffffff;
+        }
+        else
         {
-            result = st_cloudvar_value_to_json(&childValueJson, var->array_items[i]);
-            if (result != CANOPY_SUCCESS)
+            mask = (uint32_t)1 << (i % _BITS_PER_WORD);
+        }
+        var->array_set_bits[i / _BITS_PER_WORD] |= mask;
+        var->array_dirty_bits[i / _BITS_PER_WORD] |= mask;
+        i += (mask == 0xffffffff) ? _BITS_PER_WORD : 1;
+    }
+}
+
+// Index of the first dirty element at or after <i>, or array_num_items if
+// there are none.  Skips clean words 32 elements at a time.
+static size_t _next_dirty_item(STCloudVar var, size_t i)
+{
+    uint32_t bits;
+    while (i < var->array_num_items)
+    {
+        bits = var->array_dirty_bits[i / _BITS_PER_WORD] >> (i % _BITS_PER_WORD);
+        if (bits)
+        {
+            return i + __builtin_ctz(bits);
+        }
+        i = (i / _BITS_PER_WORD + 1) * _BITS_PER_WORD;
+    }
+    return var->array_num_items;
+}
+
+// Iterate over the packed array's elements that were set since the last
+// sync.
+#define _FOREACH_DIRTY_ITEM(var, i) \
+    for ((i) = _next_dirty_item((var), 0); \
+            (i) < (var)->array_num_items; \
+            (i) = _next_dirty_item((var), (i) + 1))
+
+// Write array cloud variable's value as JSON.  Arrays are sent as an object
+// keyed by element index, containing only the elements that have a value
+// (for packed arrays, only those set since the last sync).
+CanopyResultEnum st_cloudvar_array_write_json(STJsonWriter w, STCloudVar var)
+{
+    const void *data = var->array_data;
+    size_t i;
+
+    st_json_begin_object(w);
+    if (!_is_packed(var))
+    {
+        for (i = 0; i < var->array_num_items; i++)
+        {
+            CanopyResultEnum result;
+            if (st_cloudvar_has_value(var->array_items[i]))
             {
-                return result;
+                st_json_key_uint(w, i);
+                result = st_cloudvar_value_write_json(w, var->array_items[i]);
+                if (result != CANOPY_SUCCESS)
+                {
+                    return result;
+                }
             }
-            char *key = RedString_PrintfToNewChars("%d", i);
-            if (!key)
+        }
+        st_json_end_object(w);
+        return CANOPY_SUCCESS;
+    }
+
+    switch (var->array_datatype)
+    {
+        case CANOPY_DATATYPE_BOOL:
+            _FOREACH_DIRTY_ITEM(var, i) { st_json_key_uint(w, i); st_json_bool(w, ((const bool *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_FLOAT32:
+            _FOREACH_DIRTY_ITEM(var, i) { st_json_key_uint(w, i); st_json_float32(w, ((const float *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_FLOAT64:
+            _FOREACH_DIRTY_ITEM(var, i) { st_json_key_uint(w, i); st_json_float64(w, ((const double *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_INT8:
+            _FOREACH_DIRTY_ITEM(var, i) { st_json_key_uint(w, i); st_json_int(w, ((const int8_t *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_INT16:
+            _FOREACH_DIRTY_ITEM(var, i) { st_json_key_uint(w, i); st_json_int(w, ((const int16_t *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_INT32:
+            _FOREACH_DIRTY_ITEM(var, i) { st_json_key_uint(w, i); st_json_int(w, ((const int32_t *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_UINT8:
+            _FOREACH_DIRTY_ITEM(var, i) { st_json_key_uint(w, i); st_json_uint(w, ((const uint8_t *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_UINT16:
+            _FOREACH_DIRTY_ITEM(var, i) { st_json_key_uint(w, i); st_json_uint(w, ((const uint16_t *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_UINT32:
+            _FOREACH_DIRTY_ITEM(var, i) { st_json_key_uint(w, i); st_json_uint(w, ((const uint32_t *)data)[i]); }
+            break;
+        default:
+            return CANOPY_ERROR_UNKNOWN;
+    }
+    st_json_end_object(w);
+    if (st_json_writer_failed(w))
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+
+    return CANOPY_SUCCESS;
+}
+
+// Write array cloud variable's value as CBOR: a map from element index to
+// value, containing only the elements that have a value (for packed arrays,
+// only those set since the last sync).
+CanopyResultEnum st_cloudvar_array_write_cbor(STCborWriter w, STCloudVar var)
+{
+    const void *data = var->array_data;
+    size_t i;
+
+    st_cbor_begin_map(w);
+    if (!_is_packed(var))
+    {
+        for (i = 0; i < var->array_num_items; i++)
+        {
+            CanopyResultEnum result;
+            if (st_cloudvar_has_value(var->array_items[i]))
             {
-                return CANOPY_ERROR_OUT_OF_MEMORY;
+                st_cbor_uint(w, i);
+                result = st_cloudvar_value_write_cbor(w, var->array_items[i]);
+                if (result != CANOPY_SUCCESS)
+                {
+                    return result;
+                }
             }
-            RedJsonObject_Set(jsonObj, key, childValueJson);
         }
+        st_cbor_end_map(w);
+        return CANOPY_SUCCESS;
+    }
+
+    switch (var->array_datatype)
+    {
+        case CANOPY_DATATYPE_BOOL:
+            _FOREACH_DIRTY_ITEM(var, i) { st_cbor_uint(w, i); st_cbor_bool(w, ((const bool *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_FLOAT32:
+            _FOREACH_DIRTY_ITEM(var, i) { st_cbor_uint(w, i); st_cbor_float32(w, ((const float *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_FLOAT64:
+            _FOREACH_DIRTY_ITEM(var, i) { st_cbor_uint(w, i); st_cbor_float64(w, ((const double *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_INT8:
+            _FOREACH_DIRTY_ITEM(var, i) { st_cbor_uint(w, i); st_cbor_int(w, ((const int8_t *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_INT16:
+            _FOREACH_DIRTY_ITEM(var, i) { st_cbor_uint(w, i); st_cbor_int(w, ((const int16_t *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_INT32:
+            _FOREACH_DIRTY_ITEM(var, i) { st_cbor_uint(w, i); st_cbor_int(w, ((const int32_t *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_UINT8:
+            _FOREACH_DIRTY_ITEM(var, i) { st_cbor_uint(w, i); st_cbor_uint(w, ((const uint8_t *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_UINT16:
+            _FOREACH_DIRTY_ITEM(var, i) { st_cbor_uint(w, i); st_cbor_uint(w, ((const uint16_t *)data)[i]); }
+            break;
+        case CANOPY_DATATYPE_UINT32:
+            _FOREACH_DIRTY_ITEM(var, i) { st_cbor_uint(w, i); st_cbor_uint(w, ((const uint32_t *)data)[i]); }
+            break;
+        default:
+            return CANOPY_ERROR_UNKNOWN;
+    }
+    st_cbor_end_map(w);
+    if (st_cbor_writer_failed(w))
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
     }
 
-    *out = RedJsonValue_FromObject(jsonObj);
     return CANOPY_SUCCESS;
 }
 
@@ -54,7 +240,7 @@ CanopyResultEnum st_cloudvar_array_new(
         STCloudVarInitOptions options)
 {
     STCloudVar var;
-    size_t i;
+    size_t i, numWords;
 
     // Create STCloudVar object for array itself
     var = calloc(1, sizeof(STCloudVar_t));
@@ -64,6 +250,7 @@ CanopyResultEnum st_cloudvar_array_new(
     }
     // TODO: validate numItems
     var->array_num_items = options->array_num_items;
+    var->array_datatype = (CanopyDatatypeEnum)options->array_datatype;
 
     // Create SDDL declaration
     var->decl = sddl_var_new_array(
@@ -76,8 +263,37 @@ CanopyResultEnum st_cloudvar_array_new(
         return CANOPY_ERROR_UNKNOWN;
     }
 
+    // Packed storage, if the element datatype allows it.
+    var->array_item_size = st_cloudvar_basic_packed_size(var->array_datatype);
+    if (var->array_item_size)
+    {
+        numWords = (var->array_num_items + _BITS_PER_WORD - 1) / _BITS_PER_WORD;
+        var->array_data = calloc(var->array_num_items ? var->array_num_items : 1, 
+                var->array_item_size);
+        var->array_set_bits = calloc(numWords ? numWords : 1, sizeof(uint32_t));
+        var->array_dirty_bits = calloc(numWords ? numWords : 1, sizeof(uint32_t));
+        var->array_sent_bits = calloc(numWords ? numWords : 1, sizeof(uint32_t));
+        if (!var->array_data || !var->array_set_bits || !var->array_dirty_bits || 
+                !var->array_sent_bits)
+        {
+            free(var->array_data);
+            free(var->array_set_bits);
+            free(var->array_dirty_bits);
+            free(var->array_sent_bits);
+            free(var);
+            return CANOPY_ERROR_OUT_OF_MEMORY;
+        }
+        *out = var;
+        return CANOPY_SUCCESS;
+    }
+
     // Create child STCloudVar objects for each array element
     var->array_items = calloc(var->array_num_items, sizeof(STCloudVar));
+    if (!var->array_items && var->array_num_items)
+    {
+        free(var);
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
     for (i = 0; i < var->array_num_items; i++)
     {
         CanopyResultEnum result;
@@ -148,6 +364,17 @@ CanopyResultEnum st_cloudvar_array_set(STCloudVar var, CanopyVarValue value)
         }
 
         // Assign value
+        if (_is_packed(var))
+        {
+            if (elementValue->datatype != var->array_datatype)
+            {
+                return CANOPY_ERROR_INCORRECT_DATATYPE;
+            }
+            memcpy(&var->array_data[idx * var->array_item_size], 
+                    &elementValue->basic_value.val, var->array_item_size);
+            _mark_items_set(var, idx, 1);
+            continue;
+        }
         result = st_cloudvar_generic_set(var->array_items[idx], elementValue);
         if (result != CANOPY_SUCCESS)
         {
@@ -158,6 +385,34 @@ CanopyResultEnum st_cloudvar_array_set(STCloudVar var, CanopyVarValue value)
     return CANOPY_SUCCESS;
 }
 
+// Read packed element <idx> through <reader>.
+static CanopyResultEnum _read_packed_item(STCloudVar var, size_t idx, CanopyVarReader reader)
+{
+    const void *data = var->array_data;
+    if (reader->datatype != var->array_datatype)
+    {
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
+    }
+    if (!_item_is_set(var, idx))
+    {
+        return CANOPY_ERROR_VARIABLE_NOT_SET;
+    }
+    switch (var->array_datatype)
+    {
+        case CANOPY_DATATYPE_BOOL: *reader->dest.dest_bool = ((const bool *)data)[idx]; break;
+        case CANOPY_DATATYPE_FLOAT32: *reader->dest.dest_float32 = ((const float *)data)[idx]; break;
+        case CANOPY_DATATYPE_FLOAT64: *reader->dest.dest_float64 = ((const double *)data)[idx]; break;
+        case CANOPY_DATATYPE_INT8: *reader->dest.dest_int8 = ((const int8_t *)data)[idx]; break;
+        case CANOPY_DATATYPE_INT16: *reader->dest.dest_int16 = ((const int16_t *)data)[idx]; break;
+        case CANOPY_DATATYPE_INT32: *reader->dest.dest_int32 = ((const int32_t *)data)[idx]; break;
+        case CANOPY_DATATYPE_UINT8: *reader->dest.dest_uint8 = ((const uint8_t *)data)[idx]; break;
+        case CANOPY_DATATYPE_UINT16: *reader->dest.dest_uint16 = ((const uint16_t *)data)[idx]; break;
+        case CANOPY_DATATYPE_UINT32: *reader->dest.dest_uint32 = ((const uint32_t *)data)[idx]; break;
+        default: return CANOPY_ERROR_UNKNOWN;
+    }
+    return CANOPY_SUCCESS;
+}
+
 // Gets an array cloud variable's value
 CanopyResultEnum st_cloudvar_array_read_var(STCloudVar var, CanopyVarReader reader)
 {
@@ -194,7 +449,14 @@ CanopyResultEnum st_cloudvar_array_read_var(STCloudVar var, CanopyVarReader read
         }
 
         // Assign value
-        result = st_cloudvar_read_var(var->array_items[idx], elementReader);
+        if (_is_packed(var))
+        {
+            result = _read_packed_item(var, idx, elementReader);
+        }
+        else
+        {
+            result = st_cloudvar_read_var(var->array_items[idx], elementReader);
+        }
         if (result != CANOPY_SUCCESS)
         {
             return result;
@@ -203,3 +465,109 @@ CanopyResultEnum st_cloudvar_array_read_var(STCloudVar var, CanopyVarReader read
 
     return CANOPY_SUCCESS;
 }
+
+// Checks that elements <offset> through <offset> + <n> - 1 of <var> exist and
+// have datatype <datatype>.
+static CanopyResultEnum _check_range(
+        STCloudVar var, 
+        CanopyDatatypeEnum datatype, 
+        size_t offset, 
+        size_t n)
+{
+    if (st_cloudvar_datatype(var) != CANOPY_DATATYPE_ARRAY)
+    {
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
+    }
+    if (var->array_datatype != datatype || !_is_packed(var))
+    {
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
+    }
+    if (n > var->array_num_items || offset > var->array_num_items - n)
+    {
+        return CANOPY_ERROR_ARRAY_INDEX_OUT_OF_BOUNDS;
+    }
+    return CANOPY_SUCCESS;
+}
+
+CanopyResultEnum st_cloudvar_array_set_range(
+        STCloudVar var, 
+        CanopyDatatypeEnum datatype, 
+        const void *buf, 
+        size_t offset, 
+        size_t n)
+{
+    CanopyResultEnum result;
+
+    result = _check_range(var, datatype, offset, n);
+    if (result != CANOPY_SUCCESS)
+    {
+        return result;
+    }
+    if (st_cloudvar_concrete_direction(var) == CANOPY_DIRECTION_IN)
+    {
+        return CANOPY_ERROR_CANNOT_MODIFY_INPUT_VARIABLE;
+    }
+
+    memcpy(&var->array_data[offset * var->array_item_size], buf, n * var->array_item_size);
+    _mark_items_set(var, offset, n);
+
+    if (st_cloudvar_system(var) && n > 0)
+    {
+        st_cloudvar_system_mark_dirty(st_cloudvar_system(var), st_cloudvar_top_level(var));
+    }
+    return CANOPY_SUCCESS;
+}
+
+CanopyResultEnum st_cloudvar_array_get_range(
+        STCloudVar var, 
+        CanopyDatatypeEnum datatype, 
+        void *buf, 
+        size_t offset, 
+        size_t n)
+{
+    CanopyResultEnum result;
+    size_t i;
+
+    result = _check_range(var, datatype, offset, n);
+    if (result != CANOPY_SUCCESS)
+    {
+        return result;
+    }
+    for (i = offset; i < offset + n; i++)
+    {
+        if (!_item_is_set(var, i))
+        {
+            return CANOPY_ERROR_VARIABLE_NOT_SET;
+        }
+    }
+
+    memcpy(buf, &var->array_data[offset * var->array_item_size], n * var->array_item_size);
+    return CANOPY_SUCCESS;
+}
+
+void st_cloudvar_array_mark_sent_items(STCloudVar var)
+{
+    size_t numWords = (var->array_num_items + _BITS_PER_WORD - 1) / _BITS_PER_WORD;
+    size_t i;
+
+    for (i = 0; i < numWords; i++)
+    {
+        var->array_sent_bits[i] |= var->array_dirty_bits[i];
+        var->array_dirty_bits[i] = 0;
+    }
+}
+
+void st_cloudvar_array_settle_sent_items(STCloudVar var, bool written)
+{
+    size_t numWords = (var->array_num_items + _BITS_PER_WORD - 1) / _BITS_PER_WORD;
+    size_t i;
+
+    for (i = 0; i < numWords; i++)
+    {
+        if (!written)
+        {
+            var->array_dirty_bits[i] |= var->array_sent_bits[i];
+        }
+        var->array_sent_bits[i] = 0;
+    }
+}
@@ -16,53 +16,53 @@
 #include "cloudvar/st_cloudvar_internal.h"
 #include "red_string.h"
 #include <assert.h>
+#include <math.h>
 
 
-// Convert basic cloud variable's value to JSON
-CanopyResultEnum st_cloudvar_basic_value_to_json(RedJsonValue *out, STCloudVar var)
+// Write basic cloud variable's value as JSON
+CanopyResultEnum st_cloudvar_basic_write_json(STJsonWriter w, STCloudVar var)
 {
     CanopyDatatypeEnum datatype = st_cloudvar_datatype(var);
-    *out = NULL;
     switch (datatype)
     {
         case CANOPY_DATATYPE_VOID:
-            *out = RedJsonValue_Null();
+            st_json_null(w);
             break;
         case CANOPY_DATATYPE_BOOL:
-            *out = RedJsonValue_FromBoolean(var->basic_value->val.val_bool);
+            st_json_bool(w, var->basic_value.val.val_bool);
             break;
         case CANOPY_DATATYPE_FLOAT32:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_float32);
+            st_json_float32(w, var->basic_value.val.val_float32);
             break;
         case CANOPY_DATATYPE_FLOAT64:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_float64);
+            st_json_float64(w, var->basic_value.val.val_float64);
             break;
         case CANOPY_DATATYPE_INT8:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_int8);
+            st_json_int(w, var->basic_value.val.val_int8);
             break;
         case CANOPY_DATATYPE_INT16:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_int16);
+            st_json_int(w, var->basic_value.val.val_int16);
             break;
         case CANOPY_DATATYPE_INT32:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_int32);
+            st_json_int(w, var->basic_value.val.val_int32);
             break;
         case CANOPY_DATATYPE_STRING:
-            *out = RedJsonValue_FromString(var->basic_value->val.val_string);
+            st_json_string(w, var->basic_value.val.val_string);
             break;
         case CANOPY_DATATYPE_UINT8:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_uint8);
+            st_json_uint(w, var->basic_value.val.val_uint8);
             break;
         case CANOPY_DATATYPE_UINT16:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_uint16);
+            st_json_uint(w, var->basic_value.val.val_uint16);
             break;
         case CANOPY_DATATYPE_UINT32:
-            *out = RedJsonValue_FromNumber(var->basic_value->val.val_uint32);
+            st_json_uint(w, var->basic_value.val.val_uint32);
             break;
         default:
             return CANOPY_ERROR_UNKNOWN;
             break;
     }
-    if (*out == NULL)
+    if (st_json_writer_failed(w))
     {
         return CANOPY_ERROR_OUT_OF_MEMORY;
     }
@@ -70,79 +70,361 @@ CanopyResultEnum st_cloudvar_basic_value_to_json(RedJsonValue *out, STCloudVar v
     return CANOPY_SUCCESS;
 }
 
+// Make sure a string variable's buffer holds at least <size> bytes.
+static CanopyResultEnum _reserve_string(STCloudVar var, size_t size)
+{
+    if (size > var->string_capacity)
+    {
+        size_t newCapacity = var->string_capacity ? var->string_capacity : 16;
+        char *newBuf;
+        while (newCapacity < size)
+        {
+            newCapacity *= 2;
+        }
+        newBuf = realloc(var->basic_value.val.val_string, newCapacity);
+        if (!newBuf)
+        {
+            return CANOPY_ERROR_OUT_OF_MEMORY;
+        }
+        var->basic_value.val.val_string = newBuf;
+        var->string_capacity = newCapacity;
+    }
+    return CANOPY_SUCCESS;
+}
+
+// Copy the <len> bytes at <s> into a string cloud variable's value buffer,
+// NUL-terminating them.
+// The buffer is kept between updates and only grows (geometrically) when
+// the string doesn't fit, so a long-running device settles into doing no
+// allocations here.
+static CanopyResultEnum _store_string_len(STCloudVar var, const char *s, size_t len)
+{
+    CanopyResultEnum result = _reserve_string(var, len + 1);
+    if (result != CANOPY_SUCCESS)
+    {
+        return result;
+    }
+    memcpy(var->basic_value.val.val_string, s, len);
+    var->basic_value.val.val_string[len] = '\0';
+    var->has_value = true;
+    return CANOPY_SUCCESS;
+}
+
+static CanopyResultEnum _store_string(STCloudVar var, const char *sz)
+{
+    return _store_string_len(var, sz, strlen(sz));
+}
+
+// Store <newVal> as a basic cloud variable's value.
+// Strings are copied into the variable's own buffer; <newVal> keeps ownership
+// of whatever it points to.
+static CanopyResultEnum _store_basic_value(STCloudVar var, const STCloudVarBasicValue_t *newVal)
+{
+    if (st_cloudvar_datatype(var) == CANOPY_DATATYPE_STRING)
+    {
+        return _store_string(var, newVal->val.val_string);
+    }
+    var->basic_value = *newVal;
+    var->has_value = true;
+    return CANOPY_SUCCESS;
+}
+
+// Convert a numeric basic value to a double, for deadband comparisons.
+// Returns false for datatypes that aren't numeric.
+static bool _basic_value_as_double(
+        CanopyDatatypeEnum datatype, 
+        const STCloudVarBasicValue_t *value, 
+        double *out)
+{
+    switch (datatype)
+    {
+        case CANOPY_DATATYPE_FLOAT32: *out = value->val.val_float32; return true;
+        case CANOPY_DATATYPE_FLOAT64: *out = value->val.val_float64; return true;
+        case CANOPY_DATATYPE_INT8: *out = value->val.val_int8; return true;
+        case CANOPY_DATATYPE_INT16: *out = value->val.val_int16; return true;
+        case CANOPY_DATATYPE_INT32: *out = value->val.val_int32; return true;
+        case CANOPY_DATATYPE_UINT8: *out = value->val.val_uint8; return true;
+        case CANOPY_DATATYPE_UINT16: *out = value->val.val_uint16; return true;
+        case CANOPY_DATATYPE_UINT32: *out = value->val.val_uint32; return true;
+        default: return false;
+    }
+}
+
+// Is <newVal> equal to the basic cloud variable's current value?
+static bool _basic_value_equals(STCloudVar var, const STCloudVarBasicValue_t *newVal)
+{
+    const STCloudVarBasicValue_t *cur = &var->basic_value;
+    switch (st_cloudvar_datatype(var))
+    {
+        case CANOPY_DATATYPE_VOID:
+            return true;
+        case CANOPY_DATATYPE_BOOL:
+            return cur->val.val_bool == newVal->val.val_bool;
+        case CANOPY_DATATYPE_STRING:
+            return !strcmp(cur->val.val_string, newVal->val.val_string);
+        case CANOPY_DATATYPE_FLOAT32:
+            return cur->val.val_float32 == newVal->val.val_float32;
+        case CANOPY_DATATYPE_FLOAT64:
+            return cur->val.val_float64 == newVal->val.val_float64;
+        case CANOPY_DATATYPE_INT8:
+            return cur->val.val_int8 == newVal->val.val_int8;
+        case CANOPY_DATATYPE_INT16:
+            return cur->val.val_int16 == newVal->val.val_int16;
+        case CANOPY_DATATYPE_INT32:
+            return cur->val.val_int32 == newVal->val.val_int32;
+        case CANOPY_DATATYPE_UINT8:
+            return cur->val.val_uint8 == newVal->val.val_uint8;
+        case CANOPY_DATATYPE_UINT16:
+            return cur->val.val_uint16 == newVal->val.val_uint16;
+        case CANOPY_DATATYPE_UINT32:
+            return cur->val.val_uint32 == newVal->val.val_uint32;
+        default:
+            return false;
+    }
+}
+
+// Decide whether setting a basic cloud variable to <newVal> counts as a
+// change, according to the variable's change filter.
+//
+// Deadbands are measured from the last value that passed the filter (not the
+// last value set), so that slow drift is reported once it adds up.  When
+// <newVal> passes, it becomes the new reference.
+static bool _passes_change_filter(STCloudVar var, const STCloudVarBasicValue_t *newVal)
+{
+    double x, delta, band;
+
+    if (var->change_filter == CANOPY_VAR_FILTER_NONE || !var->has_value)
+    {
+        goto passed;
+    }
+
+    if (var->change_filter == CANOPY_VAR_FILTER_EXACT
+            || !_basic_value_as_double(st_cloudvar_datatype(var), newVal, &x))
+    {
+        return !_basic_value_equals(var, newVal);
+    }
+
+    if (!var->has_filter_ref)
+    {
+        goto passed;
+    }
+
+    delta = fabs(x - var->filter_ref);
+    if (isnan(delta))
+    {
+        // Moving into or out of NaN is always a change.
+        if (isnan(x) && isnan(var->filter_ref))
+            return false;
+        goto passed;
+    }
+
+    band = var->deadband;
+    if (var->change_filter == CANOPY_VAR_FILTER_PERCENT_DEADBAND)
+    {
+        band = fabs(var->filter_ref) * var->deadband / 100.0;
+    }
+    if (delta <= band)
+    {
+        return false;
+    }
+
+passed:
+    var->has_filter_ref = _basic_value_as_double(st_cloudvar_datatype(var), newVal, &var->filter_ref);
+    return true;
+}
+
 // This is used for incoming values from the cloud server
-CanopyResultEnum st_cloudvar_basic_update_from_json(STCloudVar var, RedJsonValue json)
+CanopyResultEnum st_cloudvar_basic_update_from_json(STCloudVar var, STJsonReader r)
 {
     STCloudVarBasicValue_t newVal;
     CanopyDatatypeEnum datatype = st_cloudvar_datatype(var);
+    CanopyResultEnum result;
+    double number;
+
     switch (datatype)
     {
         case CANOPY_DATATYPE_BOOL:
-            if (!RedJsonValue_IsBoolean(json))
+        {
+            if (st_json_peek_type(r) != ST_JSON_TYPE_BOOL)
                 return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_bool = RedJsonValue_GetBoolean(json);
+            st_json_read_bool(r, &newVal.val.val_bool);
             break;
+        }
+        case CANOPY_DATATYPE_STRING:
+        {
+            // Decode into the variable's own buffer, just past the current
+            // value, so that a string that fails to decode leaves the value
+            // intact.  Only once it has decoded is it moved into place.
+            size_t size = st_json_peek_string_size(r);
+            size_t offset, len;
+            char *buf;
+            if (!size)
+                return CANOPY_ERROR_INCORRECT_DATATYPE;
+            offset = var->has_value ? strlen(var->basic_value.val.val_string) + 1 : 0;
+            result = _reserve_string(var, offset + size);
+            if (result != CANOPY_SUCCESS)
+                return result;
+            buf = var->basic_value.val.val_string;
+            if (!st_json_read_string(r, buf + offset, size, &len))
+                return CANOPY_ERROR_PARSING_PAYLOAD;
+            memmove(buf, buf + offset, len + 1);
+            var->has_value = true;
+            return CANOPY_SUCCESS;
+        }
         case CANOPY_DATATYPE_FLOAT32:
-            if (!RedJsonValue_IsNumber(json))
+        case CANOPY_DATATYPE_FLOAT64:
+        case CANOPY_DATATYPE_INT8:
+        case CANOPY_DATATYPE_INT16:
+        case CANOPY_DATATYPE_INT32:
+        case CANOPY_DATATYPE_UINT8:
+        case CANOPY_DATATYPE_UINT16:
+        case CANOPY_DATATYPE_UINT32:
+        {
+            if (st_json_peek_type(r) != ST_JSON_TYPE_NUMBER)
                 return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_float32 = (float)(RedJsonValue_GetNumber(json));
+            if (!st_json_read_number(r, &number))
+                return CANOPY_ERROR_PARSING_PAYLOAD;
+            switch (datatype)
+            {
+                case CANOPY_DATATYPE_FLOAT32: newVal.val.val_float32 = (float)number; break;
+                case CANOPY_DATATYPE_FLOAT64: newVal.val.val_float64 = number; break;
+                case CANOPY_DATATYPE_INT8: newVal.val.val_int8 = (int8_t)number; break;
+                case CANOPY_DATATYPE_INT16: newVal.val.val_int16 = (int16_t)number; break;
+                case CANOPY_DATATYPE_INT32: newVal.val.val_int32 = (int32_t)number; break;
+                case CANOPY_DATATYPE_UINT8: newVal.val.val_uint8 = (uint8_t)number; break;
+                case CANOPY_DATATYPE_UINT16: newVal.val.val_uint16 = (uint16_t)number; break;
+                default: newVal.val.val_uint32 = (uint32_t)number; break;
+            }
+            break;
+        }
+        default:
+            return CANOPY_ERROR_UNKNOWN;
+            break;
+    }
+
+    // Copy value
+    return _store_basic_value(var, &newVal);
+}
+
+// Write basic cloud variable's value as CBOR
+CanopyResultEnum st_cloudvar_basic_write_cbor(STCborWriter w, STCloudVar var)
+{
+    CanopyDatatypeEnum datatype = st_cloudvar_datatype(var);
+    switch (datatype)
+    {
+        case CANOPY_DATATYPE_VOID:
+            st_cbor_null(w);
+            break;
+        case CANOPY_DATATYPE_BOOL:
+            st_cbor_bool(w, var->basic_value.val.val_bool);
+            break;
+        case CANOPY_DATATYPE_FLOAT32:
+            st_cbor_float32(w, var->basic_value.val.val_float32);
             break;
         case CANOPY_DATATYPE_FLOAT64:
-            if (!RedJsonValue_IsNumber(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_float64 = RedJsonValue_GetNumber(json);
+            st_cbor_float64(w, var->basic_value.val.val_float64);
             break;
         case CANOPY_DATATYPE_INT8:
-            if (!RedJsonValue_IsNumber(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_int8 = (int8_t)RedJsonValue_GetNumber(json);
+            st_cbor_int(w, var->basic_value.val.val_int8);
             break;
         case CANOPY_DATATYPE_INT16:
-            if (!RedJsonValue_IsNumber(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_int16 = (int16_t)RedJsonValue_GetNumber(json);
+            st_cbor_int(w, var->basic_value.val.val_int16);
             break;
         case CANOPY_DATATYPE_INT32:
-            if (!RedJsonValue_IsNumber(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_int32 = (int32_t)RedJsonValue_GetNumber(json);
+            st_cbor_int(w, var->basic_value.val.val_int32);
             break;
         case CANOPY_DATATYPE_STRING:
-            if (!RedJsonValue_IsString(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_string = RedJsonValue_GetString(json);
+            st_cbor_string(w, var->basic_value.val.val_string);
             break;
         case CANOPY_DATATYPE_UINT8:
-            if (!RedJsonValue_IsNumber(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_uint8 = (uint8_t)RedJsonValue_GetNumber(json);
+            st_cbor_uint(w, var->basic_value.val.val_uint8);
             break;
         case CANOPY_DATATYPE_UINT16:
-            if (!RedJsonValue_IsNumber(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_uint16 = (uint16_t)RedJsonValue_GetNumber(json);
+            st_cbor_uint(w, var->basic_value.val.val_uint16);
             break;
         case CANOPY_DATATYPE_UINT32:
-            if (!RedJsonValue_IsNumber(json))
-                return CANOPY_ERROR_INCORRECT_DATATYPE;
-            newVal.val.val_uint32 = (uint32_t)RedJsonValue_GetNumber(json);
+            st_cbor_uint(w, var->basic_value.val.val_uint32);
             break;
         default:
             return CANOPY_ERROR_UNKNOWN;
             break;
     }
-
-    // Copy value
-    var->basic_value = calloc(1, sizeof(STCloudVarBasicValue_t));
-    if (!var->basic_value)
+    if (st_cbor_writer_failed(w))
     {
         return CANOPY_ERROR_OUT_OF_MEMORY;
     }
-    memcpy(var->basic_value, &newVal, sizeof(STCloudVarBasicValue_t));
 
     return CANOPY_SUCCESS;
 }
 
+// This is used for incoming CBOR values from the cloud server.
+// Consumes one data item from <r>.
+CanopyResultEnum st_cloudvar_basic_update_from_cbor(STCloudVar var, STCborReader r)
+{
+    STCloudVarBasicValue_t newVal;
+    CanopyDatatypeEnum datatype = st_cloudvar_datatype(var);
+    double number;
+    int64_t integer;
+
+    switch (datatype)
+    {
+        case CANOPY_DATATYPE_BOOL:
+        {
+            if (st_cbor_peek_type(r) != ST_CBOR_TYPE_BOOL)
+                return CANOPY_ERROR_INCORRECT_DATATYPE;
+            st_cbor_read_bool(r, &newVal.val.val_bool);
+            break;
+        }
+        case CANOPY_DATATYPE_STRING:
+        {
+            const char *s;
+            size_t len;
+            if (st_cbor_peek_type(r) != ST_CBOR_TYPE_TEXT)
+                return CANOPY_ERROR_INCORRECT_DATATYPE;
+            if (!st_cbor_read_text(r, &s, &len))
+                return CANOPY_ERROR_PARSING_PAYLOAD;
+            return _store_string_len(var, s, len);
+        }
+        case CANOPY_DATATYPE_FLOAT32:
+        case CANOPY_DATATYPE_FLOAT64:
+        {
+            if (!st_cbor_read_number(r, &number))
+                return CANOPY_ERROR_INCORRECT_DATATYPE;
+            if (datatype == CANOPY_DATATYPE_FLOAT32)
+                newVal.val.val_float32 = (float)number;
+            else
+                newVal.val.val_float64 = number;
+            break;
+        }
+        case CANOPY_DATATYPE_INT8:
+        case CANOPY_DATATYPE_INT16:
+        case CANOPY_DATATYPE_INT32:
+        case CANOPY_DATATYPE_UINT8:
+        case CANOPY_DATATYPE_UINT16:
+        case CANOPY_DATATYPE_UINT32:
+        {
+            if (!st_cbor_read_int(r, &integer))
+                return CANOPY_ERROR_INCORRECT_DATATYPE;
+            switch (datatype)
+            {
+                case CANOPY_DATATYPE_INT8: newVal.val.val_int8 = (int8_t)integer; break;
+                case CANOPY_DATATYPE_INT16: newVal.val.val_int16 = (int16_t)integer; break;
+                case CANOPY_DATATYPE_INT32: newVal.val.val_int32 = (int32_t)integer; break;
+                case CANOPY_DATATYPE_UINT8: newVal.val.val_uint8 = (uint8_t)integer; break;
+                case CANOPY_DATATYPE_UINT16: newVal.val.val_uint16 = (uint16_t)integer; break;
+                default: newVal.val.val_uint32 = (uint32_t)integer; break;
+            }
+            break;
+        }
+        default:
+            return CANOPY_ERROR_UNKNOWN;
+            break;
+    }
+
+    // Copy value
+    return _store_basic_value(var, &newVal);
+}
+
 // Create a new basic cloud variable instance.
 // Caller is responsible for setting up relationships to parent & cloudvar
 // system.
@@ -150,6 +432,7 @@ CanopyResultEnum st_cloudvar_basic_new(
         STCloudVar *out, 
         STCloudVarInitOptions options)
 {
+    CanopyResultEnum result;
     STCloudVar var;
 
     // Create STCloudVar object
@@ -167,6 +450,15 @@ CanopyResultEnum st_cloudvar_basic_new(
         return CANOPY_ERROR_UNKNOWN;
     }
 
+    var->change_filter = options->change_filter;
+    var->deadband = options->deadband;
+
+    result = st_cloudvar_history_init(var, options->history_capacity);
+    if (result != CANOPY_SUCCESS)
+    {
+        return result;
+    }
+
     // TODO: other properties
 
     *out = var;
@@ -185,10 +477,30 @@ CanopyResultEnum st_cloudvar_basic_validate_value(STCloudVar var, CanopyVarValue
     return CANOPY_SUCCESS;
 }
 
+// Record a set that passed the change filter: mark the variable (or the
+// struct it is a member of) dirty, and add the value to its history.
+static void _mark_changed(STCloudVar var)
+{
+    if (var->sys)
+    {
+        st_cloudvar_system_mark_dirty(var->sys, var);
+        st_cloudvar_system_notify_change(var->sys, var);
+    }
+    else if (var->root)
+    {
+        st_cloudvar_system_mark_dirty(var->root->sys, var->root);
+    }
+    if (var->history_capacity)
+    {
+        st_cloudvar_history_record(var);
+    }
+}
+
 // Sets a basic cloud variable's value
 CanopyResultEnum st_cloudvar_basic_set(STCloudVar var, CanopyVarValue value)
 {
     CanopyResultEnum result;
+    bool changed;
 
     assert(sddl_var_is_basic(var->decl));
 
@@ -204,21 +516,204 @@ CanopyResultEnum st_cloudvar_basic_set(STCloudVar var, CanopyVarValue value)
         return result;
     }
 
+    changed = _passes_change_filter(var, &value->basic_value);
+
     // Copy value
-    var->basic_value = calloc(1, sizeof(STCloudVarBasicValue_t));
-    if (!var->basic_value)
+    result = _store_basic_value(var, &value->basic_value);
+    if (result != CANOPY_SUCCESS)
     {
-        return CANOPY_ERROR_OUT_OF_MEMORY;
+        return result;
     }
-    memcpy(var->basic_value, &value->basic_value, sizeof(STCloudVarBasicValue_t));
 
     // TODO: rethink the dirty flag now that things are recursive
-    if (var->sys)
-        st_cloudvar_system_mark_dirty(var->sys, var);
+    if (changed)
+    {
+        _mark_changed(var);
+    }
 
     return CANOPY_SUCCESS;
 }
 
+// Sets a basic cloud variable's value from a plain C value, without going
+// through a CanopyVarValue object.
+static CanopyResultEnum _set_basic_direct(
+        STCloudVar var, 
+        CanopyDatatypeEnum datatype, 
+        const STCloudVarBasicValue_t *newVal)
+{
+    CanopyResultEnum result;
+    bool changed;
+
+    if (st_cloudvar_datatype(var) != datatype)
+    {
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
+    }
+
+    // Is variable writeable?
+    if (st_cloudvar_concrete_direction(var) == CANOPY_DIRECTION_IN)
+    {
+        return CANOPY_ERROR_CANNOT_MODIFY_INPUT_VARIABLE;
+    }
+
+    changed = _passes_change_filter(var, newVal);
+
+    result = _store_basic_value(var, newVal);
+    if (result != CANOPY_SUCCESS)
+    {
+        return result;
+    }
+
+    if (changed)
+    {
+        _mark_changed(var);
+    }
+
+    return CANOPY_SUCCESS;
+}
+
+size_t st_cloudvar_basic_packed_size(CanopyDatatypeEnum datatype)
+{
+    switch (datatype)
+    {
+        case CANOPY_DATATYPE_BOOL: return sizeof(bool);
+        case CANOPY_DATATYPE_FLOAT32: return sizeof(float);
+        case CANOPY_DATATYPE_FLOAT64: return sizeof(double);
+        case CANOPY_DATATYPE_INT8: return sizeof(int8_t);
+        case CANOPY_DATATYPE_INT16: return sizeof(int16_t);
+        case CANOPY_DATATYPE_INT32: return sizeof(int32_t);
+        case CANOPY_DATATYPE_UINT8: return sizeof(uint8_t);
+        case CANOPY_DATATYPE_UINT16: return sizeof(uint16_t);
+        case CANOPY_DATATYPE_UINT32: return sizeof(uint32_t);
+        default: return 0;
+    }
+}
+
+bool st_cloudvar_basic_number(STCloudVar var, int64_t *intOut, double *floatOut)
+{
+    const STCloudVarBasicValue_t *value = &var->basic_value;
+    if (!var->has_value)
+    {
+        return false;
+    }
+    switch (st_cloudvar_datatype(var))
+    {
+        case CANOPY_DATATYPE_BOOL: *intOut = value->val.val_bool ? 1 : 0; return true;
+        case CANOPY_DATATYPE_FLOAT32: *floatOut = value->val.val_float32; return true;
+        case CANOPY_DATATYPE_FLOAT64: *floatOut = value->val.val_float64; return true;
+        case CANOPY_DATATYPE_INT8: *intOut = value->val.val_int8; return true;
+        case CANOPY_DATATYPE_INT16: *intOut = value->val.val_int16; return true;
+        case CANOPY_DATATYPE_INT32: *intOut = value->val.val_int32; return true;
+        case CANOPY_DATATYPE_UINT8: *intOut = value->val.val_uint8; return true;
+        case CANOPY_DATATYPE_UINT16: *intOut = value->val.val_uint16; return true;
+        case CANOPY_DATATYPE_UINT32: *intOut = value->val.val_uint32; return true;
+        default: return false;
+    }
+}
+
+CanopyResultEnum st_cloudvar_set_bool(STCloudVar var, bool x)
+{
+    STCloudVarBasicValue_t newVal;
+    newVal.val.val_bool = x;
+    return _set_basic_direct(var, CANOPY_DATATYPE_BOOL, &newVal);
+}
+
+CanopyResultEnum st_cloudvar_set_int8(STCloudVar var, int8_t x)
+{
+    STCloudVarBasicValue_t newVal;
+    newVal.val.val_int8 = x;
+    return _set_basic_direct(var, CANOPY_DATATYPE_INT8, &newVal);
+}
+
+CanopyResultEnum st_cloudvar_set_uint8(STCloudVar var, uint8_t x)
+{
+    STCloudVarBasicValue_t newVal;
+    newVal.val.val_uint8 = x;
+    return _set_basic_direct(var, CANOPY_DATATYPE_UINT8, &newVal);
+}
+
+CanopyResultEnum st_cloudvar_set_int16(STCloudVar var, int16_t x)
+{
+    STCloudVarBasicValue_t newVal;
+    newVal.val.val_int16 = x;
+    return _set_basic_direct(var, CANOPY_DATATYPE_INT16, &newVal);
+}
+
+CanopyResultEnum st_cloudvar_set_uint16(STCloudVar var, uint16_t x)
+{
+    STCloudVarBasicValue_t newVal;
+    newVal.val.val_uint16 = x;
+    return _set_basic_direct(var, CANOPY_DATATYPE_UINT16, &newVal);
+}
+
+CanopyResultEnum st_cloudvar_set_int32(STCloudVar var, int32_t x)
+{
+    STCloudVarBasicValue_t newVal;
+    newVal.val.val_int32 = x;
+    return _set_basic_direct(var, CANOPY_DATATYPE_INT32, &newVal);
+}
+
+CanopyResultEnum st_cloudvar_set_uint32(STCloudVar var, uint32_t x)
+{
+    STCloudVarBasicValue_t newVal;
+    newVal.val.val_uint32 = x;
+    return _set_basic_direct(var, CANOPY_DATATYPE_UINT32, &newVal);
+}
+
+CanopyResultEnum st_cloudvar_set_float32(STCloudVar var, float x)
+{
+    STCloudVarBasicValue_t newVal;
+    newVal.val.val_float32 = x;
+    return _set_basic_direct(var, CANOPY_DATATYPE_FLOAT32, &newVal);
+}
+
+CanopyResultEnum st_cloudvar_set_float64(STCloudVar var, double x)
+{
+    STCloudVarBasicValue_t newVal;
+    newVal.val.val_float64 = x;
+    return _set_basic_direct(var, CANOPY_DATATYPE_FLOAT64, &newVal);
+}
+
+CanopyResultEnum st_cloudvar_set_string(STCloudVar var, const char *sz)
+{
+    STCloudVarBasicValue_t newVal;
+    if (!sz)
+    {
+        return CANOPY_ERROR_INVALID_VALUE;
+    }
+    newVal.val.val_string = (char *)sz;
+    return _set_basic_direct(var, CANOPY_DATATYPE_STRING, &newVal);
+}
+
+CanopyResultEnum st_cloudvar_set_update(const CanopyVarUpdate *update)
+{
+    STCloudVar var = update->var;
+    switch (update->datatype)
+    {
+        case CANOPY_DATATYPE_BOOL:
+            return st_cloudvar_set_bool(var, update->val.val_bool);
+        case CANOPY_DATATYPE_INT8:
+            return st_cloudvar_set_int8(var, update->val.val_int8);
+        case CANOPY_DATATYPE_UINT8:
+            return st_cloudvar_set_uint8(var, update->val.val_uint8);
+        case CANOPY_DATATYPE_INT16:
+            return st_cloudvar_set_int16(var, update->val.val_int16);
+        case CANOPY_DATATYPE_UINT16:
+            return st_cloudvar_set_uint16(var, update->val.val_uint16);
+        case CANOPY_DATATYPE_INT32:
+            return st_cloudvar_set_int32(var, update->val.val_int32);
+        case CANOPY_DATATYPE_UINT32:
+            return st_cloudvar_set_uint32(var, update->val.val_uint32);
+        case CANOPY_DATATYPE_FLOAT32:
+            return st_cloudvar_set_float32(var, update->val.val_float32);
+        case CANOPY_DATATYPE_FLOAT64:
+            return st_cloudvar_set_float64(var, update->val.val_float64);
+        case CANOPY_DATATYPE_STRING:
+            return st_cloudvar_set_string(var, update->val.val_string);
+        default:
+            return CANOPY_ERROR_INCORRECT_DATATYPE;
+    }
+}
+
 CanopyResultEnum st_cloudvar_basic_read_var(STCloudVar var, CanopyVarReader reader)
 {
     if (st_cloudvar_datatype(var) != reader->datatype)
@@ -234,34 +729,34 @@ CanopyResultEnum st_cloudvar_basic_read_var(STCloudVar var, CanopyVarReader read
     switch (reader->datatype)
     {
         case CANOPY_DATATYPE_BOOL:
-            *reader->dest.dest_bool = var->basic_value->val.val_bool;
+            *reader->dest.dest_bool = var->basic_value.val.val_bool;
             break;
         case CANOPY_DATATYPE_FLOAT32:
-            *reader->dest.dest_float32 = var->basic_value->val.val_float32;
+            *reader->dest.dest_float32 = var->basic_value.val.val_float32;
             break;
         case CANOPY_DATATYPE_FLOAT64:
-            *reader->dest.dest_float64 = var->basic_value->val.val_float64;
+            *reader->dest.dest_float64 = var->basic_value.val.val_float64;
             break;
         case CANOPY_DATATYPE_INT8:
-            *reader->dest.dest_int8 = var->basic_value->val.val_int8;
+            *reader->dest.dest_int8 = var->basic_value.val.val_int8;
             break;
         case CANOPY_DATATYPE_INT16:
-            *reader->dest.dest_int16 = var->basic_value->val.val_int16;
+            *reader->dest.dest_int16 = var->basic_value.val.val_int16;
             break;
         case CANOPY_DATATYPE_INT32:
-            *reader->dest.dest_int32 = var->basic_value->val.val_int32;
+            *reader->dest.dest_int32 = var->basic_value.val.val_int32;
             break;
         case CANOPY_DATATYPE_STRING:
-            *reader->dest.dest_string = RedString_strdup(var->basic_value->val.val_string);
+            *reader->dest.dest_string = RedString_strdup(var->basic_value.val.val_string);
             break;
         case CANOPY_DATATYPE_UINT8:
-            *reader->dest.dest_uint8 = var->basic_value->val.val_uint8;
+            *reader->dest.dest_uint8 = var->basic_value.val.val_uint8;
             break;
         case CANOPY_DATATYPE_UINT16:
-            *reader->dest.dest_uint16 = var->basic_value->val.val_uint16;
+            *reader->dest.dest_uint16 = var->basic_value.val.val_uint16;
             break;
         case CANOPY_DATATYPE_UINT32:
-            *reader->dest.dest_uint32 = var->basic_value->val.val_uint32;
+            *reader->dest.dest_uint32 = var->basic_value.val.val_uint32;
             break;
         default:
             return CANOPY_ERROR_UNKNOWN;
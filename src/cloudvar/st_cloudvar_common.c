@@ -16,6 +16,34 @@
 #include "cloudvar/st_cloudvar_internal.h"
 #include "red_string.h"
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Append <member> to a struct's members, keeping declaration order.
+static CanopyResultEnum _add_struct_member(
+        STCloudVarInitOptions options, 
+        STCloudVarInitOptions member)
+{
+    STCloudVarInitOptions *newMembers;
+    unsigned i;
+
+    for (i = 0; i < options->struct_num_members; i++)
+    {
+        if (!strcmp(options->struct_members[i]->name, member->name))
+        {
+            return CANOPY_ERROR_BAD_VARIABLE_DECLARATION;
+        }
+    }
+    newMembers = realloc(options->struct_members, 
+            (options->struct_num_members + 1) * sizeof(STCloudVarInitOptions));
+    if (!newMembers)
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    newMembers[options->struct_num_members++] = member;
+    options->struct_members = newMembers;
+    return CANOPY_SUCCESS;
+}
 
 // Parse options passed to canopy_var_init() into STCloudVarInitOptions_t
 // structure.
@@ -35,6 +63,7 @@ CanopyResultEnum st_cloudvar_parse_init_options(
     SDDLResultEnum sddlResult;
     STCloudVarInitOptions_t *options;
     CanopyVarConfigEnum param;
+    CanopyResultEnum result;
 
     // Parse decl string (ex: "inout float32 humidity"):
     sddlResult = sddl_parse_decl(declString, &direction, &datatype, &name, &arrayElementDatatype, &arraySize);
@@ -55,15 +84,6 @@ CanopyResultEnum st_cloudvar_parse_init_options(
     options->array_datatype = arrayElementDatatype;
     options->name = RedString_strdup(name);
 
-    if (datatype == SDDL_DATATYPE_STRUCT)
-    {
-        options->struct_hash = RedHash_New(0);
-        if (!options->struct_hash)
-        {
-            return CANOPY_ERROR_OUT_OF_MEMORY;
-        }
-    }
-
     // process varargs
     while ((param = va_arg(ap, CanopyVarConfigEnum)) != 0)
     {
@@ -82,7 +102,11 @@ CanopyResultEnum st_cloudvar_parse_init_options(
                     return CANOPY_ERROR_INVALID_VALUE;
                 }
 
-                RedHash_InsertS(options->struct_hash, childObj->options->name, childObj->options);
+                result = _add_struct_member(options, childObj->options);
+                if (result != CANOPY_SUCCESS)
+                {
+                    return result;
+                }
                 break;
             }
             case CANOPY_VAR_DESCRIPTION:
@@ -91,6 +115,49 @@ CanopyResultEnum st_cloudvar_parse_init_options(
                 options->description = RedString_strdup(description);
                 break;
             }
+            case CANOPY_VAR_CHANGE_FILTER:
+            {
+                CanopyVarChangeFilterEnum filter = va_arg(ap, CanopyVarChangeFilterEnum);
+                if (!sddl_datatype_is_basic(datatype))
+                {
+                    return CANOPY_ERROR_INVALID_OPT;
+                }
+                if (filter < CANOPY_VAR_FILTER_NONE || filter > CANOPY_VAR_FILTER_PERCENT_DEADBAND)
+                {
+                    return CANOPY_ERROR_INVALID_VALUE;
+                }
+                options->change_filter = filter;
+                break;
+            }
+            case CANOPY_VAR_DEADBAND:
+            {
+                double deadband = va_arg(ap, double);
+                if (!sddl_datatype_is_basic(datatype))
+                {
+                    return CANOPY_ERROR_INVALID_OPT;
+                }
+                if (!(deadband >= 0.0))
+                {
+                    return CANOPY_ERROR_INVALID_VALUE;
+                }
+                options->deadband = deadband;
+                break;
+            }
+            case CANOPY_VAR_HISTORY_CAPACITY:
+            {
+                int capacity = va_arg(ap, int);
+                if (!sddl_datatype_is_basic(datatype) ||
+                        !st_cloudvar_history_supported((CanopyDatatypeEnum)datatype))
+                {
+                    return CANOPY_ERROR_INVALID_OPT;
+                }
+                if (capacity < 0)
+                {
+                    return CANOPY_ERROR_INVALID_VALUE;
+                }
+                options->history_capacity = (uint32_t)capacity;
+                break;
+            }
             default:
             {
                 return CANOPY_ERROR_INVALID_OPT;
@@ -151,10 +218,16 @@ CanopyResultEnum st_cloudvar_init_var(STCloudVarSystem sys, const char *decl, va
     }
 
     // Add it to the system
+    result = st_cloudvar_system_assign_id(sys, var);
+    if (result != CANOPY_SUCCESS)
+    {
+        return result;
+    }
     RedHash_InsertS(sys->vars, options->name, var);
     st_cloudvar_system_mark_dirty(sys, var);
     var->sddl_dirty_flag = true;
     var->sys = sys;
+    st_cloudvar_struct_set_root(var);
 
     return CANOPY_SUCCESS;
 }
@@ -190,7 +263,12 @@ CanopyResultEnum st_cloudvar_set_var(
         return CANOPY_ERROR_CANNOT_MODIFY_INPUT_VARIABLE;
     }
 
-    st_cloudvar_system_mark_dirty(var->sys, var);
+    // Basic variables are marked dirty by st_cloudvar_basic_set, once the
+    // new value has passed the variable's change filter.
+    if (!st_cloudvar_is_basic(var) && st_cloudvar_system(var))
+    {
+        st_cloudvar_system_mark_dirty(st_cloudvar_system(var), st_cloudvar_top_level(var));
+    }
 
     // recursive part
     return st_cloudvar_generic_set(var, value);
@@ -207,31 +285,60 @@ bool st_cloudvar_is_sddl_dirty(STCloudVar var)
 }
 
 // Convert cloud variable's value to JSON, recursively
-CanopyResultEnum st_cloudvar_value_to_json(RedJsonValue *out, STCloudVar var)
+CanopyResultEnum st_cloudvar_value_write_json(STJsonWriter w, STCloudVar var)
 {
-    // Call appropriate value_to_json routine
+    // Call appropriate write_json routine
     if (st_cloudvar_is_basic(var))
     {
-        return st_cloudvar_basic_value_to_json(out, var);
+        return st_cloudvar_basic_write_json(w, var);
     }
     else if (st_cloudvar_datatype(var) == CANOPY_DATATYPE_ARRAY)
     {
-        return st_cloudvar_array_value_to_json(out, var);
+        return st_cloudvar_array_write_json(w, var);
     }
     else if (st_cloudvar_datatype(var) == CANOPY_DATATYPE_STRUCT)
     {
-        return st_cloudvar_struct_value_to_json(out, var);
+        return st_cloudvar_struct_write_json(w, var);
+    }
+
+   return CANOPY_ERROR_UNKNOWN;
+}
+
+CanopyResultEnum st_cloudvar_value_write_cbor(STCborWriter w, STCloudVar var)
+{
+    // Call appropriate write_cbor routine
+    if (st_cloudvar_is_basic(var))
+    {
+        return st_cloudvar_basic_write_cbor(w, var);
+    }
+    else if (st_cloudvar_datatype(var) == CANOPY_DATATYPE_ARRAY)
+    {
+        return st_cloudvar_array_write_cbor(w, var);
+    }
+    else if (st_cloudvar_datatype(var) == CANOPY_DATATYPE_STRUCT)
+    {
+        return st_cloudvar_struct_write_cbor(w, var);
     }
 
    return CANOPY_ERROR_UNKNOWN;
 }
 
 // This is used for incoming values from the cloud server
-CanopyResultEnum st_cloudvar_update_from_json(STCloudVar var, RedJsonValue json)
+CanopyResultEnum st_cloudvar_update_from_json(STCloudVar var, STJsonReader r)
+{
+    if (st_cloudvar_is_basic(var))
+    {
+        return st_cloudvar_basic_update_from_json(var, r);
+    }
+    return CANOPY_ERROR_NOT_IMPLEMENTED;
+}
+
+// This is used for incoming CBOR values from the cloud server
+CanopyResultEnum st_cloudvar_update_from_cbor(STCloudVar var, STCborReader r)
 {
     if (st_cloudvar_is_basic(var))
     {
-        return st_cloudvar_basic_update_from_json(var, json);
+        return st_cloudvar_basic_update_from_cbor(var, r);
     }
     return CANOPY_ERROR_NOT_IMPLEMENTED;
 }
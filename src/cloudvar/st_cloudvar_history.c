@@ -0,0 +1,226 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Per-variable sample history.
+//
+// A basic Cloud Variable initialized with CANOPY_VAR_HISTORY_CAPACITY keeps
+// every value it is set to between syncs, not just the latest one, so that
+// they can all be sent.  Samples are kept in a ring, as two parallel arrays:
+// timestamps, and values packed at their datatype's native size.  Writing
+// out a variable's history then walks each array in order.
+//
+// Samples put in a payload stay at the start of the ring until the payload
+// has been written, so that they can be sent again if it is lost.
+
+#include "cloudvar/st_cloudvar.h"
+#include "cloudvar/st_cloudvar_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+bool st_cloudvar_history_supported(CanopyDatatypeEnum datatype)
+{
+    return st_cloudvar_basic_packed_size(datatype) != 0;
+}
+
+CanopyResultEnum st_cloudvar_history_init(STCloudVar var, uint32_t capacity)
+{
+    size_t valueSize = st_cloudvar_basic_packed_size(st_cloudvar_datatype(var));
+
+    if (capacity == 0)
+    {
+        return CANOPY_SUCCESS;
+    }
+    if (valueSize == 0)
+    {
+        return CANOPY_ERROR_INVALID_OPT;
+    }
+    var->history_times = calloc(capacity, sizeof(var->history_times[0]));
+    var->history_values = calloc(capacity, valueSize);
+    if (!var->history_times || !var->history_values)
+    {
+        free(var->history_times);
+        free(var->history_values);
+        var->history_times = NULL;
+        var->history_values = NULL;
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    var->history_capacity = capacity;
+    var->history_value_size = valueSize;
+    var->history_start = 0;
+    var->history_count = 0;
+    var->history_num_sent = 0;
+    return CANOPY_SUCCESS;
+}
+
+void st_cloudvar_history_record(STCloudVar var)
+{
+    uint32_t i;
+
+    if (var->history_count == var->history_capacity)
+    {
+        // Full: the oldest sample makes way.  If it was put in a payload,
+        // that payload still has it.
+        i = var->history_start;
+        var->history_start = (var->history_start + 1) % var->history_capacity;
+        var->history_num_dropped++;
+        if (var->history_num_sent)
+        {
+            var->history_num_sent--;
+        }
+    }
+    else
+    {
+        i = (var->history_start + var->history_count) % var->history_capacity;
+        var->history_count++;
+    }
+    var->history_times[i] = st_cloudvar_system_sample_time(st_cloudvar_system(var));
+    memcpy(&var->history_values[i * var->history_value_size], 
+            &var->basic_value.val, var->history_value_size);
+}
+
+void st_cloudvar_history_settle_sent(STCloudVar var, bool written)
+{
+    if (written && var->history_num_sent)
+    {
+        var->history_start = (var->history_start + var->history_num_sent) % 
+                var->history_capacity;
+        var->history_count -= var->history_num_sent;
+    }
+    var->history_num_sent = 0;
+}
+
+uint32_t st_cloudvar_history_count(STCloudVar var)
+{
+    return var->history_count - var->history_num_sent;
+}
+
+// Iterate over the ring slots of the samples not yet put in a payload,
+// oldest first.
+#define _FOREACH_SAMPLE(var, n, i) \
+    for ((n) = (var)->history_num_sent, \
+            (i) = ((var)->history_start + (var)->history_num_sent) % (var)->history_capacity; \
+            (n) < (var)->history_count; \
+            (n)++, (i) = ((i) + 1 == (var)->history_capacity) ? 0 : (i) + 1)
+
+CanopyResultEnum st_cloudvar_history_write_json(STJsonWriter w, STCloudVar var)
+{
+    const void *values = var->history_values;
+    uint32_t n, i;
+
+    st_json_begin_object(w);
+    st_json_key(w, "t");
+    st_json_begin_array(w);
+    _FOREACH_SAMPLE(var, n, i)
+    {
+        st_json_uint(w, var->history_times[i]);
+    }
+    st_json_end_array(w);
+    st_json_key(w, "v");
+    st_json_begin_array(w);
+    switch (st_cloudvar_datatype(var))
+    {
+        case CANOPY_DATATYPE_BOOL:
+            _FOREACH_SAMPLE(var, n, i) st_json_bool(w, ((const bool *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_FLOAT32:
+            _FOREACH_SAMPLE(var, n, i) st_json_float32(w, ((const float *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_FLOAT64:
+            _FOREACH_SAMPLE(var, n, i) st_json_float64(w, ((const double *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_INT8:
+            _FOREACH_SAMPLE(var, n, i) st_json_int(w, ((const int8_t *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_INT16:
+            _FOREACH_SAMPLE(var, n, i) st_json_int(w, ((const int16_t *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_INT32:
+            _FOREACH_SAMPLE(var, n, i) st_json_int(w, ((const int32_t *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_UINT8:
+            _FOREACH_SAMPLE(var, n, i) st_json_uint(w, ((const uint8_t *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_UINT16:
+            _FOREACH_SAMPLE(var, n, i) st_json_uint(w, ((const uint16_t *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_UINT32:
+            _FOREACH_SAMPLE(var, n, i) st_json_uint(w, ((const uint32_t *)values)[i]);
+            break;
+        default:
+            return CANOPY_ERROR_UNKNOWN;
+    }
+    st_json_end_array(w);
+    st_json_end_object(w);
+    if (st_json_writer_failed(w))
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    return CANOPY_SUCCESS;
+}
+
+CanopyResultEnum st_cloudvar_history_write_cbor(STCborWriter w, STCloudVar var)
+{
+    const void *values = var->history_values;
+    uint32_t n, i;
+
+    st_cbor_begin_map(w);
+    st_cbor_string(w, "t");
+    st_cbor_begin_array(w);
+    _FOREACH_SAMPLE(var, n, i)
+    {
+        st_cbor_uint(w, var->history_times[i]);
+    }
+    st_cbor_end_array(w);
+    st_cbor_string(w, "v");
+    st_cbor_begin_array(w);
+    switch (st_cloudvar_datatype(var))
+    {
+        case CANOPY_DATATYPE_BOOL:
+            _FOREACH_SAMPLE(var, n, i) st_cbor_bool(w, ((const bool *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_FLOAT32:
+            _FOREACH_SAMPLE(var, n, i) st_cbor_float32(w, ((const float *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_FLOAT64:
+            _FOREACH_SAMPLE(var, n, i) st_cbor_float64(w, ((const double *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_INT8:
+            _FOREACH_SAMPLE(var, n, i) st_cbor_int(w, ((const int8_t *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_INT16:
+            _FOREACH_SAMPLE(var, n, i) st_cbor_int(w, ((const int16_t *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_INT32:
+            _FOREACH_SAMPLE(var, n, i) st_cbor_int(w, ((const int32_t *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_UINT8:
+            _FOREACH_SAMPLE(var, n, i) st_cbor_uint(w, ((const uint8_t *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_UINT16:
+            _FOREACH_SAMPLE(var, n, i) st_cbor_uint(w, ((const uint16_t *)values)[i]);
+            break;
+        case CANOPY_DATATYPE_UINT32:
+            _FOREACH_SAMPLE(var, n, i) st_cbor_uint(w, ((const uint32_t *)values)[i]);
+            break;
+        default:
+            return CANOPY_ERROR_UNKNOWN;
+    }
+    st_cbor_end_array(w);
+    st_cbor_end_map(w);
+    if (st_cbor_writer_failed(w))
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    return CANOPY_SUCCESS;
+}
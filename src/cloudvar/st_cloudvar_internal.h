@@ -68,9 +68,9 @@ typedef struct STCloudVarInitOptions_t
     // (Array only) Datatype of array elements
     SDDLDatatypeEnum array_datatype;
 
-    // (Struct only) Options for child members
-    // Hash: "name" -> STCloudVarOptions
-    RedHash struct_hash;
+    // (Struct only) Options for child members, in declaration order
+    STCloudVarInitOptions *struct_members;
+    unsigned struct_num_members;
 
     // (Tuple only) Options for child members
     // Hash: "name" -> STCloudVarOptions
@@ -78,16 +78,78 @@ typedef struct STCloudVarInitOptions_t
 
     // Description provided with CANOPY_VAR_DESCRIPTION
     char *description;
+
+    // (Basic only) Change filter provided with CANOPY_VAR_CHANGE_FILTER
+    CanopyVarChangeFilterEnum change_filter;
+
+    // (Basic only) Deadband provided with CANOPY_VAR_DEADBAND
+    double deadband;
+
+    // (Basic only) Capacity provided with CANOPY_VAR_HISTORY_CAPACITY
+    uint32_t history_capacity;
 } STCloudVarInitOptions_t;
 
 struct STCloudVarSystem_t {
     bool dirty;
     CanopyContext context;
     RedHash vars; // maps (char *varname) -> (STCloudVar var)
-    RedHash dirty_vars; // maps (char *varname) -> void 
+
+    // Top-level Cloud Variables indexed by numeric ID.
+    STCloudVar *vars_by_id;
+    uint32_t num_vars;
+    uint32_t vars_by_id_capacity;
+
+    // Intrusive list of Cloud Variables touched since the last sync, linked
+    // through STCloudVar_t.next_dirty, in the order they were first touched.
+    STCloudVar dirty_head;
+    STCloudVar dirty_tail;
+    uint32_t num_dirty;
+
+    // Intrusive list of Cloud Variables in payloads that have been queued
+    // but not yet written, linked through STCloudVar_t.next_sent.  See
+    // st_cloudvar_system_mark_sent.
+    STCloudVar sent_head;
+
     RedHash callbacks; // maps (char *varname) -> (STOptions)
+
+    // See st_cloudvar_system_set_change_hook.
+    STCloudVarChangeHook change_hook;
+    void *change_hook_userdata;
+
+    // See st_cloudvar_system_set_sample_time.  0 for the current time.
+    uint64_t sample_time_ms;
 };
 
+// One entry of a struct's member table.  See st_cloudvar_struct.c.
+typedef struct STCloudVarMember_t
+{
+    // Member's path from the struct, such as "fix.quality".
+    char *path;
+
+    // Member's own name: the last component of <path>.
+    const char *name;
+
+    STCloudVar var;
+
+    // 0 for the struct's direct members, 1 for their members, and so on.
+    uint32_t depth;
+
+    // Index one past the last entry of this member's subtree, so that a walk
+    // can step over a nested struct in one go.
+    uint32_t end;
+} STCloudVarMember_t;
+
+// One field of a C struct bound with canopy_var_bind_struct.
+typedef struct STCloudVarBinding_t
+{
+    STCloudVar member;
+    CanopyDatatypeEnum datatype;
+
+    // Field's offset within the C struct, and its size (0 for strings).
+    size_t offset;
+    size_t size;
+} STCloudVarBinding_t;
+
 typedef struct STCloudVarBasicValue_t {
     union
     {
@@ -118,26 +180,95 @@ typedef struct STCloudVar_t
     // Cloud variable system that owns this cloud variable.
     STCloudVarSystem sys;
 
+    // (Top-level only) Numeric ID, assigned in initialization order.
+    uint32_t id;
+
     // Cloud variable's declaration: Recursive structure containing datatype,
     // qualifiers, and metadata for this cloud variable.
     SDDLVarDecl decl;
 
     // If cloud variable has a basic datatype, this holds its value.
-    STCloudVarBasicValue_t * basic_value;
+    STCloudVarBasicValue_t basic_value;
+
+    // (Basic only) Has basic_value been assigned yet?
+    bool has_value;
+
+    // (Basic only) Decides whether a set marks this variable dirty.
+    CanopyVarChangeFilterEnum change_filter;
+    double deadband;
+
+    // (Basic only) Last value that passed a deadband filter, as a double.
+    double filter_ref;
+    bool has_filter_ref;
+
+    // (Basic only) Values set since the last sync, with their timestamps,
+    // if the variable was initialized with CANOPY_VAR_HISTORY_CAPACITY.
+    // A ring of <history_capacity> samples, stored as parallel arrays:
+    // wall-clock times in milliseconds, and values packed at
+    // <history_value_size> bytes each.  See st_cloudvar_history.c.
+    uint64_t *history_times;
+    unsigned char *history_values;
+    size_t history_value_size;
+    uint32_t history_capacity;
+    uint32_t history_start;
+    uint32_t history_count;
+    uint32_t history_num_dropped;
 
-    // If cloud variable is an array, this holds its child elements.
+    // Number of samples at the start of the history that are in a payload
+    // not yet written.  Later payloads only carry the samples after them.
+    uint32_t history_num_sent;
+
+    // (String only) Allocated size of basic_value.val.val_string.  The buffer
+    // is reused across updates and only grows when a longer string arrives.
+    size_t string_capacity;
+
+    // If cloud variable is an array, this holds its child elements.  Arrays
+    // of datatypes that st_cloudvar_basic_packed_size can pack have no child
+    // elements; they use <array_data> instead.
     size_t array_num_items;
     STCloudVar *array_items;
 
-    // If cloud variable is a struct, this holds its child members.
-    // Hash Table: name --> STCloudVar
-    RedHash struct_hash;
+    // (Array only) Datatype of the array's elements.
+    CanopyDatatypeEnum array_datatype;
+
+    // (Packed array only) All element values in one buffer, at
+    // <array_item_size> bytes each, a bitmap of the elements that have been
+    // set, a bitmap of the elements set since the last sync, and a bitmap of
+    // the elements in a payload not yet written.  See st_cloudvar_array.c.
+    unsigned char *array_data;
+    size_t array_item_size;
+    uint32_t *array_set_bits;
+    uint32_t *array_dirty_bits;
+    uint32_t *array_sent_bits;
+
+    // If cloud variable is a struct, this holds its members at every depth,
+    // flattened depth-first in declaration order when the struct is created.
+    STCloudVarMember_t *struct_members;
+    uint32_t struct_num_members;
+
+    // (Struct only) C struct layout bound with canopy_var_bind_struct, one
+    // entry per bound field.
+    STCloudVarBinding_t *struct_binding;
+    uint32_t struct_binding_len;
+
+    // (Struct member only) Top-level Cloud Variable this member belongs to.
+    // Setting the member marks that variable dirty.
+    STCloudVar root;
 
     // Has this cloud variable's value been touched since last sync?
     bool dirty;
 
+    // Next entry in the owning system's dirty list (top-level only).
+    STCloudVar next_dirty;
+
     // Has this cloud variable's SDDL been changed since last sync?
     bool sddl_dirty_flag;
+
+    // Is this cloud variable in a payload not yet written, and was its SDDL?
+    // Next entry in the owning system's sent list (top-level only).
+    bool sent;
+    bool sddl_sent;
+    STCloudVar next_sent;
 } STCloudVar_t;
 
 typedef struct STCloudVarValue_t {
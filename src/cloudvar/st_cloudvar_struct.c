@@ -17,34 +17,201 @@
 #include "red_string.h"
 #include <assert.h>
 
-// Convert struct cloud variable's value to JSON, recursively
-CanopyResultEnum st_cloudvar_struct_value_to_json(RedJsonValue *out, STCloudVar var)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A struct keeps its members in a flat table, built once when the struct is
+// created (at canopy_var_init time): every member at every depth, depth-first
+// in declaration order.  For:
+//
+//      struct gps { float32 latitude; float32 longitude; 
+//                   struct fix { int8 quality; uint8 satellites; } }
+//
+// the table is:
+//
+//      [0] "latitude"          depth 0, end 1
+//      [1] "longitude"         depth 0, end 2
+//      [2] "fix"               depth 0, end 5
+//      [3] "fix.quality"       depth 1, end 4
+//      [4] "fix.satellites"    depth 1, end 5
+//
+// Writing the struct out is a single pass over the table, and a member path
+// such as "gps.fix.quality" resolves straight to the member's STCloudVar, so
+// a CanopyVarHandle can point at it.  Nested structs have tables of their
+// own, used when they are accessed on their own.
+
+// Does any member in entries [<first>, <end>) of <var>'s table have a value?
+// Nested structs are left out of payloads when nothing below them is set.
+static bool _subtree_has_value(STCloudVar var, uint32_t first, uint32_t end)
 {
-    RedJsonObject jsonObj = RedJsonObject_New();
-    RedHashIterator_t iter;
-    const void *key;
-    const void *hashValue;
-    size_t keySize;
-    RED_HASH_FOREACH(iter, var->struct_hash, &key, &keySize, &hashValue)
+    uint32_t i;
+    for (i = first; i < end; i++)
+    {
+        STCloudVar member = var->struct_members[i].var;
+        if (st_cloudvar_datatype(member) != CANOPY_DATATYPE_STRUCT &&
+                st_cloudvar_has_value(member))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Write struct cloud variable's value as JSON
+CanopyResultEnum st_cloudvar_struct_write_json(STJsonWriter w, STCloudVar var)
+{
+    uint32_t i, depth = 0;
+
+    st_json_begin_object(w);
+    for (i = 0; i < var->struct_num_members; i++)
+    {
+        const STCloudVarMember_t *member = &var->struct_members[i];
+        CanopyResultEnum result;
+
+        for (; depth > member->depth; depth--)
+        {
+            st_json_end_object(w);
+        }
+        if (st_cloudvar_datatype(member->var) == CANOPY_DATATYPE_STRUCT)
+        {
+            if (!_subtree_has_value(var, i + 1, member->end))
+            {
+                i = member->end - 1;
+                continue;
+            }
+            st_json_key(w, member->name);
+            st_json_begin_object(w);
+            depth++;
+        }
+        else if (st_cloudvar_has_value(member->var))
+        {
+            st_json_key(w, member->name);
+            result = st_cloudvar_value_write_json(w, member->var);
+            if (result != CANOPY_SUCCESS)
+            {
+                return result;
+            }
+        }
+    }
+    for (; depth > 0; depth--)
+    {
+        st_json_end_object(w);
+    }
+    st_json_end_object(w);
+
+    return CANOPY_SUCCESS;
+}
+
+// Write struct cloud variable's value as CBOR
+CanopyResultEnum st_cloudvar_struct_write_cbor(STCborWriter w, STCloudVar var)
+{
+    uint32_t i, depth = 0;
+
+    st_cbor_begin_map(w);
+    for (i = 0; i < var->struct_num_members; i++)
     {
+        const STCloudVarMember_t *member = &var->struct_members[i];
         CanopyResultEnum result;
-        RedJsonValue childValueJson;
-        STCloudVar childVar = (STCloudVar)hashValue;
-        if (st_cloudvar_has_value(childVar))
+
+        for (; depth > member->depth; depth--)
+        {
+            st_cbor_end_map(w);
+        }
+        if (st_cloudvar_datatype(member->var) == CANOPY_DATATYPE_STRUCT)
         {
-            result = st_cloudvar_value_to_json(&childValueJson, childVar);
+            if (!_subtree_has_value(var, i + 1, member->end))
+            {
+                i = member->end - 1;
+                continue;
+            }
+            st_cbor_string(w, member->name);
+            st_cbor_begin_map(w);
+            depth++;
+        }
+        else if (st_cloudvar_has_value(member->var))
+        {
+            st_cbor_string(w, member->name);
+            result = st_cloudvar_value_write_cbor(w, member->var);
             if (result != CANOPY_SUCCESS)
             {
                 return result;
             }
-            RedJsonObject_Set(jsonObj, key, childValueJson);
         }
     }
+    for (; depth > 0; depth--)
+    {
+        st_cbor_end_map(w);
+    }
+    st_cbor_end_map(w);
+
+    return CANOPY_SUCCESS;
+}
+
+// Append <member> and its own member table to <var>'s member table.
+static CanopyResultEnum _append_member(STCloudVar var, STCloudVar member)
+{
+    const char *name = st_cloudvar_name(member);
+    size_t nameLen = strlen(name);
+    uint32_t first = var->struct_num_members;
+    uint32_t count = 1 + member->struct_num_members;
+    STCloudVarMember_t *table;
+    uint32_t i;
+
+    table = realloc(var->struct_members, (first + count) * sizeof(STCloudVarMember_t));
+    if (!table)
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    var->struct_members = table;
+
+    table[first].path = RedString_strdup(name);
+    if (!table[first].path)
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    table[first].name = table[first].path;
+    table[first].var = member;
+    table[first].depth = 0;
+    table[first].end = first + count;
+
+    for (i = 0; i < member->struct_num_members; i++)
+    {
+        const STCloudVarMember_t *in = &member->struct_members[i];
+        STCloudVarMember_t *out = &table[first + 1 + i];
+        size_t pathSize = nameLen + 1 + strlen(in->path) + 1;
 
-    *out = RedJsonValue_FromObject(jsonObj);
+        out->path = malloc(pathSize);
+        if (!out->path)
+        {
+            return CANOPY_ERROR_OUT_OF_MEMORY;
+        }
+        snprintf(out->path, pathSize, "%s.%s", name, in->path);
+        out->name = out->path + nameLen + 1 + (in->name - in->path);
+        out->var = in->var;
+        out->depth = in->depth + 1;
+        out->end = first + 1 + in->end;
+    }
+    var->struct_num_members = first + count;
     return CANOPY_SUCCESS;
 }
 
+// Find <var>'s direct member called <name>.
+static STCloudVar _direct_member(STCloudVar var, const char *name)
+{
+    uint32_t i;
+
+    // Step over nested structs' members.
+    for (i = 0; i < var->struct_num_members; i = var->struct_members[i].end)
+    {
+        if (!strcmp(var->struct_members[i].name, name))
+        {
+            return var->struct_members[i].var;
+        }
+    }
+    return NULL;
+}
+
 // Create a new struct cloud variable instance.
 // Caller is responsible for setting up relationships to parent & cloudvar
 // system.
@@ -53,6 +220,7 @@ CanopyResultEnum st_cloudvar_struct_new(
         STCloudVarInitOptions options)
 {
     STCloudVar var;
+    unsigned i;
 
     // Create STCloudVar object for struct itself
     var = calloc(1, sizeof(STCloudVar_t));
@@ -60,12 +228,6 @@ CanopyResultEnum st_cloudvar_struct_new(
     {
         return CANOPY_ERROR_OUT_OF_MEMORY;
     }
-    // TODO: validate numItems
-    var->struct_hash = RedHash_New(0);
-    if (!var->struct_hash)
-    {
-        return CANOPY_ERROR_OUT_OF_MEMORY;
-    }
 
     // Create SDDL declaration
     var->decl = sddl_var_new_struct(options->direction, options->name);
@@ -74,20 +236,15 @@ CanopyResultEnum st_cloudvar_struct_new(
         return CANOPY_ERROR_UNKNOWN;
     }
 
-    // Create child STCloudVar objects for each struct member
-    RedHashIterator_t iter;
-    const void *key;
-    const void *hashValue;
-    size_t keySize;
-    RED_HASH_FOREACH(iter, options->struct_hash, &key, &keySize, &hashValue)
+    // Create child STCloudVar objects for each struct member, in declaration
+    // order
+    for (i = 0; i < options->struct_num_members; i++)
     {
         CanopyResultEnum result;
         STCloudVar childVar;
         bool ok;
-        STCloudVarInitOptions childOptions = (STCloudVarInitOptions)hashValue;
-
-        result = st_cloudvar_generic_new(&childVar, childOptions); 
 
+        result = st_cloudvar_generic_new(&childVar, options->struct_members[i]); 
         if (result != CANOPY_SUCCESS)
         {
             return result;
@@ -102,14 +259,39 @@ CanopyResultEnum st_cloudvar_struct_new(
         }
 
         // add newly created variable to CloudVar
-        RedHash_InsertS(var->struct_hash, st_cloudvar_name(childVar), childVar);
-
+        result = _append_member(var, childVar);
+        if (result != CANOPY_SUCCESS)
+        {
+            return result;
+        }
     }
 
     *out = var;
     return CANOPY_SUCCESS;
 }
 
+void st_cloudvar_struct_set_root(STCloudVar var)
+{
+    uint32_t i;
+    for (i = 0; i < var->struct_num_members; i++)
+    {
+        var->struct_members[i].var->root = var;
+    }
+}
+
+STCloudVar st_cloudvar_struct_member(STCloudVar var, const char *path)
+{
+    uint32_t i;
+    for (i = 0; i < var->struct_num_members; i++)
+    {
+        if (!strcmp(var->struct_members[i].path, path))
+        {
+            return var->struct_members[i].var;
+        }
+    }
+    return NULL;
+}
+
 CanopyResultEnum st_cloudvar_struct_validate_value(STCloudVar var, CanopyVarValue value)
 {
     return CANOPY_ERROR_NOT_IMPLEMENTED;
@@ -147,7 +329,7 @@ CanopyResultEnum st_cloudvar_struct_set(STCloudVar var, CanopyVarValue value)
         CanopyVarValue fieldValue = (CanopyVarValue)hashValue;
         STCloudVar fieldVar;
 
-        fieldVar = RedHash_GetWithDefaultS(var->struct_hash, fieldName, NULL);
+        fieldVar = _direct_member(var, fieldName);
         if (!fieldVar)
         {
             return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
@@ -190,7 +372,7 @@ CanopyResultEnum st_cloudvar_struct_read_var(STCloudVar var, CanopyVarReader rea
         CanopyVarReader fieldReader = (CanopyVarReader)hashValue;
         STCloudVar fieldVar;
 
-        fieldVar = RedHash_GetWithDefaultS(var->struct_hash, fieldName, NULL);
+        fieldVar = _direct_member(var, fieldName);
         if (!fieldVar)
         {
             return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
@@ -207,3 +389,144 @@ CanopyResultEnum st_cloudvar_struct_read_var(STCloudVar var, CanopyVarReader rea
     return CANOPY_SUCCESS;
 }
 
+
+// A bound C struct layout is a list of (member, offset) pairs, checked once
+// by st_cloudvar_struct_bind.  Setting or reading the whole struct is then a
+// walk over the list that copies each field between the C struct and the
+// member's storage, as the typed setters would.
+
+CanopyResultEnum st_cloudvar_struct_bind(
+        STCloudVar var, 
+        const CanopyStructField *fields, 
+        size_t numFields)
+{
+    STCloudVarBinding_t *binding;
+    size_t i;
+
+    if (st_cloudvar_datatype(var) != CANOPY_DATATYPE_STRUCT)
+    {
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
+    }
+
+    binding = calloc(numFields ? numFields : 1, sizeof(STCloudVarBinding_t));
+    if (!binding)
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    for (i = 0; i < numFields; i++)
+    {
+        STCloudVar member = st_cloudvar_struct_member(var, fields[i].name);
+        if (!member || !st_cloudvar_is_basic(member))
+        {
+            free(binding);
+            return CANOPY_ERROR_VARIABLE_NOT_INITIALIZED;
+        }
+        if (st_cloudvar_datatype(member) != fields[i].datatype ||
+                (fields[i].datatype != CANOPY_DATATYPE_STRING && 
+                    !st_cloudvar_basic_packed_size(fields[i].datatype)))
+        {
+            free(binding);
+            return CANOPY_ERROR_INCORRECT_DATATYPE;
+        }
+        binding[i].member = member;
+        binding[i].datatype = fields[i].datatype;
+        binding[i].offset = fields[i].offset;
+        binding[i].size = st_cloudvar_basic_packed_size(fields[i].datatype);
+    }
+
+    free(var->struct_binding);
+    var->struct_binding = binding;
+    var->struct_binding_len = numFields;
+    return CANOPY_SUCCESS;
+}
+
+CanopyResultEnum st_cloudvar_struct_set_bound(STCloudVar var, const void *src)
+{
+    const unsigned char *in = (const unsigned char *)src;
+    CanopyResultEnum result, firstError = CANOPY_SUCCESS;
+    CanopyVarUpdate update;
+    const char *str;
+    uint32_t i;
+
+    if (!var->struct_binding)
+    {
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
+    }
+
+    // Check everything first, so that a bad field never leaves the struct
+    // half-set.
+    for (i = 0; i < var->struct_binding_len; i++)
+    {
+        const STCloudVarBinding_t *field = &var->struct_binding[i];
+        if (st_cloudvar_concrete_direction(field->member) == CANOPY_DIRECTION_IN)
+        {
+            return CANOPY_ERROR_CANNOT_MODIFY_INPUT_VARIABLE;
+        }
+        if (!field->size)
+        {
+            memcpy(&str, &in[field->offset], sizeof(str));
+            if (!str)
+            {
+                return CANOPY_ERROR_INVALID_VALUE;
+            }
+        }
+    }
+
+    for (i = 0; i < var->struct_binding_len; i++)
+    {
+        const STCloudVarBinding_t *field = &var->struct_binding[i];
+        update.var = field->member;
+        update.datatype = field->datatype;
+        if (field->size)
+        {
+            memcpy(&update.val, &in[field->offset], field->size);
+        }
+        else
+        {
+            memcpy(&update.val.val_string, &in[field->offset], sizeof(const char *));
+        }
+
+        // Only a failed string allocation can fail here.
+        result = st_cloudvar_set_update(&update);
+        if (result != CANOPY_SUCCESS && firstError == CANOPY_SUCCESS)
+        {
+            firstError = result;
+        }
+    }
+    return firstError;
+}
+
+CanopyResultEnum st_cloudvar_struct_get_bound(STCloudVar var, void *dest)
+{
+    unsigned char *out = (unsigned char *)dest;
+    CanopyResultEnum result = CANOPY_SUCCESS;
+    uint32_t i;
+
+    if (!var->struct_binding)
+    {
+        return CANOPY_ERROR_INCORRECT_DATATYPE;
+    }
+
+    for (i = 0; i < var->struct_binding_len; i++)
+    {
+        const STCloudVarBinding_t *field = &var->struct_binding[i];
+        if (!st_cloudvar_has_value(field->member))
+        {
+            result = CANOPY_ERROR_VARIABLE_NOT_SET;
+        }
+        else if (field->size)
+        {
+            memcpy(&out[field->offset], &field->member->basic_value.val, field->size);
+        }
+        else
+        {
+            char *copy = RedString_strdup(field->member->basic_value.val.val_string);
+            if (!copy)
+            {
+                return CANOPY_ERROR_OUT_OF_MEMORY;
+            }
+            memcpy(&out[field->offset], &copy, sizeof(char *));
+        }
+    }
+    return result;
+}
@@ -14,6 +14,9 @@
 
 #include "cloudvar/st_cloudvar.h"
 #include "cloudvar/st_cloudvar_internal.h"
+#include "time/st_time.h"
+#include <stdlib.h>
+#include <string.h>
 
 STCloudVarSystem st_cloudvar_system_new(CanopyContext ctx)
 {
@@ -23,7 +26,6 @@ STCloudVarSystem st_cloudvar_system_new(CanopyContext ctx)
     sys->dirty = true;
     sys->context = ctx;
     sys->vars = RedHash_New(0);
-    sys->dirty_vars = RedHash_New(0);
     sys->callbacks = RedHash_New(0);
     return sys;
 }
@@ -34,7 +36,7 @@ void st_cloudvar_system_free(STCloudVarSystem sys)
     {
         // TODO: free all entries in hash table
         //RedHash_Free(sys->vars);
-        //RedHash_Free(sys->dirty_vars);
+        free(sys->vars_by_id);
         free(sys);
     }
 }
@@ -44,19 +46,121 @@ bool st_cloudvar_system_contains(STCloudVarSystem sys, const char *varname)
     return RedHash_HasKeyS(sys->vars, varname);
 }
 
-void st_cloudvar_system_clear_dirty(STCloudVarSystem sys)
+void st_cloudvar_system_mark_sent(STCloudVarSystem sys)
 {
+    STCloudVar var, next;
+    uint32_t i;
+    for (var = sys->dirty_head; var; var = next)
+    {
+        next = var->next_dirty;
+        var->dirty = false;
+        var->next_dirty = NULL;
+
+        // A variable already in an unwritten payload is already listed.
+        if (!var->sent)
+        {
+            var->sent = true;
+            var->next_sent = sys->sent_head;
+            sys->sent_head = var;
+        }
+        var->sddl_sent |= var->sddl_dirty_flag;
+        var->sddl_dirty_flag = false;
+        var->history_num_sent = var->history_count;
+        if (var->array_dirty_bits)
+        {
+            st_cloudvar_array_mark_sent_items(var);
+        }
+        for (i = 0; i < var->struct_num_members; i++)
+        {
+            if (var->struct_members[i].var->array_dirty_bits)
+            {
+                st_cloudvar_array_mark_sent_items(var->struct_members[i].var);
+            }
+        }
+    }
+    sys->dirty_head = NULL;
+    sys->dirty_tail = NULL;
+    sys->num_dirty = 0;
     sys->dirty = false;
-    RedHash_Clear(sys->dirty_vars);
+}
+
+void st_cloudvar_system_settle_sent(STCloudVarSystem sys, bool written)
+{
+    STCloudVar var, next;
+    uint32_t i;
+    for (var = sys->sent_head; var; var = next)
+    {
+        next = var->next_sent;
+        var->sent = false;
+        var->next_sent = NULL;
+        st_cloudvar_history_settle_sent(var, written);
+        if (var->array_sent_bits)
+        {
+            st_cloudvar_array_settle_sent_items(var, written);
+        }
+        for (i = 0; i < var->struct_num_members; i++)
+        {
+            if (var->struct_members[i].var->array_sent_bits)
+            {
+                st_cloudvar_array_settle_sent_items(var->struct_members[i].var, written);
+            }
+        }
+        if (!written)
+        {
+            var->sddl_dirty_flag |= var->sddl_sent;
+            st_cloudvar_system_mark_dirty(sys, var);
+        }
+        var->sddl_sent = false;
+    }
+    sys->sent_head = NULL;
 }
 
 void st_cloudvar_system_mark_dirty(STCloudVarSystem sys, STCloudVar var)
 {
-    const char *name = st_cloudvar_name(var);
-    RedHash_UpdateOrInsertS(sys->dirty_vars, NULL, name, (void *)true);
+    // Append to the dirty list the first time <var> is touched after a sync.
+    // Repeated sets of the same variable are then just a flag check.
+    if (!var->dirty)
+    {
+        var->dirty = true;
+        var->next_dirty = NULL;
+        if (sys->dirty_tail)
+        {
+            sys->dirty_tail->next_dirty = var;
+        }
+        else
+        {
+            sys->dirty_head = var;
+        }
+        sys->dirty_tail = var;
+        sys->num_dirty++;
+    }
     sys->dirty = true;
 }
 
+void st_cloudvar_system_set_change_hook(STCloudVarSystem sys, STCloudVarChangeHook hook, void *userdata)
+{
+    sys->change_hook = hook;
+    sys->change_hook_userdata = userdata;
+}
+
+void st_cloudvar_system_notify_change(STCloudVarSystem sys, STCloudVar var)
+{
+    if (sys->change_hook)
+    {
+        sys->change_hook(var, sys->change_hook_userdata);
+    }
+}
+
+void st_cloudvar_system_set_sample_time(STCloudVarSystem sys, uint64_t timeMs)
+{
+    sys->sample_time_ms = timeMs;
+}
+
+uint64_t st_cloudvar_system_sample_time(STCloudVarSystem sys)
+{
+    return sys->sample_time_ms ? sys->sample_time_ms : st_time_wall_ms();
+}
+
 bool st_cloudvar_system_is_dirty(STCloudVarSystem sys)
 {
     return sys->dirty;
@@ -64,30 +168,72 @@ bool st_cloudvar_system_is_dirty(STCloudVarSystem sys)
 
 uint32_t st_cloudvar_system_num_dirty(STCloudVarSystem sys)
 {
-    return RedHash_NumItems(sys->dirty_vars);
+    return sys->num_dirty;
 }
 
 STCloudVar st_cloudvar_system_lookup_var(STCloudVarSystem sys, const char *varname)
 {
-    return RedHash_GetWithDefaultS(sys->vars, varname, NULL);
+    char topName[256];
+    const char *dot;
+    STCloudVar var;
+
+    var = RedHash_GetWithDefaultS(sys->vars, varname, NULL);
+    if (var)
+    {
+        return var;
+    }
+
+    // Struct member path, such as "gps.latitude".
+    dot = strchr(varname, '.');
+    if (!dot || (size_t)(dot - varname) >= sizeof(topName))
+    {
+        return NULL;
+    }
+    memcpy(topName, varname, dot - varname);
+    topName[dot - varname] = '\0';
+    var = RedHash_GetWithDefaultS(sys->vars, topName, NULL);
+    if (!var)
+    {
+        return NULL;
+    }
+    return st_cloudvar_struct_member(var, dot + 1);
 }
 
-STCloudVar st_cloudvar_system_dirty_var(STCloudVarSystem sys, uint32_t idx)
+CanopyResultEnum st_cloudvar_system_assign_id(STCloudVarSystem sys, STCloudVar var)
 {
-    // TODO: Inefficient!
-    RedHashIterator_t iter;
-    const void *key;
-    size_t keySize;
-    uint32_t i = 0;
-    RED_HASH_FOREACH(iter, sys->dirty_vars, &key, &keySize, NULL)
+    if (sys->num_vars == sys->vars_by_id_capacity)
     {
-        const char *varname = (const char *)key;
-        if (i == idx)
+        uint32_t newCapacity = sys->vars_by_id_capacity ? 
+                sys->vars_by_id_capacity * 2 : 16;
+        STCloudVar *newVars;
+        newVars = realloc(sys->vars_by_id, newCapacity * sizeof(STCloudVar));
+        if (!newVars)
         {
-            return RedHash_GetWithDefaultS(sys->vars, varname, NULL);
+            return CANOPY_ERROR_OUT_OF_MEMORY;
         }
-        i++;
+        sys->vars_by_id = newVars;
+        sys->vars_by_id_capacity = newCapacity;
+    }
+    var->id = sys->num_vars;
+    sys->vars_by_id[sys->num_vars++] = var;
+    return CANOPY_SUCCESS;
+}
+
+STCloudVar st_cloudvar_system_lookup_var_by_id(STCloudVarSystem sys, uint64_t id)
+{
+    if (id >= sys->num_vars)
+    {
+        return NULL;
     }
-    return NULL;
+    return sys->vars_by_id[id];
 }
 
+STCloudVar st_cloudvar_system_first_dirty(STCloudVarSystem sys)
+{
+    return sys->dirty_head;
+}
+
+STCloudVar st_cloudvar_next_dirty(STCloudVar var)
+{
+    return var->next_dirty;
+}
@@ -0,0 +1,447 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "json/st_json_reader.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Longest number st_json_read_number accepts, in characters.
+#define _MAX_NUMBER_LEN 63
+
+static bool _fail(STJsonReader r)
+{
+    r->failed = true;
+    return false;
+}
+
+static void _skip_whitespace(STJsonReader r)
+{
+    while (r->pos < r->end &&
+            (*r->pos == ' ' || *r->pos == '\t' || *r->pos == '\n' || *r->pos == '\r'))
+    {
+        r->pos++;
+    }
+}
+
+// Consume <c>, after any whitespace.
+static bool _expect(STJsonReader r, char c)
+{
+    _skip_whitespace(r);
+    if (r->failed || r->pos >= r->end || *r->pos != c)
+    {
+        return _fail(r);
+    }
+    r->pos++;
+    return true;
+}
+
+static bool _read_literal(STJsonReader r, const char *literal)
+{
+    size_t len = strlen(literal);
+    _skip_whitespace(r);
+    if (r->failed || (size_t)(r->end - r->pos) < len || memcmp(r->pos, literal, len))
+    {
+        return _fail(r);
+    }
+    r->pos += len;
+    return true;
+}
+
+static int _hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Parse the 4 hex digits of a \u escape at <p>, which must have 4 characters
+// left before <end>.
+static bool _read_hex4(const char *p, const char *end, uint32_t *out)
+{
+    int i, digit;
+    if (end - p < 4)
+    {
+        return false;
+    }
+    *out = 0;
+    for (i = 0; i < 4; i++)
+    {
+        digit = _hex_digit(p[i]);
+        if (digit < 0)
+        {
+            return false;
+        }
+        *out = (*out << 4) | (uint32_t)digit;
+    }
+    return true;
+}
+
+static size_t _encode_utf8(uint32_t code, char *out)
+{
+    if (code < 0x80)
+    {
+        out[0] = (char)code;
+        return 1;
+    }
+    if (code < 0x800)
+    {
+        out[0] = (char)(0xc0 | (code >> 6));
+        out[1] = (char)(0x80 | (code & 0x3f));
+        return 2;
+    }
+    if (code < 0x10000)
+    {
+        out[0] = (char)(0xe0 | (code >> 12));
+        out[1] = (char)(0x80 | ((code >> 6) & 0x3f));
+        out[2] = (char)(0x80 | (code & 0x3f));
+        return 3;
+    }
+    out[0] = (char)(0xf0 | (code >> 18));
+    out[1] = (char)(0x80 | ((code >> 12) & 0x3f));
+    out[2] = (char)(0x80 | ((code >> 6) & 0x3f));
+    out[3] = (char)(0x80 | (code & 0x3f));
+    return 4;
+}
+
+// Read the string at the cursor, decoding it into <buf> if <buf> isn't NULL.
+// If it doesn't fit in <bufSize> bytes, the rest is still read but not
+// stored, and <*fits> is set to false.
+static bool _read_string(
+        STJsonReader r,
+        char *buf,
+        size_t bufSize,
+        size_t *len,
+        bool *fits)
+{
+    const char *p;
+    size_t n = 0;
+    bool ok = true;
+
+    if (!_expect(r, '"'))
+    {
+        return false;
+    }
+    for (p = r->pos; p < r->end && *p != '"'; )
+    {
+        char decoded[4];
+        size_t decodedLen = 1;
+        unsigned char c = (unsigned char)*p++;
+        uint32_t code, low;
+
+        if (c < 0x20)
+        {
+            return _fail(r);
+        }
+        if (c != '\\')
+        {
+            decoded[0] = (char)c;
+        }
+        else if (p >= r->end)
+        {
+            return _fail(r);
+        }
+        else
+        {
+            c = (unsigned char)*p++;
+            switch (c)
+            {
+                case '"': case '\\': case '/': decoded[0] = (char)c; break;
+                case 'b': decoded[0] = '\b'; break;
+                case 'f': decoded[0] = '\f'; break;
+                case 'n': decoded[0] = '\n'; break;
+                case 'r': decoded[0] = '\r'; break;
+                case 't': decoded[0] = '\t'; break;
+                case 'u':
+                    if (!_read_hex4(p, r->end, &code))
+                    {
+                        return _fail(r);
+                    }
+                    p += 4;
+                    // Combine a UTF-16 surrogate pair.
+                    if (code >= 0xd800 && code < 0xdc00 && r->end - p >= 6 &&
+                            p[0] == '\\' && p[1] == 'u' &&
+                            _read_hex4(p + 2, r->end, &low) &&
+                            low >= 0xdc00 && low < 0xe000)
+                    {
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                        p += 6;
+                    }
+                    decodedLen = _encode_utf8(code, decoded);
+                    break;
+                default:
+                    return _fail(r);
+            }
+        }
+
+        if (buf && ok)
+        {
+            if (n + decodedLen + 1 > bufSize)
+            {
+                ok = false;
+            }
+            else
+            {
+                memcpy(&buf[n], decoded, decodedLen);
+            }
+        }
+        n += decodedLen;
+    }
+    if (p >= r->end)
+    {
+        return _fail(r);
+    }
+    r->pos = p + 1;
+
+    if (buf && ok)
+    {
+        buf[n] = '\0';
+    }
+    if (len)
+    {
+        *len = n;
+    }
+    if (fits)
+    {
+        *fits = ok;
+    }
+    return true;
+}
+
+void st_json_reader_init(STJsonReader r, const char *text, size_t len)
+{
+    r->pos = text;
+    r->end = text + len;
+    r->failed = false;
+}
+
+bool st_json_reader_failed(STJsonReader r)
+{
+    return r->failed;
+}
+
+bool st_json_reader_at_end(STJsonReader r)
+{
+    _skip_whitespace(r);
+    return r->pos >= r->end;
+}
+
+STJsonTypeEnum st_json_peek_type(STJsonReader r)
+{
+    _skip_whitespace(r);
+    if (r->failed || r->pos >= r->end)
+    {
+        return ST_JSON_TYPE_INVALID;
+    }
+    switch (*r->pos)
+    {
+        case '{': return ST_JSON_TYPE_OBJECT;
+        case '[': return ST_JSON_TYPE_ARRAY;
+        case '"': return ST_JSON_TYPE_STRING;
+        case 't': case 'f': return ST_JSON_TYPE_BOOL;
+        case 'n': return ST_JSON_TYPE_NULL;
+        case '-': return ST_JSON_TYPE_NUMBER;
+        default:
+            if (*r->pos >= '0' && *r->pos <= '9')
+            {
+                return ST_JSON_TYPE_NUMBER;
+            }
+            return ST_JSON_TYPE_INVALID;
+    }
+}
+
+bool st_json_read_number(STJsonReader r, double *out)
+{
+    char buf[_MAX_NUMBER_LEN + 1];
+    char *numberEnd;
+    size_t n = 0;
+
+    if (st_json_peek_type(r) != ST_JSON_TYPE_NUMBER)
+    {
+        return _fail(r);
+    }
+    // strtod needs a terminated copy; the input buffer may not be.
+    while (r->pos < r->end && *r->pos && strchr("+-0123456789.eE", *r->pos))
+    {
+        if (n == _MAX_NUMBER_LEN)
+        {
+            return _fail(r);
+        }
+        buf[n++] = *r->pos++;
+    }
+    buf[n] = '\0';
+    *out = strtod(buf, &numberEnd);
+    if (numberEnd != &buf[n])
+    {
+        return _fail(r);
+    }
+    return true;
+}
+
+bool st_json_read_bool(STJsonReader r, bool *out)
+{
+    if (st_json_peek_type(r) != ST_JSON_TYPE_BOOL)
+    {
+        return _fail(r);
+    }
+    *out = (*r->pos == 't');
+    return _read_literal(r, *out ? "true" : "false");
+}
+
+bool st_json_read_null(STJsonReader r)
+{
+    return _read_literal(r, "null");
+}
+
+size_t st_json_peek_string_size(STJsonReader r)
+{
+    const char *p;
+    if (st_json_peek_type(r) != ST_JSON_TYPE_STRING)
+    {
+        return 0;
+    }
+    for (p = r->pos + 1; p < r->end && *p != '"'; p++)
+    {
+        if (*p == '\\')
+        {
+            p++;
+        }
+    }
+    return (size_t)(p - r->pos);
+}
+
+bool st_json_read_string(STJsonReader r, char *buf, size_t bufSize, size_t *len)
+{
+    bool fits;
+    if (!_read_string(r, buf, bufSize, len, &fits))
+    {
+        return false;
+    }
+    if (!fits)
+    {
+        return _fail(r);
+    }
+    return true;
+}
+
+bool st_json_read_key(STJsonReader r, char *buf, size_t bufSize, size_t *len)
+{
+    bool fits;
+    if (!_read_string(r, buf, bufSize, len, &fits) || !_expect(r, ':'))
+    {
+        return false;
+    }
+    return fits;
+}
+
+static bool _enter(STJsonReader r, STJsonContainer c, char open, char close)
+{
+    if (!_expect(r, open))
+    {
+        return false;
+    }
+    c->close = close;
+    c->first = true;
+    return true;
+}
+
+bool st_json_enter_object(STJsonReader r, STJsonContainer c)
+{
+    return _enter(r, c, '{', '}');
+}
+
+bool st_json_enter_array(STJsonReader r, STJsonContainer c)
+{
+    return _enter(r, c, '[', ']');
+}
+
+bool st_json_container_next(STJsonReader r, STJsonContainer c)
+{
+    _skip_whitespace(r);
+    if (r->failed)
+    {
+        return false;
+    }
+    if (r->pos < r->end && *r->pos == c->close)
+    {
+        r->pos++;
+        return false;
+    }
+    if (!c->first && !_expect(r, ','))
+    {
+        return false;
+    }
+    c->first = false;
+    return true;
+}
+
+// Skip an object or array.  Nested values aren't checked beyond string
+// syntax and bracket balance.
+static bool _skip_container(STJsonReader r)
+{
+    size_t depth = 0;
+    while (r->pos < r->end)
+    {
+        switch (*r->pos)
+        {
+            case '"':
+                if (!_read_string(r, NULL, 0, NULL, NULL))
+                {
+                    return false;
+                }
+                continue;
+            case '{':
+            case '[':
+                depth++;
+                break;
+            case '}':
+            case ']':
+                if (--depth == 0)
+                {
+                    r->pos++;
+                    return true;
+                }
+                break;
+            default:
+                break;
+        }
+        r->pos++;
+    }
+    return _fail(r);
+}
+
+bool st_json_skip(STJsonReader r)
+{
+    double number;
+    bool b;
+    switch (st_json_peek_type(r))
+    {
+        case ST_JSON_TYPE_OBJECT:
+        case ST_JSON_TYPE_ARRAY:
+            return _skip_container(r);
+        case ST_JSON_TYPE_STRING:
+            return _read_string(r, NULL, 0, NULL, NULL);
+        case ST_JSON_TYPE_NUMBER:
+            return st_json_read_number(r, &number);
+        case ST_JSON_TYPE_BOOL:
+            return st_json_read_bool(r, &b);
+        case ST_JSON_TYPE_NULL:
+            return st_json_read_null(r);
+        default:
+            return _fail(r);
+    }
+}
@@ -0,0 +1,119 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_JSON_READER_INCLUDED
+#define ST_JSON_READER_INCLUDED
+
+// Pull parser for JSON payloads
+//
+// Reads values one at a time from a length-bounded buffer, without building
+// a document and without allocating.  Strings are decoded into buffers the
+// caller provides.  The reader is a small cursor that lives on the caller's
+// stack, like STCborReader_t:
+//
+//      STJsonReader_t r;
+//      STJsonContainer_t obj;
+//      char key[64];
+//      st_json_reader_init(&r, payload, len);
+//      if (st_json_enter_object(&r, &obj))
+//      {
+//          while (st_json_container_next(&r, &obj))
+//          {
+//              st_json_read_key(&r, key, sizeof(key), NULL);
+//              // read or skip value
+//          }
+//      }
+//      if (st_json_reader_failed(&r)) ...
+//
+// Any malformed or truncated input, or a read of the wrong type, marks the
+// reader as failed.  Once failed, all further reads fail.
+
+#include <canopy.h>
+#include <stddef.h>
+
+typedef enum
+{
+    ST_JSON_TYPE_INVALID,
+    ST_JSON_TYPE_OBJECT,
+    ST_JSON_TYPE_ARRAY,
+    ST_JSON_TYPE_STRING,
+    ST_JSON_TYPE_NUMBER,
+    ST_JSON_TYPE_BOOL,
+    ST_JSON_TYPE_NULL,
+} STJsonTypeEnum;
+
+typedef struct STJsonReader_t
+{
+    const char *pos;
+    const char *end;
+    bool failed;
+} STJsonReader_t;
+typedef struct STJsonReader_t * STJsonReader;
+
+// Iteration state for an object or array being read.
+typedef struct STJsonContainer_t
+{
+    // '}' or ']'
+    char close;
+
+    // Has no item been read yet?
+    bool first;
+} STJsonContainer_t;
+typedef struct STJsonContainer_t * STJsonContainer;
+
+// Start reading <len> bytes at <text>.
+void st_json_reader_init(STJsonReader r, const char *text, size_t len);
+
+// Has the reader encountered malformed input or a type mismatch?
+bool st_json_reader_failed(STJsonReader r);
+
+// Has all input (other than whitespace) been consumed?
+bool st_json_reader_at_end(STJsonReader r);
+
+// Type of the next value, without consuming it.
+STJsonTypeEnum st_json_peek_type(STJsonReader r);
+
+bool st_json_read_number(STJsonReader r, double *out);
+bool st_json_read_bool(STJsonReader r, bool *out);
+bool st_json_read_null(STJsonReader r);
+
+// Size of buffer that st_json_read_string needs for the next string,
+// including the NUL terminator.  This is an upper bound: escape sequences
+// decode to fewer bytes than they take up.  0 if the next value isn't a
+// string.
+size_t st_json_peek_string_size(STJsonReader r);
+
+// Read a string, decoding escape sequences (\u escapes to UTF-8) into <buf>
+// and NUL-terminating it.  Fails if the decoded string doesn't fit in
+// <bufSize> bytes.  Sets <*len>, if not NULL, to the decoded length.
+bool st_json_read_string(STJsonReader r, char *buf, size_t bufSize, size_t *len);
+
+// Read an object's key and the ':' that follows it, like
+// st_json_read_string.  A key that doesn't fit in <bufSize> bytes is skipped
+// instead, and false returned, but the reader doesn't fail: the key's value
+// can still be read or skipped.
+bool st_json_read_key(STJsonReader r, char *buf, size_t bufSize, size_t *len);
+
+// Begin reading an object or array.
+bool st_json_enter_object(STJsonReader r, STJsonContainer c);
+bool st_json_enter_array(STJsonReader r, STJsonContainer c);
+
+// Returns true if the container has another item (or key/value pair) to
+// read.  Returns false, consuming the closing bracket, once it's done.
+bool st_json_container_next(STJsonReader r, STJsonContainer c);
+
+// Skip over the next value, including any nested values.
+bool st_json_skip(STJsonReader r);
+
+#endif // ST_JSON_READER_INCLUDED
@@ -0,0 +1,396 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "json/st_json_writer.h"
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Initial buffer size.  Grows geometrically from here.
+#define _INITIAL_CAPACITY 256
+
+// Enough room for any number written by this module.
+#define _MAX_NUMBER_LEN 32
+
+struct STJsonWriter_t
+{
+    char *buf;
+    size_t len;
+    size_t capacity;
+
+    // Does the next value or key need a leading comma?
+    bool need_comma;
+
+    // Has an allocation failed?
+    bool failed;
+
+    // If set, the buffer is allocated from here instead of the heap.
+    STArena arena;
+
+    // For in-place writers, the caller's buffer, which <buf> points
+    // <headroom> bytes into.
+    void **place;
+    size_t *place_capacity;
+    size_t headroom;
+    size_t tailroom;
+};
+
+// Grow an in-place writer's buffer so that <capacity> bytes fit between its
+// headroom and tailroom.  Returns the new text buffer, or NULL.
+static char * _realloc_in_place(STJsonWriter w, size_t capacity)
+{
+    size_t size = w->headroom + capacity + w->tailroom;
+    char *mem = realloc(*w->place, size);
+    if (!mem)
+    {
+        return NULL;
+    }
+    *w->place = mem;
+    *w->place_capacity = size;
+    return &mem[w->headroom];
+}
+
+// Make room for <extra> more bytes plus the NUL terminator.
+static bool _reserve(STJsonWriter w, size_t extra)
+{
+    size_t needed;
+    if (w->failed)
+    {
+        return false;
+    }
+    needed = w->len + extra + 1;
+    if (needed > w->capacity)
+    {
+        size_t newCapacity = w->capacity ? w->capacity : _INITIAL_CAPACITY;
+        char *newBuf;
+        while (newCapacity < needed)
+        {
+            newCapacity *= 2;
+        }
+        if (w->place)
+            newBuf = _realloc_in_place(w, newCapacity);
+        else if (w->arena)
+            newBuf = st_arena_realloc(w->arena, w->buf, w->capacity, newCapacity);
+        else
+            newBuf = realloc(w->buf, newCapacity);
+        if (!newBuf)
+        {
+            w->failed = true;
+            return false;
+        }
+        w->buf = newBuf;
+        w->capacity = newCapacity;
+    }
+    return true;
+}
+
+static void _append(STJsonWriter w, const char *bytes, size_t len)
+{
+    if (!_reserve(w, len))
+    {
+        return;
+    }
+    memcpy(&w->buf[w->len], bytes, len);
+    w->len += len;
+    w->buf[w->len] = '\0';
+}
+
+static void _append_char(STJsonWriter w, char c)
+{
+    if (!_reserve(w, 1))
+    {
+        return;
+    }
+    w->buf[w->len++] = c;
+    w->buf[w->len] = '\0';
+}
+
+// Called before writing any key, or any value that isn't preceded by a key.
+static void _separate(STJsonWriter w)
+{
+    if (w->need_comma)
+    {
+        _append_char(w, ',');
+    }
+}
+
+// Write the result of an snprintf-style format directly into the buffer.
+static void _append_number(STJsonWriter w, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+    if (!_reserve(w, _MAX_NUMBER_LEN))
+    {
+        return;
+    }
+    va_start(ap, fmt);
+    n = vsnprintf(&w->buf[w->len], _MAX_NUMBER_LEN, fmt, ap);
+    va_end(ap);
+    if (n > 0 && n < _MAX_NUMBER_LEN)
+    {
+        w->len += n;
+    }
+    w->buf[w->len] = '\0';
+}
+
+static void _append_escaped(STJsonWriter w, const char *sz)
+{
+    const char *start = sz;
+    const char *p;
+
+    _append_char(w, '"');
+    for (p = sz; *p; p++)
+    {
+        unsigned char c = (unsigned char)*p;
+        const char *esc = NULL;
+        char hex[7];
+        if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            continue;
+        }
+
+        // Flush run of characters that don't need escaping
+        _append(w, start, p - start);
+        start = p + 1;
+
+        switch (c)
+        {
+            case '"': esc = "\\\""; break;
+            case '\\': esc = "\\\\"; break;
+            case '\b': esc = "\\b"; break;
+            case '\f': esc = "\\f"; break;
+            case '\n': esc = "\\n"; break;
+            case '\r': esc = "\\r"; break;
+            case '\t': esc = "\\t"; break;
+            default:
+            {
+                snprintf(hex, sizeof(hex), "\\u%04x", c);
+                esc = hex;
+                break;
+            }
+        }
+        _append(w, esc, strlen(esc));
+    }
+    _append(w, start, p - start);
+    _append_char(w, '"');
+}
+
+STJsonWriter st_json_writer_new()
+{
+    return calloc(1, sizeof(struct STJsonWriter_t));
+}
+
+STJsonWriter st_json_writer_new_in_arena(STArena arena)
+{
+    STJsonWriter w = st_arena_alloc(arena, sizeof(struct STJsonWriter_t));
+    if (w)
+    {
+        memset(w, 0, sizeof(struct STJsonWriter_t));
+        w->arena = arena;
+    }
+    return w;
+}
+
+STJsonWriter st_json_writer_new_in_place(
+        STArena arena, 
+        void **buf, 
+        size_t *capacity, 
+        size_t headroom, 
+        size_t tailroom)
+{
+    STJsonWriter w = arena ? st_arena_alloc(arena, sizeof(struct STJsonWriter_t)) 
+            : malloc(sizeof(struct STJsonWriter_t));
+    if (!w)
+    {
+        return NULL;
+    }
+    memset(w, 0, sizeof(struct STJsonWriter_t));
+    w->arena = arena;
+    w->place = buf;
+    w->place_capacity = capacity;
+    w->headroom = headroom;
+    w->tailroom = tailroom;
+    if (*buf && *capacity > headroom + tailroom)
+    {
+        w->buf = &((char *)*buf)[headroom];
+        w->capacity = *capacity - headroom - tailroom;
+    }
+    return w;
+}
+
+void st_json_writer_free(STJsonWriter w)
+{
+    if (w && !w->arena)
+    {
+        if (!w->place)
+        {
+            free(w->buf);
+        }
+        free(w);
+    }
+}
+
+void st_json_writer_reset(STJsonWriter w)
+{
+    w->len = 0;
+    if (w->buf)
+    {
+        w->buf[0] = '\0';
+    }
+    w->need_comma = false;
+    w->failed = false;
+}
+
+bool st_json_writer_failed(STJsonWriter w)
+{
+    return w->failed;
+}
+
+size_t st_json_writer_len(STJsonWriter w)
+{
+    return w->len;
+}
+
+const char * st_json_writer_text(STJsonWriter w)
+{
+    if (w->failed || !_reserve(w, 0))
+    {
+        return NULL;
+    }
+    return w->buf;
+}
+
+char * st_json_writer_detach(STJsonWriter w)
+{
+    char *out = NULL;
+    if (!w->place && !w->failed && _reserve(w, 0))
+    {
+        out = w->buf;
+        w->buf = NULL;
+    }
+    st_json_writer_free(w);
+    return out;
+}
+
+void st_json_begin_object(STJsonWriter w)
+{
+    _separate(w);
+    _append_char(w, '{');
+    w->need_comma = false;
+}
+
+void st_json_end_object(STJsonWriter w)
+{
+    _append_char(w, '}');
+    w->need_comma = true;
+}
+
+void st_json_begin_array(STJsonWriter w)
+{
+    _separate(w);
+    _append_char(w, '[');
+    w->need_comma = false;
+}
+
+void st_json_end_array(STJsonWriter w)
+{
+    _append_char(w, ']');
+    w->need_comma = true;
+}
+
+void st_json_key(STJsonWriter w, const char *key)
+{
+    _separate(w);
+    _append_escaped(w, key);
+    _append_char(w, ':');
+    w->need_comma = false;
+}
+
+void st_json_key_uint(STJsonWriter w, uint32_t key)
+{
+    _separate(w);
+    _append_number(w, "\"%lu\":", (unsigned long)key);
+    w->need_comma = false;
+}
+
+void st_json_null(STJsonWriter w)
+{
+    _separate(w);
+    _append(w, "null", 4);
+    w->need_comma = true;
+}
+
+void st_json_bool(STJsonWriter w, bool value)
+{
+    _separate(w);
+    if (value)
+        _append(w, "true", 4);
+    else
+        _append(w, "false", 5);
+    w->need_comma = true;
+}
+
+void st_json_int(STJsonWriter w, int64_t value)
+{
+    _separate(w);
+    _append_number(w, "%lld", (long long)value);
+    w->need_comma = true;
+}
+
+void st_json_uint(STJsonWriter w, uint64_t value)
+{
+    _separate(w);
+    _append_number(w, "%llu", (unsigned long long)value);
+    w->need_comma = true;
+}
+
+void st_json_float32(STJsonWriter w, float value)
+{
+    if (!isfinite(value))
+    {
+        st_json_null(w);
+        return;
+    }
+    _separate(w);
+    _append_number(w, "%.9g", (double)value);
+    w->need_comma = true;
+}
+
+void st_json_float64(STJsonWriter w, double value)
+{
+    if (!isfinite(value))
+    {
+        st_json_null(w);
+        return;
+    }
+    _separate(w);
+    _append_number(w, "%.17g", value);
+    w->need_comma = true;
+}
+
+void st_json_string(STJsonWriter w, const char *sz)
+{
+    _separate(w);
+    _append_escaped(w, sz);
+    w->need_comma = true;
+}
+
+void st_json_raw(STJsonWriter w, const char *json)
+{
+    _separate(w);
+    _append(w, json, strlen(json));
+    w->need_comma = true;
+}
@@ -0,0 +1,113 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_JSON_WRITER_INCLUDED
+#define ST_JSON_WRITER_INCLUDED
+
+// Streaming JSON emitter for Canopy
+//
+// Appends JSON text directly into a single growable buffer, so that a
+// payload can be produced without first building a RedJson document.
+//
+//      STJsonWriter w = st_json_writer_new();
+//      st_json_begin_object(w);
+//      st_json_key(w, "temperature");
+//      st_json_float32(w, 21.5f);
+//      st_json_end_object(w);
+//      payload = st_json_writer_detach(w);
+//
+// The writer inserts commas itself.  It does not otherwise validate the
+// structure: callers must balance begin/end calls and write a key before
+// each value inside an object.
+//
+// Allocation failures are sticky.  Once one occurs, further writes are
+// ignored and st_json_writer_detach returns NULL.
+
+#include <canopy.h>
+#include <stddef.h>
+#include "arena/st_arena.h"
+
+typedef struct STJsonWriter_t * STJsonWriter;
+
+// Create a new, empty JSON writer.  Returns NULL on allocation failure.
+STJsonWriter st_json_writer_new();
+
+// Create a new, empty JSON writer whose state and buffer are allocated from
+// <arena>.  The writer and its text live until the arena is reset.
+STJsonWriter st_json_writer_new_in_arena(STArena arena);
+
+// Create a new, empty JSON writer that writes into the caller's heap buffer
+// <*buf> of <*capacity> bytes (NULL and 0 to start without one), so that
+// the text can be sent without being copied.  The text starts <headroom>
+// bytes in, and <tailroom> bytes are left spare after it.  The buffer is
+// grown with realloc, and <*buf> and <*capacity> kept up to date; it remains
+// the caller's.  The writer's state is allocated from <arena>, or from the
+// heap if <arena> is NULL.
+STJsonWriter st_json_writer_new_in_place(
+        STArena arena, 
+        void **buf, 
+        size_t *capacity, 
+        size_t headroom, 
+        size_t tailroom);
+
+// Free a JSON writer and its buffer.  No-op for arena-backed writers.  The
+// buffer of an in-place writer is left to the caller.
+void st_json_writer_free(STJsonWriter w);
+
+// Discard the written text, keeping the buffer for reuse.
+void st_json_writer_reset(STJsonWriter w);
+
+// Has an allocation failed since the writer was created or last reset?
+bool st_json_writer_failed(STJsonWriter w);
+
+// Length in bytes of the text written so far (excluding NUL terminator).
+size_t st_json_writer_len(STJsonWriter w);
+
+// Borrow the NUL-terminated text written so far.  Valid until the next
+// write, reset, or free.  Returns NULL if an allocation failed.
+const char * st_json_writer_text(STJsonWriter w);
+
+// Take ownership of the NUL-terminated text written so far (caller must
+// free it, unless the writer is arena-backed) and free the writer.  Returns
+// NULL if an allocation failed, or for in-place writers.
+char * st_json_writer_detach(STJsonWriter w);
+
+void st_json_begin_object(STJsonWriter w);
+void st_json_end_object(STJsonWriter w);
+void st_json_begin_array(STJsonWriter w);
+void st_json_end_array(STJsonWriter w);
+
+// Write an object key.  The next write is its value.
+void st_json_key(STJsonWriter w, const char *key);
+
+// Write an object key given as an unsigned integer (e.g. an array index).
+void st_json_key_uint(STJsonWriter w, uint32_t key);
+
+void st_json_null(STJsonWriter w);
+void st_json_bool(STJsonWriter w, bool value);
+void st_json_int(STJsonWriter w, int64_t value);
+void st_json_uint(STJsonWriter w, uint64_t value);
+
+// Floating point numbers are written with enough digits to round-trip.
+// NaN and infinities have no JSON representation and are written as null.
+void st_json_float32(STJsonWriter w, float value);
+void st_json_float64(STJsonWriter w, double value);
+
+// Write a string, escaping it as needed.
+void st_json_string(STJsonWriter w, const char *sz);
+
+// Write pre-serialized JSON text <json> as a value, verbatim.
+void st_json_raw(STJsonWriter w, const char *json);
+
+#endif // ST_JSON_WRITER_INCLUDED
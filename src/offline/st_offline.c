@@ -0,0 +1,356 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "offline/st_offline.h"
+#include "log/st_log.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define _MAGIC 0x43504f46 // "CPOF"
+#define _VERSION 1
+
+// Records start one page into the file, so that rewriting the header never
+// touches a page holding records.
+#define _HEADER_SIZE 4096
+
+typedef struct _Header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;
+
+    // Positions of the oldest sample and one past the newest.  Positions
+    // only ever increase; a sample's slot is its position modulo capacity.
+    uint64_t head;
+    uint64_t tail;
+
+    uint64_t num_dropped;
+} _Header_t;
+
+struct STOffline_t
+{
+    int fd;
+    void *map;
+    size_t map_size;
+
+    _Header_t *header;
+    STOfflineRecord_t *records;
+
+    CanopyOfflineOverflowEnum overflow;
+};
+
+// FNV-1a.
+static uint32_t _hash(const void *data, size_t len, uint32_t hash)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t _checksum(const STOfflineRecord_t *rec)
+{
+    uint32_t hash = 2166136261u;
+    hash = _hash(rec, offsetof(STOfflineRecord_t, checksum), hash);
+    hash = _hash(&rec->datatype, sizeof(*rec) - offsetof(STOfflineRecord_t, datatype), hash);
+    return hash;
+}
+
+static STOfflineRecord_t * _slot(STOffline store, uint64_t pos)
+{
+    return &store->records[pos % store->header->capacity];
+}
+
+static bool _is_valid(STOffline store, uint64_t pos)
+{
+    const STOfflineRecord_t *rec = _slot(store, pos);
+    return rec->seq == pos + 1 && rec->checksum == _checksum(rec);
+}
+
+// Write a record at the tail and publish it.
+static void _push(STOffline store, const STOfflineRecord_t *rec)
+{
+    STOfflineRecord_t *slot = _slot(store, store->header->tail);
+    *slot = *rec;
+    slot->seq = store->header->tail + 1;
+    slot->checksum = _checksum(slot);
+    store->header->tail++;
+}
+
+static bool _map(STOffline store, size_t size)
+{
+    store->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+    if (store->map == MAP_FAILED)
+    {
+        store->map = NULL;
+        return false;
+    }
+    store->map_size = size;
+    store->header = (_Header_t *)store->map;
+    store->records = (STOfflineRecord_t *)((char *)store->map + _HEADER_SIZE);
+    return true;
+}
+
+// Is the header one we wrote, for a file of <fileSize> bytes?
+static bool _header_ok(const _Header_t *header, size_t fileSize)
+{
+    return header->magic == _MAGIC &&
+        header->version == _VERSION &&
+        header->record_size == sizeof(STOfflineRecord_t) &&
+        header->capacity > 0 &&
+        fileSize >= _HEADER_SIZE + (size_t)header->capacity * sizeof(STOfflineRecord_t) &&
+        header->head <= header->tail &&
+        header->tail - header->head <= header->capacity;
+}
+
+STOffline st_offline_open(
+        const char *path, 
+        uint32_t capacity, 
+        CanopyOfflineOverflowEnum overflow)
+{
+    STOffline store;
+    struct stat st;
+    size_t size;
+    _Header_t header;
+
+    if (capacity == 0)
+    {
+        return NULL;
+    }
+    store = calloc(1, sizeof(struct STOffline_t));
+    if (!store)
+    {
+        return NULL;
+    }
+    store->overflow = overflow;
+    store->fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (store->fd < 0 || fstat(store->fd, &st) != 0)
+    {
+        st_log_error("Could not open offline store %s", path);
+        goto fail;
+    }
+
+    // Keep an existing store as it is, so that a change of configuration
+    // doesn't throw away samples that haven't been sent yet.
+    memset(&header, 0, sizeof(header));
+    if ((size_t)st.st_size >= _HEADER_SIZE && 
+            pread(store->fd, &header, sizeof(header), 0) == sizeof(header) &&
+            _header_ok(&header, (size_t)st.st_size))
+    {
+        size = _HEADER_SIZE + (size_t)header.capacity * sizeof(STOfflineRecord_t);
+        if (!_map(store, size))
+        {
+            goto fail;
+        }
+
+        // Pick up records appended after the header was last written.
+        while (store->header->tail - store->header->head < store->header->capacity &&
+                _is_valid(store, store->header->tail))
+        {
+            store->header->tail++;
+        }
+        return store;
+    }
+
+    st_log_info("Creating offline store %s for %u samples", path, capacity);
+    size = _HEADER_SIZE + (size_t)capacity * sizeof(STOfflineRecord_t);
+    if (ftruncate(store->fd, 0) != 0 || ftruncate(store->fd, size) != 0 || !_map(store, size))
+    {
+        st_log_error("Could not create offline store %s", path);
+        goto fail;
+    }
+    store->header->version = _VERSION;
+    store->header->record_size = sizeof(STOfflineRecord_t);
+    store->header->capacity = capacity;
+    store->header->head = 0;
+    store->header->tail = 0;
+    store->header->num_dropped = 0;
+    // The magic goes in last, so that a header that was never finished is
+    // not mistaken for a valid one.
+    store->header->magic = _MAGIC;
+    return store;
+
+fail:
+    st_offline_close(store);
+    return NULL;
+}
+
+void st_offline_close(STOffline store)
+{
+    if (!store)
+    {
+        return;
+    }
+    if (store->map)
+    {
+        msync(store->map, store->map_size, MS_SYNC);
+        munmap(store->map, store->map_size);
+    }
+    if (store->fd >= 0)
+    {
+        close(store->fd);
+    }
+    free(store);
+}
+
+// Make room in a full store by thinning it out: of each variable's
+// samples, every other one is kept, oldest first.  The survivors are
+// compacted toward the head, in order.  Variables are told apart by a hash
+// of their name, so in rare cases two variables share a counter.  If the
+// process dies part-way through, some samples may be stored twice.
+static void _downsample(STOffline store)
+{
+    bool keep[256];
+    uint64_t pos, out;
+    const STOfflineRecord_t *rec;
+    STOfflineRecord_t copy;
+    uint32_t bucket;
+
+    memset(keep, 1, sizeof(keep));
+    out = store->header->head;
+    for (pos = store->header->head; pos < store->header->tail; pos++)
+    {
+        if (!_is_valid(store, pos))
+        {
+            continue;
+        }
+        rec = _slot(store, pos);
+        bucket = _hash(rec->name, strlen(rec->name), 2166136261u) & 255;
+        if (keep[bucket])
+        {
+            if (out != pos)
+            {
+                copy = *rec;
+                copy.seq = out + 1;
+                copy.checksum = _checksum(&copy);
+                *_slot(store, out) = copy;
+            }
+            out++;
+        }
+        else
+        {
+            store->header->num_dropped++;
+        }
+        keep[bucket] = !keep[bucket];
+    }
+
+    // Clear the slots given up, so that reopening the store doesn't mistake
+    // them for samples appended after the header was written.
+    for (pos = out; pos < store->header->tail; pos++)
+    {
+        _slot(store, pos)->seq = 0;
+    }
+    store->header->tail = out;
+}
+
+bool st_offline_append(
+        STOffline store, 
+        uint64_t timeMs,
+        const char *name,
+        CanopyDatatypeEnum datatype,
+        int64_t intValue,
+        double floatValue)
+{
+    STOfflineRecord_t rec;
+    size_t nameLen = strlen(name);
+    _Header_t *header = store->header;
+
+    if (nameLen > ST_OFFLINE_MAX_NAME_LEN)
+    {
+        return false;
+    }
+
+    if (header->tail - header->head >= header->capacity)
+    {
+        switch (store->overflow)
+        {
+            case CANOPY_OFFLINE_DROP_NEWEST:
+            {
+                header->num_dropped++;
+                return false;
+            }
+            case CANOPY_OFFLINE_DOWNSAMPLE:
+            {
+                _downsample(store);
+                if (header->tail - header->head < header->capacity)
+                {
+                    break;
+                }
+                // Nothing to thin out (every sample is of a different
+                // variable), so fall back to dropping the oldest.
+            }
+            // fall through
+            case CANOPY_OFFLINE_DROP_OLDEST:
+            default:
+            {
+                header->head++;
+                header->num_dropped++;
+                break;
+            }
+        }
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.time_ms = timeMs;
+    rec.datatype = (uint8_t)datatype;
+    if (datatype == CANOPY_DATATYPE_FLOAT32 || datatype == CANOPY_DATATYPE_FLOAT64)
+        rec.value.val_float = floatValue;
+    else
+        rec.value.val_int = intValue;
+    memcpy(rec.name, name, nameLen + 1);
+    _push(store, &rec);
+    return true;
+}
+
+uint32_t st_offline_count(STOffline store)
+{
+    return (uint32_t)(store->header->tail - store->header->head);
+}
+
+uint64_t st_offline_num_dropped(STOffline store)
+{
+    return store->header->num_dropped;
+}
+
+const STOfflineRecord_t * st_offline_get(STOffline store, uint32_t i)
+{
+    uint64_t pos = store->header->head + i;
+    assert(pos < store->header->tail);
+    if (!_is_valid(store, pos))
+    {
+        return NULL;
+    }
+    return _slot(store, pos);
+}
+
+void st_offline_consume(STOffline store, uint32_t n)
+{
+    assert(n <= st_offline_count(store));
+    store->header->head += n;
+}
+
+void st_offline_sync(STOffline store)
+{
+    msync(store->map, store->map_size, MS_ASYNC);
+}
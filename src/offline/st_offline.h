@@ -0,0 +1,123 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_OFFLINE_INCLUDED
+#define ST_OFFLINE_INCLUDED
+
+// Crash-safe store of timestamped Cloud Variable samples, kept in a
+// fixed-size ring in a memory-mapped file.
+//
+// Samples are recorded while the device can't reach the server, and sent
+// in batches once it can.  The file survives restarts: reopening it picks
+// up where the last process left off.
+//
+// The file is one header page followed by <capacity> 64-byte records.
+// Each record carries its position in the ring and a checksum, so a record
+// that was only half-written when the process died is recognized and
+// ignored.  The header's head and tail are updated after the records they
+// cover, and opening the file recovers any records appended after the last
+// header update.
+//
+//      STOffline store = st_offline_open("/var/lib/canopy/offline", 16384,
+//              CANOPY_OFFLINE_DROP_OLDEST);
+//      st_offline_append(store, st_time_wall_ms(), "temperature",
+//              CANOPY_DATATYPE_FLOAT32, 0, 21.5);
+//      ...
+//      n = st_offline_count(store);
+//      for (i = 0; i < n; i++)
+//      {
+//          send(st_offline_get(store, i));
+//      }
+//      st_offline_consume(store, n);
+
+#include <canopy.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Longest variable name that can be recorded.  Samples of variables with
+// longer names are not stored.
+#define ST_OFFLINE_MAX_NAME_LEN 34
+
+// One recorded sample, exactly as it is laid out in the file.
+typedef struct STOfflineRecord_t
+{
+    // Position in the ring plus one (0 marks an unused slot).
+    uint64_t seq;
+
+    // Wall-clock time of the sample, in milliseconds since the Unix epoch.
+    uint64_t time_ms;
+
+    // val_float for float32 and float64 variables, val_int otherwise.
+    union
+    {
+        int64_t val_int;
+        double val_float;
+    } value;
+
+    // Checksum of the rest of the record.
+    uint32_t checksum;
+
+    // CanopyDatatypeEnum of the variable.
+    uint8_t datatype;
+
+    // NUL-terminated variable name.
+    char name[ST_OFFLINE_MAX_NAME_LEN + 1];
+} STOfflineRecord_t;
+
+typedef struct STOffline_t * STOffline;
+
+// Open the store at <path>, creating it with room for <capacity> samples if
+// it doesn't exist (or isn't a valid store).  An existing store keeps its
+// own capacity and its samples.  <overflow> decides what happens when a
+// sample is appended to a full store.  Returns NULL on failure.
+STOffline st_offline_open(
+        const char *path, 
+        uint32_t capacity, 
+        CanopyOfflineOverflowEnum overflow);
+
+// Flush the store to disk and close it.
+void st_offline_close(STOffline store);
+
+// Record a sample.  <intValue> is used for integer and bool variables, and
+// <floatValue> for float32 and float64 variables.  Returns false if the
+// sample was not stored (because the store is full and drops new samples,
+// or the name is too long).
+bool st_offline_append(
+        STOffline store, 
+        uint64_t timeMs,
+        const char *name,
+        CanopyDatatypeEnum datatype,
+        int64_t intValue,
+        double floatValue);
+
+// Number of samples stored.
+uint32_t st_offline_count(STOffline store);
+
+// Number of samples discarded because the store was full, since it was
+// created.
+uint64_t st_offline_num_dropped(STOffline store);
+
+// Get the <i>th oldest sample, 0 being the oldest.  Returns NULL if the
+// record is damaged, in which case it should be skipped.  The record is
+// valid until the next call that modifies the store.
+const STOfflineRecord_t * st_offline_get(STOffline store, uint32_t i);
+
+// Remove the <n> oldest samples.
+void st_offline_consume(STOffline store, uint32_t n);
+
+// Schedule the store's dirty pages to be written to disk.  Samples survive
+// a crash of the process without this, but not a power loss.
+void st_offline_sync(STOffline store);
+
+#endif // ST_OFFLINE_INCLUDED
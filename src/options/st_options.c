@@ -60,6 +60,20 @@ STOptions st_options_new_default()
     _OPTION_SET(options, CANOPY_SKIP_SSL_CERT_CHECK, false);
     _OPTION_SET(options, CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_WSS);
     _OPTION_SET(options, CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_WSS);
+    _OPTION_SET(options, CANOPY_SYNC_BLOCKING, false);
+    _OPTION_SET(options, CANOPY_SYNC_TIMEOUT_MS, 10000);
+    _OPTION_SET(options, CANOPY_SYNC_ARENA_MAX_BYTES, 0);
+    _OPTION_SET(options, CANOPY_PAYLOAD_FORMAT, CANOPY_PAYLOAD_FORMAT_JSON);
+    _OPTION_SET(options, CANOPY_SYNC_THREAD, false);
+    _OPTION_SET(options, CANOPY_RECONNECT_MIN_MS, 500);
+    _OPTION_SET(options, CANOPY_RECONNECT_MAX_MS, 30000);
+    _OPTION_SET(options, CANOPY_WS_RX_BUFFER_BYTES, 4096);
+    _OPTION_SET(options, CANOPY_WS_MAX_MESSAGE_BYTES, 1024*1024);
+    _OPTION_SET(options, CANOPY_WS_MAX_BYTES_IN_FLIGHT, 64*1024);
+    _OPTION_SET(options, CANOPY_SEND_LATENCY_BUDGET_MS, 50);
+    _OPTION_SET(options, CANOPY_OFFLINE_CAPACITY, 16384);
+    _OPTION_SET(options, CANOPY_OFFLINE_OVERFLOW, CANOPY_OFFLINE_DROP_OLDEST);
+    _OPTION_SET(options, CANOPY_OFFLINE_BATCH_SIZE, 512);
 
     return options;
 }
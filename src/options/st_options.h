@@ -65,6 +65,19 @@
     _OPTION_LIST_FOREACH(CANOPY_SKIP_SSL_CERT_CHECK, bool, int, _noop, atoi) \
     _OPTION_LIST_FOREACH(CANOPY_SYNC_BLOCKING, bool, int, _noop, atoi) \
     _OPTION_LIST_FOREACH(CANOPY_SYNC_TIMEOUT_MS, int, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_SYNC_ARENA_MAX_BYTES, int, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_PAYLOAD_FORMAT, CanopyPayloadFormatEnum, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_SYNC_THREAD, bool, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_RECONNECT_MIN_MS, int, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_RECONNECT_MAX_MS, int, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_WS_RX_BUFFER_BYTES, int, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_WS_MAX_MESSAGE_BYTES, int, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_WS_MAX_BYTES_IN_FLIGHT, int, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_SEND_LATENCY_BUDGET_MS, int, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_OFFLINE_FILE, char *, char *, free, (char *)) \
+    _OPTION_LIST_FOREACH(CANOPY_OFFLINE_CAPACITY, int, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_OFFLINE_OVERFLOW, CanopyOfflineOverflowEnum, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_OFFLINE_BATCH_SIZE, int, int, _noop, atoi) \
     _OPTION_LIST_FOREACH(CANOPY_VAR_SEND_PROTOCOL, CanopyProtocolEnum, int, _noop, atoi) \
     _OPTION_LIST_FOREACH(CANOPY_VAR_RECV_PROTOCOL, CanopyProtocolEnum, int, _noop, atoi)
 
@@ -78,7 +91,10 @@
     _OPTION_LIST_FOREACH(CANOPY_VAR_DATATYPE, CanopyDatatypeEnum, int, _noop, atoi) \
     _OPTION_LIST_FOREACH(CANOPY_VAR_DIRECTION, CanopyDirectionEnum, int, _noop, atoi) \
     _OPTION_LIST_FOREACH(CANOPY_VAR_MIN_VALUE, double, double, _noop, atof) \
-    _OPTION_LIST_FOREACH(CANOPY_VAR_MAX_VALUE, double, double, _noop, atof)
+    _OPTION_LIST_FOREACH(CANOPY_VAR_MAX_VALUE, double, double, _noop, atof) \
+    _OPTION_LIST_FOREACH(CANOPY_VAR_CHANGE_FILTER, CanopyVarChangeFilterEnum, int, _noop, atoi) \
+    _OPTION_LIST_FOREACH(CANOPY_VAR_DEADBAND, double, double, _noop, atof) \
+    _OPTION_LIST_FOREACH(CANOPY_VAR_HISTORY_CAPACITY, int, int, _noop, atoi)
 
 #define _OPTION_LIST_FOREACH(option, datatype, va_datatype, freefn, fromstring) 
 
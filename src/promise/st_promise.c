@@ -0,0 +1,104 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "promise/st_promise.h"
+#include <assert.h>
+#include <stdlib.h>
+
+struct STPromisePool_t
+{
+    CanopyContext ctx;
+
+    // Released promises, ready for reuse.
+    CanopyPromise free_list;
+};
+
+STPromisePool st_promise_pool_new(CanopyContext ctx)
+{
+    STPromisePool pool = calloc(1, sizeof(struct STPromisePool_t));
+    if (!pool)
+    {
+        return NULL;
+    }
+    pool->ctx = ctx;
+    return pool;
+}
+
+void st_promise_pool_free(STPromisePool pool)
+{
+    CanopyPromise promise, next;
+    if (!pool)
+    {
+        return;
+    }
+    for (promise = pool->free_list; promise; promise = next)
+    {
+        next = promise->next;
+        free(promise);
+    }
+    free(pool);
+}
+
+CanopyPromise st_promise_new(STPromisePool pool)
+{
+    CanopyPromise promise;
+    if (pool->free_list)
+    {
+        promise = pool->free_list;
+        pool->free_list = promise->next;
+    }
+    else
+    {
+        promise = malloc(sizeof(struct CanopyPromise_t));
+        if (!promise)
+        {
+            return NULL;
+        }
+    }
+    promise->ctx = pool->ctx;
+    promise->pool = pool;
+    promise->refcount = 1;
+    promise->done = false;
+    promise->result = CANOPY_ERROR_PROMISE_NOT_COMPLETE;
+    promise->cb = NULL;
+    promise->cb_userdata = NULL;
+    promise->next = NULL;
+    return promise;
+}
+
+void st_promise_retain(CanopyPromise promise)
+{
+    promise->refcount++;
+}
+
+void st_promise_release(CanopyPromise promise)
+{
+    assert(promise->refcount > 0);
+    if (--promise->refcount == 0)
+    {
+        promise->next = promise->pool->free_list;
+        promise->pool->free_list = promise;
+    }
+}
+
+void st_promise_complete(CanopyPromise promise, CanopyResultEnum result)
+{
+    assert(!promise->done);
+    promise->done = true;
+    promise->result = result;
+    if (promise->cb)
+    {
+        promise->cb(promise, result, promise->cb_userdata);
+    }
+}
@@ -0,0 +1,73 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_PROMISE_INCLUDED
+#define ST_PROMISE_INCLUDED
+
+// Internal implementation of CanopyPromise.
+//
+// A promise is reference counted.  The operation that creates it holds one
+// reference until it completes the promise, and the application holds
+// another if the promise was handed out.  Released promises go back to the
+// pool they came from, so a steady stream of operations doesn't allocate.
+
+#include <canopy.h>
+
+typedef struct STPromisePool_t * STPromisePool;
+
+struct CanopyPromise_t
+{
+    // Context whose operation this promise tracks.
+    CanopyContext ctx;
+
+    // Pool to return this promise to once it is released.
+    STPromisePool pool;
+
+    int refcount;
+
+    bool done;
+    CanopyResultEnum result;
+
+    // Called once, when the promise completes.
+    CanopyPromiseCallback cb;
+    void *cb_userdata;
+
+    // Next promise in whatever list currently holds this one (an operation's
+    // waiters, or the pool's free list).
+    CanopyPromise next;
+};
+
+// Create an empty promise pool for <ctx>.  Returns NULL on allocation
+// failure.
+STPromisePool st_promise_pool_new(CanopyContext ctx);
+
+// Free a promise pool.  All promises obtained from it must have been
+// released.
+void st_promise_pool_free(STPromisePool pool);
+
+// Obtain a new, pending promise with a reference count of 1.  Returns NULL
+// on allocation failure.
+CanopyPromise st_promise_new(STPromisePool pool);
+
+// Add a reference to <promise>.
+void st_promise_retain(CanopyPromise promise);
+
+// Drop a reference to <promise>, returning it to its pool when none are
+// left.
+void st_promise_release(CanopyPromise promise);
+
+// Mark <promise> as done with <result> and invoke its callback.
+void st_promise_complete(CanopyPromise promise, CanopyResultEnum result);
+
+#endif // ST_PROMISE_INCLUDED
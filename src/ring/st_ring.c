@@ -0,0 +1,136 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ring/st_ring.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Slot <i> is free for the producer that claims position <pos> when
+// seq == pos, and holds an entry for the consumer at position <pos> when
+// seq == pos + 1.  Popping sets seq to pos + capacity, ready for the
+// producer one lap later.
+struct STRing_t
+{
+    size_t mask;
+    size_t entry_size;
+
+    _Atomic size_t *seqs;
+    unsigned char *entries;
+
+    // Next position to push to (shared by producers).  Kept apart from
+    // <tail> so producers and the consumer don't fight over a cache line.
+    _Atomic size_t head;
+    char pad[64];
+
+    // Next position to pop from (consumer only).
+    size_t tail;
+};
+
+STRing st_ring_new(size_t capacity, size_t entrySize)
+{
+    STRing ring;
+    size_t i, n = 1;
+
+    while (n < capacity)
+    {
+        n *= 2;
+    }
+
+    ring = calloc(1, sizeof(struct STRing_t));
+    if (!ring)
+    {
+        return NULL;
+    }
+    ring->seqs = malloc(n * sizeof(ring->seqs[0]));
+    ring->entries = malloc(n * entrySize);
+    if (!ring->seqs || !ring->entries)
+    {
+        st_ring_free(ring);
+        return NULL;
+    }
+    for (i = 0; i < n; i++)
+    {
+        atomic_init(&ring->seqs[i], i);
+    }
+    ring->mask = n - 1;
+    ring->entry_size = entrySize;
+    atomic_init(&ring->head, 0);
+    ring->tail = 0;
+    return ring;
+}
+
+void st_ring_free(STRing ring)
+{
+    if (ring)
+    {
+        free((void *)ring->seqs);
+        free(ring->entries);
+        free(ring);
+    }
+}
+
+bool st_ring_push(STRing ring, const void *entry)
+{
+    size_t pos, seq;
+    intptr_t diff;
+
+    pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (;;)
+    {
+        seq = atomic_load_explicit(&ring->seqs[pos & ring->mask], memory_order_acquire);
+        diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            // Slot is free; try to claim it.  On failure <pos> is reloaded.
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // Slot still holds an entry from the previous lap.
+            return false;
+        }
+        else
+        {
+            // Another producer got here first.
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+
+    memcpy(&ring->entries[(pos & ring->mask) * ring->entry_size], entry, ring->entry_size);
+    atomic_store_explicit(&ring->seqs[pos & ring->mask], pos + 1, memory_order_release);
+    return true;
+}
+
+bool st_ring_pop(STRing ring, void *out)
+{
+    size_t pos = ring->tail;
+    size_t seq;
+
+    seq = atomic_load_explicit(&ring->seqs[pos & ring->mask], memory_order_acquire);
+    if (seq != pos + 1)
+    {
+        return false;
+    }
+
+    memcpy(out, &ring->entries[(pos & ring->mask) * ring->entry_size], ring->entry_size);
+    atomic_store_explicit(&ring->seqs[pos & ring->mask], pos + ring->mask + 1, memory_order_release);
+    ring->tail = pos + 1;
+    return true;
+}
@@ -0,0 +1,49 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_RING_INCLUDED
+#define ST_RING_INCLUDED
+
+// Bounded, lock-free multi-producer single-consumer queue of fixed-size
+// entries.
+//
+// Any number of threads may call st_ring_push concurrently without taking a
+// lock.  Only one thread at a time may call st_ring_pop (callers that pop
+// from several threads must serialize with their own lock).
+//
+// Each slot carries a sequence number that tells producers and the consumer
+// whose turn it is, so a push is one compare-and-swap on the shared head
+// plus a copy into a slot nobody else is touching.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct STRing_t * STRing;
+
+// Create a ring holding up to <capacity> entries of <entrySize> bytes each.
+// <capacity> is rounded up to a power of two.  Returns NULL on allocation
+// failure.
+STRing st_ring_new(size_t capacity, size_t entrySize);
+
+// Free a ring.  Entries still queued are discarded.
+void st_ring_free(STRing ring);
+
+// Copy <entry> into the ring.  Returns false if the ring is full.
+bool st_ring_push(STRing ring, const void *entry);
+
+// Copy the oldest entry into <out> and remove it.  Returns false if the ring
+// is empty.
+bool st_ring_pop(STRing ring, void *out);
+
+#endif // ST_RING_INCLUDED
@@ -15,24 +15,81 @@
  */
 
 #include "sync/st_sync.h"
+#include "cbor/st_cbor.h"
+#include "cbor/st_cbor_reader.h"
+#include "cbor/st_cbor_writer.h"
 #include "cloudvar/st_cloudvar.h"
 #include "http/st_http.h"
+#include "json/st_json_reader.h"
+#include "json/st_json_writer.h"
 #include "log/st_log.h"
+#include "offline/st_offline.h"
 #include "options/st_options.h"
+#include "promise/st_promise.h"
+#include "time/st_time.h"
 #include "websocket/st_websocket.h"
 #include "red_json.h"
 #include "red_string.h"
 #include <sddl.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 
+static bool _sends_over_websocket(STOptions options)
+{
+    return options->val_CANOPY_VAR_SEND_PROTOCOL == CANOPY_PROTOCOL_WS ||
+        options->val_CANOPY_VAR_SEND_PROTOCOL == CANOPY_PROTOCOL_WSS;
+}
+
+// Claim the WebSocket transmit buffer to serialize an outbound payload into,
+// if payloads are sent over the WebSocket.  Sets <*tx> to NULL otherwise.
+static CanopyResultEnum _claim_tx(STOptions options, STWebSocket ws, STWebSocketTxBuffer *tx)
+{
+    *tx = NULL;
+    if (!_sends_over_websocket(options))
+    {
+        return CANOPY_SUCCESS;
+    }
+    *tx = st_websocket_tx_claim(ws);
+    return *tx ? CANOPY_SUCCESS : CANOPY_ERROR_CONNECTION_FAILED;
+}
+
+// Create a writer for an outbound payload: in place in <tx> if it isn't NULL,
+// or in <arena>.
+static STJsonWriter _new_json_writer(STArena arena, STWebSocketTxBuffer tx)
+{
+    if (tx)
+    {
+        return st_json_writer_new_in_place(arena, &tx->mem, &tx->capacity, 
+                tx->headroom, tx->tailroom);
+    }
+    return st_json_writer_new_in_arena(arena);
+}
+
+static STCborWriter _new_cbor_writer(STArena arena, STWebSocketTxBuffer tx)
+{
+    if (tx)
+    {
+        return st_cbor_writer_new_in_place(arena, &tx->mem, &tx->capacity, 
+                tx->headroom, tx->tailroom);
+    }
+    return st_cbor_writer_new_in_arena(arena);
+}
+
+// Send a payload generated with _new_json_writer or _new_cbor_writer.  Over
+// the WebSocket, the payload is already in <tx>, and is queued from there.
 static CanopyResultEnum _send_payload(
         CanopyContext ctx, 
         STOptions options, 
         STWebSocket ws,
-        const char *payload)
+        STWebSocketTxBuffer tx,
+        const void *payload,
+        size_t len)
 {
+    bool binary = (options->val_CANOPY_PAYLOAD_FORMAT == CANOPY_PAYLOAD_FORMAT_CBOR);
+
     // Send payload to cloud
     if (!st_option_is_set(options, CANOPY_VAR_SEND_PROTOCOL))
     {
@@ -44,22 +101,20 @@ static CanopyResultEnum _send_payload(
     {
         return CANOPY_ERROR_PROTOCOL_NOT_SUPPORTED;
     }
-    else if (options->val_CANOPY_VAR_SEND_PROTOCOL == CANOPY_PROTOCOL_WS ||
-            options->val_CANOPY_VAR_SEND_PROTOCOL == CANOPY_PROTOCOL_WSS)
+    else if (_sends_over_websocket(options))
     {
         // Push: WS implementation
-        if (!(st_websocket_is_connected(ws) && st_websocket_is_write_ready(ws)))
-        {
-            return CANOPY_ERROR_CONNECTION_FAILED;
-        }
         // TODO: need a different payload for WS as for HTTP?
-        st_websocket_write(ws, payload);
+        st_websocket_tx_queue(ws, tx, len, binary);
     }
     else if (options->val_CANOPY_VAR_SEND_PROTOCOL == CANOPY_PROTOCOL_NOOP)
     {
         // Push: NOOP implementation
         // Just log the payload
-        printf("NOOP PUSH:\n%s\n", payload);
+        if (binary)
+            printf("NOOP PUSH:\n<%d bytes CBOR>\n", (int)len);
+        else
+            printf("NOOP PUSH:\n%s\n", (const char *)payload);
     }
     else {
         return CANOPY_ERROR_PROTOCOL_NOT_SUPPORTED;
@@ -67,218 +122,1460 @@ static CanopyResultEnum _send_payload(
     return CANOPY_SUCCESS;
 }
 
-static CanopyResultEnum _process_payload(STCloudVarSystem sys, const char *payload)
+// Process an inbound CBOR payload:
+//
+//  {
+//      "vars" : {
+//          <id or name> : <value>,
+//          ...
+//      }
+//  }
+//
+// Unknown keys and unknown variables are skipped.
+static CanopyResultEnum _process_cbor_payload(STCloudVarSystem sys, const void *payload, size_t len)
 {
-    st_log_debug("Processing payload %s", payload); // TODO: Only log if payload logging enabled
-    fprintf(stderr, "_process_payload'%s'\n", payload);
+    STCborReader_t r;
+    STCborContainer_t top;
+    CanopyResultEnum result;
+
+    st_log_debug("Processing CBOR payload (%d bytes)", (int)len);
+    st_cbor_reader_init(&r, payload, len);
 
-    RedJsonObject json = RedJson_Parse(payload);
-    if (!json)
+    if (!st_cbor_enter_map(&r, &top))
     {
         return CANOPY_ERROR_PARSING_PAYLOAD;
     }
-
-    if (RedJsonObject_HasKey(json, "vars"))
+    while (st_cbor_container_next(&r, &top))
     {
-        unsigned numVars, i;
-        RedJsonObject varsJson;
-        char ** varnames;
-        CanopyResultEnum result;
+        const char *key;
+        size_t keyLen;
+        STCborContainer_t vars;
 
-        if (!RedJsonObject_IsValueObject(json, "vars"))
+        if (!st_cbor_read_text(&r, &key, &keyLen))
         {
-            st_log_error("Inbound payload error: Expected \"vars\" to be JSON object\n");
+            return CANOPY_ERROR_PARSING_PAYLOAD;
+        }
+        if (!(keyLen == 4 && !strncmp(key, "vars", 4)))
+        {
+            st_cbor_skip(&r);
+            continue;
+        }
+
+        if (st_cbor_peek_type(&r) != ST_CBOR_TYPE_MAP)
+        {
+            st_log_error("Inbound payload error: Expected \"vars\" to be map\n");
             return CANOPY_ERROR_PROCESSING_PAYLOAD;
         }
+        st_cbor_enter_map(&r, &vars);
+        while (st_cbor_container_next(&r, &vars))
+        {
+            STCloudVar cloudvar = NULL;
+            if (st_cbor_peek_type(&r) == ST_CBOR_TYPE_UINT)
+            {
+                uint64_t id;
+                st_cbor_read_uint(&r, &id);
+                cloudvar = st_cloudvar_system_lookup_var_by_id(sys, id);
+            }
+            else if (st_cbor_peek_type(&r) == ST_CBOR_TYPE_TEXT)
+            {
+                const char *name;
+                size_t nameLen;
+                char nameBuf[256];
+                st_cbor_read_text(&r, &name, &nameLen);
+                if (nameLen < sizeof(nameBuf))
+                {
+                    memcpy(nameBuf, name, nameLen);
+                    nameBuf[nameLen] = '\0';
+                    cloudvar = st_cloudvar_system_lookup_var(sys, nameBuf);
+                }
+            }
+            else
+            {
+                return CANOPY_ERROR_PARSING_PAYLOAD;
+            }
+
+            if (!cloudvar)
+            {
+                // TODO: is this an error?
+                st_cbor_skip(&r);
+                continue;
+            }
+            result = st_cloudvar_update_from_cbor(cloudvar, &r);
+            if (result != CANOPY_SUCCESS)
+            {
+                return result;
+            }
+        }
+    }
+
+    if (st_cbor_reader_failed(&r))
+    {
+        return CANOPY_ERROR_PARSING_PAYLOAD;
+    }
+    return CANOPY_SUCCESS;
+}
+
+// Process an inbound JSON payload:
+//
+//  {
+//      "vars" : {
+//          <name> : <value>,
+//          ...
+//      }
+//  }
+//
+// The payload is read with a pull parser, and each value is written straight
+// into its Cloud Variable as it is reached: no document is built and nothing
+// is allocated, except to grow a string variable's buffer.  Unknown keys and
+// unknown variables are skipped.
+static CanopyResultEnum _process_json_payload(STCloudVarSystem sys, const char *payload, size_t len)
+{
+    STJsonReader_t r;
+    STJsonContainer_t top;
+    CanopyResultEnum result;
+    char key[256];
 
-        varsJson = RedJsonObject_GetObject(json, "vars");
+    st_log_debug("Processing payload %.*s", (int)len, payload); // TODO: Only log if payload logging enabled
+    st_json_reader_init(&r, payload, len);
 
-        numVars = RedJsonObject_NumItems(varsJson);
-        varnames = RedJsonObject_NewKeysArray(varsJson);
-        if (!varnames)
+    if (!st_json_enter_object(&r, &top))
+    {
+        return CANOPY_ERROR_PARSING_PAYLOAD;
+    }
+    while (st_json_container_next(&r, &top))
+    {
+        STJsonContainer_t vars;
+
+        if (!st_json_read_key(&r, key, sizeof(key), NULL) || strcmp(key, "vars"))
         {
-            return CANOPY_ERROR_OUT_OF_MEMORY;
+            st_json_skip(&r);
+            continue;
         }
-        for (i = 0 ; i < numVars; i++)
+
+        if (st_json_peek_type(&r) != ST_JSON_TYPE_OBJECT)
         {
-            STCloudVar cloudvar;
-            RedJsonValue json;
-            cloudvar = st_cloudvar_system_lookup_var(sys, varnames[i]);
+            st_log_error("Inbound payload error: Expected \"vars\" to be JSON object\n");
+            return CANOPY_ERROR_PROCESSING_PAYLOAD;
+        }
+        st_json_enter_object(&r, &vars);
+        while (st_json_container_next(&r, &vars))
+        {
+            STCloudVar cloudvar = NULL;
+            if (st_json_read_key(&r, key, sizeof(key), NULL))
+            {
+                cloudvar = st_cloudvar_system_lookup_var(sys, key);
+            }
             if (!cloudvar)
             {
                 // TODO: is this an error?
+                st_json_skip(&r);
                 continue;
             }
-            json = RedJsonObject_Get(varsJson, varnames[i]);
-            result = st_cloudvar_update_from_json(cloudvar, json);
+            result = st_cloudvar_update_from_json(cloudvar, &r);
             if (result != CANOPY_SUCCESS)
             {
                 return result;
             }
         }
-        RedJsonObject_FreeKeysArray(varnames);
     }
 
+    if (st_json_reader_failed(&r))
+    {
+        return CANOPY_ERROR_PARSING_PAYLOAD;
+    }
     return CANOPY_SUCCESS;
 }
 
-static void _handle_ws_recv(STWebSocket ws, const char *payload, void *userdata)
+// Process an inbound payload.  Payloads are accepted in either format: a
+// CBOR payload is a map, whose initial byte (0xa0-0xbf) can't begin a JSON
+// document.
+static CanopyResultEnum _process_payload(STCloudVarSystem sys, const char *payload, size_t len)
 {
-    fprintf(stderr, "_handle_ws_recv '%s'\n", payload);
-    _process_payload((STCloudVarSystem)userdata, payload);
+    if (len > 0 && ((uint8_t)payload[0] >> 5) == ST_CBOR_MAJOR_MAP)
+    {
+        return _process_cbor_payload(sys, payload, len);
+    }
+    return _process_json_payload(sys, payload, len);
 }
 
-static char * _gen_handshake_payload(const char *uuid, const char *secret)
+
+// Writes handshake payload into <tx>.  Returns its length, or 0 on failure.
+static size_t _gen_handshake_payload(
+        STArena arena, 
+        STWebSocketTxBuffer tx, 
+        const char *uuid, 
+        const char *secret)
 {
-    return RedString_PrintfToNewChars("{\"device_id\" : \"%s\", \"secret_key\" : \"%s\"  }", uuid, secret);
+    STJsonWriter w;
+    w = _new_json_writer(arena, tx);
+    if (!w)
+    {
+        return 0;
+    }
+    st_json_begin_object(w);
+    st_json_key(w, "device_id");
+    st_json_string(w, uuid ? uuid : "");
+    st_json_key(w, "secret_key");
+    st_json_string(w, secret ? secret : "");
+    st_json_end_object(w);
+    return st_json_writer_failed(w) ? 0 : st_json_writer_len(w);
 }
 
-static char * _gen_outbound_payload(STCloudVarSystem cloudvars)
+// Does any dirty Cloud Variable have samples in its history?
+static bool _has_history(STCloudVarSystem cloudvars)
 {
-    uint32_t i, num_dirty;
-    // construct payload:
-    RedJsonObject json = RedJsonObject_New();
-    RedJsonObject json_vars = RedJsonObject_New();
-    RedJsonObject json_sddl = RedJsonObject_New();
-    num_dirty = st_cloudvar_system_num_dirty(cloudvars);
+    STCloudVar var;
+    for (var = st_cloudvar_system_first_dirty(cloudvars); 
+            var; 
+            var = st_cloudvar_next_dirty(var))
+    {
+        if (st_cloudvar_history_count(var) > 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
 
-    if (num_dirty > 0)
+// Write the "sddl" and "vars" sections of the outbound payload for every
+// dirty Cloud Variable, streaming straight into one output buffer.
+// Variables that keep a history (CANOPY_VAR_HISTORY_CAPACITY) also get
+// every sample set since the last sync in "history":
+//
+//  {
+//      "sddl" : {
+//          "out float32 temperature" : { ... }
+//      },
+//      "vars" : {
+//          "temperature" : 21.5
+//      },
+//      "history" : {
+//          "temperature" : {
+//              "t" : [1438019348000, 1438019348001],
+//              "v" : [21.4, 21.5]
+//          }
+//      }
+//  }
+static CanopyResultEnum _write_outbound_payload(STJsonWriter w, STCloudVarSystem cloudvars)
+{
+    STCloudVar var;
+    CanopyResultEnum result;
+
+    st_json_begin_object(w);
+    if (st_cloudvar_system_num_dirty(cloudvars) > 0)
     {
-        RedJsonObject_SetObject(json, "vars", json_vars);
-        RedJsonObject_SetObject(json, "sddl", json_sddl);
+        // If a variable's configuration hasn't been sent yet, or is dirty,
+        // send it.  The declaration JSON comes from libsddl as a DOM, but
+        // it is only generated once per variable.
+        st_json_key(w, "sddl");
+        st_json_begin_object(w);
+        for (var = st_cloudvar_system_first_dirty(cloudvars); 
+                var; 
+                var = st_cloudvar_next_dirty(var))
+        {
+            RedJsonObject properties;
+            char *propertiesJson;
+            if (!st_cloudvar_is_sddl_dirty(var))
+            {
+                continue;
+            }
+            properties = st_cloudvar_definition_json(var);
+            if (!properties)
+            {
+                return CANOPY_ERROR_OUT_OF_MEMORY;
+            }
+            propertiesJson = RedJsonObject_ToJsonString(properties);
+            RedJsonObject_Free(properties);
+            if (!propertiesJson)
+            {
+                return CANOPY_ERROR_OUT_OF_MEMORY;
+            }
+            st_json_key(w, st_cloudvar_decl_string(var));
+            st_json_raw(w, propertiesJson);
+            free(propertiesJson);
+            // TODO: set other configuration settings
+        }
+        st_json_end_object(w);
 
         // For each dirty cloud variable, add to the payload "vars" object:
         // TODO: race condition?
-        for (i = 0; i < num_dirty; i++)
+        // TODO:
+        //   - timestamp for better synchronization?
+        st_json_key(w, "vars");
+        st_json_begin_object(w);
+        for (var = st_cloudvar_system_first_dirty(cloudvars); 
+                var; 
+                var = st_cloudvar_next_dirty(var))
+        {
+            if (!st_cloudvar_has_value(var))
+            {
+                continue;
+            }
+            st_json_key(w, st_cloudvar_name(var));
+            result = st_cloudvar_value_write_json(w, var);
+            if (result != CANOPY_SUCCESS)
+            {
+                return result;
+            }
+        }
+        st_json_end_object(w);
+
+        if (_has_history(cloudvars))
         {
-            STCloudVar var = st_cloudvar_system_dirty_var(cloudvars, i);
+            st_json_key(w, "history");
+            st_json_begin_object(w);
+            for (var = st_cloudvar_system_first_dirty(cloudvars); 
+                    var; 
+                    var = st_cloudvar_next_dirty(var))
+            {
+                if (st_cloudvar_history_count(var) == 0)
+                {
+                    continue;
+                }
+                st_json_key(w, st_cloudvar_name(var));
+                result = st_cloudvar_history_write_json(w, var);
+                if (result != CANOPY_SUCCESS)
+                {
+                    return result;
+                }
+            }
+            st_json_end_object(w);
+        }
+    }
+    st_json_end_object(w);
 
-            // If the variable's configuration hasn't been sent yet, or is
-            // dirty, send it
+    if (st_json_writer_failed(w))
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    return CANOPY_SUCCESS;
+}
+
+// CBOR counterpart of _write_outbound_payload.  Variables are referenced by
+// numeric ID.  Each variable's ID is announced in "ids" in the same payload
+// that carries its SDDL:
+//
+//  {
+//      "sddl" : {
+//          "out float32 temperature" : "<SDDL properties, as JSON text>"
+//      },
+//      "ids" : {
+//          "temperature" : 0
+//      },
+//      "vars" : {
+//          0 : 21.5
+//      },
+//      "history" : {
+//          0 : { "t" : [...], "v" : [...] }
+//      }
+//  }
+static CanopyResultEnum _write_outbound_payload_cbor(STCborWriter w, STCloudVarSystem cloudvars)
+{
+    STCloudVar var;
+    CanopyResultEnum result;
+
+    st_cbor_begin_map(w);
+    if (st_cloudvar_system_num_dirty(cloudvars) > 0)
+    {
+        st_cbor_string(w, "sddl");
+        st_cbor_begin_map(w);
+        for (var = st_cloudvar_system_first_dirty(cloudvars); 
+                var; 
+                var = st_cloudvar_next_dirty(var))
+        {
+            RedJsonObject properties;
+            char *propertiesJson;
+            if (!st_cloudvar_is_sddl_dirty(var))
+            {
+                continue;
+            }
+            properties = st_cloudvar_definition_json(var);
+            if (!properties)
+            {
+                return CANOPY_ERROR_OUT_OF_MEMORY;
+            }
+            propertiesJson = RedJsonObject_ToJsonString(properties);
+            RedJsonObject_Free(properties);
+            if (!propertiesJson)
+            {
+                return CANOPY_ERROR_OUT_OF_MEMORY;
+            }
+            st_cbor_string(w, st_cloudvar_decl_string(var));
+            st_cbor_string(w, propertiesJson);
+            free(propertiesJson);
+        }
+        st_cbor_end_map(w);
+
+        st_cbor_string(w, "ids");
+        st_cbor_begin_map(w);
+        for (var = st_cloudvar_system_first_dirty(cloudvars); 
+                var; 
+                var = st_cloudvar_next_dirty(var))
+        {
             if (st_cloudvar_is_sddl_dirty(var))
             {
-                //
-                // "sddl" : {
-                //     "uint16 var_u16" : {}
-                // }
-                const char * decl = st_cloudvar_decl_string(var);
-                RedJsonObject properties = st_cloudvar_definition_json(var);
-                RedJsonObject_SetObject(json_sddl, decl, properties);
-                // TODO: set other configuration settings
-
-                // TODO: Only actually mark as configured after the server responds.
-                st_cloudvar_clear_sddl_dirty_flag(var);
+                st_cbor_string(w, st_cloudvar_name(var));
+                st_cbor_uint(w, st_cloudvar_id(var));
             }
+        }
+        st_cbor_end_map(w);
 
-            // TODO:
-            //   - timestamp for better synchronization?
-            if (st_cloudvar_has_value(var))
+        st_cbor_string(w, "vars");
+        st_cbor_begin_map(w);
+        for (var = st_cloudvar_system_first_dirty(cloudvars); 
+                var; 
+                var = st_cloudvar_next_dirty(var))
+        {
+            if (!st_cloudvar_has_value(var))
+            {
+                continue;
+            }
+            st_cbor_uint(w, st_cloudvar_id(var));
+            result = st_cloudvar_value_write_cbor(w, var);
+            if (result != CANOPY_SUCCESS)
             {
-                RedJsonValue val;
-                CanopyResultEnum result;
-                result = st_cloudvar_value_to_json(&val, var);
+                return result;
+            }
+        }
+        st_cbor_end_map(w);
+
+        if (_has_history(cloudvars))
+        {
+            st_cbor_string(w, "history");
+            st_cbor_begin_map(w);
+            for (var = st_cloudvar_system_first_dirty(cloudvars); 
+                    var; 
+                    var = st_cloudvar_next_dirty(var))
+            {
+                if (st_cloudvar_history_count(var) == 0)
+                {
+                    continue;
+                }
+                st_cbor_uint(w, st_cloudvar_id(var));
+                result = st_cloudvar_history_write_cbor(w, var);
                 if (result != CANOPY_SUCCESS)
                 {
-                    return NULL;
+                    return result;
                 }
-                RedJsonObject_Set(
-                        json_vars, 
-                        st_cloudvar_name(var), 
-                        val);
             }
+            st_cbor_end_map(w);
         }
     }
+    st_cbor_end_map(w);
 
-    return RedJsonObject_ToJsonString(json);
+    if (st_cbor_writer_failed(w))
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    return CANOPY_SUCCESS;
 }
 
-CanopyResultEnum st_sync(CanopyContext ctx, STOptions options, STWebSocket ws, STCloudVarSystem cloudvars)
+// Returns outbound payload, serialized into <tx> or (if <tx> is NULL)
+// allocated from <arena>, or NULL on failure.  The payload's length is
+// stored in <*len>.  JSON payloads are also NUL-terminated.
+static const void * _gen_outbound_payload(
+        STArena arena, 
+        STWebSocketTxBuffer tx,
+        CanopyPayloadFormatEnum format,
+        STCloudVarSystem cloudvars,
+        size_t *len)
 {
     CanopyResultEnum result;
 
+    if (format == CANOPY_PAYLOAD_FORMAT_CBOR)
+    {
+        STCborWriter w = _new_cbor_writer(arena, tx);
+        if (!w)
+        {
+            return NULL;
+        }
+        result = _write_outbound_payload_cbor(w, cloudvars);
+        if (result != CANOPY_SUCCESS)
+        {
+            return NULL;
+        }
+        *len = st_cbor_writer_len(w);
+        return st_cbor_writer_data(w);
+    }
+    else
+    {
+        STJsonWriter w = _new_json_writer(arena, tx);
+        if (!w)
+        {
+            return NULL;
+        }
+        result = _write_outbound_payload(w, cloudvars);
+        if (result != CANOPY_SUCCESS)
+        {
+            return NULL;
+        }
+        *len = st_json_writer_len(w);
+        return st_json_writer_text(w);
+    }
+}
+
+// Samples recorded while offline, grouped by variable.  Each group is a
+// list of indices into <recs>, in recording order.
+typedef struct _HistoryBatch_t
+{
+    const STOfflineRecord_t **recs;
+    uint32_t *next;
+    uint32_t *group_first;
+    uint32_t *group_last;
+    uint32_t num_groups;
+} _HistoryBatch_t;
+
+#define _HISTORY_END ((uint32_t)-1)
+
+// Group the <n> oldest samples in <store> by variable, allocating from
+// <arena>.  Damaged records are left out.
+static bool _group_history(STArena arena, STOffline store, uint32_t n, _HistoryBatch_t *batch)
+{
+    const STOfflineRecord_t *rec;
+    uint32_t i, g;
+
+    batch->recs = st_arena_alloc(arena, n * sizeof(batch->recs[0]));
+    batch->next = st_arena_alloc(arena, n * sizeof(batch->next[0]));
+    batch->group_first = st_arena_alloc(arena, n * sizeof(batch->group_first[0]));
+    batch->group_last = st_arena_alloc(arena, n * sizeof(batch->group_last[0]));
+    if (!batch->recs || !batch->next || !batch->group_first || !batch->group_last)
+    {
+        return false;
+    }
+    batch->num_groups = 0;
+    for (i = 0; i < n; i++)
+    {
+        rec = st_offline_get(store, i);
+        batch->recs[i] = rec;
+        batch->next[i] = _HISTORY_END;
+        if (!rec)
+        {
+            continue;
+        }
+        // Devices have few variables, so a linear search is fine here.
+        for (g = 0; g < batch->num_groups; g++)
+        {
+            if (!strcmp(batch->recs[batch->group_first[g]]->name, rec->name))
+            {
+                break;
+            }
+        }
+        if (g == batch->num_groups)
+        {
+            batch->group_first[g] = i;
+            batch->num_groups++;
+        }
+        else
+        {
+            batch->next[batch->group_last[g]] = i;
+        }
+        batch->group_last[g] = i;
+    }
+    return true;
+}
+
+// Write the samples in <batch> as a history payload:
+//
+//  {
+//      "history" : {
+//          "temperature" : {
+//              "t" : [1438019348000, 1438019349000],
+//              "v" : [21.5, 21.6]
+//          }
+//      }
+//  }
+//
+// "t" holds each sample's time, in milliseconds since the Unix epoch, and
+// "v" its value.
+static void _write_history_payload(STJsonWriter w, const _HistoryBatch_t *batch)
+{
+    const STOfflineRecord_t *rec;
+    uint32_t g, i;
+
+    st_json_begin_object(w);
+    st_json_key(w, "history");
+    st_json_begin_object(w);
+    for (g = 0; g < batch->num_groups; g++)
+    {
+        st_json_key(w, batch->recs[batch->group_first[g]]->name);
+        st_json_begin_object(w);
+        st_json_key(w, "t");
+        st_json_begin_array(w);
+        for (i = batch->group_first[g]; i != _HISTORY_END; i = batch->next[i])
+        {
+            st_json_uint(w, batch->recs[i]->time_ms);
+        }
+        st_json_end_array(w);
+        st_json_key(w, "v");
+        st_json_begin_array(w);
+        for (i = batch->group_first[g]; i != _HISTORY_END; i = batch->next[i])
+        {
+            rec = batch->recs[i];
+            if (rec->datatype == CANOPY_DATATYPE_FLOAT32)
+                st_json_float32(w, (float)rec->value.val_float);
+            else if (rec->datatype == CANOPY_DATATYPE_FLOAT64)
+                st_json_float64(w, rec->value.val_float);
+            else if (rec->datatype == CANOPY_DATATYPE_BOOL)
+                st_json_bool(w, rec->value.val_int != 0);
+            else
+                st_json_int(w, rec->value.val_int);
+        }
+        st_json_end_array(w);
+        st_json_end_object(w);
+    }
+    st_json_end_object(w);
+    st_json_end_object(w);
+}
+
+// CBOR version of _write_history_payload.  Variables are referenced by
+// name, since the samples may predate the current context's numeric IDs.
+static void _write_history_payload_cbor(STCborWriter w, const _HistoryBatch_t *batch)
+{
+    const STOfflineRecord_t *rec;
+    uint32_t g, i;
+
+    st_cbor_begin_map(w);
+    st_cbor_string(w, "history");
+    st_cbor_begin_map(w);
+    for (g = 0; g < batch->num_groups; g++)
+    {
+        st_cbor_string(w, batch->recs[batch->group_first[g]]->name);
+        st_cbor_begin_map(w);
+        st_cbor_string(w, "t");
+        st_cbor_begin_array(w);
+        for (i = batch->group_first[g]; i != _HISTORY_END; i = batch->next[i])
+        {
+            st_cbor_uint(w, batch->recs[i]->time_ms);
+        }
+        st_cbor_end_array(w);
+        st_cbor_string(w, "v");
+        st_cbor_begin_array(w);
+        for (i = batch->group_first[g]; i != _HISTORY_END; i = batch->next[i])
+        {
+            rec = batch->recs[i];
+            if (rec->datatype == CANOPY_DATATYPE_FLOAT32)
+                st_cbor_float32(w, (float)rec->value.val_float);
+            else if (rec->datatype == CANOPY_DATATYPE_FLOAT64)
+                st_cbor_float64(w, rec->value.val_float);
+            else if (rec->datatype == CANOPY_DATATYPE_BOOL)
+                st_cbor_bool(w, rec->value.val_int != 0);
+            else
+                st_cbor_int(w, rec->value.val_int);
+        }
+        st_cbor_end_array(w);
+        st_cbor_end_map(w);
+    }
+    st_cbor_end_map(w);
+    st_cbor_end_map(w);
+}
+
+// Returns a history payload for the <n> oldest samples in <store>,
+// serialized into <tx> or (if <tx> is NULL) allocated from <arena>, or NULL
+// on failure.  The payload's length is stored in <*len>.
+static const void * _gen_history_payload(
+        STArena arena, 
+        STWebSocketTxBuffer tx,
+        CanopyPayloadFormatEnum format,
+        STOffline store,
+        uint32_t n,
+        size_t *len)
+{
+    _HistoryBatch_t batch;
+
+    if (!_group_history(arena, store, n, &batch))
+    {
+        return NULL;
+    }
+    if (format == CANOPY_PAYLOAD_FORMAT_CBOR)
+    {
+        STCborWriter w = _new_cbor_writer(arena, tx);
+        if (!w)
+        {
+            return NULL;
+        }
+        _write_history_payload_cbor(w, &batch);
+        if (st_cbor_writer_failed(w))
+        {
+            return NULL;
+        }
+        *len = st_cbor_writer_len(w);
+        return st_cbor_writer_data(w);
+    }
+    else
+    {
+        STJsonWriter w = _new_json_writer(arena, tx);
+        if (!w)
+        {
+            return NULL;
+        }
+        _write_history_payload(w, &batch);
+        if (st_json_writer_failed(w))
+        {
+            return NULL;
+        }
+        *len = st_json_writer_len(w);
+        return st_json_writer_text(w);
+    }
+}
+
+typedef enum
+{
+    // No cycle underway.
+    _SYNC_STATE_IDLE,
+
+    // Cycle requested but not started.
+    _SYNC_STATE_BEGIN,
+
+    // Connecting; the handshake goes out once the WebSocket is writable.
+    _SYNC_STATE_HANDSHAKE,
+
+    // Waiting to send the outbound payload.
+    _SYNC_STATE_SEND,
+
+    // Picking up whatever the server has sent.
+    _SYNC_STATE_RECEIVE
+} _SyncStateEnum;
+
+// List of promises waiting for the same cycle.
+typedef struct _PromiseList_t
+{
+    bool requested;
+
+    // Earliest deadline requested for the cycle, or 0 for none.
+    uint64_t deadline_us;
+
+    CanopyPromise head;
+    CanopyPromise tail;
+} _PromiseList_t;
+
+struct STSync_t
+{
+    CanopyContext ctx;
+    STOptions options;
+    STWebSocket ws;
+    STCloudVarSystem cloudvars;
+    STArena arena;
+
+    _SyncStateEnum state;
+
+    // Deadline for the cycle underway, or 0 for none.  Every step that
+    // waits on the network gives up once it passes.
+    uint64_t deadline_us;
+
+    // Number of cycles finished so far.
+    uint32_t num_finished;
+
+    // Waiters for the cycle underway, and for the one after it.
+    _PromiseList_t current;
+    _PromiseList_t next;
+
+    // st_websocket_connection_id of the connection the handshake was last
+    // sent over.  The handshake is resent whenever the WebSocket reconnects.
+    uint32_t handshake_conn_id;
+
+    // Context lock held around everything but network waits, or NULL when
+    // the STSync is only used from one thread.
+    pthread_mutex_t *lock;
+
+    // Store for changes made while offline (CANOPY_OFFLINE_FILE), opened
+    // the first time it is needed, and the path it was opened from.
+    STOffline offline;
+    char *offline_path;
+
+    // Number of samples in the batch last queued for sending, which are only
+    // removed from <offline> once it has been written on connection
+    // <offline_pending_conn>.  0 if none.
+    uint32_t offline_pending;
+    uint32_t offline_pending_conn;
+
+    // Have outbound payloads been queued on connection <sent_conn> that
+    // aren't known to have been written yet?  Their Cloud Variables are
+    // only settled once they have been, see st_cloudvar_system_mark_sent.
+    bool sent_pending;
+    uint32_t sent_conn;
+
+    // Could changes be sent right now?  Updated after every step, so that
+    // the change hook doesn't have to look at the WebSocket, which may be
+    // in the middle of st_websocket_service on another thread.
+    bool online;
+
+    // When the cycle underway first had its outbound payload ready to send,
+    // and until when it is being held back for coalescing (0 if not), see
+    // st_websocket_tx_hold_until.
+    uint64_t send_since_us;
+    uint64_t hold_until_us;
+
+    // Counters for CanopySendStats.
+    uint64_t num_syncs_with_changes;
+    uint64_t num_payloads;
+};
+
+static void _lock(STSync sync)
+{
+    if (sync->lock)
+    {
+        pthread_mutex_lock(sync->lock);
+    }
+}
+
+static void _unlock(STSync sync)
+{
+    if (sync->lock)
+    {
+        pthread_mutex_unlock(sync->lock);
+    }
+}
+
+static bool _uses_websocket(STOptions options);
+static bool _handshake_sent(STSync sync);
+
+// Is there a connection that changes can be sent over?
+static bool _is_online(STSync sync)
+{
+    return !_uses_websocket(sync->options) || _handshake_sent(sync);
+}
+
+// Open the offline store if CANOPY_OFFLINE_FILE is set (or has changed).
+// Returns false if there isn't one.
+static bool _ensure_offline(STSync sync)
+{
+    STOptions options = sync->options;
+
+    if (!options->has_CANOPY_OFFLINE_FILE || !options->val_CANOPY_OFFLINE_FILE)
+    {
+        return false;
+    }
+    if (sync->offline && !strcmp(sync->offline_path, options->val_CANOPY_OFFLINE_FILE))
+    {
+        return true;
+    }
+    st_offline_close(sync->offline);
+    free(sync->offline_path);
+    sync->offline_pending = 0;
+    sync->offline_path = RedString_strdup(options->val_CANOPY_OFFLINE_FILE);
+    sync->offline = st_offline_open(
+            options->val_CANOPY_OFFLINE_FILE,
+            options->val_CANOPY_OFFLINE_CAPACITY > 0 ? options->val_CANOPY_OFFLINE_CAPACITY : 1,
+            options->val_CANOPY_OFFLINE_OVERFLOW);
+    return sync->offline != NULL;
+}
+
+// Record local changes made while offline.
+static void _handle_change(STCloudVar var, void *userdata)
+{
+    STSync sync = (STSync)userdata;
+    int64_t intValue = 0;
+    double floatValue = 0.0;
+
+    if (sync->online || !_ensure_offline(sync))
+    {
+        return;
+    }
+    if (!st_cloudvar_basic_number(var, &intValue, &floatValue))
+    {
+        return;
+    }
+    st_offline_append(sync->offline, 
+            st_cloudvar_system_sample_time(st_cloudvar_system(var)), 
+            st_cloudvar_name(var),
+            st_cloudvar_datatype(var), intValue, floatValue);
+}
+
+static void _handle_ws_recv(STWebSocket ws, const char *payload, size_t len, void *userdata)
+{
+    STSync sync = (STSync)userdata;
+    _lock(sync);
+    _process_payload(sync->cloudvars, payload, len);
+    _unlock(sync);
+}
+
+static bool _uses_websocket(STOptions options)
+{
+    return options->val_CANOPY_VAR_RECV_PROTOCOL == CANOPY_PROTOCOL_WS ||
+        options->val_CANOPY_VAR_RECV_PROTOCOL == CANOPY_PROTOCOL_WSS;
+}
+
+static void _promise_list_append(
+        _PromiseList_t *list, 
+        CanopyPromise promise, 
+        uint64_t deadlineUs)
+{
+    list->deadline_us = st_time_min_deadline(list->deadline_us, deadlineUs);
+    list->requested = true;
+    if (!promise)
+    {
+        return;
+    }
+    st_promise_retain(promise);
+    promise->next = NULL;
+    if (list->tail)
+        list->tail->next = promise;
+    else
+        list->head = promise;
+    list->tail = promise;
+}
+
+// Complete every promise in <list> with <result> and empty it.
+static void _promise_list_complete(_PromiseList_t *list, CanopyResultEnum result)
+{
+    CanopyPromise promise, next;
+    promise = list->head;
+    list->requested = false;
+    list->deadline_us = 0;
+    list->head = list->tail = NULL;
+    for (; promise; promise = next)
+    {
+        next = promise->next;
+        st_promise_complete(promise, result);
+        st_promise_release(promise);
+    }
+}
+
+// Finish the current cycle, and begin the next one if it was requested.
+static void _finish_cycle(STSync sync, CanopyResultEnum result)
+{
+    _PromiseList_t finished = sync->current;
+
+    sync->num_finished++;
+    sync->deadline_us = 0;
+    sync->send_since_us = 0;
+    sync->hold_until_us = 0;
+    sync->current = sync->next;
+    memset(&sync->next, 0, sizeof(sync->next));
+    sync->state = sync->current.requested ? _SYNC_STATE_BEGIN : _SYNC_STATE_IDLE;
+
+    // Callbacks may request another sync, so run them last.
+    _promise_list_complete(&finished, result);
+}
+
+static CanopyResultEnum _begin(STSync sync)
+{
+    STOptions options = sync->options;
+    CanopyResultEnum result;
+    int16_t port;
+    bool useSSL = false;
+
     if (!st_option_is_set(options, CANOPY_CLOUD_SERVER))
     {
         return CANOPY_ERROR_MISSING_REQUIRED_OPTION;
     }
 
-    if (options->val_CANOPY_VAR_RECV_PROTOCOL == CANOPY_PROTOCOL_NOOP)
+    sync->deadline_us = sync->current.deadline_us;
+    if (options->val_CANOPY_SYNC_TIMEOUT_MS > 0)
+    {
+        sync->deadline_us = st_time_min_deadline(sync->deadline_us, 
+                st_time_now_us() + (uint64_t)options->val_CANOPY_SYNC_TIMEOUT_MS*1000);
+    }
+    if (st_time_expired(sync->deadline_us))
+    {
+        return CANOPY_ERROR_TIMED_OUT;
+    }
+
+    st_arena_set_max_bytes(sync->arena, 
+            options->has_CANOPY_SYNC_ARENA_MAX_BYTES ? 
+                options->val_CANOPY_SYNC_ARENA_MAX_BYTES : 0);
+
+    if (!_uses_websocket(options))
+    {
+        sync->state = _SYNC_STATE_SEND;
+        return CANOPY_SUCCESS;
+    }
+
+    // The handshake is sent once the connection is established, unless it
+    // has been sent over this connection already.  A connection that is
+    // being re-established is waited for, rather than started over.
+    st_websocket_set_backoff(sync->ws, 
+            options->val_CANOPY_RECONNECT_MIN_MS > 0 ? options->val_CANOPY_RECONNECT_MIN_MS : 0,
+            options->val_CANOPY_RECONNECT_MAX_MS > 0 ? options->val_CANOPY_RECONNECT_MAX_MS : 0);
+    st_websocket_set_send_limits(sync->ws,
+            options->val_CANOPY_WS_MAX_BYTES_IN_FLIGHT > 0 ? options->val_CANOPY_WS_MAX_BYTES_IN_FLIGHT : 1,
+            options->val_CANOPY_SEND_LATENCY_BUDGET_MS > 0 ? options->val_CANOPY_SEND_LATENCY_BUDGET_MS : 0);
+    st_websocket_set_recv_buffer(sync->ws,
+            options->val_CANOPY_WS_RX_BUFFER_BYTES > 0 ? options->val_CANOPY_WS_RX_BUFFER_BYTES : 4096,
+            options->val_CANOPY_WS_MAX_MESSAGE_BYTES > 0 ? options->val_CANOPY_WS_MAX_MESSAGE_BYTES : 1024*1024);
+    sync->state = _SYNC_STATE_HANDSHAKE;
+    if (st_websocket_state(sync->ws) != CANOPY_CONNECTION_STATE_DISCONNECTED)
+    {
+        return CANOPY_SUCCESS;
+    }
+
+    // WS Pull:
+    // Initiate websocket connection.
+    if (options->val_CANOPY_VAR_RECV_PROTOCOL == CANOPY_PROTOCOL_WSS)
+    {
+        port = options->val_CANOPY_HTTPS_PORT;
+        useSSL = true;
+    }
+    else 
+    {
+        port = options->val_CANOPY_HTTP_PORT;
+    }
+    result = st_websocket_connect(
+            sync->ws,
+            options->val_CANOPY_CLOUD_SERVER,
+            port,
+            useSSL,
+            options->val_CANOPY_SKIP_SSL_CERT_CHECK,
+            "/echo"); // TODO: rename
+    if (result != CANOPY_SUCCESS && 
+            st_websocket_state(sync->ws) == CANOPY_CONNECTION_STATE_DISCONNECTED)
+    {
+        return result;
+    }
+    return CANOPY_SUCCESS;
+}
+
+static CanopyResultEnum _send_handshake(STSync sync)
+{
+    STWebSocketTxBuffer tx;
+    size_t len;
+
+    tx = st_websocket_tx_claim(sync->ws);
+    if (!tx)
+    {
+        return CANOPY_ERROR_CONNECTION_FAILED;
+    }
+    len = _gen_handshake_payload(
+            sync->arena,
+            tx,
+            sync->options->val_CANOPY_DEVICE_UUID,
+            sync->options->val_CANOPY_DEVICE_SECRET_KEY);
+    if (!len)
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+
+    // TODO: need a different payload for WS as for HTTP?
+    st_websocket_tx_queue(sync->ws, tx, len, false);
+    sync->handshake_conn_id = st_websocket_connection_id(sync->ws);
+    return CANOPY_SUCCESS;
+}
+
+// Has the handshake been sent over the current connection?
+static bool _handshake_sent(STSync sync)
+{
+    return st_websocket_is_connected(sync->ws) &&
+        sync->handshake_conn_id == st_websocket_connection_id(sync->ws);
+}
+
+// Have the outbound payloads queued on the WebSocket been written?  If so,
+// forget what they carried.  If the connection they were queued on has
+// gone, they were discarded with it, so mark their Cloud Variables dirty
+// again to be sent with the next sync.
+static void _settle_sent(STSync sync)
+{
+    if (!sync->sent_pending)
+    {
+        return;
+    }
+    if (!st_websocket_is_connected(sync->ws) ||
+            st_websocket_connection_id(sync->ws) != sync->sent_conn)
+    {
+        st_cloudvar_system_settle_sent(sync->cloudvars, false);
+        sync->sent_pending = false;
+        return;
+    }
+    if (st_websocket_tx_flushed(sync->ws))
+    {
+        st_cloudvar_system_settle_sent(sync->cloudvars, true);
+        sync->sent_pending = false;
+    }
+}
+
+// Send outbound payload if any Cloud Variables have changed since the last
+// sync.
+static CanopyResultEnum _send(STSync sync)
+{
+    STCloudVarSystem cloudvars = sync->cloudvars;
+    STWebSocketTxBuffer tx;
+    CanopyResultEnum result;
+    const void *payload;
+    size_t len;
+
+    // Settle earlier payloads first, so that changes lost with a dropped
+    // connection go out with this one.
+    _settle_sent(sync);
+    if (!st_cloudvar_system_is_dirty(cloudvars))
+    {
+        sync->state = _SYNC_STATE_RECEIVE;
+        return CANOPY_SUCCESS;
+    }
+
+    result = _claim_tx(sync->options, sync->ws, &tx);
+    if (result != CANOPY_SUCCESS)
+    {
+        return result;
+    }
+    payload = _gen_outbound_payload(
+            sync->arena, 
+            tx,
+            sync->options->val_CANOPY_PAYLOAD_FORMAT, 
+            cloudvars, 
+            &len);
+    if (!payload)
+    {
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+
+    result = _send_payload(sync->ctx, sync->options, sync->ws, tx, payload, len);
+    if (result != CANOPY_SUCCESS)
+    {
+        return result;
+    }
+    sync->num_payloads++;
+
+    // Over the WebSocket the payload is only queued.  Keep track of what it
+    // carries until it has been written, see _settle_sent.
+    // TODO: Only actually mark as configured after the server responds.
+    st_cloudvar_system_mark_sent(cloudvars);
+    if (!_sends_over_websocket(sync->options))
+    {
+        st_cloudvar_system_settle_sent(cloudvars, true);
+    }
+    else if (!sync->sent_pending)
+    {
+        sync->sent_pending = true;
+        sync->sent_conn = st_websocket_connection_id(sync->ws);
+    }
+
+    sync->state = _SYNC_STATE_RECEIVE;
+    return CANOPY_SUCCESS;
+}
+
+// Has the batch of offline samples last queued been written?  If so, remove
+// its samples from the store.  If the connection it was queued on has gone,
+// forget about it, so that its samples are sent again.  Returns false while
+// it is still waiting to be written.
+static bool _settle_offline_batch(STSync sync)
+{
+    if (!sync->offline_pending)
+    {
+        return true;
+    }
+    if (!st_websocket_is_connected(sync->ws) ||
+            st_websocket_connection_id(sync->ws) != sync->offline_pending_conn)
+    {
+        sync->offline_pending = 0;
+        return true;
+    }
+    if (!st_websocket_tx_flushed(sync->ws))
+    {
+        return false;
+    }
+    st_offline_consume(sync->offline, sync->offline_pending);
+    st_offline_sync(sync->offline);
+    sync->offline_pending = 0;
+    return true;
+}
+
+// Send the oldest batch of changes recorded while offline, if the
+// connection is ready for it.  Returns true if a batch was sent.
+//
+// Samples are only removed once their batch has been written to the
+// connection, so a batch still queued when the connection drops is sent
+// again, as is one that was only partly removed when the process died
+// (at-least-once delivery).
+static bool _send_offline_batch(STSync sync)
+{
+    STOptions options = sync->options;
+    STWebSocketTxBuffer tx;
+    const void *payload;
+    uint32_t n;
+    size_t len;
+
+    if (!_ensure_offline(sync) || !_settle_offline_batch(sync) || !_is_online(sync))
+    {
+        return false;
+    }
+    n = st_offline_count(sync->offline);
+    if (n == 0)
+    {
+        return false;
+    }
+    if (_claim_tx(options, sync->ws, &tx) != CANOPY_SUCCESS)
+    {
+        return false;
+    }
+    if (options->val_CANOPY_OFFLINE_BATCH_SIZE > 0 && 
+            n > (uint32_t)options->val_CANOPY_OFFLINE_BATCH_SIZE)
+    {
+        n = options->val_CANOPY_OFFLINE_BATCH_SIZE;
+    }
+
+    payload = _gen_history_payload(sync->arena, tx, options->val_CANOPY_PAYLOAD_FORMAT,
+            sync->offline, n, &len);
+    if (!payload)
+    {
+        return false;
+    }
+    if (_send_payload(sync->ctx, options, sync->ws, tx, payload, len) != CANOPY_SUCCESS)
     {
-        // Noop Pull: 
+        return false;
     }
-    else if (options->val_CANOPY_VAR_RECV_PROTOCOL == CANOPY_PROTOCOL_WS ||
-            options->val_CANOPY_VAR_RECV_PROTOCOL == CANOPY_PROTOCOL_WSS)
+    sync->offline_pending = n;
+    sync->offline_pending_conn = st_websocket_connection_id(sync->ws);
+    return true;
+}
+
+// Is the WebSocket ready for the current step?  Fails with
+// CANOPY_ERROR_CONNECTION_FAILED if the connection has gone away.
+static CanopyResultEnum _check_ws_ready(STSync sync, bool *ready)
+{
+    *ready = st_websocket_is_connected(sync->ws) && 
+            st_websocket_is_write_ready(sync->ws);
+    if (!st_websocket_is_connected(sync->ws))
+    {
+        return CANOPY_ERROR_CONNECTION_FAILED;
+    }
+    return CANOPY_SUCCESS;
+}
+
+// Run one step of the current cycle.  Returns false if the step has to wait
+// for the network.
+static bool _step(STSync sync)
+{
+    CanopyResultEnum result = CANOPY_SUCCESS;
+    CanopyConnectionStateEnum wsState;
+    bool ready;
+
+    switch (sync->state)
     {
-        // WS Pull:
-        // Initiate websocket connection if necessary:
-        if (!st_websocket_is_connected(ws))
+        case _SYNC_STATE_IDLE:
         {
-            CanopyResultEnum result;
-            int16_t port;
-            bool useSSL = false;
-            if (options->val_CANOPY_VAR_RECV_PROTOCOL == CANOPY_PROTOCOL_WSS)
+            // If the WebSocket reconnected on its own, identify ourselves
+            // again so that the server can keep pushing changes to us.
+            if (_uses_websocket(sync->options) && 
+                    st_websocket_is_connected(sync->ws) &&
+                    st_websocket_is_write_ready(sync->ws) &&
+                    !_handshake_sent(sync))
             {
-                port = options->val_CANOPY_HTTPS_PORT;
-                useSSL = true;
+                _send_handshake(sync);
             }
-            else 
+
+            // Catch the server up on changes made while offline.
+            return _send_offline_batch(sync);
+        }
+        case _SYNC_STATE_BEGIN:
+        {
+            result = _begin(sync);
+            break;
+        }
+        case _SYNC_STATE_HANDSHAKE:
+        {
+            wsState = st_websocket_state(sync->ws);
+            if (_handshake_sent(sync))
             {
-                port = options->val_CANOPY_HTTP_PORT;
+                sync->state = _SYNC_STATE_SEND;
+                break;
             }
-            result = st_websocket_connect(
-                    ws,
-                    options->val_CANOPY_CLOUD_SERVER,
-                    port,
-                    useSSL,
-                    options->val_CANOPY_SKIP_SSL_CERT_CHECK,
-                    "/echo"); // TODO: rename
-            if (result != CANOPY_SUCCESS)
-                return result;
-
-            // Service websocket for first time
-            st_websocket_recv_callback(ws, _handle_ws_recv, cloudvars);
-            st_websocket_service(ws, 1000);
-            st_websocket_service(ws, 1000);
-
-            // send handhsake
-            char *handshakePayload;
-            handshakePayload = _gen_handshake_payload(
-                    options->val_CANOPY_DEVICE_UUID,
-                    options->val_CANOPY_DEVICE_SECRET_KEY);
-
-            while (!(st_websocket_is_connected(ws) && st_websocket_is_write_ready(ws)))
+            if (wsState == CANOPY_CONNECTION_STATE_DISCONNECTED)
             {
-                // TODO: give up eventually!
-                st_websocket_service(ws, 1000);
+                result = CANOPY_ERROR_CONNECTION_FAILED;
+                break;
             }
-            // TODO: need a different payload for WS as for HTTP?
-            st_websocket_write(ws, handshakePayload);
-            free(handshakePayload);
+            if (!(wsState == CANOPY_CONNECTION_STATE_CONNECTED && 
+                    st_websocket_is_write_ready(sync->ws)))
+            {
+                // Still connecting, or waiting to reconnect.
+                if (!st_time_expired(sync->deadline_us))
+                {
+                    return false;
+                }
+                // Don't leave a half-open connection behind; the next
+                // attempt starts over.
+                if (wsState != CANOPY_CONNECTION_STATE_WAITING_TO_RECONNECT)
+                {
+                    st_websocket_drop(sync->ws);
+                }
+                result = CANOPY_ERROR_TIMED_OUT;
+                break;
+            }
+            result = _send_handshake(sync);
+            if (result == CANOPY_SUCCESS)
+            {
+                sync->state = _SYNC_STATE_SEND;
+            }
+            break;
+        }
+        case _SYNC_STATE_SEND:
+        {
+            if (_sends_over_websocket(sync->options) && 
+                    st_cloudvar_system_is_dirty(sync->cloudvars))
+            {
+                result = _check_ws_ready(sync, &ready);
+                if (result == CANOPY_SUCCESS && !ready)
+                {
+                    if (!st_time_expired(sync->deadline_us))
+                    {
+                        return false;
+                    }
+                    result = CANOPY_ERROR_TIMED_OUT;
+                }
 
-            st_websocket_service(ws, 1000);
+                // If earlier payloads are still waiting to go out, hold this
+                // one back, so that changes made meanwhile go out with it.
+                if (result == CANOPY_SUCCESS)
+                {
+                    if (!sync->send_since_us)
+                    {
+                        sync->send_since_us = st_time_now_us();
+                    }
+                    sync->hold_until_us = st_websocket_tx_hold_until(
+                            sync->ws, sync->send_since_us);
+                    if (sync->hold_until_us && !st_time_expired(sync->deadline_us))
+                    {
+                        return false;
+                    }
+                    sync->hold_until_us = 0;
+                }
+            }
+            if (result == CANOPY_SUCCESS)
+            {
+                result = _send(sync);
+            }
+            break;
+        }
+        case _SYNC_STATE_RECEIVE:
+        {
+            if (_uses_websocket(sync->options))
+            {
+                st_websocket_service(sync->ws, 0);
+            }
+            _finish_cycle(sync, CANOPY_SUCCESS);
+            return true;
         }
     }
 
-    // Check if local copy of any Cloud Variables have changed since last sync.
-    if (st_cloudvar_system_is_dirty(cloudvars))
+    if (result != CANOPY_SUCCESS)
     {
-        char *payload;
-        payload = _gen_outbound_payload(cloudvars);
+        _finish_cycle(sync, result);
+    }
+    return true;
+}
 
-        result = _send_payload(ctx, options, ws, payload);
-        free(payload);
-        if (result != CANOPY_SUCCESS)
-            return result;
+STSync st_sync_new(
+        CanopyContext ctx, 
+        STOptions options, 
+        STWebSocket ws, 
+        STCloudVarSystem cloudvars, 
+        STArena arena)
+{
+    STSync sync = calloc(1, sizeof(struct STSync_t));
+    if (!sync)
+    {
+        return NULL;
+    }
+    sync->ctx = ctx;
+    sync->options = options;
+    sync->ws = ws;
+    sync->cloudvars = cloudvars;
+    sync->arena = arena;
+    sync->state = _SYNC_STATE_IDLE;
+    sync->online = !_uses_websocket(options);
+    st_websocket_recv_callback(ws, _handle_ws_recv, sync);
+    st_cloudvar_system_set_change_hook(cloudvars, _handle_change, sync);
+    return sync;
+}
 
-        st_cloudvar_system_clear_dirty(cloudvars);
+void st_sync_free(STSync sync)
+{
+    if (!sync)
+    {
+        return;
     }
+    _promise_list_complete(&sync->current, CANOPY_ERROR_UNKNOWN);
+    _promise_list_complete(&sync->next, CANOPY_ERROR_UNKNOWN);
+    st_cloudvar_system_set_change_hook(sync->cloudvars, NULL, NULL);
+    st_offline_close(sync->offline);
+    free(sync->offline_path);
+    free(sync);
+}
 
-    if (options->val_CANOPY_VAR_RECV_PROTOCOL == CANOPY_PROTOCOL_WS ||
-        options->val_CANOPY_VAR_RECV_PROTOCOL == CANOPY_PROTOCOL_WSS)
+void st_sync_start(STSync sync, CanopyPromise promise, uint64_t deadlineUs)
+{
+    // A cycle that hasn't touched the network yet can take on new waiters.
+    // Otherwise, changes made from now on may miss the cycle underway, so
+    // wait for another one.
+    if (st_cloudvar_system_is_dirty(sync->cloudvars))
     {
-        // Service websockets
-        // TODO: don't hardcode timeout
-        st_websocket_service(ws, 1000);
+        sync->num_syncs_with_changes++;
     }
+    if (sync->state == _SYNC_STATE_IDLE || sync->state == _SYNC_STATE_BEGIN)
+    {
+        _promise_list_append(&sync->current, promise, deadlineUs);
+        sync->state = _SYNC_STATE_BEGIN;
+    }
+    else
+    {
+        _promise_list_append(&sync->next, promise, deadlineUs);
+    }
+}
 
-    return CANOPY_SUCCESS;
+// Run steps until one has to wait for the network.  Stops after finishing
+// two cycles (the one underway and the one queued behind it), so that a
+// promise callback that keeps requesting syncs can't stall the caller.
+static void _run(STSync sync)
+{
+    uint32_t stopAt = sync->num_finished + 2;
+    _settle_sent(sync);
+    while (sync->num_finished != stopAt && _step(sync))
+    {
+    }
+    sync->online = _is_online(sync);
+}
+
+void st_sync_get_send_stats(STSync sync, CanopySendStats *stats)
+{
+    STWebSocketStats_t wsStats;
+
+    st_websocket_get_stats(sync->ws, &wsStats);
+    stats->syncs = sync->num_syncs_with_changes;
+    stats->payloads = sync->num_payloads;
+    stats->frames = wsStats.frames;
+    stats->bytes = wsStats.bytes;
+    stats->write_rounds = wsStats.write_rounds;
+}
+
+uint32_t st_sync_offline_backlog(STSync sync)
+{
+    return _ensure_offline(sync) ? st_offline_count(sync->offline) : 0;
+}
+
+void st_sync_set_lock(STSync sync, pthread_mutex_t *lock)
+{
+    sync->lock = lock;
+}
+
+bool st_sync_service(STSync sync, uint32_t timeoutMs)
+{
+    bool waited = false;
+
+    // Do everything that doesn't need to wait first.
+    _lock(sync);
+    _run(sync);
+
+    // Then wait for the network, which also delivers received payloads.
+    // A cycle waiting on the network (or for the WebSocket to reconnect) is
+    // woken up in time for its deadline.
+    if (_uses_websocket(sync->options) && 
+            st_websocket_state(sync->ws) != CANOPY_CONNECTION_STATE_DISCONNECTED)
+    {
+        if (sync->state != _SYNC_STATE_IDLE)
+        {
+            timeoutMs = st_time_remaining_ms(
+                    st_time_min_deadline(sync->deadline_us, sync->hold_until_us), 
+                    timeoutMs);
+        }
+        _unlock(sync);
+        st_websocket_service(sync->ws, timeoutMs);
+        _lock(sync);
+        _run(sync);
+        waited = true;
+    }
+
+    // Everything allocated for this call is released at once.  The arena
+    // keeps its memory, so later calls don't need to call malloc.
+    st_arena_reset(sync->arena);
+    _unlock(sync);
+    return waited;
 }
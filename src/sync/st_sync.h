@@ -18,7 +18,66 @@
 #define ST_SYNC_INCLUDED
 
 #include <canopy.h>
+#include "arena/st_arena.h"
+#include "cloudvar/st_cloudvar.h"
+#include "options/st_options.h"
+#include "websocket/st_websocket.h"
+#include <pthread.h>
 
-CanopyResultEnum st_sync();
+// An STSync drives sync cycles for one context without blocking.
+//
+// A cycle connects to the server if needed, sends the handshake, sends the
+// outbound payload once the WebSocket is ready for it, and then picks up
+// whatever the server has sent.  Each step that would have to wait for the
+// network is deferred to a later call to st_sync_service instead.
+typedef struct STSync_t * STSync;
+
+// Create a new, idle STSync.  Returns NULL on allocation failure.
+//
+// Scratch memory for each step (payloads not sent over the WebSocket, and
+// writer state) is allocated from <arena>, which is reset at the end of
+// every st_sync_service call.
+STSync st_sync_new(
+        CanopyContext ctx, 
+        STOptions options, 
+        STWebSocket ws, 
+        STCloudVarSystem cloudvars, 
+        STArena arena);
+
+// Free an STSync.  Pending promises are completed with
+// CANOPY_ERROR_UNKNOWN.
+void st_sync_free(STSync sync);
+
+// Request a sync cycle.  If a cycle is already underway, another one is
+// started once it finishes.
+//
+// If <promise> is non-NULL, the STSync takes a reference to it, and
+// completes it when the requested cycle finishes.
+//
+// The cycle fails with CANOPY_ERROR_TIMED_OUT if it hasn't finished by
+// <deadlineUs> (from st_time_now_us, or 0 for none), or within
+// CANOPY_SYNC_TIMEOUT_MS of starting, whichever comes first.
+void st_sync_start(STSync sync, CanopyPromise promise, uint64_t deadlineUs);
+
+// Advance the current cycle as far as possible, waiting at most <timeoutMs>
+// milliseconds for network activity (less if the cycle's deadline is
+// sooner), and process any received payloads.
+//
+// Returns true if it waited on the network.
+bool st_sync_service(STSync sync, uint32_t timeoutMs);
+
+// Fill in <stats> with running totals of what has been sent.  Caller must
+// hold the context lock, which covers the sync counters; the WebSocket's own
+// counters are read atomically, since they change while it is serviced.
+void st_sync_get_send_stats(STSync sync, CanopySendStats *stats);
+
+// Number of changes recorded while offline that haven't been sent yet, or
+// 0 if CANOPY_OFFLINE_FILE isn't set.
+uint32_t st_sync_offline_backlog(STSync sync);
+
+// Have st_sync_service hold <lock> whenever it touches Cloud Variables,
+// promises or the arena, releasing it only while waiting on the network.
+// Pass NULL to go back to unlocked, single-threaded use.
+void st_sync_set_lock(STSync sync, pthread_mutex_t *lock);
 
 #endif // ST_SYNC_INCLUDED
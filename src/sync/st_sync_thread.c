@@ -0,0 +1,307 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sync/st_sync_thread.h"
+#include "log/st_log.h"
+#include "promise/st_promise.h"
+#include "ring/st_ring.h"
+#include "time/st_time.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// How long the thread waits for network activity (or to be woken) per loop.
+// Queued updates are drained at least this often.
+#define _POLL_MS 10
+
+struct STSyncThread_t
+{
+    STSync sync;
+
+    // Recursive, so that promise and on-change callbacks running on the
+    // thread may call back into libcanopy.
+    pthread_mutex_t lock;
+
+    // Signalled when a sync is requested or the thread should stop.
+    pthread_cond_t wake_cond;
+    bool wake_pending;
+
+    // Broadcast after each loop, in case promises completed.
+    pthread_cond_t done_cond;
+
+    STRing ring;
+
+    pthread_t thread;
+    bool stop;
+
+    // Read without the lock, by entrypoints deciding whether to take it.
+    _Atomic bool running;
+};
+
+static void _apply_update(STSyncUpdate_t *update)
+{
+    CanopyResultEnum result;
+    if (update->set.datatype == CANOPY_DATATYPE_STRING)
+    {
+        update->set.val.val_string = 
+                update->heap_string ? update->heap_string : update->inline_string;
+    }
+    result = st_cloudvar_set_update(&update->set);
+    free(update->heap_string);
+    if (result != CANOPY_SUCCESS)
+    {
+        st_log_error("Could not apply queued update: %d", result);
+    }
+}
+
+// Apply all queued updates.  Caller must hold the lock.
+static void _drain(STSyncThread thread)
+{
+    STSyncUpdate_t update;
+    if (!thread->ring)
+    {
+        return;
+    }
+    while (st_ring_pop(thread->ring, &update))
+    {
+        st_cloudvar_system_set_sample_time(st_cloudvar_system(update.set.var), update.time_ms);
+        _apply_update(&update);
+        st_cloudvar_system_set_sample_time(st_cloudvar_system(update.set.var), 0);
+    }
+}
+
+// Convert a deadline from st_time_now_us to a timespec for
+// pthread_cond_timedwait (which uses CLOCK_MONOTONIC here).
+static struct timespec _to_timespec(uint64_t deadlineUs)
+{
+    struct timespec ts;
+    ts.tv_sec = deadlineUs / CANOPY_SECONDS;
+    ts.tv_nsec = (deadlineUs % CANOPY_SECONDS) * 1000;
+    return ts;
+}
+
+static void * _thread_main(void *arg)
+{
+    STSyncThread thread = (STSyncThread)arg;
+    struct timespec ts;
+    bool waited;
+
+    pthread_mutex_lock(&thread->lock);
+    while (!thread->stop)
+    {
+        _drain(thread);
+        pthread_mutex_unlock(&thread->lock);
+
+        // Takes the lock itself, except while waiting on the network.
+        waited = st_sync_service(thread->sync, _POLL_MS);
+
+        pthread_mutex_lock(&thread->lock);
+        pthread_cond_broadcast(&thread->done_cond);
+        if (!waited && !thread->wake_pending && !thread->stop)
+        {
+            // Nothing to wait for on the network, so sleep until woken.
+            ts = _to_timespec(st_time_now_us() + _POLL_MS*1000);
+            pthread_cond_timedwait(&thread->wake_cond, &thread->lock, &ts);
+        }
+        thread->wake_pending = false;
+    }
+    pthread_mutex_unlock(&thread->lock);
+    return NULL;
+}
+
+STSyncThread st_sync_thread_new(STSync sync)
+{
+    STSyncThread thread;
+    pthread_mutexattr_t mutexAttr;
+    pthread_condattr_t condAttr;
+
+    thread = calloc(1, sizeof(struct STSyncThread_t));
+    if (!thread)
+    {
+        return NULL;
+    }
+    thread->sync = sync;
+    atomic_init(&thread->running, false);
+
+    pthread_mutexattr_init(&mutexAttr);
+    pthread_mutexattr_settype(&mutexAttr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&thread->lock, &mutexAttr);
+    pthread_mutexattr_destroy(&mutexAttr);
+
+    // Deadlines are monotonic, so wait against the same clock.
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&thread->wake_cond, &condAttr);
+    pthread_cond_init(&thread->done_cond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+
+    return thread;
+}
+
+void st_sync_thread_free(STSyncThread thread)
+{
+    if (!thread)
+    {
+        return;
+    }
+    st_sync_thread_stop(thread);
+    pthread_cond_destroy(&thread->wake_cond);
+    pthread_cond_destroy(&thread->done_cond);
+    pthread_mutex_destroy(&thread->lock);
+    st_ring_free(thread->ring);
+    free(thread);
+}
+
+CanopyResultEnum st_sync_thread_start(STSyncThread thread)
+{
+    if (atomic_load(&thread->running))
+    {
+        return CANOPY_SUCCESS;
+    }
+    if (!thread->ring)
+    {
+        thread->ring = st_ring_new(ST_SYNC_THREAD_RING_CAPACITY, sizeof(STSyncUpdate_t));
+        if (!thread->ring)
+        {
+            return CANOPY_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    st_sync_set_lock(thread->sync, &thread->lock);
+    thread->stop = false;
+    if (pthread_create(&thread->thread, NULL, _thread_main, thread) != 0)
+    {
+        st_sync_set_lock(thread->sync, NULL);
+        return CANOPY_ERROR_UNKNOWN;
+    }
+    atomic_store(&thread->running, true);
+    return CANOPY_SUCCESS;
+}
+
+void st_sync_thread_stop(STSyncThread thread)
+{
+    if (!atomic_load(&thread->running))
+    {
+        return;
+    }
+    pthread_mutex_lock(&thread->lock);
+    thread->stop = true;
+    pthread_cond_signal(&thread->wake_cond);
+    pthread_mutex_unlock(&thread->lock);
+
+    pthread_join(thread->thread, NULL);
+    atomic_store(&thread->running, false);
+    st_sync_set_lock(thread->sync, NULL);
+
+    // Setters may have raced with the shutdown.
+    _drain(thread);
+}
+
+bool st_sync_thread_is_running(STSyncThread thread)
+{
+    return atomic_load(&thread->running);
+}
+
+bool st_sync_thread_is_current(STSyncThread thread)
+{
+    return atomic_load(&thread->running) && pthread_equal(pthread_self(), thread->thread);
+}
+
+void st_sync_thread_lock(STSyncThread thread)
+{
+    pthread_mutex_lock(&thread->lock);
+    _drain(thread);
+}
+
+void st_sync_thread_unlock(STSyncThread thread)
+{
+    pthread_mutex_unlock(&thread->lock);
+}
+
+void st_sync_thread_wake(STSyncThread thread)
+{
+    pthread_mutex_lock(&thread->lock);
+    thread->wake_pending = true;
+    pthread_cond_signal(&thread->wake_cond);
+    pthread_mutex_unlock(&thread->lock);
+}
+
+CanopyResultEnum st_sync_thread_queue_update(STSyncThread thread, const STSyncUpdate_t *update)
+{
+    STSyncUpdate_t queued = *update;
+    size_t len;
+
+    queued.heap_string = NULL;
+    queued.time_ms = st_time_wall_ms();
+    if (update->set.datatype == CANOPY_DATATYPE_STRING)
+    {
+        len = strlen(update->set.val.val_string) + 1;
+        if (len <= sizeof(queued.inline_string))
+        {
+            memcpy(queued.inline_string, update->set.val.val_string, len);
+        }
+        else
+        {
+            queued.heap_string = malloc(len);
+            if (!queued.heap_string)
+            {
+                return CANOPY_ERROR_OUT_OF_MEMORY;
+            }
+            memcpy(queued.heap_string, update->set.val.val_string, len);
+        }
+        queued.set.val.val_string = NULL;
+    }
+
+    // If the ring is full, wait for the thread to drain it, which it does
+    // at least every _POLL_MS.  We only drain it ourselves if the thread has
+    // stopped, or we are the thread (in a callback).  Either way the update
+    // still goes through the ring (rather than being applied directly), so
+    // it can't overtake earlier updates that another setter is still in the
+    // middle of pushing.
+    while (!st_ring_push(thread->ring, &queued))
+    {
+        if (!atomic_load(&thread->running) || st_sync_thread_is_current(thread))
+        {
+            st_sync_thread_lock(thread);
+            st_sync_thread_unlock(thread);
+        }
+        sched_yield();
+    }
+    return CANOPY_SUCCESS;
+}
+
+bool st_sync_thread_wait(STSyncThread thread, CanopyPromise promise, uint64_t deadlineUs)
+{
+    struct timespec ts;
+    while (!promise->done)
+    {
+        if (st_time_expired(deadlineUs))
+        {
+            return false;
+        }
+        if (deadlineUs)
+        {
+            ts = _to_timespec(deadlineUs);
+            pthread_cond_timedwait(&thread->done_cond, &thread->lock, &ts);
+        }
+        else
+        {
+            pthread_cond_wait(&thread->done_cond, &thread->lock);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,103 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_SYNC_THREAD_INCLUDED
+#define ST_SYNC_THREAD_INCLUDED
+
+// Background I/O thread for a context (enabled with CANOPY_SYNC_THREAD).
+//
+// While the thread runs, it is the only one that drives the context's STSync
+// and WebSocket.  Everything else that touches Cloud Variables or promises
+// holds the context lock (st_sync_thread_lock), which the thread only holds
+// while doing CPU work, never while waiting on the network.
+//
+// Typed setters don't take the lock.  Variables can't be added while the
+// thread runs, so they look the name up without it, then push an
+// STSyncUpdate_t onto a lock-free MPSC ring.  The thread drains the ring
+// into the Cloud Variables on each loop, as does anything else that takes
+// the lock (getters, batches), so that it sees the latest values.  Several
+// updates to one variable coalesce there: the last value wins and the
+// variable is queued for sync once.
+
+#include <canopy.h>
+#include "cloudvar/st_cloudvar.h"
+#include "sync/st_sync.h"
+
+// Number of updates the ring can hold before setters have to wait for the
+// thread to drain it.
+#define ST_SYNC_THREAD_RING_CAPACITY 1024
+
+// Strings up to this length (including the NUL) are copied into the update
+// itself.  Longer ones are copied to the heap.
+#define ST_SYNC_UPDATE_INLINE_STRING 48
+
+typedef struct STSyncThread_t * STSyncThread;
+
+// A queued update to a basic Cloud Variable.
+typedef struct STSyncUpdate_t
+{
+    // The update itself.  For strings, <set.val.val_string> is the caller's
+    // string, which st_sync_thread_queue_update copies.
+    CanopyVarUpdate set;
+
+    // (String only) Where the queued copy of the string lives.
+    char *heap_string;
+    char inline_string[ST_SYNC_UPDATE_INLINE_STRING];
+
+    // When the update was queued (wall-clock milliseconds), so that sample
+    // histories are timestamped with when the value was set rather than
+    // when the update was applied.
+    uint64_t time_ms;
+} STSyncUpdate_t;
+
+// Create the (stopped) background thread state for <sync>.  Returns NULL on
+// allocation failure.
+STSyncThread st_sync_thread_new(STSync sync);
+
+// Stop the thread if it is running, and free everything.
+void st_sync_thread_free(STSyncThread thread);
+
+// Start the thread.
+CanopyResultEnum st_sync_thread_start(STSyncThread thread);
+
+// Stop the thread and wait for it to exit.  Queued updates are applied.
+void st_sync_thread_stop(STSyncThread thread);
+
+// Is the thread running?  Safe to call from any thread.
+bool st_sync_thread_is_running(STSyncThread thread);
+
+// Is the caller the thread itself (for example, a callback it runs)?
+bool st_sync_thread_is_current(STSyncThread thread);
+
+// Take the context lock, and apply any queued updates.  The lock is
+// recursive.
+void st_sync_thread_lock(STSyncThread thread);
+
+// Release the context lock.
+void st_sync_thread_unlock(STSyncThread thread);
+
+// Wake the thread up, for example after requesting a sync.
+void st_sync_thread_wake(STSyncThread thread);
+
+// Queue <update> for the thread, without taking the lock.  If the ring is
+// full, this waits for the thread to drain it.  The caller must have checked
+// that the update is valid for its variable.
+CanopyResultEnum st_sync_thread_queue_update(STSyncThread thread, const STSyncUpdate_t *update);
+
+// Wait (holding the lock exactly once) until <promise> completes or
+// <deadlineUs> passes.  <deadlineUs> is from st_time_now_us, or 0 for none.
+// Returns false on timeout.
+bool st_sync_thread_wait(STSyncThread thread, CanopyPromise promise, uint64_t deadlineUs);
+
+#endif // ST_SYNC_THREAD_INCLUDED
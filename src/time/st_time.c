@@ -0,0 +1,61 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <canopy.h>
+#include "time/st_time.h"
+#include <time.h>
+
+uint64_t st_time_now_us()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*CANOPY_SECONDS + (t.tv_nsec/1000);
+}
+
+uint64_t st_time_wall_ms()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    return (uint64_t)t.tv_sec*1000 + (t.tv_nsec/1000000);
+}
+
+uint64_t st_time_min_deadline(uint64_t a, uint64_t b)
+{
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+    return (a < b) ? a : b;
+}
+
+bool st_time_expired(uint64_t deadlineUs)
+{
+    return deadlineUs && st_time_now_us() >= deadlineUs;
+}
+
+uint32_t st_time_remaining_ms(uint64_t deadlineUs, uint32_t maxMs)
+{
+    uint64_t now, remainingMs;
+    if (!deadlineUs)
+    {
+        return maxMs;
+    }
+    now = st_time_now_us();
+    if (now >= deadlineUs)
+    {
+        return 0;
+    }
+    remainingMs = (deadlineUs - now + 999) / 1000;
+    return (remainingMs < maxMs) ? (uint32_t)remainingMs : maxMs;
+}
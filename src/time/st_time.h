@@ -0,0 +1,43 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ST_TIME_INCLUDED
+#define ST_TIME_INCLUDED
+
+// Monotonic time and deadlines.
+//
+// Deadlines are absolute times from st_time_now_us.  A deadline of 0 means
+// "no deadline".
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Current time in microseconds, from a clock that never jumps backwards.
+uint64_t st_time_now_us();
+
+// Wall-clock time in milliseconds since the Unix epoch, for timestamps that
+// are sent to the server.  Not suitable for deadlines.
+uint64_t st_time_wall_ms();
+
+// Earlier of two deadlines, either of which may be 0 (none).
+uint64_t st_time_min_deadline(uint64_t a, uint64_t b);
+
+// Has <deadlineUs> passed?  Always false if <deadlineUs> is 0.
+bool st_time_expired(uint64_t deadlineUs);
+
+// Milliseconds left until <deadlineUs>, rounded up and capped at <maxMs>.
+// Returns <maxMs> if <deadlineUs> is 0, and 0 once it has passed.
+uint32_t st_time_remaining_ms(uint64_t deadlineUs, uint32_t maxMs);
+
+#endif // ST_TIME_INCLUDED
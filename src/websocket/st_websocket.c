@@ -17,11 +17,25 @@
 #include "websocket/st_websocket.h"
 #include "red_log.h"
 #include "log/st_log.h"
+#include "time/st_time.h"
 #include <libwebsockets.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Maximum number of messages waiting to be sent.
+#define _TX_QUEUE_LEN 8
+
+// A message waiting to be sent, serialized <buf.headroom> bytes into its
+// buffer.
+typedef struct _TxSlot_t
+{
+    STWebSocketTxBuffer_t buf;
+    size_t len;
+    bool binary;
+} _TxSlot_t;
+
 struct STWebSocket_t
 {
     struct libwebsocket_context *ws_ctx;
@@ -29,18 +43,328 @@ struct STWebSocket_t
     bool ws_write_ready;
     STWebsocketRecvCallback cb_recv;
     void *cb_recv_userdata;
+
+    CanopyConnectionStateEnum state;
+    STWebsocketStateCallback cb_state;
+    void *cb_state_userdata;
+    uint32_t connection_id;
+
+    // Where to (re)connect to.  Set by st_websocket_connect.
+    char *hostname;
+    uint16_t port;
+    bool use_ssl;
+    bool skip_ssl_cert_check;
+    char *url;
+
+    // Reconnect backoff.  <num_failures> counts attempts that failed since
+    // the last established connection.
+    uint32_t backoff_min_ms;
+    uint32_t backoff_max_ms;
+    uint32_t num_failures;
+    uint64_t reconnect_at_us;
+
+    // State of the jitter PRNG (xorshift32).  Per-object, so that
+    // STWebSockets on different threads don't share it.
+    uint32_t rand_state;
+
+    // Protocol table given to libwebsockets.  Per-object, so that each
+    // STWebSocket can size its own rx buffer.
+    struct libwebsocket_protocols protocols[2];
+
+    // Reassembly of messages that arrive in more than one piece (fragmented,
+    // or larger than the rx buffer).  <recv_buf> is kept between messages
+    // and grows as needed, up to <recv_max_bytes>.  <recv_overflow> is set
+    // while the rest of a message too large to keep is being discarded.
+    char *recv_buf;
+    size_t recv_len;
+    size_t recv_capacity;
+    size_t recv_max_bytes;
+    bool recv_overflow;
+
+    // Transmit queue: a ring of <tx_count> messages starting at <tx_head>.
+    // Each slot's buffer is kept when its message has been sent, and
+    // reused for later ones.
+    _TxSlot_t tx[_TX_QUEUE_LEN];
+    uint32_t tx_head;
+    uint32_t tx_count;
+
+    // Send scheduling.  <bytes_in_flight> counts bytes written since
+    // libwebsockets last reported the connection writable; once it reaches
+    // <max_bytes_in_flight> (or the socket is choked), writing stops until
+    // it does again.  See st_websocket_set_send_limits.
+    size_t bytes_in_flight;
+    size_t max_bytes_in_flight;
+    uint32_t latency_budget_ms;
+
+    // Set when a write fails, until the next connection is established.
+    bool write_failed;
+
+    // Running totals; see st_websocket_get_stats.  They are updated while
+    // servicing, which the sync thread does without the context lock, and
+    // may be read from any thread meanwhile.  Each is atomic so that a
+    // 64-bit counter can't be read half-updated on 32-bit targets.
+    _Atomic uint64_t stats_frames;
+    _Atomic uint64_t stats_bytes;
+    _Atomic uint64_t stats_write_rounds;
 };
 
+// Most times the backoff delay doubles (before capping), to avoid overflow.
+#define _MAX_BACKOFF_DOUBLINGS 16
+
+// Initial size of the reassembly buffer.
+#define _MIN_RECV_CAPACITY 4096
+
+static int _ws_callback(
+        struct libwebsocket_context *this,
+        struct libwebsocket *wsi,
+        enum libwebsocket_callback_reasons reason,
+        void *user,
+        void *in,
+        size_t len);
+
 STWebSocket st_websocket_new()
 {
-    return calloc(1, sizeof(struct STWebSocket_t));
+    int i;
+    STWebSocket ws = calloc(1, sizeof(struct STWebSocket_t));
+    if (!ws)
+    {
+        return NULL;
+    }
+    ws->state = CANOPY_CONNECTION_STATE_DISCONNECTED;
+    ws->backoff_min_ms = 500;
+    ws->backoff_max_ms = 30000;
+    ws->rand_state = (uint32_t)(st_time_now_us() ^ (uintptr_t)ws) | 1;
+    ws->protocols[0].name = "echo"; // TODO: rename
+    ws->protocols[0].callback = _ws_callback;
+    ws->protocols[0].rx_buffer_size = 4096;
+    ws->recv_max_bytes = 1024*1024;
+    ws->max_bytes_in_flight = 64*1024;
+    ws->latency_budget_ms = 50;
+    atomic_init(&ws->stats_frames, 0);
+    atomic_init(&ws->stats_bytes, 0);
+    atomic_init(&ws->stats_write_rounds, 0);
+    for (i = 0; i < _TX_QUEUE_LEN; i++)
+    {
+        ws->tx[i].buf.headroom = LWS_SEND_BUFFER_PRE_PADDING;
+        ws->tx[i].buf.tailroom = LWS_SEND_BUFFER_POST_PADDING;
+    }
+    return ws;
 }
 
 void st_websocket_free(STWebSocket ws)
 {
+    int i;
+    if (!ws)
+    {
+        return;
+    }
+    // Closing the connection isn't worth reporting now.
+    ws->cb_state = NULL;
+    if (ws->ws_ctx)
+    {
+        libwebsocket_context_destroy(ws->ws_ctx);
+    }
+    free(ws->hostname);
+    free(ws->url);
+    free(ws->recv_buf);
+    for (i = 0; i < _TX_QUEUE_LEN; i++)
+    {
+        free(ws->tx[i].buf.mem);
+    }
     free(ws);
 }
 
+static void _set_state(STWebSocket ws, CanopyConnectionStateEnum state)
+{
+    if (ws->state == state)
+    {
+        return;
+    }
+    ws->state = state;
+    if (ws->cb_state)
+    {
+        ws->cb_state(ws, state, ws->cb_state_userdata);
+    }
+}
+
+static uint32_t _rand(STWebSocket ws)
+{
+    uint32_t x = ws->rand_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    ws->rand_state = x;
+    return x;
+}
+
+// Delay before the next attempt: the backoff for this many failures, less
+// a random amount of up to half of it ("equal jitter").
+static uint32_t _backoff_delay_ms(STWebSocket ws)
+{
+    uint64_t cap = ws->backoff_min_ms;
+    uint32_t doublings = ws->num_failures;
+    if (doublings > _MAX_BACKOFF_DOUBLINGS)
+    {
+        doublings = _MAX_BACKOFF_DOUBLINGS;
+    }
+    cap <<= doublings;
+    if (cap > ws->backoff_max_ms)
+    {
+        cap = ws->backoff_max_ms;
+    }
+    return (uint32_t)(cap - cap/2 + _rand(ws) % (cap/2 + 1));
+}
+
+// The connection (or attempt) has gone away.  Schedule the next attempt.
+static void _connection_lost(STWebSocket ws)
+{
+    ws->ws = NULL;
+    ws->ws_write_ready = false;
+    ws->recv_len = 0;
+    ws->recv_overflow = false;
+    ws->tx_count = 0;
+    ws->bytes_in_flight = 0;
+    if (ws->state == CANOPY_CONNECTION_STATE_DISCONNECTED ||
+        ws->state == CANOPY_CONNECTION_STATE_WAITING_TO_RECONNECT)
+    {
+        return;
+    }
+    if (ws->backoff_min_ms == 0 || !ws->hostname)
+    {
+        _set_state(ws, CANOPY_CONNECTION_STATE_DISCONNECTED);
+        return;
+    }
+    ws->reconnect_at_us = st_time_now_us() + (uint64_t)_backoff_delay_ms(ws)*1000;
+    ws->num_failures++;
+    _set_state(ws, CANOPY_CONNECTION_STATE_WAITING_TO_RECONNECT);
+}
+
+// Write the oldest queued message.
+static void _write_head(STWebSocket ws)
+{
+    _TxSlot_t *slot = &ws->tx[ws->tx_head];
+    unsigned char *data = &((unsigned char *)slot->buf.mem)[slot->buf.headroom];
+
+    // Log payload
+    if (slot->binary)
+        st_log_debug("Websocket Send: %d bytes (binary)\n", (int)slot->len);
+    else
+        st_log_debug("Websocket Send: %d '%.*s'\n", (int)slot->len, (int)slot->len, (char *)data);
+
+    // Send msg.  libwebsockets writes the frame header into the headroom.
+    if (libwebsocket_write(ws->ws, data, slot->len, 
+            slot->binary ? LWS_WRITE_BINARY : LWS_WRITE_TEXT) < 0)
+    {
+        // libwebsockets closes the connection.  Stop writing to it.
+        st_log_error("Websocket write failed");
+        ws->ws_write_ready = false;
+        ws->write_failed = true;
+    }
+    ws->tx_head = (ws->tx_head + 1) % _TX_QUEUE_LEN;
+    ws->tx_count--;
+    ws->bytes_in_flight += slot->len;
+    atomic_fetch_add(&ws->stats_frames, 1);
+    atomic_fetch_add(&ws->stats_bytes, slot->len);
+}
+
+// Write as many queued messages as libwebsockets will take, oldest first.
+// Messages are written back to back, without waiting for a writable
+// callback in between, until the socket is choked or the bytes in flight
+// reach their limit.
+static void _flush(STWebSocket ws)
+{
+    bool wrote = false;
+
+    while (ws->ws && ws->ws_write_ready && ws->tx_count > 0)
+    {
+        _write_head(ws);
+        wrote = true;
+        if (lws_send_pipe_choked(ws->ws) || 
+                ws->bytes_in_flight >= ws->max_bytes_in_flight)
+        {
+            ws->ws_write_ready = false;
+        }
+    }
+    if (wrote)
+    {
+        atomic_fetch_add(&ws->stats_write_rounds, 1);
+
+        // Register callback so that we're informed when the data has drained.
+        libwebsocket_callback_on_writable(ws->ws_ctx, ws->ws);
+    }
+}
+
+// Append <len> bytes to the message being reassembled, growing the buffer
+// if needed.  Returns false if the message would exceed <recv_max_bytes>.
+static bool _recv_append(STWebSocket ws, const char *data, size_t len)
+{
+    size_t capacity;
+    char *buf;
+
+    if (ws->recv_len > ws->recv_max_bytes || 
+            len > ws->recv_max_bytes - ws->recv_len)
+    {
+        return false;
+    }
+    if (ws->recv_len + len > ws->recv_capacity)
+    {
+        capacity = ws->recv_capacity ? ws->recv_capacity : _MIN_RECV_CAPACITY;
+        while (capacity < ws->recv_len + len)
+        {
+            capacity *= 2;
+        }
+        if (capacity > ws->recv_max_bytes)
+        {
+            capacity = ws->recv_max_bytes;
+        }
+        buf = realloc(ws->recv_buf, capacity);
+        if (!buf)
+        {
+            return false;
+        }
+        ws->recv_buf = buf;
+        ws->recv_capacity = capacity;
+    }
+    memcpy(&ws->recv_buf[ws->recv_len], data, len);
+    ws->recv_len += len;
+    return true;
+}
+
+// Handle a piece of an inbound message, and deliver the message once it is
+// complete.  A message that arrives in one piece, as most do, is delivered
+// straight from libwebsockets' buffer; only the others are copied.
+static void _recv(STWebSocket ws, struct libwebsocket *wsi, const char *data, size_t len)
+{
+    bool complete = libwebsocket_is_final_fragment(wsi) &&
+            libwebsockets_remaining_packet_payload(wsi) == 0;
+
+    if (complete && ws->recv_len == 0 && !ws->recv_overflow)
+    {
+        if (ws->cb_recv)
+        {
+            ws->cb_recv(ws, data, len, ws->cb_recv_userdata);
+        }
+        return;
+    }
+
+    if (!ws->recv_overflow && !_recv_append(ws, data, len))
+    {
+        st_log_error("Inbound websocket message exceeds %u bytes.  Discarding.",
+                (unsigned)ws->recv_max_bytes);
+        ws->recv_overflow = true;
+    }
+    if (!complete)
+    {
+        return;
+    }
+    if (!ws->recv_overflow && ws->cb_recv)
+    {
+        ws->cb_recv(ws, ws->recv_buf, ws->recv_len, ws->cb_recv_userdata);
+    }
+    ws->recv_len = 0;
+    ws->recv_overflow = false;
+}
+
 static int _ws_callback(
         struct libwebsocket_context *this,
         struct libwebsocket *wsi,
@@ -54,47 +378,34 @@ static int _ws_callback(
     {
         case LWS_CALLBACK_CLIENT_ESTABLISHED:
         {
-            fprintf(stderr, "ws_callback: LWS_CALLBACK_CLIENT_ESTABLISHED\n");
-            libwebsocket_callback_on_writable(this, wsi);
-#if 0
-            CanopyEventDetails_t eventDetails;
-            fprintf(stderr, "ws_callback: LWS_CALLBACK_CLIENT_ESTABLISHED\n");
+            st_log_info("WebSocket connected to %s:%d", ws->hostname, ws->port);
+            ws->num_failures = 0;
+            ws->connection_id++;
+            ws->write_failed = false;
+            _set_state(ws, CANOPY_CONNECTION_STATE_CONNECTED);
             libwebsocket_callback_on_writable(this, wsi);
-
-            /* Call event callback */
-            eventDetails.ctx = canopy;
-            eventDetails.eventType = CANOPY_EVENT_CONNECTION_ESTABLISHED;
-            eventDetails.userData = canopy->cbExtra;
-            canopy->cb(canopy, &eventDetails);
-            canopy->ws_closed = false; // TODO: change to "connected"
-#endif
             break;
         }
         case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
-            fprintf(stderr, "ws_callback: LWS_CALLBACK_CLIENT_CONNECTION_ERROR\n");
+            st_log_debug("WebSocket connection attempt failed");
+            // libwebsockets frees <wsi> after this callback.
+            _connection_lost(ws);
             return -1;
         case LWS_CALLBACK_CLOSED:
         {
-#if 0
-            fprintf(stderr, "ws_callback: LWS_CALLBACK_CLOSED\n");
-            canopy->ws_closed = true;
-#endif
+            st_log_info("WebSocket connection closed");
+            _connection_lost(ws);
             return -1;
         }
         case LWS_CALLBACK_CLIENT_WRITEABLE:
         {
             ws->ws_write_ready = true;
+            ws->bytes_in_flight = 0;
+            _flush(ws);
             break;
         }
         case LWS_CALLBACK_CLIENT_RECEIVE:
-            /* TODO: this next line seems dangerous! */
-            ((char *)in)[len] = '\0';
-            fprintf(stderr, "rx %d '%s'\n", (int)len, (char *)in);
-            //_process_ws_payload(canopy, in);
-            if (ws->cb_recv)
-            {
-                ws->cb_recv(ws, in, ws->cb_recv_userdata);
-            }
+            _recv(ws, wsi, (const char *)in, len);
             break;
         /*case LWS_CALLBACK_CLIENT_CONFIRM_EXTENSION_SUPPORTED:*/
         default:
@@ -103,42 +414,109 @@ static int _ws_callback(
     return 0;
 }
 
+// Destroy the libwebsockets context, and with it any connection.
+// libwebsockets has no way to abort a single client connection from outside
+// its callbacks, so this is the only way to give up on one that is stuck.
+static void _destroy_context(STWebSocket ws)
+{
+    if (ws->ws_ctx)
+    {
+        libwebsocket_context_destroy(ws->ws_ctx);
+        ws->ws_ctx = NULL;
+    }
+    ws->ws = NULL;
+    ws->ws_write_ready = false;
+    ws->recv_len = 0;
+    ws->recv_overflow = false;
+    ws->tx_count = 0;
+    ws->bytes_in_flight = 0;
+}
+
+void st_websocket_disconnect(STWebSocket ws)
+{
+    // Set the state first, so that closing doesn't schedule a reconnect.
+    _set_state(ws, CANOPY_CONNECTION_STATE_DISCONNECTED);
+    _destroy_context(ws);
+}
+
+void st_websocket_drop(STWebSocket ws)
+{
+    _destroy_context(ws);
+    _connection_lost(ws);
+}
+
+void st_websocket_set_backoff(STWebSocket ws, uint32_t minMs, uint32_t maxMs)
+{
+    ws->backoff_min_ms = minMs;
+    ws->backoff_max_ms = (maxMs > minMs) ? maxMs : minMs;
+}
+
+void st_websocket_set_recv_buffer(STWebSocket ws, size_t rxBufferBytes, size_t maxMessageBytes)
+{
+    ws->protocols[0].rx_buffer_size = rxBufferBytes;
+    ws->recv_max_bytes = maxMessageBytes;
+}
+
+void st_websocket_set_send_limits(
+        STWebSocket ws, 
+        size_t maxBytesInFlight, 
+        uint32_t latencyBudgetMs)
+{
+    ws->max_bytes_in_flight = maxBytesInFlight;
+    ws->latency_budget_ms = latencyBudgetMs;
+}
+
+void st_websocket_get_stats(STWebSocket ws, STWebSocketStats_t *stats)
+{
+    stats->frames = atomic_load(&ws->stats_frames);
+    stats->bytes = atomic_load(&ws->stats_bytes);
+    stats->write_rounds = atomic_load(&ws->stats_write_rounds);
+}
+
+CanopyConnectionStateEnum st_websocket_state(STWebSocket ws)
+{
+    return ws->state;
+}
+
+uint32_t st_websocket_connection_id(STWebSocket ws)
+{
+    return ws->connection_id;
+}
+
 bool st_websocket_is_connected(STWebSocket ws)
 {
     assert(ws);
-    return ws->ws != NULL;
+    return ws->state == CANOPY_CONNECTION_STATE_CONNECTED;
+}
+
+bool st_websocket_tx_flushed(STWebSocket ws)
+{
+    assert(ws);
+    return ws->state == CANOPY_CONNECTION_STATE_CONNECTED && 
+            ws->tx_count == 0 && 
+            !ws->write_failed;
 }
 
 bool st_websocket_is_write_ready(STWebSocket ws)
 {
     assert(ws);
-    return ws->ws_write_ready;
+    return ws->ws && ws->state == CANOPY_CONNECTION_STATE_CONNECTED && 
+            ws->tx_count < _TX_QUEUE_LEN;
 }
 
-CanopyResultEnum st_websocket_connect(
-        STWebSocket ws,
-        const char *hostname,
-        uint16_t port,
-        bool useSSL,
-        bool skipSSLCertCheck,
-        const char *url)
+// Create the libwebsockets context, unless there is one already.
+static CanopyResultEnum _ensure_context(STWebSocket ws)
 {
-    static struct libwebsocket_protocols sCanopyWsProtocols[] = {
-        {
-            "echo", // TODO: rename 
-            _ws_callback,
-            1024,
-            1024,
-            0,
-            NULL,
-            0
-        },
-        { NULL, NULL, 0, 0, 0, NULL, 0} // end
-    };
     struct lws_context_creation_info info={0};
+
+    if (ws->ws_ctx)
+    {
+        return CANOPY_SUCCESS;
+    }
+
     info.port = CONTEXT_PORT_NO_LISTEN;
     info.iface = NULL;
-    info.protocols = sCanopyWsProtocols;
+    info.protocols = ws->protocols;
     info.extensions = NULL;
     info.ssl_cert_filepath = NULL;
     info.ssl_private_key_filepath = NULL;
@@ -157,67 +535,185 @@ CanopyResultEnum st_websocket_connect(
     ws->ws_ctx = libwebsocket_create_context(&info);
     if (!ws->ws_ctx)
     {
-        fprintf(stderr, "Failed to create libwebsocket context\n");
+        st_log_error("Failed to create libwebsocket context");
         return CANOPY_ERROR_CONNECTION_FAILED;
     }
+    return CANOPY_SUCCESS;
+}
+
+// Start a connection attempt to the saved server.
+static CanopyResultEnum _open(STWebSocket ws)
+{
+    struct libwebsocket *wsi;
+    CanopyResultEnum result;
+
+    _set_state(ws, CANOPY_CONNECTION_STATE_CONNECTING);
+    result = _ensure_context(ws);
+    if (result != CANOPY_SUCCESS)
+    {
+        _connection_lost(ws);
+        return result;
+    }
 
-    printf("Connecting to:\n");
-    printf("Host: %s\n", hostname);
-    printf("Port: %d\n", port);
-    printf("UseSSL: %d\n", useSSL);
-    printf("Skip SSL Cert Check: %d\n", skipSSLCertCheck);
-    ws->ws = libwebsocket_client_connect(
+    st_log_debug("WebSocket connecting to %s:%d (ssl %d, skip cert check %d)",
+            ws->hostname, ws->port, ws->use_ssl, ws->skip_ssl_cert_check);
+    wsi = libwebsocket_client_connect(
             ws->ws_ctx, 
-            hostname, 
-            port,
-            useSSL ? (skipSSLCertCheck ? 2 : 1) : 0,
-            url, // "/echo"
-            hostname ,
+            ws->hostname, 
+            ws->port,
+            ws->use_ssl ? (ws->skip_ssl_cert_check ? 2 : 1) : 0,
+            ws->url, // "/echo"
+            ws->hostname,
             "localhost", // origin
             "echo", // TODO: rename
             -1 // latest ietf version
         );
-    if (!ws->ws)
+    if (!wsi)
     {
-        fprintf(stderr, "Failed to create libwebsocket connection\n");
+        st_log_debug("Failed to create libwebsocket connection");
+        _connection_lost(ws);
         return CANOPY_ERROR_CONNECTION_FAILED;
     }
+    ws->ws = wsi;
 
     libwebsocket_callback_on_writable(ws->ws_ctx, ws->ws);
     return CANOPY_SUCCESS;
 }
 
+CanopyResultEnum st_websocket_connect(
+        STWebSocket ws,
+        const char *hostname,
+        uint16_t port,
+        bool useSSL,
+        bool skipSSLCertCheck,
+        const char *url)
+{
+    char *hostnameCopy, *urlCopy;
+
+    hostnameCopy = strdup(hostname);
+    urlCopy = strdup(url);
+    if (!hostnameCopy || !urlCopy)
+    {
+        free(hostnameCopy);
+        free(urlCopy);
+        return CANOPY_ERROR_OUT_OF_MEMORY;
+    }
+    free(ws->hostname);
+    free(ws->url);
+    ws->hostname = hostnameCopy;
+    ws->url = urlCopy;
+    ws->port = port;
+    ws->use_ssl = useSSL;
+    ws->skip_ssl_cert_check = skipSSLCertCheck;
+    ws->num_failures = 0;
+
+    // Discard what's left of a previous connection.  The context itself is
+    // reused, unless a connection is still using it.
+    if (ws->ws)
+    {
+        _destroy_context(ws);
+    }
+    ws->state = CANOPY_CONNECTION_STATE_DISCONNECTED;
+
+    return _open(ws);
+}
+
 void st_websocket_service(STWebSocket ws, uint32_t timeout_ms)
 {
-    libwebsocket_service(ws->ws_ctx, timeout_ms);
+    uint64_t now;
+
+    if (ws->state == CANOPY_CONNECTION_STATE_WAITING_TO_RECONNECT)
+    {
+        now = st_time_now_us();
+        if (now >= ws->reconnect_at_us)
+        {
+            // Failures are picked up by _connection_lost, which schedules
+            // the next attempt.
+            _open(ws);
+        }
+    }
+    if (ws->state == CANOPY_CONNECTION_STATE_WAITING_TO_RECONNECT)
+    {
+        // Wake up in time for the next attempt.
+        timeout_ms = st_time_remaining_ms(ws->reconnect_at_us, timeout_ms);
+        if (_ensure_context(ws) != CANOPY_SUCCESS)
+        {
+            return;
+        }
+    }
+    if (ws->ws_ctx)
+    {
+        libwebsocket_service(ws->ws_ctx, timeout_ms);
+    }
 }
 
-void st_websocket_write(STWebSocket ws, const char *msg)
+STWebSocketTxBuffer st_websocket_tx_claim(STWebSocket ws)
 {
-    char *buf;
-    if (!ws->ws_write_ready)
+    if (!st_websocket_is_write_ready(ws))
     {
-        RedLog_DebugLog("canopy", "WS not ready for write!  Skipping.");
-        return;
+        return NULL;
     }
+    return &ws->tx[(ws->tx_head + ws->tx_count) % _TX_QUEUE_LEN].buf;
+}
 
-    // libwebsockets requires all this crazy padding.
-    size_t len = strlen(msg);
-    buf = calloc(1, LWS_SEND_BUFFER_PRE_PADDING + len + LWS_SEND_BUFFER_POST_PADDING);
-    strcpy(&buf[LWS_SEND_BUFFER_PRE_PADDING], msg);
+uint64_t st_websocket_tx_hold_until(STWebSocket ws, uint64_t sinceUs)
+{
+    uint64_t until;
+    if (ws->tx_count == 0 && ws->ws_write_ready)
+    {
+        return 0;
+    }
+    until = sinceUs + (uint64_t)ws->latency_budget_ms*1000;
+    return st_time_expired(until) ? 0 : until;
+}
 
-    // Log payload
-    st_log_debug("Websocket Send: %d '%s'\n", (int)len, (char *)msg);
+void st_websocket_tx_queue(STWebSocket ws, STWebSocketTxBuffer tx, size_t len, bool binary)
+{
+    _TxSlot_t *slot = &ws->tx[(ws->tx_head + ws->tx_count) % _TX_QUEUE_LEN];
+    assert(tx == &slot->buf);
+    slot->len = len;
+    slot->binary = binary;
+    ws->tx_count++;
+    _flush(ws);
+}
 
-    // Send msg.
-    libwebsocket_write(ws->ws, (unsigned char *)&buf[LWS_SEND_BUFFER_PRE_PADDING], len, LWS_WRITE_TEXT);
-    ws->ws_write_ready = false;
+// Queue a copy of <data>.
+static void _write(STWebSocket ws, const void *data, size_t len, bool binary)
+{
+    STWebSocketTxBuffer tx;
+    size_t size;
+    void *mem;
 
-    // Register callback so that we're informed when it is safe to write again.
-    libwebsocket_callback_on_writable(ws->ws_ctx, ws->ws);
+    tx = st_websocket_tx_claim(ws);
+    if (!tx)
+    {
+        RedLog_DebugLog("canopy", "WS not ready for write!  Skipping.");
+        return;
+    }
+    size = tx->headroom + len + tx->tailroom;
+    if (size > tx->capacity)
+    {
+        mem = realloc(tx->mem, size);
+        if (!mem)
+        {
+            st_log_error("OOM in st_websocket_write");
+            return;
+        }
+        tx->mem = mem;
+        tx->capacity = size;
+    }
+    memcpy(&((char *)tx->mem)[tx->headroom], data, len);
+    st_websocket_tx_queue(ws, tx, len, binary);
+}
+
+void st_websocket_write(STWebSocket ws, const char *msg)
+{
+    _write(ws, msg, strlen(msg), false);
+}
 
-    // Cleanup.
-    free(buf);
+void st_websocket_write_binary(STWebSocket ws, const void *data, size_t len)
+{
+    _write(ws, data, len, true);
 }
 
 void st_websocket_recv_callback(STWebSocket ws, STWebsocketRecvCallback cb, void *userdata)
@@ -225,3 +721,9 @@ void st_websocket_recv_callback(STWebSocket ws, STWebsocketRecvCallback cb, void
     ws->cb_recv = cb;
     ws->cb_recv_userdata = userdata;
 }
+
+void st_websocket_state_callback(STWebSocket ws, STWebsocketStateCallback cb, void *userdata)
+{
+    ws->cb_state = cb;
+    ws->cb_state_userdata = userdata;
+}
@@ -20,9 +20,54 @@
 #include <canopy.h>
 
 // An STWebSocket is an ADT representing a websocket connection.
+//
+// Once st_websocket_connect has been called, the STWebSocket keeps itself
+// connected: if the connection drops or an attempt fails, it tries again
+// from st_websocket_service after a randomized, exponentially growing
+// delay (see st_websocket_set_backoff).  The libwebsockets context is kept
+// and reused across reconnects.
 typedef struct STWebSocket_t * STWebSocket;
 
-typedef void (*STWebsocketRecvCallback)(STWebSocket ws, const char *payload, void *userdata);
+// A buffer that an outbound message is serialized into, in place, so that it
+// can be sent without another copy.  It belongs to the STWebSocket, but
+// whoever fills it may grow it with realloc, updating <mem> and <capacity>:
+//
+//      tx = st_websocket_tx_claim(ws);
+//      w = st_json_writer_new_in_place(arena, &tx->mem, &tx->capacity, 
+//              tx->headroom, tx->tailroom);
+//      ... write payload ...
+//      st_websocket_tx_queue(ws, tx, st_json_writer_len(w), false);
+typedef struct STWebSocketTxBuffer_t
+{
+    void *mem;
+    size_t capacity;
+
+    // The message goes <headroom> bytes into <mem>, with at least <tailroom>
+    // bytes spare after it.  libwebsockets frames it in that space.
+    size_t headroom;
+    size_t tailroom;
+} STWebSocketTxBuffer_t;
+typedef struct STWebSocketTxBuffer_t * STWebSocketTxBuffer;
+
+// Running totals of what has been sent.
+typedef struct STWebSocketStats_t
+{
+    // Messages (frames) written, and their payload bytes.
+    uint64_t frames;
+    uint64_t bytes;
+
+    // Number of times a batch of one or more frames was written back to
+    // back.  frames/write_rounds is the pipelining ratio.
+    uint64_t write_rounds;
+} STWebSocketStats_t;
+
+// Called for each message received, once all of it has arrived.  <payload>
+// is <len> bytes long, and is not NUL-terminated.  It is only valid during
+// the call.
+typedef void (*STWebsocketRecvCallback)(STWebSocket ws, const char *payload, size_t len, void *userdata);
+
+// Called whenever the connection changes state.
+typedef void (*STWebsocketStateCallback)(STWebSocket ws, CanopyConnectionStateEnum state, void *userdata);
 
 // Create a new (disconnected) WebSocket object.
 STWebSocket st_websocket_new();
@@ -30,9 +75,11 @@ STWebSocket st_websocket_new();
 // Free websocket object.
 void st_websocket_free(STWebSocket ws);
 
-// Connect to WebSocket server.
+// Connect to WebSocket server, and keep reconnecting to it from now on.
 // Set <skipSSLCertCheck> to true if you are using SSL with a self-signed
 // certificate.
+//
+// The connection is established asynchronously, from st_websocket_service.
 CanopyResultEnum st_websocket_connect(
         STWebSocket ws,
         const char *hostname,
@@ -41,20 +88,103 @@ CanopyResultEnum st_websocket_connect(
         bool skipSSLCertCheck,
         const char *url);
 
-// Is STWebSocket connected?
+// Drop the connection (established or not) and release its resources.  No
+// reconnection is attempted until st_websocket_connect is called again.
+void st_websocket_disconnect(STWebSocket ws);
+
+// Abandon the connection (established or not) as if it had failed, so that
+// a new one is attempted after the backoff delay.
+void st_websocket_drop(STWebSocket ws);
+
+// Configure the delay before reconnecting.  The delay starts at <minMs>
+// and doubles with each consecutive failure, up to <maxMs>, and each delay
+// is randomized to between half and all of that.  A <minMs> of 0 disables
+// reconnection: a lost connection stays DISCONNECTED.
+void st_websocket_set_backoff(STWebSocket ws, uint32_t minMs, uint32_t maxMs);
+
+// Configure inbound buffering.  libwebsockets hands over received data in
+// pieces of at most <rxBufferBytes>; this takes effect from the next
+// connection.  Messages that take more than one piece are reassembled, up to
+// <maxMessageBytes>.  Larger messages are discarded.
+void st_websocket_set_recv_buffer(STWebSocket ws, size_t rxBufferBytes, size_t maxMessageBytes);
+
+// Configure send scheduling.  Queued messages are written back to back
+// until <maxBytesInFlight> bytes have been written since the connection was
+// last reported writable (at least one message is always written).  A new
+// message that would have to wait behind others may be held for up to
+// <latencyBudgetMs>, so that it can be coalesced with later changes; see
+// st_websocket_tx_hold_until.
+void st_websocket_set_send_limits(
+        STWebSocket ws, 
+        size_t maxBytesInFlight, 
+        uint32_t latencyBudgetMs);
+
+// Get running totals of what has been sent.  Safe to call from any thread,
+// even while another is servicing <ws>.  Each total is read atomically, but
+// they aren't a snapshot of one instant: a frame being written meanwhile may
+// be counted in <frames> before its bytes are in <bytes>.
+void st_websocket_get_stats(STWebSocket ws, STWebSocketStats_t *stats);
+
+// Current state of the connection.
+CanopyConnectionStateEnum st_websocket_state(STWebSocket ws);
+
+// Identifies the current connection.  Changes every time a new connection
+// is established (starting from 1), so callers can tell when they need to
+// redo per-connection setup.  0 before the first connection.
+uint32_t st_websocket_connection_id(STWebSocket ws);
+
+// Is STWebSocket connected (established)?
 bool st_websocket_is_connected(STWebSocket ws);
 
-// Is WebSocket ready to send bytes?
+// Can a message be queued for sending?  True while connected, unless the
+// transmit queue is full.
 bool st_websocket_is_write_ready(STWebSocket ws);
 
-// Service WebSocket.  You must call this periodically.
+// Has every message queued on the current connection been written to it?
+// False if the connection is down or a write to it failed.  A message that
+// was queued, but not written, when a connection was lost is discarded, so
+// a sender that needs to know its message went out can wait for this, on
+// the same st_websocket_connection_id.
+bool st_websocket_tx_flushed(STWebSocket ws);
+
+// Service WebSocket.  You must call this periodically.  Also reconnects
+// once the backoff delay has passed, and waits no longer than that.
 void st_websocket_service(STWebSocket ws, uint32_t timeout_ms);
 
-// Send payload over the WebSocket.  Fails silently if the WebSocket isn't
-// connected to the server.
+// Claim the transmit buffer for the next message.  Returns NULL unless
+// st_websocket_is_write_ready.  Only one buffer can be claimed at a time:
+// until it is queued, later calls return the same one.
+STWebSocketTxBuffer st_websocket_tx_claim(STWebSocket ws);
+
+// Should a message that has been ready to send since <sinceUs> be held back?
+// While earlier messages are still waiting to be written, a sender can hold
+// off, and fold later changes into the same message, instead of queueing
+// one message per change behind them.  Returns the time (from
+// st_time_now_us) until which to hold it, or 0 if it should be queued now:
+// because the connection can take it, or because the latency budget has run
+// out.
+uint64_t st_websocket_tx_hold_until(STWebSocket ws, uint64_t sinceUs);
+
+// Queue the message in <tx>, which must be the buffer just claimed, for
+// sending.  <len> bytes start <tx->headroom> bytes into it.  Messages are
+// sent in order, as soon as libwebsockets is ready for them: from
+// st_websocket_tx_queue itself if it is ready now, or else from
+// st_websocket_service.  Messages still queued when the connection is lost
+// are discarded.
+void st_websocket_tx_queue(STWebSocket ws, STWebSocketTxBuffer tx, size_t len, bool binary);
+
+// Queue a copy of the text message <msg>.  Fails silently if the WebSocket
+// isn't st_websocket_is_write_ready.
 void st_websocket_write(STWebSocket ws, const char *msg);
 
+// Queue a copy of <len> bytes of binary payload.  Behaves like
+// st_websocket_write otherwise.
+void st_websocket_write_binary(STWebSocket ws, const void *data, size_t len);
+
 // Set the callback that gets triggered when data is received from the server.
 void st_websocket_recv_callback(STWebSocket ws, STWebsocketRecvCallback cb, void *userdata);
 
+// Set the callback that gets triggered when the connection changes state.
+void st_websocket_state_callback(STWebSocket ws, STWebsocketStateCallback cb, void *userdata);
+
 #endif // ST_WEBSOCKET_INCLUDED
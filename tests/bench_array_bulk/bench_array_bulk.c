@@ -0,0 +1,150 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "bench.h"
+#include <stdio.h>
+
+// Benchmark & checks for the bulk array accessors.
+//
+// Publishes a 4096-bin spectrum, as an FFT would, first one element per
+// canopy_var_set(ctx, name, CANOPY_VALUE_ARRAY(i, ...)) call, then all at
+// once with canopy_var_set_array_float32, which must not touch the heap.
+// Also reports how much memory an array takes per element.
+#define NUM_BINS 4096
+#define NUM_ITERATIONS 1000
+
+static void _report_memory(const char *name, uint64_t bytes, uint64_t allocs)
+{
+    printf("MEM   %-40s bytes/elem=%-8.1f allocs/elem=%.3f\n",
+            name, (double)bytes/NUM_BINS, (double)allocs/NUM_BINS);
+}
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    RedTest test;
+    uint64_t start, allocs, bytes;
+    float spectrum[NUM_BINS], readback[NUM_BINS];
+    int16_t samples[4], samplesOut[4];
+    bool ok;
+    int i, j;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy_set_global_opt(CANOPY_LOG_ENABLED, false);
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    // Memory per element.  Numeric arrays are stored packed; string arrays
+    // still get a Cloud Variable per element, as every array used to.
+    allocs = bench_num_allocs();
+    bytes = bench_num_alloc_bytes();
+    result = canopy_var_init(canopy, "out string[4096] labels");
+    RedTest_Verify(test, "Init labels", result == CANOPY_SUCCESS);
+    _report_memory("per-element storage (string[4096])", 
+            bench_num_alloc_bytes() - bytes, bench_num_allocs() - allocs);
+
+    allocs = bench_num_allocs();
+    bytes = bench_num_alloc_bytes();
+    result = canopy_var_init(canopy, "out float32[4096] spectrum");
+    RedTest_Verify(test, "Init spectrum", result == CANOPY_SUCCESS);
+    bytes = bench_num_alloc_bytes() - bytes;
+    allocs = bench_num_allocs() - allocs;
+    _report_memory("packed storage (float32[4096])", bytes, allocs);
+    RedTest_Verify(test, "Packed array is compact", bytes < 8*NUM_BINS);
+    RedTest_Verify(test, "Packed array is few allocations", allocs < 16);
+
+    result = canopy_var_init(canopy, "inout int16[4] samples");
+    RedTest_Verify(test, "Init samples", result == CANOPY_SUCCESS);
+    result = canopy_var_init(canopy, "in uint8[4] leds");
+    RedTest_Verify(test, "Init leds", result == CANOPY_SUCCESS);
+
+    // Error cases.
+    result = canopy_var_get_array_float32(canopy, "spectrum", readback, 0, 1);
+    RedTest_Verify(test, "Get before set", result == CANOPY_ERROR_VARIABLE_NOT_SET);
+    result = canopy_var_set_array_float32(canopy, "nonexistent", spectrum, 0, 1);
+    RedTest_Verify(test, "Unknown variable",
+            result == CANOPY_ERROR_VARIABLE_NOT_INITIALIZED);
+    result = canopy_var_set_array_float64(canopy, "spectrum", (const double *)spectrum, 0, 1);
+    RedTest_Verify(test, "Wrong element type", result == CANOPY_ERROR_INCORRECT_DATATYPE);
+    result = canopy_var_set_array_int16(canopy, "samples", samples, 2, 3);
+    RedTest_Verify(test, "Range past end",
+            result == CANOPY_ERROR_ARRAY_INDEX_OUT_OF_BOUNDS);
+    result = canopy_var_set_array_int16(canopy, "samples", samples, (size_t)-1, 2);
+    RedTest_Verify(test, "Range wraps around",
+            result == CANOPY_ERROR_ARRAY_INDEX_OUT_OF_BOUNDS);
+    result = canopy_var_set_array_uint8(canopy, "leds", (const uint8_t *)samples, 0, 4);
+    RedTest_Verify(test, "Input array", result == CANOPY_ERROR_CANNOT_MODIFY_INPUT_VARIABLE);
+
+    // Partial ranges.
+    for (i = 0; i < 4; i++)
+    {
+        samples[i] = (int16_t)(-100*i);
+    }
+    result = canopy_var_set_array_int16(canopy, "samples", samples, 0, 4);
+    RedTest_Verify(test, "Set samples", result == CANOPY_SUCCESS);
+    result = canopy_var_set_array_int16(canopy, "samples", &samples[1], 2, 1);
+    RedTest_Verify(test, "Set one sample", result == CANOPY_SUCCESS);
+    result = canopy_var_get_array_int16(canopy, "samples", samplesOut, 1, 3);
+    RedTest_Verify(test, "Get samples", result == CANOPY_SUCCESS);
+    RedTest_Verify(test, "Samples match",
+            samplesOut[0] == -100 && samplesOut[1] == -100 && samplesOut[2] == -300);
+
+    // The element-at-a-time path, for comparison.
+    allocs = bench_num_allocs();
+    start = bench_now_us();
+    for (i = 0; i < NUM_BINS; i++)
+    {
+        canopy_var_set(canopy, "spectrum",
+                CANOPY_VALUE_ARRAY(i, CANOPY_VALUE_FLOAT32((float)i)));
+    }
+    bench_report("spectrum via CANOPY_VALUE_ARRAY", 1,
+            bench_now_us() - start, bench_num_allocs() - allocs);
+
+    allocs = bench_num_allocs();
+    start = bench_now_us();
+    for (j = 0; j < NUM_ITERATIONS; j++)
+    {
+        for (i = 0; i < NUM_BINS; i++)
+        {
+            spectrum[i] = (float)(i + j);
+        }
+        canopy_var_set_array_float32(canopy, "spectrum", spectrum, 0, NUM_BINS);
+    }
+    allocs = bench_num_allocs() - allocs;
+    bench_report("spectrum via canopy_var_set_array_float32", NUM_ITERATIONS,
+            bench_now_us() - start, allocs);
+    RedTest_Verify(test, "Bulk set does not allocate", allocs == 0);
+
+    allocs = bench_num_allocs();
+    start = bench_now_us();
+    for (j = 0; j < NUM_ITERATIONS; j++)
+    {
+        canopy_var_get_array_float32(canopy, "spectrum", readback, 0, NUM_BINS);
+    }
+    allocs = bench_num_allocs() - allocs;
+    bench_report("spectrum via canopy_var_get_array_float32", NUM_ITERATIONS,
+            bench_now_us() - start, allocs);
+    RedTest_Verify(test, "Bulk get does not allocate", allocs == 0);
+
+    ok = true;
+    for (i = 0; i < NUM_BINS; i++)
+    {
+        ok = ok && readback[i] == (float)(i + NUM_ITERATIONS - 1);
+    }
+    RedTest_Verify(test, "Spectrum reads back", ok);
+
+    result = canopy_sync(canopy, NULL);
+    RedTest_Verify(test, "Sync", result == CANOPY_SUCCESS);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
@@ -0,0 +1,104 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "bench.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Benchmark for syncing a large number of dirty Cloud Variables.
+//
+// Every variable is touched, then synced.  Collecting the dirty variables
+// walks the system's dirty list once, so the cost of a sync should grow
+// linearly with the number of dirty variables.
+//
+// The NOOP protocol prints each payload to stdout, so stdout is redirected
+// to /dev/null while syncing.
+#define NUM_VARS 10000
+#define NUM_ROUNDS 10
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    CanopyVarHandle handles[NUM_VARS];
+    RedTest test;
+    uint64_t start, setUs, syncUs, cleanUs, setAllocs, syncAllocs;
+    char decl[64];
+    bool ok;
+    int i, round, savedStdout;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy_set_global_opt(CANOPY_LOG_ENABLED, false);
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    ok = true;
+    for (i = 0; i < NUM_VARS; i++)
+    {
+        snprintf(decl, sizeof(decl), "out float32 v%d", i);
+        result = canopy_var_init(canopy, decl);
+        handles[i] = canopy_var_handle(canopy, decl + strlen("out float32 "));
+        ok = ok && (result == CANOPY_SUCCESS) && handles[i];
+    }
+    RedTest_Verify(test, "Init cloud variables", ok);
+
+    fflush(stdout);
+    savedStdout = dup(STDOUT_FILENO);
+    if (savedStdout < 0 || !freopen("/dev/null", "w", stdout))
+    {
+        RedTest_Abort(test, "Could not redirect stdout");
+    }
+
+    setUs = 0;
+    syncUs = 0;
+    setAllocs = 0;
+    syncAllocs = 0;
+    ok = true;
+    for (round = 0; round < NUM_ROUNDS; round++)
+    {
+        setAllocs -= bench_num_allocs();
+        start = bench_now_us();
+        for (i = 0; i < NUM_VARS; i++)
+        {
+            ok = ok && (canopy_var_set_h(canopy, handles[i],
+                    CANOPY_VALUE_FLOAT32((float)(round + i))) == CANOPY_SUCCESS);
+        }
+        setUs += bench_now_us() - start;
+        setAllocs += bench_num_allocs();
+
+        syncAllocs -= bench_num_allocs();
+        start = bench_now_us();
+        ok = ok && (canopy_sync_blocking(canopy, 0) == CANOPY_SUCCESS);
+        syncUs += bench_now_us() - start;
+        syncAllocs += bench_num_allocs();
+    }
+    RedTest_Verify(test, "Set and sync succeed", ok);
+
+    // Nothing touched since the last sync: must be cheap.
+    start = bench_now_us();
+    result = canopy_sync_blocking(canopy, 0);
+    cleanUs = bench_now_us() - start;
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+
+    RedTest_Verify(test, "Clean sync succeeds", result == CANOPY_SUCCESS);
+
+    bench_report("canopy_var_set_h (10k vars)", NUM_ROUNDS * NUM_VARS, setUs, setAllocs);
+    bench_report("canopy_sync_blocking (10k dirty)", NUM_ROUNDS, syncUs, syncAllocs);
+    bench_report("canopy_sync_blocking (0 dirty)", 1, cleanUs, 0);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
@@ -0,0 +1,154 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "bench.h"
+#include "ws_server.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Benchmark for replaying changes recorded while offline.
+//
+// The device records samples while the server is unreachable, is shut down
+// and restarted (the samples must survive in the CANOPY_OFFLINE_FILE), and
+// then the server comes up.  The test measures how quickly the backlog is
+// drained, in batches of CANOPY_OFFLINE_BATCH_SIZE samples.  It also checks
+// the overflow policies on a small store.
+#define NUM_SAMPLES 8192
+#define BATCH_SIZE 512
+#define SMALL_CAPACITY 100
+
+static CanopyContext _init(RedTest test, const char *file, int port,
+        int capacity, CanopyOfflineOverflowEnum overflow)
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_HTTP_PORT, port,
+        CANOPY_DEVICE_UUID, "9dfe2a00-efe2-45f9-a84c-8afc69caf4e6",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_OFFLINE_FILE, file,
+        CANOPY_OFFLINE_CAPACITY, capacity,
+        CANOPY_OFFLINE_OVERFLOW, overflow,
+        CANOPY_OFFLINE_BATCH_SIZE, BATCH_SIZE
+    );
+    RedTest_Verify(test, "Configure", result == CANOPY_SUCCESS);
+    result = canopy_var_init(canopy, "out float32 temperature");
+    RedTest_Verify(test, "Init temperature", result == CANOPY_SUCCESS);
+    result = canopy_var_init(canopy, "out int32 count");
+    RedTest_Verify(test, "Init count", result == CANOPY_SUCCESS);
+    return canopy;
+}
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    TestWsServer server;
+    RedTest test;
+    uint64_t start, elapsed;
+    char file[64];
+    bool ok;
+    int i, port, numBatches;
+    uint32_t backlog;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+    canopy_set_global_opt(CANOPY_LOG_ENABLED, false);
+
+    port = 19000 + (getpid() % 1000);
+    snprintf(file, sizeof(file), "/tmp/canopy_offline_%d", (int)getpid());
+    unlink(file);
+
+    // Nothing is listening on <port> yet, so every change is recorded.
+    canopy = _init(test, file, port, 2*NUM_SAMPLES, CANOPY_OFFLINE_DROP_OLDEST);
+    RedTest_Verify(test, "Starts with empty backlog", canopy_offline_backlog(canopy) == 0);
+    start = bench_now_us();
+    ok = true;
+    for (i = 0; i < NUM_SAMPLES/2; i++)
+    {
+        ok = ok && canopy_var_set_float32(canopy, "temperature", 20.0f + i*0.01f) == CANOPY_SUCCESS;
+        ok = ok && canopy_var_set_int32(canopy, "count", i) == CANOPY_SUCCESS;
+    }
+    bench_report("record offline sample", NUM_SAMPLES, bench_now_us() - start, 0);
+    RedTest_Verify(test, "Set while offline", ok);
+    RedTest_Verify(test, "Every change recorded", canopy_offline_backlog(canopy) == NUM_SAMPLES);
+
+    result = canopy_sync_blocking(canopy, CANOPY_SECONDS);
+    RedTest_Verify(test, "Sync fails while server is down", result != CANOPY_SUCCESS);
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    // The backlog outlives the context.
+    canopy = _init(test, file, port, 2*NUM_SAMPLES, CANOPY_OFFLINE_DROP_OLDEST);
+    RedTest_Verify(test, "Backlog survives restart",
+            canopy_offline_backlog(canopy) == NUM_SAMPLES);
+
+    if (!test_ws_server_start(&server, port))
+    {
+        RedTest_Abort(test, "Could not start stand-in server");
+    }
+    result = canopy_sync_blocking(canopy, 5*CANOPY_SECONDS);
+    RedTest_Verify(test, "Sync once server is up", result == CANOPY_SUCCESS);
+
+    // Drain the backlog.
+    start = bench_now_us();
+    while ((backlog = canopy_offline_backlog(canopy)) > 0 &&
+            bench_now_us() - start < 10*CANOPY_SECONDS)
+    {
+        canopy_service(canopy, 100);
+    }
+    elapsed = bench_now_us() - start;
+    bench_report("replay offline sample", NUM_SAMPLES, elapsed, 0);
+    RedTest_Verify(test, "Backlog drained", backlog == 0);
+
+    numBatches = 0;
+    for (i = 0; i < test_ws_server_num_messages(&server); i++)
+    {
+        if (test_ws_server_message_contains(&server, i, "\"history\"", 9))
+        {
+            numBatches++;
+        }
+    }
+    printf("Replayed %d samples in %d batches\n", NUM_SAMPLES, numBatches);
+    RedTest_Verify(test, "Replayed in batches",
+            numBatches == (NUM_SAMPLES + BATCH_SIZE - 1) / BATCH_SIZE);
+    RedTest_Verify(test, "History grouped by variable",
+            test_ws_server_message_contains(&server, 1, "\"temperature\":{\"t\":[", 20) ||
+            test_ws_server_message_contains(&server, 2, "\"temperature\":{\"t\":[", 20));
+
+    // Changes made while connected are sent as usual, not recorded.
+    canopy_var_set_float32(canopy, "temperature", 30.0f);
+    RedTest_Verify(test, "Nothing recorded while online", canopy_offline_backlog(canopy) == 0);
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+    test_ws_server_stop(&server);
+    unlink(file);
+
+    // Overflow policies.  The server is down again.
+    canopy = _init(test, file, port, SMALL_CAPACITY, CANOPY_OFFLINE_DROP_NEWEST);
+    for (i = 0; i < 3*SMALL_CAPACITY; i++)
+    {
+        canopy_var_set_int32(canopy, "count", i);
+    }
+    RedTest_Verify(test, "DROP_NEWEST keeps capacity",
+            canopy_offline_backlog(canopy) == SMALL_CAPACITY);
+    canopy_shutdown_context(canopy);
+    unlink(file);
+
+    canopy = _init(test, file, port, SMALL_CAPACITY, CANOPY_OFFLINE_DOWNSAMPLE);
+    for (i = 0; i < 3*SMALL_CAPACITY; i++)
+    {
+        canopy_var_set_int32(canopy, "count", i);
+    }
+    backlog = canopy_offline_backlog(canopy);
+    RedTest_Verify(test, "DOWNSAMPLE stays within capacity", backlog <= SMALL_CAPACITY);
+    RedTest_Verify(test, "DOWNSAMPLE keeps at least half", backlog >= SMALL_CAPACITY/2);
+    canopy_shutdown_context(canopy);
+    unlink(file);
+
+    return RedTest_End(test);
+}
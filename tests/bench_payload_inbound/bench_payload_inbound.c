@@ -0,0 +1,257 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "bench.h"
+#include "ws_server.h"
+#include "cloudvar/st_cloudvar.h"
+#include "json/st_json_reader.h"
+#include <red_hash.h>
+#include <red_json.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Benchmark & checks for inbound JSON payload processing.
+//
+// First, a stand-in server sends a 1000-variable control message, which
+// arrives in several pieces that must be reassembled, and every variable in
+// it must be updated.  Then the way that message is processed, with a
+// streaming reader that dispatches each value as it is reached, is timed
+// against the previous approach: parse a RedJson document, allocate its keys
+// array, and look each key up.  The streaming reader must not touch the heap.
+#define NUM_VARS 1000
+#define NUM_ITERATIONS 200
+#define MAX_SERVICE_CALLS 50
+
+#define PAYLOAD_MAX (32*1024)
+
+static char sPayload[PAYLOAD_MAX];
+static int32_t sValues[NUM_VARS];
+
+// {"vars" : {"reg_0" : 0, "reg_1" : -7, ..., "note" : "..."}}
+static size_t _gen_payload(int round, int numVars)
+{
+    size_t len;
+    int i;
+
+    len = snprintf(sPayload, PAYLOAD_MAX, "{\"vars\" : {");
+    for (i = 0; i < numVars; i++)
+    {
+        len += snprintf(&sPayload[len], PAYLOAD_MAX - len, "%s\"reg_%d\" : %d",
+                i ? ", " : "", i, round - 7*i);
+    }
+    len += snprintf(&sPayload[len], PAYLOAD_MAX - len,
+            ", \"note\" : \"caf\\u00e9 \\\"ok\\\"\"}}");
+    return len;
+}
+
+// The previous approach: build a document, then look up each of its keys.
+static bool _process_dom(RedHash slots, const char *payload)
+{
+    RedJsonObject json, varsJson;
+    char **varnames;
+    unsigned numVars, i;
+
+    json = RedJson_Parse(payload);
+    if (!json || !RedJsonObject_IsValueObject(json, "vars"))
+    {
+        return false;
+    }
+    varsJson = RedJsonObject_GetObject(json, "vars");
+    numVars = RedJsonObject_NumItems(varsJson);
+    varnames = RedJsonObject_NewKeysArray(varsJson);
+    for (i = 0; i < numVars; i++)
+    {
+        int32_t *slot = RedHash_GetWithDefaultS(slots, varnames[i], NULL);
+        if (slot)
+        {
+            *slot = (int32_t)RedJsonValue_GetNumber(RedJsonObject_Get(varsJson, varnames[i]));
+        }
+    }
+    RedJsonObject_FreeKeysArray(varnames);
+    RedJsonObject_Free(json);
+    return true;
+}
+
+// The streaming approach, as used by libcanopy.
+static bool _process_streaming(RedHash slots, const char *payload, size_t len)
+{
+    STJsonReader_t r;
+    STJsonContainer_t top, vars;
+    char key[256];
+    double number;
+
+    st_json_reader_init(&r, payload, len);
+    if (!st_json_enter_object(&r, &top))
+    {
+        return false;
+    }
+    while (st_json_container_next(&r, &top))
+    {
+        if (!st_json_read_key(&r, key, sizeof(key), NULL) || strcmp(key, "vars"))
+        {
+            st_json_skip(&r);
+            continue;
+        }
+        st_json_enter_object(&r, &vars);
+        while (st_json_container_next(&r, &vars))
+        {
+            int32_t *slot = NULL;
+            if (st_json_read_key(&r, key, sizeof(key), NULL))
+            {
+                slot = RedHash_GetWithDefaultS(slots, key, NULL);
+            }
+            if (!slot)
+            {
+                st_json_skip(&r);
+                continue;
+            }
+            st_json_read_number(&r, &number);
+            *slot = (int32_t)number;
+        }
+    }
+    return !st_json_reader_failed(&r);
+}
+
+static bool _check_values(int round)
+{
+    int i;
+    for (i = 0; i < NUM_VARS; i++)
+    {
+        if (sValues[i] != round - 7*i)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    TestWsServer server;
+    RedTest test;
+    RedHash slots;
+    STJsonReader_t r;
+    uint64_t start, allocs;
+    char name[32], decl[64];
+    char *note = NULL;
+    size_t len;
+    int32_t value;
+    int port, i;
+    bool ok;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    // End to end.
+    len = _gen_payload(1, NUM_VARS);
+    port = 20000 + (getpid() % 1000);
+    if (!test_ws_server_start(&server, port))
+    {
+        RedTest_Abort(test, "Could not start stand-in server");
+    }
+    // Message 1 is the handshake, message 2 the first sync payload.
+    test_ws_server_reply(&server, 2, sPayload, len, false);
+
+    canopy_set_global_opt(CANOPY_LOG_ENABLED, false);
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_HTTP_PORT, port,
+        CANOPY_DEVICE_UUID, "9dfe2a00-efe2-45f9-a84c-8afc69caf4e6",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_WS_RX_BUFFER_BYTES, 1024
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    ok = true;
+    for (i = 0; i < NUM_VARS; i++)
+    {
+        snprintf(decl, sizeof(decl), "in int32 reg_%d", i);
+        ok = ok && canopy_var_init(canopy, decl) == CANOPY_SUCCESS;
+    }
+    RedTest_Verify(test, "Init registers", ok);
+    result = canopy_var_init(canopy, "in string note");
+    RedTest_Verify(test, "Init note", result == CANOPY_SUCCESS);
+
+    result = canopy_sync_blocking(canopy, 5*CANOPY_SECONDS);
+    RedTest_Verify(test, "Sync", result == CANOPY_SUCCESS);
+    for (i = 0; i < MAX_SERVICE_CALLS; i++)
+    {
+        if (canopy_var_get_string(canopy, "note", &note) == CANOPY_SUCCESS)
+        {
+            break;
+        }
+        canopy_service(canopy, 100000);
+    }
+    RedTest_Verify(test, "Escaped string received", note && !strcmp(note, "caf\xc3\xa9 \"ok\""));
+    free(note);
+
+    // A string that fails to decode leaves the value it would replace alone.
+    st_json_reader_init(&r, "\"caf\\q\"", 7);
+    result = st_cloudvar_basic_update_from_json(canopy_var_handle(canopy, "note"), &r);
+    RedTest_Verify(test, "Bad escape rejected", result == CANOPY_ERROR_PARSING_PAYLOAD);
+    note = NULL;
+    canopy_var_get_string(canopy, "note", &note);
+    RedTest_Verify(test, "Bad string leaves value intact", 
+            note && !strcmp(note, "caf\xc3\xa9 \"ok\""));
+    free(note);
+
+    ok = true;
+    for (i = 0; i < NUM_VARS; i++)
+    {
+        snprintf(name, sizeof(name), "reg_%d", i);
+        ok = ok && canopy_var_get_int32(canopy, name, &value) == CANOPY_SUCCESS;
+        ok = ok && value == 1 - 7*i;
+    }
+    RedTest_Verify(test, "Every register received", ok);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+    test_ws_server_stop(&server);
+
+    // Parse & dispatch only.
+    slots = RedHash_New(0);
+    for (i = 0; i < NUM_VARS; i++)
+    {
+        snprintf(name, sizeof(name), "reg_%d", i);
+        RedHash_InsertS(slots, name, &sValues[i]);
+    }
+
+    len = _gen_payload(2, NUM_VARS);
+    allocs = bench_num_allocs();
+    start = bench_now_us();
+    ok = true;
+    for (i = 0; i < NUM_ITERATIONS; i++)
+    {
+        ok = ok && _process_dom(slots, sPayload);
+    }
+    bench_report("1000-variable message via RedJson document", NUM_ITERATIONS,
+            bench_now_us() - start, bench_num_allocs() - allocs);
+    RedTest_Verify(test, "Document path sets every value", ok && _check_values(2));
+
+    len = _gen_payload(3, NUM_VARS);
+    allocs = bench_num_allocs();
+    start = bench_now_us();
+    ok = true;
+    for (i = 0; i < NUM_ITERATIONS; i++)
+    {
+        ok = ok && _process_streaming(slots, sPayload, len);
+    }
+    allocs = bench_num_allocs() - allocs;
+    bench_report("1000-variable message via st_json_reader", NUM_ITERATIONS,
+            bench_now_us() - start, allocs);
+    RedTest_Verify(test, "Streaming path sets every value", ok && _check_values(3));
+    RedTest_Verify(test, "Streaming path does not allocate", allocs == 0);
+
+    // Malformed input is rejected, wherever it goes wrong.
+    ok = true;
+    for (i = (int)len - 1; i >= 0; i -= 97)
+    {
+        ok = ok && !_process_streaming(slots, sPayload, (size_t)i);
+    }
+    RedTest_Verify(test, "Truncated messages rejected", ok);
+
+    return RedTest_End(test);
+}
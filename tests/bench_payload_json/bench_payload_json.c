@@ -0,0 +1,95 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "bench.h"
+#include <stdio.h>
+#include <unistd.h>
+
+// Benchmark for generating the outbound sync payload of a large array.
+//
+// A 1000-element float32 array is set and synced repeatedly over the NOOP
+// protocol.  The payload is streamed into a single growable buffer, so the
+// number of allocations per sync should stay small and must not scale with
+// the number of array elements.
+//
+// The NOOP protocol prints each payload to stdout, so stdout is redirected
+// to /dev/null while syncing.
+#define NUM_ITEMS 1000
+#define NUM_ROUNDS 100
+
+// Upper bound on allocations for one sync of the array.  The payload is
+// about 12KB, which takes a handful of buffer doublings.
+#define MAX_ALLOCS_PER_SYNC 32
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    RedTest test;
+    uint64_t start, syncUs, syncAllocs;
+    bool ok;
+    int i, round, savedStdout;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy_set_global_opt(CANOPY_LOG_ENABLED, false);
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out float32[1000] samples");
+    RedTest_Verify(test, "Init array", result == CANOPY_SUCCESS);
+
+    fflush(stdout);
+    savedStdout = dup(STDOUT_FILENO);
+    if (savedStdout < 0 || !freopen("/dev/null", "w", stdout))
+    {
+        RedTest_Abort(test, "Could not redirect stdout");
+    }
+
+    syncUs = 0;
+    syncAllocs = 0;
+    ok = true;
+    for (round = 0; round <= NUM_ROUNDS; round++)
+    {
+        for (i = 0; i < NUM_ITEMS; i++)
+        {
+            ok = ok && (canopy_var_set(canopy, "samples",
+                    CANOPY_VALUE_ARRAY(i, CANOPY_VALUE_FLOAT32(round + i*0.001f)))
+                    == CANOPY_SUCCESS);
+        }
+
+        // Round 0 warms up (first sync also sends the SDDL declaration).
+        if (round == 0)
+        {
+            ok = ok && (canopy_sync_blocking(canopy, 0) == CANOPY_SUCCESS);
+            continue;
+        }
+
+        syncAllocs -= bench_num_allocs();
+        start = bench_now_us();
+        ok = ok && (canopy_sync_blocking(canopy, 0) == CANOPY_SUCCESS);
+        syncUs += bench_now_us() - start;
+        syncAllocs += bench_num_allocs();
+    }
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+
+    RedTest_Verify(test, "Set and sync succeed", ok);
+
+    bench_report("canopy_sync_blocking (float32[1000])", NUM_ROUNDS, syncUs, syncAllocs);
+    RedTest_Verify(test, "Allocations don't scale with array length",
+            syncAllocs <= (uint64_t)NUM_ROUNDS*MAX_ALLOCS_PER_SYNC);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
@@ -0,0 +1,120 @@
+#define TEST_WS_SERVER_MAX_MESSAGES 4096
+
+#include <canopy.h>
+#include "red_test.h"
+#include "bench.h"
+#include "ws_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Benchmark & checks for outbound send scheduling.
+//
+// A fast publisher changes a variable and requests a sync, NUM_SYNCS times
+// in a row, against a local stand-in server.  This is run twice: once with
+// the default send limits, where queued payloads are pipelined, and once
+// with only one byte allowed in flight, so that the link is busy most of
+// the time and syncs are coalesced while it is.  Either way, the last value
+// must arrive, and there must be no more payloads than syncs.
+#define NUM_SYNCS 1000
+#define MAX_SERVICE_CALLS 50
+
+static void _run(RedTest test, const char *name, int port, int maxBytesInFlight)
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    CanopySendStats stats;
+    TestWsServer server;
+    uint64_t start, elapsed;
+    char expect[32];
+    bool ok, found;
+    int i, j;
+
+    if (!test_ws_server_start(&server, port))
+    {
+        RedTest_Abort(test, "Could not start stand-in server");
+    }
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_HTTP_PORT, port,
+        CANOPY_DEVICE_UUID, "9dfe2a00-efe2-45f9-a84c-8afc69caf4e6",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_WS_MAX_BYTES_IN_FLIGHT, maxBytesInFlight
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+    result = canopy_var_init(canopy, "out int32 counter");
+    RedTest_Verify(test, "Init counter", result == CANOPY_SUCCESS);
+
+    // Connect first, so that only publishing is timed.
+    result = canopy_sync_blocking(canopy, 5*CANOPY_SECONDS);
+    RedTest_Verify(test, "Connect", result == CANOPY_SUCCESS);
+
+    start = bench_now_us();
+    ok = true;
+    for (i = 1; i <= NUM_SYNCS; i++)
+    {
+        ok = ok && canopy_var_set_int32(canopy, "counter", i) == CANOPY_SUCCESS;
+        ok = ok && canopy_sync(canopy, NULL) == CANOPY_SUCCESS;
+        canopy_service(canopy, 0);
+    }
+    result = canopy_sync_blocking(canopy, 5*CANOPY_SECONDS);
+    elapsed = bench_now_us() - start;
+    RedTest_Verify(test, "Publish", ok && result == CANOPY_SUCCESS);
+    bench_report(name, NUM_SYNCS, elapsed, 0);
+
+    // Let the queue drain.
+    snprintf(expect, sizeof(expect), "\"counter\":%d}", NUM_SYNCS);
+    found = false;
+    for (j = 0; j < MAX_SERVICE_CALLS && !found; j++)
+    {
+        for (i = test_ws_server_num_messages(&server) - 1; i >= 0 && !found; i--)
+        {
+            found = test_ws_server_message_contains(&server, i, expect, strlen(expect));
+        }
+        canopy_service(canopy, 100000);
+    }
+    RedTest_Verify(test, "Last value received", found);
+
+    result = canopy_get_send_stats(canopy, &stats);
+    RedTest_Verify(test, "Get send stats", result == CANOPY_SUCCESS);
+    printf("    syncs=%llu payloads=%llu (%.2f syncs/payload) "
+            "frames=%llu write_rounds=%llu (%.2f frames/round) bytes=%llu\n",
+            (unsigned long long)stats.syncs,
+            (unsigned long long)stats.payloads,
+            stats.payloads ? (double)stats.syncs/stats.payloads : 0.0,
+            (unsigned long long)stats.frames,
+            (unsigned long long)stats.write_rounds,
+            stats.write_rounds ? (double)stats.frames/stats.write_rounds : 0.0,
+            (unsigned long long)stats.bytes);
+    RedTest_Verify(test, "Every change synced", stats.syncs >= NUM_SYNCS);
+    RedTest_Verify(test, "No more payloads than syncs", stats.payloads <= stats.syncs);
+    RedTest_Verify(test, "Every payload written",
+            stats.frames == stats.payloads + 1 &&
+            stats.frames == (uint64_t)test_ws_server_num_messages(&server));
+    RedTest_Verify(test, "Frames written in rounds",
+            stats.write_rounds > 0 && stats.write_rounds <= stats.frames);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+    test_ws_server_stop(&server);
+}
+
+int main(int argc, const char *argv[])
+{
+    RedTest test;
+    int port;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+    canopy_set_global_opt(CANOPY_LOG_ENABLED, false);
+
+    port = 22000 + (getpid() % 500);
+    _run(test, "sync, pipelined", port, 65536);
+    _run(test, "sync, coalesced while link is busy", port + 500, 1);
+
+    return RedTest_End(test);
+}
@@ -0,0 +1,94 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "bench.h"
+#include <stdio.h>
+
+// Microbenchmark for setting a basic Cloud Variable locally.
+//
+// Compares canopy_var_set(ctx, name, CANOPY_VALUE_FLOAT32(x)), which creates
+// a single-use value object per call, with the typed setter
+// canopy_var_set_float32(ctx, name, x), which must not touch the heap.
+#define NUM_ITERATIONS 1000000
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    RedTest test;
+    uint64_t start, allocs;
+    float readback;
+    int i;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy_set_global_opt(CANOPY_LOG_ENABLED, false);
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out float32 temperature");
+    RedTest_Verify(test, "Init cloud variable", result == CANOPY_SUCCESS);
+
+    // Warm up: first set may allocate the variable's value storage.
+    result = canopy_var_set_float32(canopy, "temperature", 0.0f);
+    RedTest_Verify(test, "Warm up", result == CANOPY_SUCCESS);
+
+    allocs = bench_num_allocs();
+    start = bench_now_us();
+    for (i = 0; i < NUM_ITERATIONS; i++)
+    {
+        canopy_var_set(canopy, "temperature", CANOPY_VALUE_FLOAT32((float)i));
+    }
+    bench_report("canopy_var_set(CANOPY_VALUE_FLOAT32)", NUM_ITERATIONS,
+            bench_now_us() - start, bench_num_allocs() - allocs);
+
+    allocs = bench_num_allocs();
+    start = bench_now_us();
+    for (i = 0; i < NUM_ITERATIONS; i++)
+    {
+        canopy_var_set_float32(canopy, "temperature", (float)i);
+    }
+    allocs = bench_num_allocs() - allocs;
+    bench_report("canopy_var_set_float32", NUM_ITERATIONS,
+            bench_now_us() - start, allocs);
+    RedTest_Verify(test, "Typed setter does not allocate", allocs == 0);
+
+    result = canopy_var_get_float32(canopy, "temperature", &readback);
+    RedTest_Verify(test, "Read back", result == CANOPY_SUCCESS);
+    RedTest_Verify(test, "Value matches", readback == (float)(NUM_ITERATIONS - 1));
+
+    // Strings are copied into a buffer owned by the variable, which only
+    // grows when needed.  Once it has grown, updates must not allocate.
+    result = canopy_var_init(canopy, "out string status");
+    RedTest_Verify(test, "Init string variable", result == CANOPY_SUCCESS);
+    result = canopy_var_set_string(canopy, "status", "warming up......");
+    RedTest_Verify(test, "Warm up string", result == CANOPY_SUCCESS);
+
+    allocs = bench_num_allocs();
+    start = bench_now_us();
+    for (i = 0; i < NUM_ITERATIONS; i++)
+    {
+        canopy_var_set_string(canopy, "status", (i & 1) ? "ok" : "degraded");
+    }
+    allocs = bench_num_allocs() - allocs;
+    bench_report("canopy_var_set_string", NUM_ITERATIONS,
+            bench_now_us() - start, allocs);
+    RedTest_Verify(test, "String setter reaches steady state", allocs == 0);
+
+    result = canopy_var_set_string(canopy, "status", NULL);
+    RedTest_Verify(test, "NULL string rejected", result == CANOPY_ERROR_INVALID_VALUE);
+
+    result = canopy_var_set_int32(canopy, "temperature", 4);
+    RedTest_Verify(test, "Datatype mismatch rejected",
+            result == CANOPY_ERROR_INCORRECT_DATATYPE);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
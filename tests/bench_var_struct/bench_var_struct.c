@@ -0,0 +1,163 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Benchmark & checks for C struct binding.
+//
+// Publishes a telemetry struct first as a CANOPY_VALUE_STRUCT tree, one
+// CanopyVarValue per field, then with canopy_var_set_struct from a bound C
+// struct, which must not touch the heap.
+#define NUM_ITERATIONS 100000
+
+struct telemetry
+{
+    float temperature;
+    uint16_t rpm;
+    bool running;
+    struct
+    {
+        double latitude;
+        double longitude;
+    } position;
+    const char *mode;
+};
+
+static const CanopyStructField sTelemetryFields[] = {
+    CANOPY_STRUCT_FIELD(struct telemetry, temperature, CANOPY_DATATYPE_FLOAT32),
+    CANOPY_STRUCT_FIELD(struct telemetry, rpm, CANOPY_DATATYPE_UINT16),
+    CANOPY_STRUCT_FIELD(struct telemetry, running, CANOPY_DATATYPE_BOOL),
+    CANOPY_STRUCT_FIELD(struct telemetry, position.latitude, CANOPY_DATATYPE_FLOAT64),
+    CANOPY_STRUCT_FIELD(struct telemetry, position.longitude, CANOPY_DATATYPE_FLOAT64),
+    CANOPY_STRUCT_FIELD(struct telemetry, mode, CANOPY_DATATYPE_STRING),
+};
+#define NUM_FIELDS (sizeof(sTelemetryFields)/sizeof(sTelemetryFields[0]))
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    CanopyStructField badField;
+    RedTest test;
+    uint64_t start, allocs;
+    struct telemetry telemetry, readback;
+    uint16_t rpm;
+    int i;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy_set_global_opt(CANOPY_LOG_ENABLED, false);
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out struct telemetry",
+            CANOPY_INIT_FIELD("float32 temperature"),
+            CANOPY_INIT_FIELD("uint16 rpm"),
+            CANOPY_INIT_FIELD("bool running"),
+            CANOPY_INIT_FIELD("struct position",
+                CANOPY_INIT_FIELD("float64 latitude"),
+                CANOPY_INIT_FIELD("float64 longitude")
+            ),
+            CANOPY_INIT_FIELD("string mode")
+    );
+    RedTest_Verify(test, "Init telemetry", result == CANOPY_SUCCESS);
+    result = canopy_var_init(canopy, "out float32 temperature");
+    RedTest_Verify(test, "Init temperature", result == CANOPY_SUCCESS);
+
+    // Error cases.
+    memset(&telemetry, 0, sizeof(telemetry));
+    result = canopy_var_set_struct(canopy, "telemetry", &telemetry);
+    RedTest_Verify(test, "Set before bind", result == CANOPY_ERROR_INCORRECT_DATATYPE);
+    result = canopy_var_bind_struct(canopy, "nonexistent", sTelemetryFields, NUM_FIELDS);
+    RedTest_Verify(test, "Unknown variable", result == CANOPY_ERROR_VARIABLE_NOT_INITIALIZED);
+    result = canopy_var_bind_struct(canopy, "temperature", sTelemetryFields, NUM_FIELDS);
+    RedTest_Verify(test, "Not a struct", result == CANOPY_ERROR_INCORRECT_DATATYPE);
+    badField.name = "position.altitude";
+    badField.datatype = CANOPY_DATATYPE_FLOAT64;
+    badField.offset = 0;
+    result = canopy_var_bind_struct(canopy, "telemetry", &badField, 1);
+    RedTest_Verify(test, "Unknown member", result == CANOPY_ERROR_VARIABLE_NOT_INITIALIZED);
+    badField.name = "rpm";
+    result = canopy_var_bind_struct(canopy, "telemetry", &badField, 1);
+    RedTest_Verify(test, "Wrong member datatype", result == CANOPY_ERROR_INCORRECT_DATATYPE);
+
+    result = canopy_var_bind_struct(canopy, "telemetry", sTelemetryFields, NUM_FIELDS);
+    RedTest_Verify(test, "Bind telemetry", result == CANOPY_SUCCESS);
+    result = canopy_var_set_struct(canopy, "telemetry", &telemetry);
+    RedTest_Verify(test, "NULL string rejected", result == CANOPY_ERROR_INVALID_VALUE);
+    result = canopy_var_get_struct(canopy, "telemetry", &readback);
+    RedTest_Verify(test, "Get before set", result == CANOPY_ERROR_VARIABLE_NOT_SET);
+
+    telemetry.temperature = 21.5f;
+    telemetry.rpm = 1200;
+    telemetry.running = true;
+    telemetry.position.latitude = 37.77;
+    telemetry.position.longitude = -122.42;
+    telemetry.mode = "auto";
+    result = canopy_var_set_struct(canopy, "telemetry", &telemetry);
+    RedTest_Verify(test, "Set telemetry", result == CANOPY_SUCCESS);
+
+    result = canopy_var_get_uint16(canopy, "telemetry.rpm", &rpm);
+    RedTest_Verify(test, "Member set", result == CANOPY_SUCCESS && rpm == 1200);
+    memset(&readback, 0, sizeof(readback));
+    result = canopy_var_get_struct(canopy, "telemetry", &readback);
+    RedTest_Verify(test, "Get telemetry", result == CANOPY_SUCCESS);
+    RedTest_Verify(test, "Telemetry reads back",
+            readback.temperature == 21.5f && readback.rpm == 1200 && readback.running
+            && readback.position.latitude == 37.77 && readback.position.longitude == -122.42
+            && readback.mode && !strcmp(readback.mode, "auto"));
+    free((char *)readback.mode);
+
+    // The CanopyVarValue path, for comparison.
+    allocs = bench_num_allocs();
+    start = bench_now_us();
+    for (i = 0; i < NUM_ITERATIONS; i++)
+    {
+        canopy_var_set(canopy, "telemetry",
+            CANOPY_VALUE_STRUCT(
+                "temperature", CANOPY_VALUE_FLOAT32((float)i),
+                "rpm", CANOPY_VALUE_UINT16((uint16_t)i),
+                "running", CANOPY_VALUE_BOOL(i & 1),
+                "position", CANOPY_VALUE_STRUCT(
+                    "latitude", CANOPY_VALUE_FLOAT64(i * 0.001),
+                    "longitude", CANOPY_VALUE_FLOAT64(i * -0.001)
+                ),
+                "mode", CANOPY_VALUE_STRING("auto")
+            )
+        );
+    }
+    bench_report("telemetry via CANOPY_VALUE_STRUCT", NUM_ITERATIONS,
+            bench_now_us() - start, bench_num_allocs() - allocs);
+
+    allocs = bench_num_allocs();
+    start = bench_now_us();
+    for (i = 0; i < NUM_ITERATIONS; i++)
+    {
+        telemetry.temperature = (float)i;
+        telemetry.rpm = (uint16_t)i;
+        telemetry.running = i & 1;
+        telemetry.position.latitude = i * 0.001;
+        telemetry.position.longitude = i * -0.001;
+        canopy_var_set_struct(canopy, "telemetry", &telemetry);
+    }
+    allocs = bench_num_allocs() - allocs;
+    bench_report("telemetry via canopy_var_set_struct", NUM_ITERATIONS,
+            bench_now_us() - start, allocs);
+    RedTest_Verify(test, "Struct set does not allocate", allocs == 0);
+
+    result = canopy_sync(canopy, NULL);
+    RedTest_Verify(test, "Sync", result == CANOPY_SUCCESS);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
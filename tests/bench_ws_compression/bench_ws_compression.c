@@ -0,0 +1,228 @@
+#define TEST_WS_SERVER_MAX_MESSAGES 256
+
+#include <canopy.h>
+#include "red_test.h"
+#include "bench.h"
+#include "ws_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Benchmark for WebSocket compression, ahead of permessage-deflate support,
+// which the bundled libwebsockets doesn't provide.
+//
+// First, a device with a typical mix of Cloud Variables syncs NUM_SYNCS
+// times to a local stand-in server.  Every payload must arrive intact.  The
+// payloads the server recorded (the handshake, the first sync with its
+// SDDL, then changes) are then deflated the way RFC 7692 permessage-deflate
+// does it, one message at a time, at several levels and window sizes, with
+// and without keeping the compression context from one message to the next
+// (context takeover), to weigh bytes saved against CPU time per message.
+#define NUM_SYNCS 200
+#define NUM_ITERATIONS 20
+#define MAX_SERVICE_CALLS 50
+
+#define OUT_MAX (64*1024)
+
+typedef struct _Config
+{
+    int level;
+    int windowBits;
+    bool takeover;
+} _Config;
+
+static const _Config sConfigs[] = {
+    { 1, 9, false },
+    { 1, 15, false },
+    { 6, 15, false },
+    { 1, 9, true },
+    { 1, 12, true },
+    { 1, 15, true },
+    { 6, 15, true },
+    { 9, 15, true },
+};
+#define NUM_CONFIGS (sizeof(sConfigs)/sizeof(sConfigs[0]))
+
+// permessage-deflate ends each message with an empty stored block,
+// 00 00 ff ff, which isn't sent.
+static const unsigned char sTrailer[4] = { 0x00, 0x00, 0xff, 0xff };
+
+static unsigned char sOut[OUT_MAX];
+static unsigned char sInflated[OUT_MAX];
+
+static void _publish(RedTest test, TestWsServer *server, int port)
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    float spectrum[16];
+    char status[32], expect[32];
+    int i, j;
+    bool ok;
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_HTTP_PORT, port,
+        CANOPY_DEVICE_UUID, "9dfe2a00-efe2-45f9-a84c-8afc69caf4e6",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_WS
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    ok = canopy_var_init(canopy, "out float32 temperature") == CANOPY_SUCCESS;
+    ok = ok && canopy_var_init(canopy, "out float32 humidity") == CANOPY_SUCCESS;
+    ok = ok && canopy_var_init(canopy, "out int32 uptime") == CANOPY_SUCCESS;
+    ok = ok && canopy_var_init(canopy, "out bool door_open") == CANOPY_SUCCESS;
+    ok = ok && canopy_var_init(canopy, "out string status") == CANOPY_SUCCESS;
+    ok = ok && canopy_var_init(canopy, "out float32[16] spectrum") == CANOPY_SUCCESS;
+    RedTest_Verify(test, "Init variables", ok);
+
+    ok = true;
+    for (i = 0; i < NUM_SYNCS; i++)
+    {
+        for (j = 0; j < 16; j++)
+        {
+            spectrum[j] = (float)((i*7 + j*13) % 100) / 10.0f;
+        }
+        snprintf(status, sizeof(status), i % 10 ? "ok" : "calibrating %d", i);
+        ok = ok && canopy_var_set_float32(canopy, "temperature", 20.0f + (i % 50)*0.1f) == CANOPY_SUCCESS;
+        ok = ok && canopy_var_set_float32(canopy, "humidity", 40.0f + (i % 7)) == CANOPY_SUCCESS;
+        ok = ok && canopy_var_set_int32(canopy, "uptime", 3600 + i*15) == CANOPY_SUCCESS;
+        ok = ok && canopy_var_set_bool(canopy, "door_open", (i % 17) == 0) == CANOPY_SUCCESS;
+        ok = ok && canopy_var_set_string(canopy, "status", status) == CANOPY_SUCCESS;
+        ok = ok && canopy_var_set_array_float32(canopy, "spectrum", spectrum, 0, 16) == CANOPY_SUCCESS;
+        ok = ok && canopy_sync_blocking(canopy, 5*CANOPY_SECONDS) == CANOPY_SUCCESS;
+    }
+    RedTest_Verify(test, "Sync", ok);
+
+    // Let the queue drain.
+    for (i = 0; i < MAX_SERVICE_CALLS; i++)
+    {
+        if (test_ws_server_num_messages(server) >= NUM_SYNCS + 1)
+        {
+            break;
+        }
+        canopy_service(canopy, 100000);
+    }
+    RedTest_Verify(test, "Every payload received",
+            test_ws_server_num_messages(server) == NUM_SYNCS + 1);
+    snprintf(expect, sizeof(expect), "\"uptime\":%d", 3600 + (NUM_SYNCS - 1)*15);
+    RedTest_Verify(test, "Payloads intact",
+            test_ws_server_message_contains(server, NUM_SYNCS, expect, strlen(expect)));
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+}
+
+// Compress one message into sOut.  Returns its compressed length, as sent.
+static size_t _deflate(z_stream *zs, const _Config *config, unsigned char *msg, size_t len)
+{
+    if (!config->takeover)
+    {
+        deflateReset(zs);
+    }
+    zs->next_in = msg;
+    zs->avail_in = len;
+    zs->next_out = sOut;
+    zs->avail_out = OUT_MAX;
+    deflate(zs, Z_SYNC_FLUSH);
+    return (OUT_MAX - zs->avail_out) - sizeof(sTrailer);
+}
+
+// Decompress what _deflate produced, and compare it to <msg>.
+static bool _inflate_matches(z_stream *zs, const _Config *config, size_t outLen,
+        const unsigned char *msg, size_t len)
+{
+    if (!config->takeover)
+    {
+        inflateReset(zs);
+    }
+    memcpy(&sOut[outLen], sTrailer, sizeof(sTrailer));
+    zs->next_in = sOut;
+    zs->avail_in = outLen + sizeof(sTrailer);
+    zs->next_out = sInflated;
+    zs->avail_out = OUT_MAX;
+    inflate(zs, Z_SYNC_FLUSH);
+    return OUT_MAX - zs->avail_out == len && !memcmp(sInflated, msg, len);
+}
+
+static void _bench(RedTest test, TestWsServer *server)
+{
+    const _Config *config;
+    z_stream zs, zi;
+    uint64_t start, elapsed, allocs;
+    size_t inBytes, outBytes, outLen;
+    char name[64];
+    unsigned i;
+    int iter, n, m;
+    bool ok;
+
+    // Nothing else touches the recorded messages now.
+    n = test_ws_server_num_messages(server);
+    for (i = 0; i < NUM_CONFIGS; i++)
+    {
+        config = &sConfigs[i];
+        memset(&zs, 0, sizeof(zs));
+        deflateInit2(&zs, config->level, Z_DEFLATED, -config->windowBits, 8, Z_DEFAULT_STRATEGY);
+
+        allocs = bench_num_allocs();
+        start = bench_now_us();
+        for (iter = 0; iter < NUM_ITERATIONS; iter++)
+        {
+            deflateReset(&zs);
+            for (m = 0; m < n; m++)
+            {
+                _deflate(&zs, config, server->messages[m], server->message_lens[m]);
+            }
+        }
+        elapsed = bench_now_us() - start;
+        snprintf(name, sizeof(name), "deflate level %d, 2^%d window%s",
+                config->level, config->windowBits, config->takeover ? ", takeover" : "");
+        bench_report(name, (uint64_t)n*NUM_ITERATIONS, elapsed, bench_num_allocs() - allocs);
+
+        // Once more, checking the round trip and counting bytes.
+        memset(&zi, 0, sizeof(zi));
+        inflateInit2(&zi, -15);
+        deflateReset(&zs);
+        inBytes = outBytes = 0;
+        ok = true;
+        for (m = 0; m < n; m++)
+        {
+            outLen = _deflate(&zs, config, server->messages[m], server->message_lens[m]);
+            ok = ok && _inflate_matches(&zi, config, outLen,
+                    server->messages[m], server->message_lens[m]);
+            inBytes += server->message_lens[m];
+            outBytes += outLen;
+        }
+        printf("    %d messages, %zu bytes -> %zu bytes (ratio %.2f)\n",
+                n, inBytes, outBytes, outBytes ? (double)inBytes/outBytes : 0.0);
+        RedTest_Verify(test, "Round trip", ok);
+        RedTest_Verify(test, "Compresses", outBytes < inBytes);
+        inflateEnd(&zi);
+        deflateEnd(&zs);
+    }
+}
+
+int main(int argc, const char *argv[])
+{
+    TestWsServer server;
+    RedTest test;
+    int port;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+    canopy_set_global_opt(CANOPY_LOG_ENABLED, false);
+
+    port = 23000 + (getpid() % 1000);
+    if (!test_ws_server_start(&server, port))
+    {
+        RedTest_Abort(test, "Could not start stand-in server");
+    }
+    _publish(test, &server, port);
+    _bench(test, &server);
+    test_ws_server_stop(&server);
+
+    return RedTest_End(test);
+}
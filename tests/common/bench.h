@@ -0,0 +1,106 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CANOPY_BENCH_INCLUDED
+#define CANOPY_BENCH_INCLUDED
+
+// Helpers shared by the libcanopy benchmark programs.
+//
+// Include this from exactly one source file of a benchmark.  It replaces
+// malloc & friends with versions that count calls before forwarding to glibc,
+// so that a benchmark can report how many heap allocations an operation
+// performs.  This relies on glibc's __libc_* entry points.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <time.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static uint64_t sBenchNumAllocs;
+static uint64_t sBenchNumFrees;
+static uint64_t sBenchNumAllocBytes;
+
+void *malloc(size_t size)
+{
+    __atomic_fetch_add(&sBenchNumAllocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sBenchNumAllocBytes, size, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    __atomic_fetch_add(&sBenchNumAllocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sBenchNumAllocBytes, nmemb*size, __ATOMIC_RELAXED);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    __atomic_fetch_add(&sBenchNumAllocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sBenchNumAllocBytes, size, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    if (ptr)
+    {
+        __atomic_fetch_add(&sBenchNumFrees, 1, __ATOMIC_RELAXED);
+    }
+    __libc_free(ptr);
+}
+
+// Number of malloc/calloc/realloc calls made so far by this process.
+static inline uint64_t bench_num_allocs(void)
+{
+    return __atomic_load_n(&sBenchNumAllocs, __ATOMIC_RELAXED);
+}
+
+// Total bytes requested by malloc/calloc/realloc calls so far (not
+// counting frees, so it only grows).
+static inline uint64_t bench_num_alloc_bytes(void)
+{
+    return __atomic_load_n(&sBenchNumAllocBytes, __ATOMIC_RELAXED);
+}
+
+// Number of free calls (with non-NULL pointer) made so far by this process.
+static inline uint64_t bench_num_frees(void)
+{
+    return __atomic_load_n(&sBenchNumFrees, __ATOMIC_RELAXED);
+}
+
+// Current monotonic time in microseconds.
+static inline uint64_t bench_now_us(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*1000000 + (uint64_t)(t.tv_nsec/1000);
+}
+
+// Print one result line in a format that is easy to grep & compare.
+static inline void bench_report(const char *name, uint64_t iterations, uint64_t elapsedUs, uint64_t allocs)
+{
+    printf("BENCH %-40s iters=%-10llu ns/iter=%-10.1f allocs/iter=%.3f\n",
+            name,
+            (unsigned long long)iterations,
+            iterations ? (elapsedUs*1000.0)/iterations : 0.0,
+            iterations ? (double)allocs/iterations : 0.0);
+}
+
+#endif // CANOPY_BENCH_INCLUDED
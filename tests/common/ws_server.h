@@ -0,0 +1,306 @@
+// Copyright 2015 SimpleThings, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CANOPY_TEST_WS_SERVER_INCLUDED
+#define CANOPY_TEST_WS_SERVER_INCLUDED
+
+// Local stand-in for the Canopy Cloud Service, for round-trip tests.
+//
+// Runs a libwebsockets server on a background thread that accepts the
+// "echo" protocol libcanopy connects with.  It records every message it
+// receives and, after a chosen number of messages, sends one canned reply:
+//
+//      TestWsServer server;
+//      test_ws_server_start(&server, port);
+//      test_ws_server_reply(&server, 2, replyBytes, replyLen, true);
+//      ... point a CanopyContext at localhost:<port> over CANOPY_PROTOCOL_WS
+//      test_ws_server_stop(&server);
+//
+// test_ws_server_drop closes the client's connection from the server side,
+// for testing reconnection.
+//
+// Link with -lpthread.
+
+#include <libwebsockets.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Define TEST_WS_SERVER_MAX_MESSAGES before including this to record more.
+#ifndef TEST_WS_SERVER_MAX_MESSAGES
+#define TEST_WS_SERVER_MAX_MESSAGES 64
+#endif
+
+typedef struct TestWsServer
+{
+    struct libwebsocket_context *ctx;
+    pthread_t thread;
+    volatile bool stop;
+
+    pthread_mutex_t lock;
+
+    // Messages received so far (protected by <lock>).
+    unsigned char *messages[TEST_WS_SERVER_MAX_MESSAGES];
+    size_t message_lens[TEST_WS_SERVER_MAX_MESSAGES];
+    bool message_binary[TEST_WS_SERVER_MAX_MESSAGES];
+    int num_messages;
+
+    // Canned reply, sent once <reply_after> messages have arrived.
+    const unsigned char *reply;
+    size_t reply_len;
+    bool reply_binary;
+    int reply_after;
+    bool reply_pending;
+    bool reply_sent;
+
+    // Current client connection, and number accepted so far (protected by
+    // <lock>).
+    struct libwebsocket *conn;
+    int num_connections;
+    bool drop_pending;
+} TestWsServer;
+
+static int _test_ws_server_http_cb(
+        struct libwebsocket_context *context,
+        struct libwebsocket *wsi,
+        enum libwebsocket_callback_reasons reason,
+        void *user,
+        void *in,
+        size_t len)
+{
+    return 0;
+}
+
+static int _test_ws_server_cb(
+        struct libwebsocket_context *context,
+        struct libwebsocket *wsi,
+        enum libwebsocket_callback_reasons reason,
+        void *user,
+        void *in,
+        size_t len)
+{
+    TestWsServer *server = (TestWsServer *)libwebsocket_context_user(context);
+    switch (reason)
+    {
+        case LWS_CALLBACK_ESTABLISHED:
+        {
+            pthread_mutex_lock(&server->lock);
+            server->conn = wsi;
+            server->num_connections++;
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        case LWS_CALLBACK_CLOSED:
+        {
+            pthread_mutex_lock(&server->lock);
+            if (server->conn == wsi)
+                server->conn = NULL;
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        case LWS_CALLBACK_RECEIVE:
+        {
+            pthread_mutex_lock(&server->lock);
+            if (server->num_messages < TEST_WS_SERVER_MAX_MESSAGES)
+            {
+                int i = server->num_messages++;
+                server->messages[i] = malloc(len + 1);
+                memcpy(server->messages[i], in, len);
+                server->messages[i][len] = '\0';
+                server->message_lens[i] = len;
+                server->message_binary[i] = lws_frame_is_binary(wsi);
+            }
+            if (server->reply && !server->reply_sent &&
+                    server->num_messages >= server->reply_after)
+            {
+                server->reply_pending = true;
+                libwebsocket_callback_on_writable(context, wsi);
+            }
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        case LWS_CALLBACK_SERVER_WRITEABLE:
+        {
+            unsigned char *buf;
+            pthread_mutex_lock(&server->lock);
+            if (server->drop_pending && wsi == server->conn)
+            {
+                // Returning -1 makes libwebsockets close the connection.
+                server->drop_pending = false;
+                server->conn = NULL;
+                pthread_mutex_unlock(&server->lock);
+                return -1;
+            }
+            if (server->reply_pending)
+            {
+                buf = calloc(1, LWS_SEND_BUFFER_PRE_PADDING + server->reply_len +
+                        LWS_SEND_BUFFER_POST_PADDING);
+                memcpy(&buf[LWS_SEND_BUFFER_PRE_PADDING], server->reply, 
+                        server->reply_len);
+                libwebsocket_write(wsi, &buf[LWS_SEND_BUFFER_PRE_PADDING], 
+                        server->reply_len,
+                        server->reply_binary ? LWS_WRITE_BINARY : LWS_WRITE_TEXT);
+                free(buf);
+                server->reply_pending = false;
+                server->reply_sent = true;
+            }
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        default:
+            break;
+    }
+    return 0;
+}
+
+static void * _test_ws_server_thread(void *arg)
+{
+    TestWsServer *server = (TestWsServer *)arg;
+    while (!server->stop)
+    {
+        // libwebsockets isn't thread-safe, so drops requested by the test
+        // are started from here.
+        pthread_mutex_lock(&server->lock);
+        if (server->drop_pending && server->conn)
+        {
+            libwebsocket_callback_on_writable(server->ctx, server->conn);
+        }
+        pthread_mutex_unlock(&server->lock);
+        libwebsocket_service(server->ctx, 20);
+    }
+    return NULL;
+}
+
+// Start listening on <port>.  Returns false on failure.
+static inline bool test_ws_server_start(TestWsServer *server, int port)
+{
+    static struct libwebsocket_protocols protocols[] = {
+        { "http-only", _test_ws_server_http_cb, 0, 0, 0, NULL, 0 },
+        { "echo", _test_ws_server_cb, 0, 65536, 0, NULL, 0 },
+        { NULL, NULL, 0, 0, 0, NULL, 0 }
+    };
+    struct lws_context_creation_info info;
+
+    memset(server, 0, sizeof(*server));
+    pthread_mutex_init(&server->lock, NULL);
+
+    memset(&info, 0, sizeof(info));
+    info.port = port;
+    info.protocols = protocols;
+    info.gid = -1;
+    info.uid = -1;
+    info.user = server;
+    server->ctx = libwebsocket_create_context(&info);
+    if (!server->ctx)
+    {
+        return false;
+    }
+    return pthread_create(&server->thread, NULL, _test_ws_server_thread, server) == 0;
+}
+
+// Send <reply> (which must outlive the server) to the client once
+// <afterMessages> messages have been received.
+static inline void test_ws_server_reply(
+        TestWsServer *server, 
+        int afterMessages, 
+        const void *reply, 
+        size_t len, 
+        bool binary)
+{
+    pthread_mutex_lock(&server->lock);
+    server->reply = (const unsigned char *)reply;
+    server->reply_len = len;
+    server->reply_binary = binary;
+    server->reply_after = afterMessages;
+    pthread_mutex_unlock(&server->lock);
+}
+
+// Number of messages received so far.
+static inline int test_ws_server_num_messages(TestWsServer *server)
+{
+    int n;
+    pthread_mutex_lock(&server->lock);
+    n = server->num_messages;
+    pthread_mutex_unlock(&server->lock);
+    return n;
+}
+
+// Number of client connections accepted so far.
+static inline int test_ws_server_num_connections(TestWsServer *server)
+{
+    int n;
+    pthread_mutex_lock(&server->lock);
+    n = server->num_connections;
+    pthread_mutex_unlock(&server->lock);
+    return n;
+}
+
+// Is a client connected right now?
+static inline bool test_ws_server_is_connected(TestWsServer *server)
+{
+    bool connected;
+    pthread_mutex_lock(&server->lock);
+    connected = (server->conn != NULL);
+    pthread_mutex_unlock(&server->lock);
+    return connected;
+}
+
+// Close the current client connection (shortly, from the server thread).
+static inline void test_ws_server_drop(TestWsServer *server)
+{
+    pthread_mutex_lock(&server->lock);
+    server->drop_pending = true;
+    pthread_mutex_unlock(&server->lock);
+}
+
+// Does message <idx> contain the byte sequence <needle>?
+static inline bool test_ws_server_message_contains(
+        TestWsServer *server, 
+        int idx, 
+        const void *needle, 
+        size_t needleLen)
+{
+    bool found = false;
+    size_t i;
+    pthread_mutex_lock(&server->lock);
+    if (idx < server->num_messages && server->message_lens[idx] >= needleLen)
+    {
+        for (i = 0; i + needleLen <= server->message_lens[idx]; i++)
+        {
+            if (!memcmp(&server->messages[idx][i], needle, needleLen))
+            {
+                found = true;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+    return found;
+}
+
+static inline void test_ws_server_stop(TestWsServer *server)
+{
+    int i;
+    server->stop = true;
+    pthread_join(server->thread, NULL);
+    libwebsocket_context_destroy(server->ctx);
+    for (i = 0; i < server->num_messages; i++)
+    {
+        free(server->messages[i]);
+    }
+    pthread_mutex_destroy(&server->lock);
+}
+
+#endif // CANOPY_TEST_WS_SERVER_INCLUDED
@@ -0,0 +1,115 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "ws_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Round-trip test for the CBOR payload format, against a local stand-in
+// server.
+//
+// The device sends its handshake, then a CBOR payload announcing variable
+// IDs and the value of "temperature".  The server answers with a CBOR
+// payload that sets "setpoint" by ID and "status" by name.
+
+#define MAX_SERVICE_CALLS 50
+
+// {"vars": {1: 42.5f, "status": "hi"}}
+static const unsigned char sReply[] = {
+    0xa1,
+        0x64, 'v', 'a', 'r', 's',
+        0xa2,
+            0x01, 0xfa, 0x42, 0x2a, 0x00, 0x00,
+            0x66, 's', 't', 'a', 't', 'u', 's', 0x62, 'h', 'i'
+};
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    TestWsServer server;
+    RedTest test;
+    float setpoint = 0.0f;
+    char *status = NULL;
+    int port, i;
+
+    // id 0 : 21.5f
+    static const unsigned char expectTemperature[] = {0x00, 0xfa, 0x41, 0xac, 0x00, 0x00};
+    // "ids" : { "temperature" : 0, ... }
+    static const unsigned char expectIds[] = {
+        0x63, 'i', 'd', 's', 0xbf, 
+            0x6b, 't', 'e', 'm', 'p', 'e', 'r', 'a', 't', 'u', 'r', 'e', 0x00
+    };
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    port = 18000 + (getpid() % 1000);
+    if (!test_ws_server_start(&server, port))
+    {
+        RedTest_Abort(test, "Could not start stand-in server");
+    }
+    // Message 1 is the handshake, message 2 the first sync payload.
+    test_ws_server_reply(&server, 2, sReply, sizeof(sReply), true);
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_HTTP_PORT, port,
+        CANOPY_DEVICE_UUID, "9dfe2a00-efe2-45f9-a84c-8afc69caf4e6",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_PAYLOAD_FORMAT, CANOPY_PAYLOAD_FORMAT_CBOR
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out float32 temperature");
+    RedTest_Verify(test, "Init temperature", result == CANOPY_SUCCESS);
+    result = canopy_var_init(canopy, "in float32 setpoint");
+    RedTest_Verify(test, "Init setpoint", result == CANOPY_SUCCESS);
+    result = canopy_var_init(canopy, "in string status");
+    RedTest_Verify(test, "Init status", result == CANOPY_SUCCESS);
+
+    result = canopy_var_set_float32(canopy, "temperature", 21.5f);
+    RedTest_Verify(test, "Set temperature", result == CANOPY_SUCCESS);
+
+    result = canopy_sync_blocking(canopy, 5*CANOPY_SECONDS);
+    RedTest_Verify(test, "Sync", result == CANOPY_SUCCESS);
+
+    // Wait for the server's reply.
+    for (i = 0; i < MAX_SERVICE_CALLS; i++)
+    {
+        if (canopy_var_get_float32(canopy, "setpoint", &setpoint) == CANOPY_SUCCESS)
+        {
+            break;
+        }
+        canopy_service(canopy, 100000);
+    }
+
+    RedTest_Verify(test, "Server received handshake and payload",
+            test_ws_server_num_messages(&server) >= 2);
+    RedTest_Verify(test, "Handshake is JSON text", 
+            !server.message_binary[0] && server.messages[0][0] == '{');
+    RedTest_Verify(test, "Payload is a binary frame", server.message_binary[1]);
+    RedTest_Verify(test, "Payload is a CBOR map", 
+            (server.messages[1][0] >> 5) == 5);
+    RedTest_Verify(test, "Payload announces variable IDs",
+            test_ws_server_message_contains(&server, 1, expectIds, sizeof(expectIds)));
+    RedTest_Verify(test, "Payload sends temperature by ID",
+            test_ws_server_message_contains(&server, 1, 
+                expectTemperature, sizeof(expectTemperature)));
+
+    RedTest_Verify(test, "Setpoint received by ID", setpoint == 42.5f);
+    result = canopy_var_get_string(canopy, "status", &status);
+    RedTest_Verify(test, "Status received by name", 
+            result == CANOPY_SUCCESS && status && !strcmp(status, "hi"));
+    free(status);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+    test_ws_server_stop(&server);
+
+    return RedTest_End(test);
+}
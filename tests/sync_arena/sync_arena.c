@@ -0,0 +1,100 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "bench.h"
+#include <stdio.h>
+#include <unistd.h>
+
+// Checks that sync cycles reuse the per-context arena.
+//
+// After a few warm-up cycles, syncing must not call malloc at all, and a
+// payload that doesn't fit under CANOPY_SYNC_ARENA_MAX_BYTES must fail
+// cleanly and be sent once the cap is raised.
+//
+// The NOOP protocol prints each payload to stdout, so stdout is redirected
+// to /dev/null while syncing.
+#define NUM_WARMUP 4
+#define NUM_ROUNDS 100
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    RedTest test;
+    uint64_t allocs;
+    bool ok;
+    int i, savedStdout;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy_set_global_opt(CANOPY_LOG_ENABLED, false);
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out float32 temperature");
+    RedTest_Verify(test, "Init float32", result == CANOPY_SUCCESS);
+    result = canopy_var_init(canopy, "out string status");
+    RedTest_Verify(test, "Init string", result == CANOPY_SUCCESS);
+
+    fflush(stdout);
+    savedStdout = dup(STDOUT_FILENO);
+    if (savedStdout < 0 || !freopen("/dev/null", "w", stdout))
+    {
+        RedTest_Abort(test, "Could not redirect stdout");
+    }
+
+    ok = true;
+    for (i = 0; i < NUM_WARMUP; i++)
+    {
+        ok = ok && canopy_var_set_float32(canopy, "temperature", i) == CANOPY_SUCCESS;
+        ok = ok && canopy_var_set_string(canopy, "status", "warming up") == CANOPY_SUCCESS;
+        ok = ok && canopy_sync_blocking(canopy, 0) == CANOPY_SUCCESS;
+    }
+
+    allocs = bench_num_allocs();
+    for (i = 0; i < NUM_ROUNDS; i++)
+    {
+        ok = ok && canopy_var_set_float32(canopy, "temperature", i) == CANOPY_SUCCESS;
+        ok = ok && canopy_var_set_string(canopy, "status", (i & 1) ? "ok" : "busy") == CANOPY_SUCCESS;
+        ok = ok && canopy_sync_blocking(canopy, 0) == CANOPY_SUCCESS;
+    }
+    allocs = bench_num_allocs() - allocs;
+
+    // Payload can't fit in 64 bytes of scratch memory.
+    result = canopy_set_opt(canopy, CANOPY_SYNC_ARENA_MAX_BYTES, 64);
+    ok = ok && (result == CANOPY_SUCCESS);
+    ok = ok && canopy_var_set_float32(canopy, "temperature", 1.0f) == CANOPY_SUCCESS;
+    result = canopy_sync_blocking(canopy, 0);
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+
+    RedTest_Verify(test, "Set and sync succeed", ok);
+    RedTest_Verify(test, "Steady-state sync does not allocate", allocs == 0);
+    RedTest_Verify(test, "Sync fails when arena cap is too small",
+            result == CANOPY_ERROR_OUT_OF_MEMORY);
+
+    if (!freopen("/dev/null", "w", stdout))
+    {
+        RedTest_Abort(test, "Could not redirect stdout");
+    }
+    result = canopy_set_opt(canopy, CANOPY_SYNC_ARENA_MAX_BYTES, 0);
+    ok = (result == CANOPY_SUCCESS);
+    result = canopy_sync_blocking(canopy, 0);
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    RedTest_Verify(test, "Sync succeeds once cap is lifted",
+            ok && result == CANOPY_SUCCESS);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
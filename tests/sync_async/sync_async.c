@@ -0,0 +1,132 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "ws_server.h"
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+// Checks that canopy_sync returns without waiting for the network, and that
+// the promise it hands back completes as canopy_service is called.
+//
+// The device talks to a local stand-in server.  The control loop below
+// calls canopy_service with a 1 ms budget, and no call may take much longer
+// than that while the connection, handshake and payload are in flight.
+
+#define MAX_LOOPS 5000
+
+// Allowed time for a call that shouldn't wait, in microseconds.  Generous,
+// to tolerate loaded test machines.
+#define MAX_CALL_US 50000
+
+static int sNumCallbacks;
+static CanopyResultEnum sCallbackResult;
+
+static void _on_sync_done(CanopyPromise promise, CanopyResultEnum result, void *userdata)
+{
+    sNumCallbacks++;
+    sCallbackResult = result;
+}
+
+static uint64_t _now_us(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*1000000 + t.tv_nsec/1000;
+}
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    CanopyPromise promise;
+    TestWsServer server;
+    RedTest test;
+    uint64_t start, elapsed, worst;
+    int port, loops;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    port = 19000 + (getpid() % 1000);
+    if (!test_ws_server_start(&server, port))
+    {
+        RedTest_Abort(test, "Could not start stand-in server");
+    }
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    // NOOP syncs have nothing to wait for, so they complete right away.
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure NOOP", result == CANOPY_SUCCESS);
+    result = canopy_sync(canopy, &promise);
+    RedTest_Verify(test, "NOOP sync", result == CANOPY_SUCCESS);
+    RedTest_Verify(test, "NOOP promise done", canopy_promise_is_done(promise));
+    RedTest_Verify(test, "NOOP promise result", 
+            canopy_promise_result(promise) == CANOPY_SUCCESS);
+    canopy_promise_free(promise);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_HTTP_PORT, port,
+        CANOPY_DEVICE_UUID, "9dfe2a00-efe2-45f9-a84c-8afc69caf4e6",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_WS
+    );
+    RedTest_Verify(test, "Configure WS", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out float32 temperature");
+    RedTest_Verify(test, "Init temperature", result == CANOPY_SUCCESS);
+    result = canopy_var_set_float32(canopy, "temperature", 21.5f);
+    RedTest_Verify(test, "Set temperature", result == CANOPY_SUCCESS);
+
+    start = _now_us();
+    result = canopy_sync(canopy, &promise);
+    elapsed = _now_us() - start;
+    RedTest_Verify(test, "Start sync", result == CANOPY_SUCCESS);
+    RedTest_Verify(test, "canopy_sync returns without waiting", elapsed < MAX_CALL_US);
+    RedTest_Verify(test, "Promise pending", !canopy_promise_is_done(promise));
+    RedTest_Verify(test, "Result not available yet", 
+            canopy_promise_result(promise) == CANOPY_ERROR_PROMISE_NOT_COMPLETE);
+
+    result = canopy_promise_on_done(promise, _on_sync_done, NULL);
+    RedTest_Verify(test, "Register callback", result == CANOPY_SUCCESS);
+
+    worst = 0;
+    for (loops = 0; loops < MAX_LOOPS && !canopy_promise_is_done(promise); loops++)
+    {
+        start = _now_us();
+        canopy_service(canopy, 1000);
+        elapsed = _now_us() - start;
+        if (elapsed > worst)
+            worst = elapsed;
+    }
+    printf("Sync completed after %d service calls, worst call %d us\n", 
+            loops, (int)worst);
+
+    RedTest_Verify(test, "Promise completes", canopy_promise_is_done(promise));
+    RedTest_Verify(test, "Sync succeeded", 
+            canopy_promise_result(promise) == CANOPY_SUCCESS);
+    RedTest_Verify(test, "Callback triggered once", sNumCallbacks == 1);
+    RedTest_Verify(test, "Callback got result", sCallbackResult == CANOPY_SUCCESS);
+    RedTest_Verify(test, "canopy_service keeps to its budget", worst < MAX_CALL_US);
+    RedTest_Verify(test, "Server received handshake and payload",
+            test_ws_server_num_messages(&server) >= 2);
+    canopy_promise_free(promise);
+
+    // A second sync over the open connection, waited on directly.
+    canopy_var_set_float32(canopy, "temperature", 22.5f);
+    result = canopy_sync(canopy, &promise);
+    RedTest_Verify(test, "Start second sync", result == CANOPY_SUCCESS);
+    result = canopy_promise_wait(promise, 5*CANOPY_SECONDS);
+    RedTest_Verify(test, "Wait for second sync", result == CANOPY_SUCCESS);
+    canopy_promise_free(promise);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+    test_ws_server_stop(&server);
+
+    return RedTest_End(test);
+}
@@ -0,0 +1,229 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "ws_server.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Checks CANOPY_SYNC_THREAD: several application threads set Cloud
+// Variables while the background thread syncs them to a local stand-in
+// server.  The setters must never wait for a sync in progress, and every
+// variable must end up with the last value its thread set.  A blocking
+// sync from a callback on the background thread must fail rather than
+// deadlock.
+
+#define NUM_WRITERS 4
+#define SETS_PER_WRITER 20000
+
+// Allowed time for one setter call, in microseconds.  Generous, to tolerate
+// loaded test machines; a setter that waited for the network would take
+// far longer.
+#define MAX_SET_US 50000
+
+typedef struct
+{
+    CanopyContext canopy;
+    char varname[32];
+    int numFailed;
+    uint64_t worst;
+} _Writer_t;
+
+static uint64_t _now_us(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*1000000 + t.tv_nsec/1000;
+}
+
+static pthread_t sMainThread;
+static volatile bool sCallbackDone;
+static volatile bool sCallbackOnMain;
+static volatile CanopyResultEnum sCallbackResult;
+
+static void _sync_from_callback(CanopyPromise promise, CanopyResultEnum result, void *userdata)
+{
+    CanopyContext canopy = (CanopyContext)userdata;
+    sCallbackOnMain = pthread_equal(pthread_self(), sMainThread);
+    sCallbackResult = canopy_sync_blocking(canopy, CANOPY_SECONDS);
+    sCallbackDone = true;
+}
+
+static void * _writer_main(void *arg)
+{
+    _Writer_t *writer = (_Writer_t *)arg;
+    uint64_t start, elapsed;
+    int i;
+
+    for (i = 0; i < SETS_PER_WRITER; i++)
+    {
+        start = _now_us();
+        if (canopy_var_set_int32(writer->canopy, writer->varname, i) != CANOPY_SUCCESS)
+        {
+            writer->numFailed++;
+        }
+        elapsed = _now_us() - start;
+        if (elapsed > writer->worst)
+            writer->worst = elapsed;
+        if ((i % 1000) == 0)
+        {
+            canopy_var_set_string(writer->canopy, "status", 
+                    "a status message too long to be copied inline into the queue");
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    CanopyPromise promise;
+    TestWsServer server;
+    RedTest test;
+    pthread_t threads[NUM_WRITERS];
+    _Writer_t writers[NUM_WRITERS];
+    char decl[64];
+    char *status;
+    int32_t value;
+    uint64_t worst, start;
+    int port, i, numFailed, numSyncs;
+    bool found;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    port = 19000 + (getpid() % 1000);
+    if (!test_ws_server_start(&server, port))
+    {
+        RedTest_Abort(test, "Could not start stand-in server");
+    }
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_HTTP_PORT, port,
+        CANOPY_DEVICE_UUID, "9dfe2a00-efe2-45f9-a84c-8afc69caf4e6",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_WS
+    );
+    RedTest_Verify(test, "Configure", result == CANOPY_SUCCESS);
+
+    // Variables must be initialized before the thread starts.
+    for (i = 0; i < NUM_WRITERS; i++)
+    {
+        writers[i].canopy = canopy;
+        writers[i].numFailed = 0;
+        writers[i].worst = 0;
+        snprintf(writers[i].varname, sizeof(writers[i].varname), "counter_%d", i);
+        snprintf(decl, sizeof(decl), "out int32 %s", writers[i].varname);
+        result = canopy_var_init(canopy, decl);
+        RedTest_Verify(test, "Init counter", result == CANOPY_SUCCESS);
+    }
+    result = canopy_var_init(canopy, "out string status");
+    RedTest_Verify(test, "Init status", result == CANOPY_SUCCESS);
+
+    result = canopy_set_opt(canopy, CANOPY_SYNC_THREAD, true);
+    RedTest_Verify(test, "Start sync thread", result == CANOPY_SUCCESS);
+    result = canopy_var_init(canopy, "out int32 late");
+    RedTest_Verify(test, "No new variables while the thread runs", 
+            result == CANOPY_ERROR_SYNC_THREAD_RUNNING);
+
+    // Type errors are still reported synchronously.
+    result = canopy_var_set_float32(canopy, "counter_0", 1.0f);
+    RedTest_Verify(test, "Setter checks datatype", 
+            result == CANOPY_ERROR_INCORRECT_DATATYPE);
+    result = canopy_var_set_string(canopy, "status", NULL);
+    RedTest_Verify(test, "NULL string rejected before queueing", 
+            result == CANOPY_ERROR_INVALID_VALUE);
+
+    for (i = 0; i < NUM_WRITERS; i++)
+    {
+        pthread_create(&threads[i], NULL, _writer_main, &writers[i]);
+    }
+
+    // Keep syncing while the writers run.
+    numSyncs = 0;
+    for (i = 0; i < 5; i++)
+    {
+        result = canopy_sync(canopy, &promise);
+        RedTest_Verify(test, "Start sync", result == CANOPY_SUCCESS);
+        result = canopy_promise_wait(promise, 5*CANOPY_SECONDS);
+        if (result == CANOPY_SUCCESS)
+            numSyncs++;
+        canopy_promise_free(promise);
+    }
+    RedTest_Verify(test, "Syncs succeed alongside setters", numSyncs == 5);
+
+    numFailed = 0;
+    worst = 0;
+    for (i = 0; i < NUM_WRITERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        numFailed += writers[i].numFailed;
+        if (writers[i].worst > worst)
+            worst = writers[i].worst;
+    }
+    printf("Worst setter call: %d us\n", (int)worst);
+    RedTest_Verify(test, "All sets accepted", numFailed == 0);
+    RedTest_Verify(test, "Setters don't wait for sync", worst < MAX_SET_US);
+
+    // Reading back applies everything still queued.
+    for (i = 0; i < NUM_WRITERS; i++)
+    {
+        result = canopy_var_get(canopy, writers[i].varname, CANOPY_READ_INT32(&value));
+        RedTest_Verify(test, "Read counter", result == CANOPY_SUCCESS);
+        RedTest_Verify(test, "Last value wins", value == SETS_PER_WRITER - 1);
+    }
+    status = NULL;
+    result = canopy_var_get(canopy, "status", CANOPY_READ_STRING(&status));
+    RedTest_Verify(test, "Read status", result == CANOPY_SUCCESS);
+    RedTest_Verify(test, "Long string queued intact", 
+            status && !strcmp(status, 
+                "a status message too long to be copied inline into the queue"));
+    free(status);
+
+    // The final values reach the server.
+    result = canopy_sync_blocking(canopy, 5*CANOPY_SECONDS);
+    RedTest_Verify(test, "Final sync", result == CANOPY_SUCCESS);
+    found = false;
+    for (i = 0; i < test_ws_server_num_messages(&server); i++)
+    {
+        found = found || test_ws_server_message_contains(&server, i, "19999", 5);
+    }
+    RedTest_Verify(test, "Server received final value", found);
+
+    // The callback normally runs on the background thread, unless the sync
+    // has already finished when it is registered.
+    sMainThread = pthread_self();
+    result = canopy_sync(canopy, &promise);
+    RedTest_Verify(test, "Start sync", result == CANOPY_SUCCESS);
+    canopy_promise_on_done(promise, _sync_from_callback, canopy);
+    start = _now_us();
+    while (!sCallbackDone && _now_us() - start < 5*CANOPY_SECONDS)
+    {
+        usleep(1000);
+    }
+    RedTest_Verify(test, "Blocking sync from callback returns", sCallbackDone);
+    RedTest_Verify(test, "Blocking sync from sync thread refused", 
+            sCallbackOnMain || sCallbackResult == CANOPY_ERROR_WRONG_THREAD);
+    canopy_promise_free(promise);
+
+    // Turning the thread off goes back to canopy_service.
+    result = canopy_set_opt(canopy, CANOPY_SYNC_THREAD, false);
+    RedTest_Verify(test, "Stop thread", result == CANOPY_SUCCESS);
+    result = canopy_var_init(canopy, "out int32 late");
+    RedTest_Verify(test, "New variables once the thread stops", result == CANOPY_SUCCESS);
+    canopy_var_set_int32(canopy, "counter_0", -1);
+    result = canopy_sync_blocking(canopy, 5*CANOPY_SECONDS);
+    RedTest_Verify(test, "Sync without thread", result == CANOPY_SUCCESS);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+    test_ws_server_stop(&server);
+
+    return RedTest_End(test);
+}
@@ -0,0 +1,166 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "ws_server.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Checks that syncs against a server that stalls the handshake give up with
+// CANOPY_ERROR_TIMED_OUT within their time budget.
+//
+// The stand-in server is a TCP socket that listens but never accepts.  The
+// kernel completes the TCP connection, so libcanopy gets as far as sending
+// its WebSocket upgrade request, and then hears nothing back.
+//
+// Finally, with no timeout at all, a sync against a server that does answer
+// must not fail at once.
+
+#define BUDGET_US (200*1000)
+
+// How late a timed-out call may return, in microseconds.  Generous, to
+// tolerate loaded test machines.
+#define SLACK_US (100*1000)
+
+static uint64_t _now_us(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*1000000 + t.tv_nsec/1000;
+}
+
+// Listen on a free localhost port.  Returns the socket, and the port in
+// <*port>, or -1 on failure.
+static int _start_stalling_server(int *port)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    int sock;
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+    {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            listen(sock, 16) < 0 ||
+            getsockname(sock, (struct sockaddr *)&addr, &addrLen) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    *port = ntohs(addr.sin_port);
+    return sock;
+}
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    CanopyPromise promise;
+    TestWsServer wsServer;
+    RedTest test;
+    uint64_t start, elapsed, worst;
+    int port, server, i;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    server = _start_stalling_server(&port);
+    if (server < 0)
+    {
+        RedTest_Abort(test, "Could not start stalling server");
+    }
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "127.0.0.1",
+        CANOPY_HTTP_PORT, port,
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_SYNC_TIMEOUT_MS, BUDGET_US/1000
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out float32 temperature");
+    RedTest_Verify(test, "Init temperature", result == CANOPY_SUCCESS);
+    canopy_var_set_float32(canopy, "temperature", 21.5f);
+
+    // Blocking syncs, repeated to cover reconnecting after a timeout.
+    worst = 0;
+    for (i = 0; i < 3; i++)
+    {
+        start = _now_us();
+        result = canopy_sync_blocking(canopy, BUDGET_US);
+        elapsed = _now_us() - start;
+        if (elapsed > worst)
+            worst = elapsed;
+        RedTest_Verify(test, "Blocking sync times out", result == CANOPY_ERROR_TIMED_OUT);
+    }
+    printf("Blocking sync: worst %d us for a %d us budget\n", (int)worst, BUDGET_US);
+    RedTest_Verify(test, "Blocking sync returns within budget", worst < BUDGET_US + SLACK_US);
+
+    // A shorter explicit timeout than CANOPY_SYNC_TIMEOUT_MS wins.
+    start = _now_us();
+    result = canopy_sync_blocking(canopy, BUDGET_US/4);
+    elapsed = _now_us() - start;
+    RedTest_Verify(test, "Short blocking sync times out", result == CANOPY_ERROR_TIMED_OUT);
+    RedTest_Verify(test, "Short blocking sync returns within budget", 
+            elapsed < BUDGET_US/4 + SLACK_US);
+
+    // Asynchronous sync, serviced from a 1 ms control loop, fails once
+    // CANOPY_SYNC_TIMEOUT_MS has passed.
+    start = _now_us();
+    result = canopy_sync(canopy, &promise);
+    RedTest_Verify(test, "Start async sync", result == CANOPY_SUCCESS);
+    while (!canopy_promise_is_done(promise) && _now_us() - start < 10*BUDGET_US)
+    {
+        canopy_service(canopy, 1000);
+    }
+    elapsed = _now_us() - start;
+    RedTest_Verify(test, "Async sync times out", 
+            canopy_promise_result(promise) == CANOPY_ERROR_TIMED_OUT);
+    RedTest_Verify(test, "Async sync gives up on time", 
+            elapsed >= BUDGET_US && elapsed < BUDGET_US + SLACK_US);
+    canopy_promise_free(promise);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+    close(server);
+
+    // 0 for both timeouts means no limit.
+    port = 24000 + (getpid() % 1000);
+    if (!test_ws_server_start(&wsServer, port))
+    {
+        RedTest_Abort(test, "Could not start stand-in server");
+    }
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_HTTP_PORT, port,
+        CANOPY_DEVICE_UUID, "9dfe2a00-efe2-45f9-a84c-8afc69caf4e6",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_SYNC_TIMEOUT_MS, 0
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+    result = canopy_var_init(canopy, "out float32 temperature");
+    RedTest_Verify(test, "Init temperature", result == CANOPY_SUCCESS);
+    canopy_var_set_float32(canopy, "temperature", 21.5f);
+    result = canopy_sync_blocking(canopy, 0);
+    RedTest_Verify(test, "Sync without a time limit", result == CANOPY_SUCCESS);
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+    test_ws_server_stop(&wsServer);
+
+    return RedTest_End(test);
+}
@@ -0,0 +1,140 @@
+#include <canopy.h>
+#include "red_test.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Checks that numeric arrays only send the elements set since the last
+// sync.
+//
+// The NOOP protocol prints each payload to stdout, so stdout is redirected
+// to a temporary file and each payload is inspected after it is written.
+
+#define NUM_CHANNELS 256
+
+#define PAYLOAD_MAX (64*1024)
+
+static FILE *sOut;
+static long sOutPos;
+static char sPayload[PAYLOAD_MAX];
+
+// Sync, and return the payload that was sent (or "" if none).
+static const char * _sync(CanopyContext canopy)
+{
+    size_t n;
+
+    sPayload[0] = '\0';
+    if (canopy_sync_blocking(canopy, 0) != CANOPY_SUCCESS)
+    {
+        return sPayload;
+    }
+    fflush(stdout);
+    fseek(sOut, sOutPos, SEEK_SET);
+    n = fread(sPayload, 1, sizeof(sPayload) - 1, sOut);
+    sPayload[n] = '\0';
+    sOutPos = ftell(sOut);
+    return sPayload;
+}
+
+// Count the keys of the JSON object following <key> in <payload>.
+static int _object_len(const char *payload, const char *key)
+{
+    const char *p = payload ? strstr(payload, key) : NULL;
+    int n = 1;
+    if (!p || !(p = strchr(p, '{')))
+    {
+        return -1;
+    }
+    if (p[1] == '}')
+    {
+        return 0;
+    }
+    for (; *p && *p != '}'; p++)
+    {
+        if (*p == ',')
+            n++;
+    }
+    return n;
+}
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    RedTest test;
+    char outPath[] = "/tmp/var_array_partial_XXXXXX";
+    const char *payload;
+    float channels[NUM_CHANNELS];
+    int savedStdout, fd, i;
+    bool r[5];
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy_set_global_opt(CANOPY_LOG_ENABLED, false);
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out float32[256] channels");
+    RedTest_Verify(test, "Init channels", result == CANOPY_SUCCESS);
+
+    fd = mkstemp(outPath);
+    fflush(stdout);
+    savedStdout = dup(STDOUT_FILENO);
+    if (fd < 0 || savedStdout < 0 || !freopen(outPath, "w", stdout)
+            || !(sOut = fopen(outPath, "r")))
+    {
+        RedTest_Abort(test, "Could not redirect stdout");
+    }
+    close(fd);
+
+    // The first update sends every channel.
+    for (i = 0; i < NUM_CHANNELS; i++)
+    {
+        channels[i] = (float)i;
+    }
+    canopy_var_set_array_float32(canopy, "channels", channels, 0, NUM_CHANNELS);
+    payload = _sync(canopy);
+    r[0] = _object_len(strstr(payload, "\"vars\""), "\"channels\"") == NUM_CHANNELS;
+
+    // Then only the channels that changed, whichever way they were set.
+    channels[7] = -7.0f;
+    canopy_var_set_array_float32(canopy, "channels", &channels[7], 7, 1);
+    canopy_var_set(canopy, "channels", CANOPY_VALUE_ARRAY(200, CANOPY_VALUE_FLOAT32(-200.0f)));
+    payload = _sync(canopy);
+    r[1] = strstr(payload, "\"channels\":{\"7\":-7,\"200\":-200}") != NULL;
+
+    // A contiguous range.
+    canopy_var_set_array_float32(canopy, "channels", channels, 32, 64);
+    payload = _sync(canopy);
+    r[2] = _object_len(strstr(payload, "\"vars\""), "\"channels\"") == 64;
+    r[3] = strstr(payload, "\"32\":0,") != NULL && strstr(payload, "\"95\":63}") != NULL;
+
+    // Nothing changed, nothing sent.
+    payload = _sync(canopy);
+    r[4] = strstr(payload, "\"channels\"") == NULL;
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    fclose(sOut);
+    unlink(outPath);
+
+    RedTest_Verify(test, "First sync sends every channel", r[0]);
+    RedTest_Verify(test, "Only changed channels sent", r[1]);
+    RedTest_Verify(test, "Range sends only its channels", r[2]);
+    RedTest_Verify(test, "Range values sent", r[3]);
+    RedTest_Verify(test, "Unchanged array not sent", r[4]);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
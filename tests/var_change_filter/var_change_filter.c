@@ -0,0 +1,159 @@
+#include <canopy.h>
+#include "red_test.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Checks that Cloud Variable change filters keep unchanged or insignificant
+// values out of sync payloads.
+//
+// The NOOP protocol prints each payload to stdout, so stdout is redirected
+// to a temporary file and each payload is inspected after it is written.
+
+static FILE *sOut;
+static long sOutPos;
+
+// Sync, and report whether <varname> was included in the payload's "vars".
+static bool _synced(CanopyContext canopy, const char *varname)
+{
+    char buf[4096];
+    char needle[128];
+    const char *vars;
+    size_t n;
+
+    if (canopy_sync_blocking(canopy, 0) != CANOPY_SUCCESS)
+    {
+        return false;
+    }
+    fflush(stdout);
+    fseek(sOut, sOutPos, SEEK_SET);
+    n = fread(buf, 1, sizeof(buf) - 1, sOut);
+    buf[n] = '\0';
+    sOutPos = ftell(sOut);
+
+    vars = strstr(buf, "\"vars\"");
+    snprintf(needle, sizeof(needle), "\"%s\":", varname);
+    return vars && strstr(vars, needle);
+}
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    RedTest test;
+    char outPath[] = "/tmp/var_change_filter_XXXXXX";
+    int savedStdout, fd;
+    bool r[16];
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy_set_global_opt(CANOPY_LOG_ENABLED, false);
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out float32 unfiltered");
+    RedTest_Verify(test, "Init unfiltered", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out string exact",
+        CANOPY_VAR_CHANGE_FILTER, CANOPY_VAR_FILTER_EXACT
+    );
+    RedTest_Verify(test, "Init exact", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out float32 absolute",
+        CANOPY_VAR_CHANGE_FILTER, CANOPY_VAR_FILTER_ABSOLUTE_DEADBAND,
+        CANOPY_VAR_DEADBAND, 0.5
+    );
+    RedTest_Verify(test, "Init absolute", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out int32 percent",
+        CANOPY_VAR_CHANGE_FILTER, CANOPY_VAR_FILTER_PERCENT_DEADBAND,
+        CANOPY_VAR_DEADBAND, 10.0
+    );
+    RedTest_Verify(test, "Init percent", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out float32 negative",
+        CANOPY_VAR_CHANGE_FILTER, CANOPY_VAR_FILTER_ABSOLUTE_DEADBAND,
+        CANOPY_VAR_DEADBAND, -1.0
+    );
+    RedTest_Verify(test, "Negative deadband rejected", result == CANOPY_ERROR_INVALID_VALUE);
+
+    result = canopy_var_init(canopy, "out float32 nofilter[4]",
+        CANOPY_VAR_CHANGE_FILTER, CANOPY_VAR_FILTER_EXACT
+    );
+    RedTest_Verify(test, "Filter on array rejected", result == CANOPY_ERROR_INVALID_OPT);
+
+    fd = mkstemp(outPath);
+    fflush(stdout);
+    savedStdout = dup(STDOUT_FILENO);
+    if (fd < 0 || savedStdout < 0 || !freopen(outPath, "w", stdout) 
+            || !(sOut = fopen(outPath, "r")))
+    {
+        RedTest_Abort(test, "Could not redirect stdout");
+    }
+    close(fd);
+
+    // Initial values always pass.
+    canopy_var_set_float32(canopy, "unfiltered", 1.0f);
+    canopy_var_set_string(canopy, "exact", "idle");
+    canopy_var_set_float32(canopy, "absolute", 20.0f);
+    canopy_var_set_int32(canopy, "percent", 100);
+    _synced(canopy, "unfiltered");
+
+    // Same values again.
+    canopy_var_set_float32(canopy, "unfiltered", 1.0f);
+    canopy_var_set_string(canopy, "exact", "idle");
+    r[0] = _synced(canopy, "unfiltered");
+    r[1] = _synced(canopy, "exact");
+
+    // Exact filter passes any difference.
+    canopy_var_set_string(canopy, "exact", "busy");
+    r[2] = _synced(canopy, "exact");
+
+    // Absolute deadband: drift is measured from the last reported value.
+    canopy_var_set_float32(canopy, "absolute", 20.3f);
+    r[3] = _synced(canopy, "absolute");
+    canopy_var_set_float32(canopy, "absolute", 20.45f);
+    r[4] = _synced(canopy, "absolute");
+    canopy_var_set_float32(canopy, "absolute", 20.6f);
+    r[5] = _synced(canopy, "absolute");
+    canopy_var_set_float32(canopy, "absolute", 20.9f);
+    r[6] = _synced(canopy, "absolute");
+
+    // Percent deadband: 10% of 100.
+    canopy_var_set_int32(canopy, "percent", 109);
+    r[7] = _synced(canopy, "percent");
+    canopy_var_set_int32(canopy, "percent", 111);
+    r[8] = _synced(canopy, "percent");
+    canopy_var_set_int32(canopy, "percent", 120);
+    r[9] = _synced(canopy, "percent");
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    fclose(sOut);
+    unlink(outPath);
+
+    RedTest_Verify(test, "Unfiltered resends identical value", r[0]);
+    RedTest_Verify(test, "Exact suppresses identical value", !r[1]);
+    RedTest_Verify(test, "Exact passes changed value", r[2]);
+    RedTest_Verify(test, "Absolute suppresses change within deadband", !r[3]);
+    RedTest_Verify(test, "Absolute suppresses accumulated drift within deadband", !r[4]);
+    RedTest_Verify(test, "Absolute passes accumulated drift beyond deadband", r[5]);
+    RedTest_Verify(test, "Absolute measures from last reported value", !r[6]);
+    RedTest_Verify(test, "Percent suppresses change within deadband", !r[7]);
+    RedTest_Verify(test, "Percent passes change beyond deadband", r[8]);
+    RedTest_Verify(test, "Percent measures from last reported value", !r[9]);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
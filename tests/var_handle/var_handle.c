@@ -0,0 +1,66 @@
+#include <canopy.h>
+#include "red_test.h"
+#include <stdio.h>
+
+// Tests pre-resolved Cloud Variable handles.  Doesn't "sync" w/ server.
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    CanopyVarHandle handle;
+    RedTest test;
+    float temperature;
+    int i;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "dev02.canopy.link",
+        CANOPY_DEVICE_UUID, "c31a8ced-b9f1-4b0c-afe9-1afed3b0c21f",
+        CANOPY_SYNC_BLOCKING, true,
+        CANOPY_SYNC_TIMEOUT_MS, 10000,
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    handle = canopy_var_handle(canopy, "temperature");
+    RedTest_Verify(test, "No handle before init", handle == NULL);
+
+    result = canopy_var_set_h(canopy, handle, CANOPY_VALUE_FLOAT32(1.0f));
+    RedTest_Verify(test, "Set with NULL handle fails",
+            result == CANOPY_ERROR_VARIABLE_NOT_INITIALIZED);
+
+    result = canopy_var_init(canopy, "inout float32 temperature");
+    RedTest_Verify(test, "Initialize cloud var", result == CANOPY_SUCCESS);
+
+    handle = canopy_var_handle(canopy, "temperature");
+    RedTest_Verify(test, "Get handle", handle != NULL);
+
+    for (i = 0; i < 1000; i++)
+    {
+        result = canopy_var_set_h(canopy, handle, CANOPY_VALUE_FLOAT32((float)i));
+        if (result != CANOPY_SUCCESS)
+            break;
+    }
+    RedTest_Verify(test, "Set cloud variable by handle", result == CANOPY_SUCCESS);
+
+    result = canopy_var_get_h(canopy, handle, CANOPY_READ_FLOAT32(&temperature));
+    RedTest_Verify(test, "Get cloud variable by handle", result == CANOPY_SUCCESS);
+    RedTest_Verify(test, "Temperature matches", temperature == 999.0f);
+
+    result = canopy_var_get_float32(canopy, "temperature", &temperature);
+    RedTest_Verify(test, "Get cloud variable by name", result == CANOPY_SUCCESS);
+    RedTest_Verify(test, "Name and handle agree", temperature == 999.0f);
+
+    result = canopy_sync(canopy, NULL);
+    RedTest_Verify(test, "Sync", result == CANOPY_SUCCESS);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
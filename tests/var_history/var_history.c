@@ -0,0 +1,180 @@
+#include <canopy.h>
+#include "red_test.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Checks that Cloud Variables initialized with CANOPY_VAR_HISTORY_CAPACITY
+// send every sample set between syncs, and that the history is bounded.
+//
+// The NOOP protocol prints each payload to stdout, so stdout is redirected
+// to a temporary file and each payload is inspected after it is written.
+
+// 1 kHz for one second between syncs.
+#define NUM_SAMPLES 1000
+
+#define PAYLOAD_MAX (256*1024)
+
+static FILE *sOut;
+static long sOutPos;
+static char sPayload[PAYLOAD_MAX];
+
+// Sync, and return the payload that was sent (or "" if none).
+static const char * _sync(CanopyContext canopy)
+{
+    size_t n;
+
+    sPayload[0] = '\0';
+    if (canopy_sync_blocking(canopy, 0) != CANOPY_SUCCESS)
+    {
+        return sPayload;
+    }
+    fflush(stdout);
+    fseek(sOut, sOutPos, SEEK_SET);
+    n = fread(sPayload, 1, sizeof(sPayload) - 1, sOut);
+    sPayload[n] = '\0';
+    sOutPos = ftell(sOut);
+    return sPayload;
+}
+
+// Count the elements of the JSON array following <key> in <payload>.
+static int _array_len(const char *payload, const char *key)
+{
+    const char *p = payload ? strstr(payload, key) : NULL;
+    int n = 1;
+    if (!p || !(p = strchr(p, '[')))
+    {
+        return -1;
+    }
+    if (p[1] == ']')
+    {
+        return 0;
+    }
+    for (; *p && *p != ']'; p++)
+    {
+        if (*p == ',')
+            n++;
+    }
+    return n;
+}
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    RedTest test;
+    char outPath[] = "/tmp/var_history_XXXXXX";
+    const char *payload;
+    const char *history;
+    int savedStdout, fd, i;
+    bool ok;
+    int numTimes, numValues;
+    bool r[8];
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy_set_global_opt(CANOPY_LOG_ENABLED, false);
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out float32 vibration",
+        CANOPY_VAR_HISTORY_CAPACITY, 2*NUM_SAMPLES
+    );
+    RedTest_Verify(test, "Init vibration", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out int32 counter",
+        CANOPY_VAR_HISTORY_CAPACITY, 10
+    );
+    RedTest_Verify(test, "Init counter", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out float32 latest");
+    RedTest_Verify(test, "Init latest", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out string label",
+        CANOPY_VAR_HISTORY_CAPACITY, 10
+    );
+    RedTest_Verify(test, "History on string rejected", result == CANOPY_ERROR_INVALID_OPT);
+
+    result = canopy_var_init(canopy, "out float32 nohistory[4]",
+        CANOPY_VAR_HISTORY_CAPACITY, 10
+    );
+    RedTest_Verify(test, "History on array rejected", result == CANOPY_ERROR_INVALID_OPT);
+
+    result = canopy_var_init(canopy, "out float32 negative",
+        CANOPY_VAR_HISTORY_CAPACITY, -1
+    );
+    RedTest_Verify(test, "Negative capacity rejected", result == CANOPY_ERROR_INVALID_VALUE);
+
+    fd = mkstemp(outPath);
+    fflush(stdout);
+    savedStdout = dup(STDOUT_FILENO);
+    if (fd < 0 || savedStdout < 0 || !freopen(outPath, "w", stdout) 
+            || !(sOut = fopen(outPath, "r")))
+    {
+        RedTest_Abort(test, "Could not redirect stdout");
+    }
+    close(fd);
+
+    // Every sample between syncs is sent, oldest first.
+    ok = true;
+    for (i = 0; i < NUM_SAMPLES; i++)
+    {
+        ok = ok && canopy_var_set_float32(canopy, "vibration", (float)i) == CANOPY_SUCCESS;
+        canopy_var_set_float32(canopy, "latest", (float)i);
+    }
+    payload = _sync(canopy);
+    history = strstr(payload, "\"history\"");
+    numTimes = history ? _array_len(strstr(history, "\"vibration\""), "\"t\"") : -1;
+    numValues = history ? _array_len(strstr(history, "\"vibration\""), "\"v\"") : -1;
+    r[0] = ok;
+    r[1] = (numTimes == NUM_SAMPLES && numValues == NUM_SAMPLES);
+    r[2] = history && strstr(history, "\"v\":[0,1,2,3,") != NULL;
+    r[3] = history && strstr(history, "\"latest\"") == NULL;
+
+    // Only samples set since the last sync are sent.
+    canopy_var_set_float32(canopy, "vibration", 5.0f);
+    payload = _sync(canopy);
+    history = strstr(payload, "\"history\"");
+    r[4] = history && strstr(history, "\"vibration\":{\"t\":[") && 
+            strstr(history, "\"v\":[5]");
+
+    // A full history keeps the most recent samples.
+    for (i = 0; i < 25; i++)
+    {
+        canopy_var_set_int32(canopy, "counter", i);
+    }
+    payload = _sync(canopy);
+    history = strstr(payload, "\"history\"");
+    r[5] = history && strstr(history, "\"v\":[15,16,17,18,19,20,21,22,23,24]");
+
+    // No history section when nothing was set.
+    payload = _sync(canopy);
+    r[6] = strstr(payload, "\"history\"") == NULL;
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    fclose(sOut);
+    unlink(outPath);
+
+    RedTest_Verify(test, "Set samples", r[0]);
+    RedTest_Verify(test, "Every sample sent", r[1]);
+    RedTest_Verify(test, "Samples sent in order", r[2]);
+    RedTest_Verify(test, "Variables without history send latest value only", r[3]);
+    RedTest_Verify(test, "History cleared after sync", r[4]);
+    RedTest_Verify(test, "Full history keeps most recent samples", r[5]);
+    RedTest_Verify(test, "No empty history", r[6]);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
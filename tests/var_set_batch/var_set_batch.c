@@ -0,0 +1,218 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "ws_server.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Tests canopy_var_set_batch.
+//
+// First, without a sync thread: a batch that contains a bad entry must
+// change nothing, and a good batch must set every variable.  Then, with
+// CANOPY_SYNC_THREAD, a writer thread keeps setting "left" and "right" to
+// matching values in one batch while the background thread syncs them to a
+// stand-in server.  Every payload the server receives must carry a matching
+// pair.
+
+#define NUM_VARS 50
+#define NUM_BATCHES 20000
+
+typedef struct
+{
+    CanopyContext canopy;
+    int numFailed;
+} _Writer_t;
+
+static void * _writer_main(void *arg)
+{
+    _Writer_t *writer = (_Writer_t *)arg;
+    CanopyVarUpdate updates[2];
+    char left[16], right[16];
+    int i;
+
+    updates[0].var = canopy_var_handle(writer->canopy, "left");
+    updates[0].datatype = CANOPY_DATATYPE_STRING;
+    updates[0].val.val_string = left;
+    updates[1].var = canopy_var_handle(writer->canopy, "right");
+    updates[1].datatype = CANOPY_DATATYPE_STRING;
+    updates[1].val.val_string = right;
+    for (i = 0; i < NUM_BATCHES; i++)
+    {
+        snprintf(left, sizeof(left), "L%06d", i);
+        snprintf(right, sizeof(right), "R%06d", i);
+        if (canopy_var_set_batch(writer->canopy, updates, 2) != CANOPY_SUCCESS)
+        {
+            writer->numFailed++;
+        }
+    }
+    return NULL;
+}
+
+// Finds "<prefix>NNNNNN" in message <idx> and returns NNNNNN, or -1.
+static int _find_number(TestWsServer *server, int idx, char prefix)
+{
+    const unsigned char *msg;
+    size_t len, i;
+    int out = -1;
+
+    pthread_mutex_lock(&server->lock);
+    msg = server->messages[idx];
+    len = server->message_lens[idx];
+    for (i = 0; i + 8 <= len; i++)
+    {
+        if (msg[i] == '"' && msg[i+1] == prefix)
+        {
+            if (sscanf((const char *)&msg[i+2], "%6d", &out) == 1)
+                break;
+            out = -1;
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+    return out;
+}
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    CanopyVarUpdate updates[NUM_VARS];
+    TestWsServer server;
+    RedTest test;
+    pthread_t thread;
+    _Writer_t writer;
+    char decl[64], name[32];
+    int32_t value;
+    float temperature;
+    int port, i, numPairs, numTorn, l, r;
+    bool ok;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "dev02.canopy.link",
+        CANOPY_DEVICE_UUID, "c31a8ced-b9f1-4b0c-afe9-1afed3b0c21f",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure", result == CANOPY_SUCCESS);
+
+    for (i = 0; i < NUM_VARS; i++)
+    {
+        snprintf(decl, sizeof(decl), "out int32 reg_%d", i);
+        result = canopy_var_init(canopy, decl);
+        RedTest_Verify(test, "Init register", result == CANOPY_SUCCESS);
+        snprintf(name, sizeof(name), "reg_%d", i);
+        updates[i].var = canopy_var_handle(canopy, name);
+        updates[i].datatype = CANOPY_DATATYPE_INT32;
+        updates[i].val.val_int32 = 1000 + i;
+    }
+    result = canopy_var_init(canopy, "in float32 setpoint");
+    RedTest_Verify(test, "Init setpoint", result == CANOPY_SUCCESS);
+
+    result = canopy_var_set_batch(canopy, updates, 0);
+    RedTest_Verify(test, "Empty batch", result == CANOPY_SUCCESS);
+
+    // A bad entry anywhere rejects the whole batch.
+    updates[NUM_VARS - 1].datatype = CANOPY_DATATYPE_FLOAT32;
+    result = canopy_var_set_batch(canopy, updates, NUM_VARS);
+    RedTest_Verify(test, "Wrong datatype rejected",
+            result == CANOPY_ERROR_INCORRECT_DATATYPE);
+    result = canopy_var_get_int32(canopy, "reg_0", &value);
+    RedTest_Verify(test, "Rejected batch changes nothing",
+            result == CANOPY_ERROR_VARIABLE_NOT_SET);
+    updates[NUM_VARS - 1].datatype = CANOPY_DATATYPE_INT32;
+
+    updates[NUM_VARS - 1].var = canopy_var_handle(canopy, "setpoint");
+    updates[NUM_VARS - 1].datatype = CANOPY_DATATYPE_FLOAT32;
+    updates[NUM_VARS - 1].val.val_float32 = 1.0f;
+    result = canopy_var_set_batch(canopy, updates, NUM_VARS);
+    RedTest_Verify(test, "Input variable rejected",
+            result == CANOPY_ERROR_CANNOT_MODIFY_INPUT_VARIABLE);
+    result = canopy_var_get_float32(canopy, "setpoint", &temperature);
+    RedTest_Verify(test, "Input variable unchanged",
+            result == CANOPY_ERROR_VARIABLE_NOT_SET);
+
+    updates[NUM_VARS - 1].var = NULL;
+    result = canopy_var_set_batch(canopy, updates, NUM_VARS);
+    RedTest_Verify(test, "NULL handle rejected",
+            result == CANOPY_ERROR_VARIABLE_NOT_INITIALIZED);
+
+    updates[NUM_VARS - 1].var = canopy_var_handle(canopy, "reg_49");
+    updates[NUM_VARS - 1].datatype = CANOPY_DATATYPE_INT32;
+    updates[NUM_VARS - 1].val.val_int32 = 1000 + NUM_VARS - 1;
+    result = canopy_var_set_batch(canopy, updates, NUM_VARS);
+    RedTest_Verify(test, "Set batch", result == CANOPY_SUCCESS);
+    ok = true;
+    for (i = 0; i < NUM_VARS; i++)
+    {
+        snprintf(name, sizeof(name), "reg_%d", i);
+        ok = ok && canopy_var_get_int32(canopy, name, &value) == CANOPY_SUCCESS;
+        ok = ok && value == 1000 + i;
+    }
+    RedTest_Verify(test, "Every variable set", ok);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    // Batches are atomic with respect to the sync thread.
+    port = 19000 + (getpid() % 1000);
+    if (!test_ws_server_start(&server, port))
+    {
+        RedTest_Abort(test, "Could not start stand-in server");
+    }
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_HTTP_PORT, port,
+        CANOPY_DEVICE_UUID, "9dfe2a00-efe2-45f9-a84c-8afc69caf4e6",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_WS
+    );
+    RedTest_Verify(test, "Configure", result == CANOPY_SUCCESS);
+    result = canopy_var_init(canopy, "out string left");
+    RedTest_Verify(test, "Init left", result == CANOPY_SUCCESS);
+    result = canopy_var_init(canopy, "out string right");
+    RedTest_Verify(test, "Init right", result == CANOPY_SUCCESS);
+    result = canopy_set_opt(canopy, CANOPY_SYNC_THREAD, true);
+    RedTest_Verify(test, "Start sync thread", result == CANOPY_SUCCESS);
+
+    writer.canopy = canopy;
+    writer.numFailed = 0;
+    pthread_create(&thread, NULL, _writer_main, &writer);
+    for (i = 0; i < 20; i++)
+    {
+        canopy_sync_blocking(canopy, 5*CANOPY_SECONDS);
+    }
+    pthread_join(thread, NULL);
+    RedTest_Verify(test, "All batches accepted", writer.numFailed == 0);
+    result = canopy_sync_blocking(canopy, 5*CANOPY_SECONDS);
+    RedTest_Verify(test, "Final sync", result == CANOPY_SUCCESS);
+
+    numPairs = 0;
+    numTorn = 0;
+    for (i = 0; i < test_ws_server_num_messages(&server); i++)
+    {
+        l = _find_number(&server, i, 'L');
+        r = _find_number(&server, i, 'R');
+        if (l >= 0 || r >= 0)
+        {
+            numPairs++;
+            if (l != r)
+                numTorn++;
+        }
+    }
+    printf("Server received %d pairs\n", numPairs);
+    RedTest_Verify(test, "Server received pairs", numPairs > 0);
+    RedTest_Verify(test, "No torn pairs", numTorn == 0);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+    test_ws_server_stop(&server);
+
+    return RedTest_End(test);
+}
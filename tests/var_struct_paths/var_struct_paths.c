@@ -0,0 +1,178 @@
+#include <canopy.h>
+#include "red_test.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Checks struct members addressed by path ("gps.fix.quality"), and that
+// structs are written out in declaration order.
+//
+// The NOOP protocol prints each payload to stdout, so stdout is redirected
+// to a temporary file and each payload is inspected after it is written.
+
+#define PAYLOAD_MAX (64*1024)
+
+static FILE *sOut;
+static long sOutPos;
+static char sPayload[PAYLOAD_MAX];
+
+// Sync, and return the payload that was sent (or "" if none).
+static const char * _sync(CanopyContext canopy)
+{
+    size_t n;
+
+    sPayload[0] = '\0';
+    if (canopy_sync_blocking(canopy, 0) != CANOPY_SUCCESS)
+    {
+        return sPayload;
+    }
+    fflush(stdout);
+    fseek(sOut, sOutPos, SEEK_SET);
+    n = fread(sPayload, 1, sizeof(sPayload) - 1, sOut);
+    sPayload[n] = '\0';
+    sOutPos = ftell(sOut);
+    return sPayload;
+}
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    RedTest test;
+    char outPath[] = "/tmp/var_struct_paths_XXXXXX";
+    const char *payload;
+    CanopyVarHandle quality, latitude;
+    CanopyVarUpdate updates[2];
+    int savedStdout, fd;
+    int8_t qualityOut;
+    float latitudeOut;
+    bool r[5];
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    canopy_set_global_opt(CANOPY_LOG_ENABLED, false);
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_NOOP,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_NOOP
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out struct gps",
+            CANOPY_INIT_FIELD("float32 latitude"),
+            CANOPY_INIT_FIELD("float32 longitude"),
+            CANOPY_INIT_FIELD("struct fix",
+                CANOPY_INIT_FIELD("int8 quality"),
+                CANOPY_INIT_FIELD("uint8 satellites")
+            ),
+            CANOPY_INIT_FIELD("float32 altitude")
+    );
+    RedTest_Verify(test, "Init gps struct", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out struct pos",
+            CANOPY_INIT_FIELD("float32 x"),
+            CANOPY_INIT_FIELD("struct fix",
+                CANOPY_INIT_FIELD("int8 quality")
+            )
+    );
+    RedTest_Verify(test, "Init pos struct", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out struct pair",
+            CANOPY_INIT_FIELD("int8 a"),
+            CANOPY_INIT_FIELD("int8 a")
+    );
+    RedTest_Verify(test, "Duplicate member rejected",
+            result == CANOPY_ERROR_BAD_VARIABLE_DECLARATION);
+
+    // Handles.
+    latitude = canopy_var_handle(canopy, "gps.latitude");
+    quality = canopy_var_handle(canopy, "gps.fix.quality");
+    RedTest_Verify(test, "Member handle", latitude != NULL);
+    RedTest_Verify(test, "Nested member handle", quality != NULL);
+    RedTest_Verify(test, "Nested struct handle", canopy_var_handle(canopy, "gps.fix") != NULL);
+    RedTest_Verify(test, "Unknown member", canopy_var_handle(canopy, "gps.speed") == NULL);
+    RedTest_Verify(test, "Unknown struct", canopy_var_handle(canopy, "car.latitude") == NULL);
+    RedTest_Verify(test, "Partial path", canopy_var_handle(canopy, "gps.fix.") == NULL);
+
+    fd = mkstemp(outPath);
+    fflush(stdout);
+    savedStdout = dup(STDOUT_FILENO);
+    if (fd < 0 || savedStdout < 0 || !freopen(outPath, "w", stdout)
+            || !(sOut = fopen(outPath, "r")))
+    {
+        RedTest_Abort(test, "Could not redirect stdout");
+    }
+    close(fd);
+    _sync(canopy);
+
+    // Members set by path, in any order, are written in declaration order.
+    canopy_var_set_float32(canopy, "gps.altitude", 10.0f);
+    canopy_var_set_int8(canopy, "gps.fix.quality", 2);
+    canopy_var_set_float32(canopy, "gps.latitude", 0.5f);
+    payload = _sync(canopy);
+    r[0] = strstr(payload,
+            "\"gps\":{\"latitude\":0.5,\"fix\":{\"quality\":2},\"altitude\":10}") != NULL;
+
+    // Nothing changed, nothing sent.
+    payload = _sync(canopy);
+    r[1] = strstr(payload, "\"gps\"") == NULL;
+
+    // Setting a member through its handle marks the struct dirty.
+    updates[0].var = latitude;
+    updates[0].datatype = CANOPY_DATATYPE_FLOAT32;
+    updates[0].val.val_float32 = -0.25f;
+    updates[1].var = quality;
+    updates[1].datatype = CANOPY_DATATYPE_INT8;
+    updates[1].val.val_int8 = 3;
+    result = canopy_var_set_batch(canopy, updates, 2);
+    payload = _sync(canopy);
+    r[2] = result == CANOPY_SUCCESS
+            && strstr(payload, "\"latitude\":-0.25") != NULL
+            && strstr(payload, "\"quality\":3") != NULL;
+
+    // Set as a whole struct, too.
+    canopy_var_set(canopy, "gps",
+        CANOPY_VALUE_STRUCT(
+            "fix", CANOPY_VALUE_STRUCT(
+                "satellites", CANOPY_VALUE_UINT8(9)
+            )
+        )
+    );
+    payload = _sync(canopy);
+    r[3] = strstr(payload, "\"fix\":{\"quality\":3,\"satellites\":9}") != NULL;
+
+    // A nested struct with nothing set is left out.
+    canopy_var_set_float32(canopy, "pos.x", 1.0f);
+    payload = _sync(canopy);
+    r[4] = strstr(payload, "\"pos\":{\"x\":1}") != NULL;
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    fclose(sOut);
+    unlink(outPath);
+
+    RedTest_Verify(test, "Members written in declaration order", r[0]);
+    RedTest_Verify(test, "Unchanged struct not sent", r[1]);
+    RedTest_Verify(test, "Member handles mark struct dirty", r[2]);
+    RedTest_Verify(test, "Struct value sent", r[3]);
+    RedTest_Verify(test, "Empty nested struct left out", r[4]);
+
+    // Reads.
+    result = canopy_var_get_float32(canopy, "gps.latitude", &latitudeOut);
+    RedTest_Verify(test, "Read member", result == CANOPY_SUCCESS && latitudeOut == -0.25f);
+    result = canopy_var_get_h(canopy, quality, CANOPY_READ_INT8(&qualityOut));
+    RedTest_Verify(test, "Read member by handle", result == CANOPY_SUCCESS && qualityOut == 3);
+    result = canopy_var_get(canopy, "gps",
+            CANOPY_READ_STRUCT("fix", CANOPY_READ_STRUCT("quality", CANOPY_READ_INT8(&qualityOut))));
+    RedTest_Verify(test, "Read nested member from struct", result == CANOPY_SUCCESS && qualityOut == 3);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+
+    return RedTest_End(test);
+}
@@ -0,0 +1,201 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "ws_server.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Checks that a dropped WebSocket connection is re-established on its own,
+// with jittered exponential backoff, and that connection state changes are
+// reported.
+//
+// The stand-in server drops the connection several times; each time, the
+// test measures how long it takes until the device is connected and has
+// identified itself again (time-to-recover).  Then the server goes away
+// for a while, to check the spacing of reconnect attempts.
+
+#define NUM_DROPS 5
+
+#define RECONNECT_MIN_MS 50
+#define RECONNECT_MAX_MS 400
+
+// Allowed time-to-recover, in microseconds.  Generous, to tolerate loaded
+// test machines; recovery should take about RECONNECT_MIN_MS.
+#define MAX_RECOVER_US (2*CANOPY_SECONDS)
+
+// Slack allowed above the longest reconnect delay, in milliseconds.
+#define SLACK_MS 150
+
+#define MAX_ATTEMPTS 64
+
+static int sNumEvents[CANOPY_CONNECTION_STATE_WAITING_TO_RECONNECT + 1];
+static uint64_t sAttemptTimes[MAX_ATTEMPTS];
+static int sNumAttempts;
+
+static uint64_t _now_us(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*1000000 + t.tv_nsec/1000;
+}
+
+static void _on_state(CanopyContext ctx, CanopyConnectionStateEnum state, void *userdata)
+{
+    sNumEvents[state]++;
+    if (state == CANOPY_CONNECTION_STATE_CONNECTING && sNumAttempts < MAX_ATTEMPTS)
+    {
+        sAttemptTimes[sNumAttempts++] = _now_us();
+    }
+}
+
+// Call canopy_service until <server> has seen more than <numConnections>
+// connections and <numMessages> messages, or <timeoutUs> passes.
+static bool _service_until_recovered(
+        CanopyContext canopy, 
+        TestWsServer *server, 
+        int numConnections, 
+        int numMessages,
+        uint64_t timeoutUs)
+{
+    uint64_t start = _now_us();
+    while (_now_us() - start < timeoutUs)
+    {
+        if (canopy_connection_state(canopy) == CANOPY_CONNECTION_STATE_CONNECTED &&
+                test_ws_server_num_connections(server) > numConnections &&
+                test_ws_server_num_messages(server) > numMessages)
+        {
+            return true;
+        }
+        canopy_service(canopy, 1000);
+    }
+    return false;
+}
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    TestWsServer server;
+    RedTest test;
+    uint64_t start, elapsed, worst, total;
+    uint32_t gapMs;
+    int port, i, numConnections, numMessages, numRecovered, firstAttempt;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    port = 19000 + (getpid() % 1000);
+    if (!test_ws_server_start(&server, port))
+    {
+        RedTest_Abort(test, "Could not start stand-in server");
+    }
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+    RedTest_Verify(test, "Starts disconnected", 
+            canopy_connection_state(canopy) == CANOPY_CONNECTION_STATE_DISCONNECTED);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_HTTP_PORT, port,
+        CANOPY_DEVICE_UUID, "9dfe2a00-efe2-45f9-a84c-8afc69caf4e6",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_RECONNECT_MIN_MS, RECONNECT_MIN_MS,
+        CANOPY_RECONNECT_MAX_MS, RECONNECT_MAX_MS
+    );
+    RedTest_Verify(test, "Configure", result == CANOPY_SUCCESS);
+    result = canopy_on_connection_state(canopy, _on_state, NULL);
+    RedTest_Verify(test, "Register state callback", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out float32 temperature");
+    RedTest_Verify(test, "Init temperature", result == CANOPY_SUCCESS);
+    canopy_var_set_float32(canopy, "temperature", 20.0f);
+    result = canopy_sync_blocking(canopy, 5*CANOPY_SECONDS);
+    RedTest_Verify(test, "First sync", result == CANOPY_SUCCESS);
+    RedTest_Verify(test, "Connected", 
+            canopy_connection_state(canopy) == CANOPY_CONNECTION_STATE_CONNECTED);
+    RedTest_Verify(test, "CONNECTING reported", 
+            sNumEvents[CANOPY_CONNECTION_STATE_CONNECTING] == 1);
+    RedTest_Verify(test, "CONNECTED reported", 
+            sNumEvents[CANOPY_CONNECTION_STATE_CONNECTED] == 1);
+
+    // Drop the connection repeatedly, and time each recovery.
+    worst = 0;
+    total = 0;
+    numRecovered = 0;
+    for (i = 0; i < NUM_DROPS; i++)
+    {
+        numConnections = test_ws_server_num_connections(&server);
+        numMessages = test_ws_server_num_messages(&server);
+        start = _now_us();
+        test_ws_server_drop(&server);
+
+        // Recovered once reconnected and the handshake has been resent,
+        // without the application doing anything but canopy_service.
+        if (_service_until_recovered(canopy, &server, numConnections, numMessages, 
+                    MAX_RECOVER_US))
+        {
+            elapsed = _now_us() - start;
+            numRecovered++;
+            total += elapsed;
+            if (elapsed > worst)
+                worst = elapsed;
+        }
+
+        // The new connection is used by the next sync.
+        canopy_var_set_float32(canopy, "temperature", 21.0f + i);
+        result = canopy_sync_blocking(canopy, 5*CANOPY_SECONDS);
+        RedTest_Verify(test, "Sync after reconnect", result == CANOPY_SUCCESS);
+    }
+    printf("Time-to-recover over %d drops: average %d us, worst %d us\n", 
+            numRecovered, numRecovered ? (int)(total/numRecovered) : -1, (int)worst);
+    RedTest_Verify(test, "Recovered from every drop", numRecovered == NUM_DROPS);
+    RedTest_Verify(test, "Recovered in time", worst < MAX_RECOVER_US);
+    RedTest_Verify(test, "Connection reused by syncs", 
+            test_ws_server_num_connections(&server) == NUM_DROPS + 1);
+    RedTest_Verify(test, "Each drop reported", 
+            sNumEvents[CANOPY_CONNECTION_STATE_WAITING_TO_RECONNECT] == NUM_DROPS);
+    RedTest_Verify(test, "Each reconnect reported", 
+            sNumEvents[CANOPY_CONNECTION_STATE_CONNECTED] == NUM_DROPS + 1);
+
+    // Take the server away, so that reconnect attempts keep failing, and
+    // check that they back off.
+    test_ws_server_stop(&server);
+    firstAttempt = sNumAttempts;
+    start = _now_us();
+    while (_now_us() - start < 2*CANOPY_SECONDS)
+    {
+        canopy_service(canopy, 10000);
+    }
+    printf("Reconnect attempts while server down: %d\n", sNumAttempts - firstAttempt);
+    RedTest_Verify(test, "Keeps trying to reconnect", sNumAttempts - firstAttempt >= 3);
+    for (i = firstAttempt + 1; i < sNumAttempts; i++)
+    {
+        gapMs = (uint32_t)((sAttemptTimes[i] - sAttemptTimes[i - 1]) / 1000);
+        printf("  attempt %d after %d ms\n", i - firstAttempt, (int)gapMs);
+        RedTest_Verify(test, "Attempts never hammer the server", 
+                gapMs >= RECONNECT_MIN_MS/2);
+        RedTest_Verify(test, "Delay capped at RECONNECT_MAX_MS", 
+                gapMs <= RECONNECT_MAX_MS + SLACK_MS);
+    }
+    gapMs = (uint32_t)((sAttemptTimes[sNumAttempts - 1] - sAttemptTimes[sNumAttempts - 2]) / 1000);
+    RedTest_Verify(test, "Delay grows with failures", gapMs >= RECONNECT_MAX_MS/2);
+
+    // Once the server is back, the device reconnects by itself.
+    if (!test_ws_server_start(&server, port))
+    {
+        RedTest_Abort(test, "Could not restart stand-in server");
+    }
+    RedTest_Verify(test, "Reconnects when server returns", 
+            _service_until_recovered(canopy, &server, 0, 0, 
+                2*RECONNECT_MAX_MS*1000 + MAX_RECOVER_US));
+    result = canopy_sync_blocking(canopy, 5*CANOPY_SECONDS);
+    RedTest_Verify(test, "Sync after server returns", result == CANOPY_SUCCESS);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+    test_ws_server_stop(&server);
+
+    return RedTest_End(test);
+}
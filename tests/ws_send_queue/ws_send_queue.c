@@ -0,0 +1,86 @@
+#include <canopy.h>
+#include "red_test.h"
+#include "ws_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Test for the WebSocket transmit queue, against a local stand-in server.
+//
+// Syncs are run back to back, so each payload is queued while the previous
+// one may still be waiting for libwebsockets to become writable.  None may
+// be dropped, and they must arrive in order, after the handshake.
+
+#define NUM_SYNCS 20
+#define MAX_SERVICE_CALLS 50
+
+int main(int argc, const char *argv[])
+{
+    CanopyContext canopy;
+    CanopyResultEnum result;
+    TestWsServer server;
+    RedTest test;
+    char expect[32];
+    int port, i;
+    bool ok;
+
+    test = RedTest_Begin(argv[0], NULL, NULL);
+
+    port = 21000 + (getpid() % 1000);
+    if (!test_ws_server_start(&server, port))
+    {
+        RedTest_Abort(test, "Could not start stand-in server");
+    }
+
+    canopy = canopy_init_context();
+    RedTest_Verify(test, "Canopy init", canopy);
+
+    result = canopy_set_opt(canopy,
+        CANOPY_CLOUD_SERVER, "localhost",
+        CANOPY_HTTP_PORT, port,
+        CANOPY_DEVICE_UUID, "9dfe2a00-efe2-45f9-a84c-8afc69caf4e6",
+        CANOPY_VAR_SEND_PROTOCOL, CANOPY_PROTOCOL_WS,
+        CANOPY_VAR_RECV_PROTOCOL, CANOPY_PROTOCOL_WS
+    );
+    RedTest_Verify(test, "Configure canopy options", result == CANOPY_SUCCESS);
+
+    result = canopy_var_init(canopy, "out int32 counter");
+    RedTest_Verify(test, "Init counter", result == CANOPY_SUCCESS);
+
+    ok = true;
+    for (i = 0; i < NUM_SYNCS; i++)
+    {
+        ok = ok && canopy_var_set_int32(canopy, "counter", i) == CANOPY_SUCCESS;
+        ok = ok && canopy_sync_blocking(canopy, 5*CANOPY_SECONDS) == CANOPY_SUCCESS;
+    }
+    RedTest_Verify(test, "Back-to-back syncs", ok);
+
+    // Let the queue drain.
+    for (i = 0; i < MAX_SERVICE_CALLS; i++)
+    {
+        if (test_ws_server_num_messages(&server) >= NUM_SYNCS + 1)
+        {
+            break;
+        }
+        canopy_service(canopy, 100000);
+    }
+    RedTest_Verify(test, "Every payload received",
+            test_ws_server_num_messages(&server) == NUM_SYNCS + 1);
+    RedTest_Verify(test, "Handshake first",
+            test_ws_server_message_contains(&server, 0, "\"device_id\"", 11));
+
+    ok = true;
+    for (i = 0; i < NUM_SYNCS; i++)
+    {
+        snprintf(expect, sizeof(expect), "\"counter\":%d}", i);
+        ok = ok && test_ws_server_message_contains(&server, i + 1, expect, strlen(expect));
+    }
+    RedTest_Verify(test, "Payloads in order", ok);
+
+    result = canopy_shutdown_context(canopy);
+    RedTest_Verify(test, "Shutdown", result == CANOPY_SUCCESS);
+    test_ws_server_stop(&server);
+
+    return RedTest_End(test);
+}